@@ -0,0 +1,187 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define WORD_MAX_BITS 128
+#define WORD_TEXT_MAX 132 // 128 binary digits, sign and NUL
+
+// Programmer-mode values live in the low `bits` bits of an unsigned 128-bit
+// word; signedness only changes how they are read.
+typedef unsigned __int128 Word;
+typedef __int128 SWord;
+
+static Word word_mask(int bits) {
+  return bits >= WORD_MAX_BITS ? ~(Word)0 : ((Word)1 << bits) - 1;
+}
+
+static Word word_wrap(Word v, int bits) { return v & word_mask(bits); }
+
+static SWord word_signed(Word v, int bits) {
+  if (bits < WORD_MAX_BITS && ((v >> (bits - 1)) & 1))
+    v |= ~word_mask(bits);
+  return (SWord)v;
+}
+
+static int word_is_negative(Word v, int bits, int isSigned) {
+  return isSigned && ((v >> (bits - 1)) & 1);
+}
+
+static int word_popcount(Word v) {
+  return __builtin_popcountll((uint64_t)v) +
+         __builtin_popcountll((uint64_t)(v >> 64));
+}
+
+// Leading zeros within the word, so clz(1) is 31 at 32 bits.
+static int word_clz(Word v, int bits) {
+  uint64_t hi = (uint64_t)(v >> 64), lo = (uint64_t)v;
+  if (!v)
+    return bits;
+  int n = hi ? __builtin_clzll(hi) : 64 + __builtin_clzll(lo);
+  return n - (WORD_MAX_BITS - bits);
+}
+
+static int word_ctz(Word v, int bits) {
+  uint64_t lo = (uint64_t)v;
+  if (!v)
+    return bits;
+  return lo ? __builtin_ctzll(lo) : 64 + __builtin_ctzll((uint64_t)(v >> 64));
+}
+
+static Word word_bswap(Word v, int bits) {
+  Word r = ((Word)__builtin_bswap64((uint64_t)v) << 64) |
+           __builtin_bswap64((uint64_t)(v >> 64));
+  return r >> (WORD_MAX_BITS - bits);
+}
+
+static Word word_shl(Word v, unsigned n, int bits) {
+  return n >= (unsigned)bits ? 0 : word_wrap(v << n, bits);
+}
+
+// Arithmetic for signed words, logical otherwise.
+static Word word_shr(Word v, unsigned n, int bits, int isSigned) {
+  if (isSigned) {
+    SWord s = word_signed(v, bits);
+    if (n >= (unsigned)bits)
+      return s < 0 ? word_mask(bits) : 0;
+    return word_wrap((Word)(s >> n), bits);
+  }
+  return n >= (unsigned)bits ? 0 : v >> n;
+}
+
+static Word word_rol(Word v, unsigned n, int bits) {
+  n %= (unsigned)bits;
+  if (!n)
+    return v;
+  return word_wrap((v << n) | (v >> (bits - n)), bits);
+}
+
+static Word word_ror(Word v, unsigned n, int bits) {
+  return word_rol(v, (unsigned)bits - n % (unsigned)bits, bits);
+}
+
+// Truncating division or remainder. Returns 0 on a zero divisor; the one
+// signed overflow (MIN / -1) wraps like the hardware.
+static int word_div(Word a, Word b, int bits, int isSigned, int rem,
+                    Word *out) {
+  if (!b)
+    return 0;
+  if (isSigned) {
+    SWord x = word_signed(a, bits), y = word_signed(b, bits);
+    if (y == -1)
+      *out = rem ? 0 : word_wrap((Word)0 - a, bits);
+    else
+      *out = word_wrap((Word)(rem ? x % y : x / y), bits);
+  } else {
+    *out = rem ? a % b : a / b;
+  }
+  return 1;
+}
+
+// Appends digit d of base to value, refusing anything past the word's
+// range (the positive half when entering signed decimal).
+static int word_push_digit(Word *v, int d, int base, int bits, int isSigned) {
+  Word limit = word_mask(bits);
+  if (isSigned && base == 10)
+    limit >>= 1;
+  if (*v > (limit - (Word)d) / (Word)base)
+    return 0;
+  *v = *v * (Word)base + (Word)d;
+  return 1;
+}
+
+static const char WORD_DIGITS[] = "0123456789ABCDEF";
+
+// Writes the digits of v backwards from end, padded to width when the chunk
+// is not the leading one. Returns the new start.
+static char *word_chunk_digits(uint64_t v, int base, int width, char *end) {
+  char *p = end;
+  if (base == 10) {
+    static const char pairs[] = "0001020304050607080910111213141516171819"
+                                "2021222324252627282930313233343536373839"
+                                "4041424344454647484950515253545556575859"
+                                "6061626364656667686970717273747576777879"
+                                "8081828384858687888990919293949596979899";
+    while (v >= 100) {
+      unsigned r = (unsigned)(v % 100) * 2;
+      v /= 100;
+      *--p = pairs[r + 1];
+      *--p = pairs[r];
+    }
+    if (v >= 10) {
+      *--p = pairs[v * 2 + 1];
+      *--p = pairs[v * 2];
+    } else {
+      *--p = (char)('0' + v);
+    }
+  } else {
+    int shift = base == 16 ? 4 : base == 8 ? 3 : 1;
+    do {
+      *--p = WORD_DIGITS[v & (uint64_t)(base - 1)];
+      v >>= shift;
+    } while (v);
+  }
+  while (end - p < width)
+    *--p = '0';
+  return p;
+}
+
+// Formats the word in base 2, 8, 10 or 16. Digits come out in 64-bit-sized
+// chunks (10^19, 8^21, 16^16, 2^64) so only the chunk split touches 128-bit
+// arithmetic. Decimal honours the sign; the other bases show the raw bits.
+static void word_format(Word v, int bits, int isSigned, int base, char *buf,
+                        size_t size) {
+  char tmp[WORD_TEXT_MAX];
+  char *end = tmp + sizeof(tmp) - 1, *p = end;
+  int neg = 0;
+
+  *end = '\0';
+  v = word_wrap(v, bits);
+  if (base == 10 && word_is_negative(v, bits, isSigned)) {
+    neg = 1;
+    v = word_wrap((Word)0 - v, bits); // |MIN| still fits unsigned
+  }
+
+  int chunkDigits = base == 10 ? 19 : base == 8 ? 21 : base == 16 ? 16 : 64;
+  int chunkShift = base == 8 ? 63 : 64;
+  const Word pow10 = (Word)10000000000000000000ULL;
+  for (;;) {
+    Word hi = base == 10 ? v / pow10 : v >> chunkShift;
+    uint64_t lo = (uint64_t)(v - (base == 10 ? hi * pow10 : hi << chunkShift));
+    p = word_chunk_digits(lo, base, hi ? chunkDigits : 0, p);
+    if (!hi)
+      break;
+    v = hi;
+  }
+  if (neg)
+    *--p = '-';
+  size_t len = (size_t)(end - p);
+  if (len >= size)
+    len = size - 1;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+}
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef CPLX_H
+#define CPLX_H
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atod.h"
+#include "dtoa.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CPLX_X86 1
+#endif
+
+#define CPLX_POW_INT_MAX 64 // integer powers up to this use repeated squaring
+
+typedef struct {
+  double re, im;
+} Cplx;
+
+static Cplx cplx(double re, double im) {
+  Cplx z = {re, im};
+  return z;
+}
+
+static Cplx cplx_add(Cplx a, Cplx b) { return cplx(a.re + b.re, a.im + b.im); }
+static Cplx cplx_sub(Cplx a, Cplx b) { return cplx(a.re - b.re, a.im - b.im); }
+static Cplx cplx_conj(Cplx a) { return cplx(a.re, -a.im); }
+static double cplx_abs(Cplx a) { return hypot(a.re, a.im); }
+static double cplx_arg(Cplx a) { return atan2(a.im, a.re); }
+
+static Cplx cplx_mul(Cplx a, Cplx b) {
+  return cplx(a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re);
+}
+
+static Cplx cplx_scale(Cplx a, double s) { return cplx(a.re * s, a.im * s); }
+
+// Smith's algorithm: scales by the larger component of b so |b|^2 never
+// overflows or underflows on its own.
+static Cplx cplx_div(Cplx a, Cplx b) {
+  if (fabs(b.re) >= fabs(b.im)) {
+    double r = b.im / b.re, d = b.re + b.im * r;
+    return cplx((a.re + a.im * r) / d, (a.im - a.re * r) / d);
+  }
+  double r = b.re / b.im, d = b.re * r + b.im;
+  return cplx((a.re * r + a.im) / d, (a.im * r - a.re) / d);
+}
+
+static Cplx cplx_polar(double r, double theta) {
+  return cplx(r * cos(theta), r * sin(theta));
+}
+
+static Cplx cplx_exp(Cplx a) { return cplx_polar(exp(a.re), a.im); }
+
+static Cplx cplx_log(Cplx a) { return cplx(log(cplx_abs(a)), cplx_arg(a)); }
+
+static Cplx cplx_log10(Cplx a) { return cplx_scale(cplx_log(a), 1 / M_LN10); }
+
+// Principal root without cancellation: the larger part comes from a sum, the
+// smaller one from a division.
+static Cplx cplx_sqrt(Cplx a) {
+  if (a.re == 0 && a.im == 0)
+    return cplx(0, a.im);
+  double t = sqrt((cplx_abs(a) + fabs(a.re)) / 2);
+  if (a.re >= 0)
+    return cplx(t, a.im / (2 * t));
+  return cplx(fabs(a.im) / (2 * t), copysign(t, a.im));
+}
+
+static Cplx cplx_pow(Cplx a, Cplx b) {
+  if (a.re == 0 && a.im == 0) {
+    if (b.re == 0 && b.im == 0)
+      return cplx(1, 0);
+    return b.im == 0 && b.re > 0 ? cplx(0, 0) : cplx(NAN, NAN);
+  }
+  // Small integer exponents stay exact: (1+i)^2 is 2i, not 2i + 1e-16
+  if (b.im == 0 && b.re == floor(b.re) && fabs(b.re) <= CPLX_POW_INT_MAX) {
+    int n = (int)fabs(b.re);
+    Cplx r = cplx(1, 0), x = a;
+    for (; n; n >>= 1, x = cplx_mul(x, x))
+      if (n & 1)
+        r = cplx_mul(r, x);
+    return b.re < 0 ? cplx_div(cplx(1, 0), r) : r;
+  }
+  return cplx_exp(cplx_mul(b, cplx_log(a)));
+}
+
+static Cplx cplx_sin(Cplx a) {
+  return cplx(sin(a.re) * cosh(a.im), cos(a.re) * sinh(a.im));
+}
+
+static Cplx cplx_cos(Cplx a) {
+  return cplx(cos(a.re) * cosh(a.im), -sin(a.re) * sinh(a.im));
+}
+
+// tan(a+bi) = (sin 2a + i sinh 2b) / (cos 2a + cosh 2b); far from the real
+// axis cosh overflows, so the limit is taken directly.
+static Cplx cplx_tan(Cplx a) {
+  if (fabs(a.im) > 20)
+    return cplx(2 * sin(2 * a.re) * exp(-2 * fabs(a.im)), copysign(1, a.im));
+  double d = cos(2 * a.re) + cosh(2 * a.im);
+  return cplx(sin(2 * a.re) / d, sinh(2 * a.im) / d);
+}
+
+static void cplx_puts(char *buf, size_t size, size_t *n, const char *s) {
+  for (; *s; s++)
+    dtoa_put(buf, size, n, *s);
+}
+
+// One part at the given significant digits, with a + in front of a
+// nonnegative value when plus is set.
+static void cplx_put_part(char *buf, size_t size, size_t *n, double v,
+                          int digits, int plus) {
+  char part[32];
+  dtoa_format(v, digits, 0, part, sizeof(part));
+  if (plus && part[0] != '-')
+    dtoa_put(buf, size, n, '+');
+  cplx_puts(buf, size, n, part);
+}
+
+// Rectangular "a+bi" or polar "r cis t"; parts are written by dtoa_format
+// with the given significant digits.
+static void cplx_format(Cplx a, int polar, int digits, char *buf,
+                        size_t size) {
+  size_t n = 0;
+  if (polar) {
+    cplx_put_part(buf, size, &n, cplx_abs(a), digits, 0);
+    cplx_puts(buf, size, &n, " cis ");
+    cplx_put_part(buf, size, &n, cplx_arg(a), digits, 0);
+  } else if (a.im == 0 || isnan(a.re) != isnan(a.im)) {
+    cplx_put_part(buf, size, &n, isnan(a.re) ? a.im : a.re, digits, 0);
+  } else {
+    if (a.re != 0)
+      cplx_put_part(buf, size, &n, a.re, digits, 0);
+    if (fabs(a.im) != 1)
+      cplx_put_part(buf, size, &n, a.im, digits, a.re != 0);
+    else if (a.im < 0 || a.re != 0)
+      dtoa_put(buf, size, &n, a.im < 0 ? '-' : '+');
+    dtoa_put(buf, size, &n, 'i');
+  }
+  dtoa_finish(buf, size, n);
+}
+
+// Reads what cplx_format writes, plus bare "i" and "-i". Trailing text that
+// does not form an imaginary part is ignored.
+static Cplx cplx_parse(const char *s) {
+  const char *end = s + strlen(s), *next;
+  double x;
+  Cplx z = cplx(0, 0);
+
+  while (*s == ' ')
+    s++;
+  if ((s[0] == '-' || s[0] == '+') && s[1] == 'i')
+    return cplx(0, s[0] == '-' ? -1 : 1);
+  if (s[0] == 'i')
+    return cplx(0, 1);
+  if (!(next = atod_parse(s, end, &x)))
+    return z;
+  if (*next == 'i')
+    return cplx(0, x);
+  z.re = x;
+  s = next;
+  while (*s == ' ')
+    s++;
+  if (strncmp(s, "cis", 3) == 0) {
+    double t;
+    for (s += 3; *s == ' ';)
+      s++;
+    return atod_parse(s, end, &t) ? cplx_polar(x, t) : z;
+  }
+  if (*s == '+' || *s == '-') {
+    if (s[1] == 'i') {
+      z.im = *s == '-' ? -1 : 1;
+    } else {
+      next = atod_parse(s, end, &x);
+      if (next && *next == 'i')
+        z.im = x;
+    }
+  }
+  return z;
+}
+
+// Batch kernels work on split (re[], im[]) arrays, which map straight onto
+// vector lanes; cplx_join interleaves their results back into Cplx arrays.
+#ifdef CPLX_X86
+static int cplx_has_avx2(void) {
+  static int has = -1;
+  if (has < 0) {
+    __builtin_cpu_init();
+    has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  }
+  return has;
+}
+
+__attribute__((target("avx2,fma"))) static size_t
+cplx_horner_split_avx2(int deg, const double *pr, const double *pi, size_t n,
+                       const double *zr, const double *zi, double *outr,
+                       double *outi) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d xr = _mm256_loadu_pd(zr + i), xi = _mm256_loadu_pd(zi + i);
+    __m256d vr = _mm256_set1_pd(pr[0]), vi = _mm256_set1_pd(pi[0]);
+    for (int k = 1; k <= deg; k++) {
+      __m256d cr = _mm256_set1_pd(pr[k]), ci = _mm256_set1_pd(pi[k]);
+      __m256d t = _mm256_fmsub_pd(vr, xr, _mm256_fmsub_pd(vi, xi, cr));
+      vi = _mm256_fmadd_pd(vr, xi, _mm256_fmadd_pd(vi, xr, ci));
+      vr = t;
+    }
+    _mm256_storeu_pd(outr + i, vr);
+    _mm256_storeu_pd(outi + i, vi);
+  }
+  return i;
+}
+
+__attribute__((target("avx2,fma"))) static size_t
+cplx_inv_sum_split_avx2(size_t n, const double *zr, const double *zi, Cplx a,
+                        double *sum) {
+  __m256d ar = _mm256_set1_pd(a.re), ai = _mm256_set1_pd(a.im);
+  __m256d sr = _mm256_setzero_pd(), si = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d dr = _mm256_sub_pd(ar, _mm256_loadu_pd(zr + i));
+    __m256d di = _mm256_sub_pd(ai, _mm256_loadu_pd(zi + i));
+    __m256d inv = _mm256_div_pd(
+        _mm256_set1_pd(1), _mm256_fmadd_pd(dr, dr, _mm256_mul_pd(di, di)));
+    sr = _mm256_fmadd_pd(dr, inv, sr);
+    si = _mm256_fnmadd_pd(di, inv, si);
+  }
+  // re0+re1 im0+im1 re2+re3 im2+im3, then the two halves
+  __m256d h = _mm256_hadd_pd(sr, si);
+  __m128d t = _mm_add_pd(_mm256_castpd256_pd128(h),
+                         _mm256_extractf128_pd(h, 1));
+  sum[0] = _mm_cvtsd_f64(t);
+  sum[1] = _mm_cvtsd_f64(_mm_unpackhi_pd(t, t));
+  return i;
+}
+
+__attribute__((target("avx2"))) static size_t
+cplx_join_avx2(size_t n, const double *re, const double *im, Cplx *z) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d r = _mm256_loadu_pd(re + i), m = _mm256_loadu_pd(im + i);
+    __m256d lo = _mm256_unpacklo_pd(r, m); // r0 m0 r2 m2
+    __m256d hi = _mm256_unpackhi_pd(r, m); // r1 m1 r3 m3
+    _mm256_storeu_pd(&z[i].re, _mm256_permute2f128_pd(lo, hi, 0x20));
+    _mm256_storeu_pd(&z[i + 2].re, _mm256_permute2f128_pd(lo, hi, 0x31));
+  }
+  return i;
+}
+#endif
+
+// Evaluates the polynomial p[0] z^deg + ... + p[deg] at n points at once,
+// for root finders and plotting.
+static void cplx_horner_split(int deg, const double *pr, const double *pi,
+                              size_t n, const double *zr, const double *zi,
+                              double *outr, double *outi) {
+  size_t i = 0;
+#ifdef CPLX_X86
+  if (cplx_has_avx2())
+    i = cplx_horner_split_avx2(deg, pr, pi, n, zr, zi, outr, outi);
+#endif
+  for (; i < n; i++) {
+    double vr = pr[0], vi = pi[0];
+    for (int k = 1; k <= deg; k++) {
+      double t = vr * zr[i] - vi * zi[i] + pr[k];
+      vi = vr * zi[i] + vi * zr[i] + pi[k];
+      vr = t;
+    }
+    outr[i] = vr;
+    outi[i] = vi;
+  }
+}
+
+// Sum of 1 / (a - z[i]) over n points, the pull of the other roots in
+// Aberth's method.
+static Cplx cplx_inv_sum_split(size_t n, const double *zr, const double *zi,
+                               Cplx a) {
+  double sum[2] = {0, 0};
+  size_t i = 0;
+#ifdef CPLX_X86
+  if (cplx_has_avx2())
+    i = cplx_inv_sum_split_avx2(n, zr, zi, a, sum);
+#endif
+  for (; i < n; i++) {
+    double dr = a.re - zr[i], di = a.im - zi[i];
+    double inv = 1 / (dr * dr + di * di);
+    sum[0] += dr * inv;
+    sum[1] -= di * inv;
+  }
+  return cplx(sum[0], sum[1]);
+}
+
+// Interleaves split arrays into z.
+static void cplx_join(size_t n, const double *re, const double *im, Cplx *z) {
+  size_t i = 0;
+#ifdef CPLX_X86
+  if (cplx_has_avx2())
+    i = cplx_join_avx2(n, re, im, z);
+#endif
+  for (; i < n; i++)
+    z[i] = cplx(re[i], im[i]);
+}
+
+#endif
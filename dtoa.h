@@ -0,0 +1,365 @@
+#ifndef DTOA_H
+#define DTOA_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "atod.h"
+
+#define DTOA_SHORTEST 0
+#define DTOA_MAX_DIGITS 17
+
+// Double to text without printf. Grisu2 produces the shortest digits that
+// read back to the same double; %g-style and %f-style layouts, with optional
+// thousands grouping, are built on those digits in one pass. Fixed precision
+// rounds the shortest digits half-up, so 0.15 shows as 0.2 at one digit: the
+// decimal the user typed, not its binary expansion.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DtoaFp;
+
+// 10^k as normalized 64-bit significands for k = -348, -340, ..., 340.
+static const DtoaFp DTOA_POW10[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+    {0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+    {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+    {0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+    {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+    {0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+    {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+    {0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+    {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+    {0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+    {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+    {0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+    {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+    {0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+    {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+    {0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+    {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+    {0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+    {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+    {0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+    {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+    {0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+    {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+    {0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+    {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+    {0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+    {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+    {0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+    {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+    {0xaf87023b9bf0ee6bULL, 1066},
+};
+
+static DtoaFp dtoa_mul(DtoaFp x, DtoaFp y) {
+  unsigned __int128 p = (unsigned __int128)x.f * y.f;
+  DtoaFp r = {(uint64_t)(p >> 64) + ((uint64_t)p >> 63), x.e + y.e + 64};
+  return r;
+}
+
+static DtoaFp dtoa_normalize(DtoaFp x) {
+  int s = __builtin_clzll(x.f);
+  DtoaFp r = {x.f << s, x.e - s};
+  return r;
+}
+
+// Picks the cached power that brings the scaled value's exponent into
+// [-60, -32], so the integer part of the digit loop fits 32 bits.
+static DtoaFp dtoa_cached_power(int e, int *K) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int k = (int)dk;
+  if (dk - k > 0)
+    k++;
+  int index = (k >> 3) + 1;
+  *K = -(-348 + index * 8);
+  return DTOA_POW10[index];
+}
+
+static const uint32_t DTOA_POW10_32[] = {1,      10,      100,      1000,
+                                         10000,  100000,  1000000,  10000000,
+                                         100000000, 1000000000};
+
+// Walks the last digit down while that stays inside the rounding interval
+// and brings the digits closer to the exact value.
+static void dtoa_grisu_round(char *d, int len, uint64_t delta, uint64_t rest,
+                             uint64_t tenKappa, uint64_t wpw) {
+  while (rest < wpw && delta - rest >= tenKappa &&
+         (rest + tenKappa < wpw || wpw - rest > rest + tenKappa - wpw)) {
+    d[len - 1]--;
+    rest += tenKappa;
+  }
+}
+
+// Shortest digits of a positive finite v, with v = d * 10^K. Returns the
+// digit count. The scaled boundaries carry a few units of error, so when
+// stopping after fewer digits missed the interval only by that much, *near
+// gets the shorter length to check exactly.
+static int dtoa_grisu2(double v, char *d, int *K, int *near) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  int be = (int)(bits >> 52 & 0x7ff);
+  uint64_t frac = bits & ((1ULL << 52) - 1);
+  DtoaFp w = {be ? frac | 1ULL << 52 : frac, be ? be - 1075 : -1074};
+
+  // Boundaries halfway to the neighbouring doubles; the lower gap is half as
+  // wide at a power of two
+  DtoaFp plus = {(w.f << 1) + 1, w.e - 1}, minus;
+  plus = dtoa_normalize(plus);
+  if (w.f == 1ULL << 52) {
+    minus.f = (w.f << 2) - 1;
+    minus.e = w.e - 2;
+  } else {
+    minus.f = (w.f << 1) - 1;
+    minus.e = w.e - 1;
+  }
+  minus.f <<= minus.e - plus.e;
+  minus.e = plus.e;
+
+  DtoaFp c = dtoa_cached_power(plus.e, K);
+  DtoaFp W = dtoa_mul(dtoa_normalize(w), c);
+  DtoaFp Wp = dtoa_mul(plus, c), Wm = dtoa_mul(minus, c);
+  Wm.f++;
+  Wp.f--;
+
+  uint64_t delta = Wp.f - Wm.f, wpw = Wp.f - W.f;
+  int shift = -Wp.e;
+  uint64_t one = 1ULL << shift;
+  uint32_t p1 = (uint32_t)(Wp.f >> shift);
+  uint64_t p2 = Wp.f & (one - 1);
+  int kappa = 10, len = 0;
+  uint64_t margin = 4;
+  *near = 0;
+  while (kappa > 1 && p1 < DTOA_POW10_32[kappa - 1])
+    kappa--;
+
+  while (kappa > 0) {
+    uint32_t div = DTOA_POW10_32[kappa - 1];
+    uint32_t digit = p1 / div;
+    p1 %= div;
+    if (digit || len)
+      d[len++] = (char)('0' + digit);
+    kappa--;
+    uint64_t rest = ((uint64_t)p1 << shift) + p2;
+    uint64_t tenKappa = (uint64_t)DTOA_POW10_32[kappa] << shift;
+    if (rest <= delta) {
+      *K += kappa;
+      dtoa_grisu_round(d, len, delta, rest, tenKappa, wpw);
+      return len;
+    }
+    if (len && !*near && (rest - delta <= margin || tenKappa - rest <= margin))
+      *near = len;
+  }
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char digit = (char)(p2 >> shift);
+    if (digit || len)
+      d[len++] = (char)('0' + digit);
+    p2 &= one - 1;
+    kappa--;
+    margin *= 10;
+    if (p2 < delta) {
+      *K += kappa;
+      dtoa_grisu_round(d, len, delta, p2, one,
+                       -kappa < 10 ? wpw * DTOA_POW10_32[-kappa] : 0);
+      return len;
+    }
+    if (len && !*near && (p2 - delta <= margin || one - p2 <= margin))
+      *near = len;
+  }
+}
+
+// Rounds d half-up to `keep` digits (zero or fewer rounds to nothing or to a
+// single 1) and drops trailing zeros.
+static void dtoa_round(char *d, int *nd, int *point, int keep) {
+  if (keep < *nd) {
+    int up = keep >= 0 && d[keep] >= '5';
+    *nd = keep < 0 ? 0 : keep;
+    if (up) {
+      int i = keep - 1;
+      while (i >= 0 && d[i] == '9')
+        i--;
+      if (i < 0) {
+        d[0] = '1';
+        *nd = 1;
+        (*point)++;
+      } else {
+        d[i]++;
+        *nd = i + 1;
+      }
+    }
+  }
+  while (*nd > 0 && d[*nd - 1] == '0')
+    (*nd)--;
+}
+
+// Grisu2 misses the shortest form for a few doubles in ten thousand. When
+// it reports a shorter length as borderline, the two neighbours at that
+// length, nearer first, are checked by reading them back.
+static void dtoa_shorten(double v, char *d, int *nd, int *point, int len) {
+  char text[DTOA_MAX_DIGITS + 8];
+  for (int t = 0; t < 2; t++) {
+    int up = (d[len] >= '5') ^ t, p = *point, i = len - 1, e, n = len;
+    memcpy(text, d, (size_t)len);
+    if (up) {
+      while (i >= 0 && text[i] == '9')
+        text[i--] = '0';
+      if (i < 0) {
+        text[0] = '1';
+        p++;
+      } else {
+        text[i]++;
+      }
+    }
+    e = p - len;
+    text[n++] = 'e';
+    if (e < 0) {
+      text[n++] = '-';
+      e = -e;
+    }
+    if (e >= 100)
+      text[n++] = (char)('0' + e / 100);
+    if (e >= 10)
+      text[n++] = (char)('0' + e / 10 % 10);
+    text[n++] = (char)('0' + e % 10);
+    text[n] = '\0';
+    if (atod(text) == v) {
+      memcpy(d, text, (size_t)len);
+      *nd = len;
+      *point = p;
+      return;
+    }
+  }
+}
+
+// Digits of |v| with the decimal point after `point` of them. v must be
+// finite; zero gives no digits.
+static int dtoa_digits(double v, char *d, int *point) {
+  int K, nd, near;
+  v = fabs(v);
+  if (v == 0) {
+    *point = 1;
+    return 0;
+  }
+  nd = dtoa_grisu2(v, d, &K, &near);
+  *point = nd + K;
+  if (near && near < nd)
+    dtoa_shorten(v, d, &nd, point, near);
+  dtoa_round(d, &nd, point, nd);
+  return nd;
+}
+
+static void dtoa_put(char *buf, size_t size, size_t *n, char c) {
+  if (*n + 1 < size)
+    buf[*n] = c;
+  (*n)++;
+}
+
+static size_t dtoa_finish(char *buf, size_t size, size_t n) {
+  if (size)
+    buf[n < size ? n : size - 1] = '\0';
+  return n;
+}
+
+// nan and inf spelled as printf does. Returns 1 when v was one of them.
+static int dtoa_special(double v, char *buf, size_t size, size_t *n) {
+  const char *s = isnan(v) ? "nan" : signbit(v) ? "-inf" : "inf";
+  if (isfinite(v))
+    return 0;
+  for (; *s; s++)
+    dtoa_put(buf, size, n, *s);
+  return 1;
+}
+
+// Plain positional layout. decimals < 0 writes every digit after the point,
+// otherwise exactly that many; sep groups the integer part when nonzero.
+static void dtoa_put_fixed(char *buf, size_t size, size_t *n, const char *d,
+                           int nd, int point, int decimals, char sep) {
+  if (point <= 0)
+    dtoa_put(buf, size, n, '0');
+  for (int i = 0; i < point; i++) {
+    if (sep && i && (point - i) % 3 == 0)
+      dtoa_put(buf, size, n, sep);
+    dtoa_put(buf, size, n, i < nd ? d[i] : '0');
+  }
+  int fracDigits = decimals >= 0 ? decimals : nd - point;
+  if (fracDigits > 0) {
+    dtoa_put(buf, size, n, '.');
+    for (int i = point; i < point + fracDigits; i++)
+      dtoa_put(buf, size, n, i >= 0 && i < nd ? d[i] : '0');
+  }
+}
+
+// Like %.<precision>g, or the shortest round-trip text for DTOA_SHORTEST.
+// Returns the length the full text needs, as snprintf does.
+static size_t dtoa_format(double v, int precision, char sep, char *buf,
+                          size_t size) {
+  char d[DTOA_MAX_DIGITS + 1];
+  int point, nd, p = precision > 0 ? precision : DTOA_MAX_DIGITS;
+  size_t n = 0;
+
+  if (dtoa_special(v, buf, size, &n))
+    return dtoa_finish(buf, size, n);
+  nd = dtoa_digits(v, d, &point);
+  if (precision > 0)
+    dtoa_round(d, &nd, &point, precision);
+  if (signbit(v))
+    dtoa_put(buf, size, &n, '-');
+  int x = nd ? point - 1 : 0;
+  if (x < -4 || x >= p) {
+    dtoa_put(buf, size, &n, d[0]);
+    if (nd > 1) {
+      dtoa_put(buf, size, &n, '.');
+      for (int i = 1; i < nd; i++)
+        dtoa_put(buf, size, &n, d[i]);
+    }
+    dtoa_put(buf, size, &n, 'e');
+    dtoa_put(buf, size, &n, x < 0 ? '-' : '+');
+    x = x < 0 ? -x : x;
+    if (x >= 100)
+      dtoa_put(buf, size, &n, (char)('0' + x / 100));
+    dtoa_put(buf, size, &n, (char)('0' + x / 10 % 10));
+    dtoa_put(buf, size, &n, (char)('0' + x % 10));
+  } else {
+    dtoa_put_fixed(buf, size, &n, d, nd, nd ? point : 1, -1, sep);
+  }
+  return dtoa_finish(buf, size, n);
+}
+
+// Like %.<decimals>f.
+static size_t dtoa_fixed(double v, int decimals, char sep, char *buf,
+                         size_t size) {
+  char d[DTOA_MAX_DIGITS + 1];
+  int point, nd;
+  size_t n = 0;
+
+  if (dtoa_special(v, buf, size, &n))
+    return dtoa_finish(buf, size, n);
+  nd = dtoa_digits(v, d, &point);
+  dtoa_round(d, &nd, &point, point + decimals);
+  if (signbit(v))
+    dtoa_put(buf, size, &n, '-');
+  dtoa_put_fixed(buf, size, &n, d, nd, nd ? point : 1, decimals, sep);
+  return dtoa_finish(buf, size, n);
+}
+
+#endif
@@ -0,0 +1,634 @@
+#ifndef FRAC_H
+#define FRAC_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FRAC_LIMBS 64 // 2048-bit numerators and denominators
+#define FRAC_TEXT_MAX (FRAC_LIMBS * 20 + 8)
+#define FRAC_POW_MAX 4096
+
+// Magnitude as little-endian 32-bit limbs; len 0 is zero and w[len - 1] is
+// never 0.
+typedef struct {
+  int len;
+  uint32_t w[FRAC_LIMBS];
+} FracNat;
+
+// Kept in lowest terms with den > 0; zero is 0/1 and never negative. While
+// both parts fit 64 bits the arithmetic runs on machine words and only
+// falls back to the limb code when a result outgrows them.
+typedef struct {
+  int neg;
+  FracNat num, den;
+} Frac;
+
+static void fnat_set(FracNat *a, uint64_t v) {
+  a->w[0] = (uint32_t)v;
+  a->w[1] = (uint32_t)(v >> 32);
+  a->len = v >> 32 ? 2 : v ? 1 : 0;
+}
+
+static int fnat_small(const FracNat *a) { return a->len <= 2; }
+
+static uint64_t fnat_u64(const FracNat *a) {
+  if (a->len == 0)
+    return 0;
+  return a->len == 1 ? a->w[0] : a->w[0] | (uint64_t)a->w[1] << 32;
+}
+
+static void fnat_trim(FracNat *a) {
+  while (a->len && !a->w[a->len - 1])
+    a->len--;
+}
+
+static int fnat_cmp(const FracNat *a, const FracNat *b) {
+  if (a->len != b->len)
+    return a->len < b->len ? -1 : 1;
+  for (int i = a->len - 1; i >= 0; i--)
+    if (a->w[i] != b->w[i])
+      return a->w[i] < b->w[i] ? -1 : 1;
+  return 0;
+}
+
+static int fnat_is_one(const FracNat *a) { return a->len == 1 && a->w[0] == 1; }
+
+// r = a + b. Returns 0 on overflow. r may alias either input.
+static int fnat_add(FracNat *r, const FracNat *a, const FracNat *b) {
+  int n = a->len > b->len ? a->len : b->len;
+  uint64_t c = 0;
+  for (int i = 0; i < n; i++) {
+    c += (uint64_t)(i < a->len ? a->w[i] : 0) + (i < b->len ? b->w[i] : 0);
+    r->w[i] = (uint32_t)c;
+    c >>= 32;
+  }
+  if (c) {
+    if (n == FRAC_LIMBS)
+      return 0;
+    r->w[n++] = (uint32_t)c;
+  }
+  r->len = n;
+  return 1;
+}
+
+// r = a - b for a >= b.
+static void fnat_sub(FracNat *r, const FracNat *a, const FracNat *b) {
+  int64_t borrow = 0;
+  for (int i = 0; i < a->len; i++) {
+    int64_t t = (int64_t)a->w[i] - (i < b->len ? b->w[i] : 0) - borrow;
+    borrow = t < 0;
+    r->w[i] = (uint32_t)t;
+  }
+  r->len = a->len;
+  fnat_trim(r);
+}
+
+// r = a * b. Returns 0 on overflow.
+static int fnat_mul(FracNat *r, const FracNat *a, const FracNat *b) {
+  uint32_t t[2 * FRAC_LIMBS];
+  int n = a->len + b->len;
+
+  if (!a->len || !b->len) {
+    r->len = 0;
+    return 1;
+  }
+  if (n > FRAC_LIMBS + 1)
+    return 0;
+  memset(t, 0, (size_t)n * sizeof(t[0]));
+  for (int i = 0; i < a->len; i++) {
+    uint64_t c = 0;
+    for (int j = 0; j < b->len; j++) {
+      c += (uint64_t)a->w[i] * b->w[j] + t[i + j];
+      t[i + j] = (uint32_t)c;
+      c >>= 32;
+    }
+    t[i + b->len] = (uint32_t)c;
+  }
+  while (n && !t[n - 1])
+    n--;
+  if (n > FRAC_LIMBS)
+    return 0;
+  memcpy(r->w, t, (size_t)n * sizeof(t[0]));
+  r->len = n;
+  return 1;
+}
+
+// r = a * m + add. Returns 0 on overflow.
+static int fnat_mul_add_small(FracNat *r, const FracNat *a, uint32_t m,
+                              uint32_t add) {
+  uint64_t c = add;
+  for (int i = 0; i < a->len; i++) {
+    c += (uint64_t)a->w[i] * m;
+    r->w[i] = (uint32_t)c;
+    c >>= 32;
+  }
+  r->len = a->len;
+  if (c) {
+    if (r->len == FRAC_LIMBS)
+      return 0;
+    r->w[r->len++] = (uint32_t)c;
+  }
+  fnat_trim(r);
+  return 1;
+}
+
+// q = a / d, returning the remainder.
+static uint32_t fnat_divmod_small(FracNat *q, const FracNat *a, uint32_t d) {
+  uint64_t rem = 0;
+  for (int i = a->len - 1; i >= 0; i--) {
+    uint64_t cur = rem << 32 | a->w[i];
+    q->w[i] = (uint32_t)(cur / d);
+    rem = cur % d;
+  }
+  q->len = a->len;
+  fnat_trim(q);
+  return (uint32_t)rem;
+}
+
+// q = a / b and r = a % b, either may be NULL; b must be nonzero. Knuth's
+// algorithm D on normalized 32-bit limbs.
+static void fnat_divmod(const FracNat *a, const FracNat *b, FracNat *q,
+                        FracNat *r) {
+  uint32_t un[FRAC_LIMBS + 1], vn[FRAC_LIMBS];
+  FracNat qq;
+  int n = b->len, m = a->len - b->len;
+
+  if (fnat_cmp(a, b) < 0) {
+    if (r)
+      *r = *a;
+    if (q)
+      q->len = 0;
+    return;
+  }
+  if (n == 1) {
+    uint32_t rem = fnat_divmod_small(&qq, a, b->w[0]);
+    if (r)
+      fnat_set(r, rem);
+    if (q)
+      *q = qq;
+    return;
+  }
+
+  int s = __builtin_clz(b->w[n - 1]);
+  for (int i = n - 1; i > 0; i--)
+    vn[i] = b->w[i] << s | (s ? b->w[i - 1] >> (32 - s) : 0);
+  vn[0] = b->w[0] << s;
+  un[a->len] = s ? a->w[a->len - 1] >> (32 - s) : 0;
+  for (int i = a->len - 1; i > 0; i--)
+    un[i] = a->w[i] << s | (s ? a->w[i - 1] >> (32 - s) : 0);
+  un[0] = a->w[0] << s;
+
+  for (int j = m; j >= 0; j--) {
+    uint64_t num = (uint64_t)un[j + n] << 32 | un[j + n - 1];
+    uint64_t qhat = num / vn[n - 1], rhat = num % vn[n - 1];
+    while (qhat >> 32 || qhat * vn[n - 2] > (rhat << 32 | un[j + n - 2])) {
+      qhat--;
+      rhat += vn[n - 1];
+      if (rhat >> 32)
+        break;
+    }
+    int64_t k = 0, t;
+    for (int i = 0; i < n; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i + j] - k - (int64_t)(p & 0xffffffffu);
+      un[i + j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j + n] - k;
+    un[j + n] = (uint32_t)t;
+    if (t < 0) {
+      // qhat was one too large; add the divisor back
+      uint64_t c = 0;
+      qhat--;
+      for (int i = 0; i < n; i++) {
+        c += (uint64_t)un[i + j] + vn[i];
+        un[i + j] = (uint32_t)c;
+        c >>= 32;
+      }
+      un[j + n] += (uint32_t)c;
+    }
+    qq.w[j] = (uint32_t)qhat;
+  }
+  qq.len = m + 1;
+  fnat_trim(&qq);
+  if (r) {
+    for (int i = 0; i < n; i++)
+      r->w[i] = un[i] >> s | (s ? un[i + 1] << (32 - s) : 0);
+    r->len = n;
+    fnat_trim(r);
+  }
+  if (q)
+    *q = qq;
+}
+
+static int fnat_ctz(const FracNat *a) {
+  int i = 0;
+  while (!a->w[i])
+    i++;
+  return i * 32 + __builtin_ctz(a->w[i]);
+}
+
+static void fnat_shr(FracNat *a, int bits) {
+  int limbs = bits / 32, s = bits % 32;
+  for (int i = 0; i + limbs < a->len; i++) {
+    uint32_t hi = i + limbs + 1 < a->len ? a->w[i + limbs + 1] : 0;
+    a->w[i] = a->w[i + limbs] >> s | (s ? hi << (32 - s) : 0);
+  }
+  a->len -= limbs;
+  fnat_trim(a);
+}
+
+// Restores the common power of two in a GCD, which never outgrows the
+// operands, so there is always room for the extra limbs.
+static void fnat_shl(FracNat *a, int bits) {
+  int limbs = bits / 32, s = bits % 32, n = a->len + limbs;
+  if (!a->len)
+    return;
+  uint32_t top = s ? a->w[a->len - 1] >> (32 - s) : 0;
+  for (int i = n - 1; i >= limbs; i--) {
+    uint32_t lo = i - limbs - 1 >= 0 ? a->w[i - limbs - 1] : 0;
+    a->w[i] = a->w[i - limbs] << s | (s ? lo >> (32 - s) : 0);
+  }
+  for (int i = 0; i < limbs; i++)
+    a->w[i] = 0;
+  a->len = n;
+  if (top)
+    a->w[a->len++] = top;
+}
+
+// Stein's binary GCD on words: shifts and subtractions only.
+static uint64_t frac_gcd64(uint64_t a, uint64_t b) {
+  if (!a || !b)
+    return a | b;
+  int k = __builtin_ctzll(a | b);
+  a >>= __builtin_ctzll(a);
+  do {
+    b >>= __builtin_ctzll(b);
+    if (a > b) {
+      uint64_t t = a;
+      a = b;
+      b = t;
+    }
+    b -= a;
+  } while (b);
+  return a << k;
+}
+
+// The same on limbs, dropping to frac_gcd64 once both sides fit a word.
+static void fnat_gcd(FracNat *g, const FracNat *a, const FracNat *b) {
+  FracNat u, v;
+  if (!a->len || !b->len) {
+    *g = a->len ? *a : *b;
+    return;
+  }
+  u = *a;
+  v = *b;
+  int tu = fnat_ctz(&u), tv = fnat_ctz(&v), k = tu < tv ? tu : tv;
+  fnat_shr(&u, tu);
+  fnat_shr(&v, tv);
+  for (;;) {
+    if (fnat_small(&u) && fnat_small(&v)) {
+      fnat_set(g, frac_gcd64(fnat_u64(&u), fnat_u64(&v)));
+      break;
+    }
+    if (fnat_cmp(&u, &v) > 0) {
+      FracNat t = u;
+      u = v;
+      v = t;
+    }
+    fnat_sub(&v, &v, &u);
+    if (!v.len) {
+      *g = u;
+      break;
+    }
+    fnat_shr(&v, fnat_ctz(&v));
+  }
+  fnat_shl(g, k);
+}
+
+static void frac_fix_zero(Frac *f) {
+  if (!f->num.len) {
+    f->neg = 0;
+    fnat_set(&f->den, 1);
+  }
+}
+
+static void frac_from_u64(Frac *f, int neg, uint64_t num, uint64_t den) {
+  fnat_set(&f->num, num);
+  fnat_set(&f->den, den);
+  f->neg = neg;
+  frac_fix_zero(f);
+}
+
+static void frac_from_int(Frac *f, int64_t v) {
+  frac_from_u64(f, v < 0, v < 0 ? 0 - (uint64_t)v : (uint64_t)v, 1);
+}
+
+static int frac_is_zero(const Frac *f) { return !f->num.len; }
+
+static int frac_is_small(const Frac *f) {
+  return fnat_small(&f->num) && fnat_small(&f->den);
+}
+
+// Brings num/den to lowest terms; only needed after building a value by
+// hand, the arithmetic below never leaves a common factor behind.
+static void frac_reduce(Frac *f) {
+  FracNat g;
+  fnat_gcd(&g, &f->num, &f->den);
+  if (g.len && !fnat_is_one(&g)) {
+    fnat_divmod(&f->num, &g, &f->num, NULL);
+    fnat_divmod(&f->den, &g, &f->den, NULL);
+  }
+  frac_fix_zero(f);
+}
+
+// r = a + b, or a - b when sub is set. Henrici's method: with g the GCD of
+// the denominators the numerator sum is only reduced against g, which keeps
+// the GCDs small. Returns 0 when the result outgrows FRAC_LIMBS.
+static int frac_add(Frac *r, const Frac *a, const Frac *b, int sub) {
+  int bneg = b->neg ^ (sub && b->num.len);
+
+  if (frac_is_small(a) && frac_is_small(b)) {
+    uint64_t an = fnat_u64(&a->num), ad = fnat_u64(&a->den);
+    uint64_t bn = fnat_u64(&b->num), bd = fnat_u64(&b->den);
+    uint64_t g = frac_gcd64(ad, bd);
+    unsigned __int128 x = (unsigned __int128)an * (bd / g);
+    unsigned __int128 y = (unsigned __int128)bn * (ad / g), t;
+    int neg = a->neg, fits = 1;
+    if (a->neg == bneg) {
+      t = x + y;
+      fits = t >= x;
+    } else if (x >= y) {
+      t = x - y;
+    } else {
+      t = y - x;
+      neg = bneg;
+    }
+    if (fits) {
+      uint64_t g2 = frac_gcd64((uint64_t)(t % g), g);
+      unsigned __int128 num = t / g2;
+      unsigned __int128 den = (unsigned __int128)(ad / g) * (bd / g2);
+      if (!(num >> 64) && !(den >> 64)) {
+        frac_from_u64(r, neg, (uint64_t)num, (uint64_t)den);
+        return 1;
+      }
+    }
+  }
+
+  Frac res;
+  FracNat g, adg, bdg, x, y, t, g2;
+  fnat_gcd(&g, &a->den, &b->den);
+  fnat_divmod(&a->den, &g, &adg, NULL);
+  fnat_divmod(&b->den, &g, &bdg, NULL);
+  if (!fnat_mul(&x, &a->num, &bdg) || !fnat_mul(&y, &b->num, &adg))
+    return 0;
+  res.neg = a->neg;
+  if (a->neg == bneg) {
+    if (!fnat_add(&t, &x, &y))
+      return 0;
+  } else if (fnat_cmp(&x, &y) >= 0) {
+    fnat_sub(&t, &x, &y);
+  } else {
+    fnat_sub(&t, &y, &x);
+    res.neg = bneg;
+  }
+  fnat_gcd(&g2, &t, &g);
+  fnat_divmod(&t, &g2, &res.num, NULL);
+  fnat_divmod(&b->den, &g2, &y, NULL);
+  if (!fnat_mul(&res.den, &adg, &y))
+    return 0;
+  frac_fix_zero(&res);
+  *r = res;
+  return 1;
+}
+
+// r = a * b with cross-cancellation: a.num against b.den and b.num against
+// a.den before multiplying, so the product is already in lowest terms and
+// the operands stay as small as possible.
+static int frac_mul(Frac *r, const Frac *a, const Frac *b) {
+  int neg = a->neg ^ b->neg;
+
+  if (frac_is_small(a) && frac_is_small(b)) {
+    uint64_t an = fnat_u64(&a->num), ad = fnat_u64(&a->den);
+    uint64_t bn = fnat_u64(&b->num), bd = fnat_u64(&b->den);
+    uint64_t g1 = frac_gcd64(an, bd), g2 = frac_gcd64(bn, ad);
+    unsigned __int128 num = (unsigned __int128)(an / g1) * (bn / g2);
+    unsigned __int128 den = (unsigned __int128)(ad / g2) * (bd / g1);
+    if (!(num >> 64) && !(den >> 64)) {
+      frac_from_u64(r, neg, (uint64_t)num, (uint64_t)den);
+      return 1;
+    }
+  }
+
+  Frac res;
+  FracNat g1, g2, an, ad, bn, bd;
+  fnat_gcd(&g1, &a->num, &b->den);
+  fnat_gcd(&g2, &b->num, &a->den);
+  fnat_divmod(&a->num, &g1, &an, NULL);
+  fnat_divmod(&b->den, &g1, &bd, NULL);
+  fnat_divmod(&b->num, &g2, &bn, NULL);
+  fnat_divmod(&a->den, &g2, &ad, NULL);
+  if (!fnat_mul(&res.num, &an, &bn) || !fnat_mul(&res.den, &ad, &bd))
+    return 0;
+  res.neg = neg;
+  frac_fix_zero(&res);
+  *r = res;
+  return 1;
+}
+
+// r = 1 / a for nonzero a.
+static void frac_recip(Frac *r, const Frac *a) {
+  FracNat t = a->num;
+  r->neg = a->neg;
+  r->num = a->den;
+  r->den = t;
+}
+
+// r = a / b. Returns -1 when b is zero, 0 on overflow.
+static int frac_div(Frac *r, const Frac *a, const Frac *b) {
+  Frac inv;
+  if (frac_is_zero(b))
+    return -1;
+  frac_recip(&inv, b);
+  return frac_mul(r, a, &inv);
+}
+
+// r = a^e by squaring numerator and denominator separately; a power of a
+// reduced fraction is still reduced. |e| is capped at FRAC_POW_MAX.
+static int frac_pow(Frac *r, const Frac *a, long e) {
+  Frac base = *a, res;
+  int neg = a->neg && (e & 1);
+
+  if (e < 0) {
+    if (frac_is_zero(a))
+      return -1;
+    frac_recip(&base, a);
+    e = -e;
+  }
+  if (e > FRAC_POW_MAX)
+    return 0;
+  frac_from_int(&res, 1);
+  for (; e; e >>= 1) {
+    if (e & 1)
+      if (!fnat_mul(&res.num, &res.num, &base.num) ||
+          !fnat_mul(&res.den, &res.den, &base.den))
+        return 0;
+    if (e > 1)
+      if (!fnat_mul(&base.num, &base.num, &base.num) ||
+          !fnat_mul(&base.den, &base.den, &base.den))
+        return 0;
+  }
+  res.neg = neg;
+  frac_fix_zero(&res);
+  *r = res;
+  return 1;
+}
+
+// Top three limbs as a double scaled by 2^-exp.
+static double fnat_top(const FracNat *a, int *exp) {
+  double v = 0;
+  int lo = a->len > 3 ? a->len - 3 : 0;
+  for (int i = a->len - 1; i >= lo; i--)
+    v = v * 4294967296.0 + a->w[i];
+  *exp = 32 * lo;
+  return v;
+}
+
+static double frac_to_double(const Frac *f) {
+  int en, ed;
+  double n = fnat_top(&f->num, &en), d = fnat_top(&f->den, &ed);
+  double v = ldexp(n / d, en - ed);
+  return f->neg ? -v : v;
+}
+
+// Decimal digits of a, written backwards from end in 9-digit chunks.
+// Returns the new start.
+static char *fnat_digits(const FracNat *a, char *end) {
+  FracNat t = *a;
+  char *p = end;
+  do {
+    uint32_t chunk = fnat_divmod_small(&t, &t, 1000000000u);
+    for (int i = 0; i < 9 && (t.len || chunk); i++) {
+      *--p = (char)('0' + chunk % 10);
+      chunk /= 10;
+    }
+  } while (t.len);
+  if (p == end)
+    *--p = '0';
+  return p;
+}
+
+// "n/d", "n" for integers, or "w n/d" as a mixed number.
+static void frac_format(const Frac *f, int mixed, char *buf, size_t size) {
+  char tmp[FRAC_TEXT_MAX];
+  char *end = tmp + sizeof(tmp) - 1, *p = end;
+  FracNat whole, rem;
+
+  *end = '\0';
+  if (fnat_is_one(&f->den)) {
+    p = fnat_digits(&f->num, p);
+  } else if (mixed && fnat_cmp(&f->num, &f->den) > 0) {
+    fnat_divmod(&f->num, &f->den, &whole, &rem);
+    p = fnat_digits(&f->den, p);
+    *--p = '/';
+    p = fnat_digits(&rem, p);
+    *--p = ' ';
+    p = fnat_digits(&whole, p);
+  } else {
+    p = fnat_digits(&f->den, p);
+    *--p = '/';
+    p = fnat_digits(&f->num, p);
+  }
+  if (f->neg)
+    *--p = '-';
+  snprintf(buf, size, "%s", p);
+}
+
+// Reads a decimal "12.5" exactly as 25/2, and "1.5e-3" as 3/2000. Returns
+// the characters used.
+static int frac_parse_decimal(const char *s, Frac *f) {
+  const char *p = s;
+  int digits = 0, seenDot = 0;
+
+  f->neg = 0;
+  f->num.len = 0;
+  fnat_set(&f->den, 1);
+  for (;; p++) {
+    if (*p == '.' && !seenDot) {
+      seenDot = 1;
+    } else if (*p >= '0' && *p <= '9') {
+      if (!fnat_mul_add_small(&f->num, &f->num, 10, (uint32_t)(*p - '0')))
+        return 0;
+      if (seenDot && !fnat_mul_add_small(&f->den, &f->den, 10, 0))
+        return 0;
+      digits++;
+    } else {
+      break;
+    }
+  }
+  if (!digits)
+    return 0;
+
+  // An exponent scales the numerator or denominator by 10^|e|; past
+  // FRAC_LIMBS * 10 digits the value could not fit anyway
+  const char *q = p + 1;
+  int eneg = 0, e = 0;
+  if ((*p == 'e' || *p == 'E') && (*q == '-' || *q == '+'))
+    eneg = *q++ == '-';
+  if ((*p == 'e' || *p == 'E') && *q >= '0' && *q <= '9') {
+    for (; *q >= '0' && *q <= '9'; q++) {
+      e = e * 10 + (*q - '0');
+      if (e > FRAC_LIMBS * 10)
+        return 0;
+    }
+    for (int i = 0; i < e; i++)
+      if (!fnat_mul_add_small(eneg ? &f->den : &f->num,
+                              eneg ? &f->den : &f->num, 10, 0))
+        return 0;
+    p = q;
+  }
+  return (int)(p - s);
+}
+
+// Parses "a", "a/b", "w a/b" and decimals in any of those places. Returns 0
+// when nothing numeric is found, text is left over, the value does not
+// fit, or b is zero.
+static int frac_parse(const char *s, Frac *f) {
+  Frac a, b;
+  int neg = 0, n, m;
+
+  while (*s == ' ')
+    s++;
+  if (*s == '-' || *s == '+')
+    neg = *s++ == '-';
+  if (!(n = frac_parse_decimal(s, &a)))
+    return 0;
+  s += n;
+  if (*s == '/') {
+    if (!(n = frac_parse_decimal(s + 1, &b)) || frac_div(&a, &a, &b) != 1)
+      return 0;
+    s += 1 + n;
+  } else if (*s == ' ' && s[1] >= '0' && s[1] <= '9') {
+    Frac fn, fd;
+    if (!(n = frac_parse_decimal(s + 1, &fn)) || s[1 + n] != '/' ||
+        !(m = frac_parse_decimal(s + 2 + n, &fd)) ||
+        frac_div(&b, &fn, &fd) != 1)
+      return 0;
+    frac_reduce(&a);
+    if (!frac_add(&a, &a, &b, 0))
+      return 0;
+    s += 2 + n + m;
+  }
+  while (*s == ' ')
+    s++;
+  if (*s)
+    return 0;
+  frac_reduce(&a);
+  a.neg = neg && !frac_is_zero(&a);
+  *f = a;
+  return 1;
+}
+
+#endif
@@ -0,0 +1,262 @@
+// Expands units.def with SI and binary prefixes and writes units_table.h: a
+// hash-and-displace perfect hash so unit_find() resolves a name with one
+// probe. Run by the Makefile; `./gen_units units_table.h`.
+#define UNITS_GENERATOR
+#include "units.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GEN_MAX_UNITS 4096
+#define GEN_NAME_MAX 32
+#define GEN_MAX_DISP 65535
+#define GEN_BUCKET_LOAD 3
+
+typedef struct {
+  char name[GEN_NAME_MAX];
+  double scale;
+  double offset;
+  int8_t dim[UNIT_DIMS];
+  uint64_t hash;
+} GenUnit;
+
+typedef struct {
+  const char *sym;
+  int exp;
+} GenPrefix;
+
+static const GenPrefix SI_PREFIXES[] = {
+    {"Y", 24},  {"Z", 21},  {"E", 18},   {"P", 15},   {"T", 12},  {"G", 9},
+    {"M", 6},   {"k", 3},   {"h", 2},    {"da", 1},   {"d", -1},  {"c", -2},
+    {"m", -3},  {"µ", -6},  {"μ", -6},   {"u", -6},   {"n", -9},  {"p", -12},
+    {"f", -15}, {"a", -18}, {"z", -21},  {"y", -24}};
+
+static const GenPrefix BIN_PREFIXES[] = {{"Ki", 10}, {"Mi", 20}, {"Gi", 30},
+                                         {"Ti", 40}, {"Pi", 50}, {"Ei", 60}};
+
+typedef struct {
+  const char *name;
+  double scale, offset;
+  int8_t dim[UNIT_DIMS];
+  int flags;
+} GenBase;
+
+static const GenBase BASE_UNITS[] = {
+#define UNIT(name, scale, offset, L, M, T, I, K, N, J, B, flags)               \
+  {name, scale, offset, {L, M, T, I, K, N, J, B}, flags},
+#include "units.def"
+#undef UNIT
+};
+
+#define NUM_BASE_UNITS (int)(sizeof(BASE_UNITS) / sizeof(BASE_UNITS[0]))
+
+static GenUnit units[GEN_MAX_UNITS];
+static int numUnits = 0;
+
+static int find_unit(const char *name) {
+  for (int i = 0; i < numUnits; i++)
+    if (strcmp(units[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+static void add_unit(const char *prefix, const GenBase *b, double scale) {
+  char name[GEN_NAME_MAX];
+  snprintf(name, sizeof(name), "%s%s", prefix, b->name);
+  if (find_unit(name) >= 0)
+    return;
+  if (numUnits == GEN_MAX_UNITS) {
+    fprintf(stderr, "gen_units: too many units\n");
+    exit(1);
+  }
+  GenUnit *u = &units[numUnits++];
+  strcpy(u->name, name);
+  u->scale = scale;
+  u->offset = b->offset;
+  memcpy(u->dim, b->dim, sizeof(u->dim));
+  u->hash = unit_hash(name, strlen(name));
+}
+
+// Scales a base factor by 10^exp through its shortest decimal spelling, so
+// mg comes out as exactly 1e-6 rather than 1e-3 * 1e-3.
+static double decimal_scale(double v, int exp) {
+  char buf[64];
+  for (int prec = 0; prec <= 16; prec++) {
+    snprintf(buf, sizeof(buf), "%.*e", prec, v);
+    if (strtod(buf, NULL) == v)
+      break;
+  }
+  char *e = strchr(buf, 'e');
+  snprintf(e, sizeof(buf) - (size_t)(e - buf), "e%d", atoi(e + 1) + exp);
+  return strtod(buf, NULL);
+}
+
+static void expand_units(void) {
+  // Explicit entries first so they shadow any prefixed spelling
+  for (int i = 0; i < NUM_BASE_UNITS; i++) {
+    if (find_unit(BASE_UNITS[i].name) >= 0) {
+      fprintf(stderr, "gen_units: duplicate unit %s\n", BASE_UNITS[i].name);
+      exit(1);
+    }
+    add_unit("", &BASE_UNITS[i], BASE_UNITS[i].scale);
+  }
+  for (int i = 0; i < NUM_BASE_UNITS; i++) {
+    const GenBase *b = &BASE_UNITS[i];
+    if (b->flags & UNIT_SI)
+      for (size_t p = 0; p < sizeof(SI_PREFIXES) / sizeof(SI_PREFIXES[0]); p++)
+        add_unit(SI_PREFIXES[p].sym, b,
+                 decimal_scale(b->scale, SI_PREFIXES[p].exp));
+    if (b->flags & UNIT_BIN)
+      for (size_t p = 0; p < sizeof(BIN_PREFIXES) / sizeof(BIN_PREFIXES[0]); p++)
+        add_unit(BIN_PREFIXES[p].sym, b, ldexp(b->scale, BIN_PREFIXES[p].exp));
+  }
+}
+
+static int *bucketSizes;
+
+static int cmp_bucket(const void *a, const void *b) {
+  return bucketSizes[*(const int *)b] - bucketSizes[*(const int *)a];
+}
+
+// Hash and displace: buckets are placed largest first, each trying
+// displacements until all of its keys land in free, distinct slots.
+static int build_table(uint32_t size, uint32_t buckets, int *slotOf,
+                       uint16_t *disp) {
+  int *order = malloc(buckets * sizeof(int));
+  int *members = malloc(numUnits * sizeof(int));
+  int *start = calloc(buckets + 1, sizeof(int));
+  char *taken = calloc(size, 1);
+  uint32_t *slots = malloc(numUnits * sizeof(uint32_t));
+  int ok = 1;
+
+  bucketSizes = calloc(buckets, sizeof(int));
+  for (int i = 0; i < numUnits; i++)
+    bucketSizes[unit_bucket(units[i].hash, buckets)]++;
+  for (uint32_t b = 0; b < buckets; b++)
+    start[b + 1] = start[b] + bucketSizes[b];
+  int *fill = calloc(buckets, sizeof(int));
+  for (int i = 0; i < numUnits; i++) {
+    uint32_t b = unit_bucket(units[i].hash, buckets);
+    members[start[b] + fill[b]++] = i;
+  }
+  for (uint32_t b = 0; b < buckets; b++)
+    order[b] = (int)b;
+  qsort(order, buckets, sizeof(int), cmp_bucket);
+
+  for (uint32_t o = 0; o < buckets && ok; o++) {
+    int b = order[o], n = bucketSizes[b];
+    disp[b] = 0;
+    if (n == 0)
+      continue;
+    uint32_t d;
+    for (d = 0; d <= GEN_MAX_DISP; d++) {
+      int fits = 1;
+      for (int k = 0; k < n && fits; k++) {
+        uint32_t s = unit_slot(units[members[start[b] + k]].hash, d, size);
+        fits = !taken[s];
+        for (int j = 0; j < k && fits; j++)
+          fits = slots[j] != s;
+        slots[k] = s;
+      }
+      if (fits)
+        break;
+    }
+    if (d > GEN_MAX_DISP) {
+      ok = 0;
+      break;
+    }
+    disp[b] = (uint16_t)d;
+    for (int k = 0; k < n; k++) {
+      taken[slots[k]] = 1;
+      slotOf[slots[k]] = members[start[b] + k];
+    }
+  }
+
+  free(order);
+  free(members);
+  free(start);
+  free(taken);
+  free(slots);
+  free(fill);
+  free(bucketSizes);
+  return ok;
+}
+
+static void write_name(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    if (c < 0x80 && c != '"' && c != '\\')
+      fputc(c, f);
+    else
+      fprintf(f, "\\%03o", c);
+  }
+  fputc('"', f);
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: gen_units <units_table.h>\n");
+    return 1;
+  }
+
+  expand_units();
+  for (int i = 0; i < numUnits; i++)
+    for (int j = i + 1; j < numUnits; j++)
+      if (units[i].hash == units[j].hash) {
+        fprintf(stderr, "gen_units: hash collision %s %s\n", units[i].name,
+                units[j].name);
+        return 1;
+      }
+
+  uint32_t size = 1;
+  while (size < (uint32_t)numUnits + numUnits / 8)
+    size *= 2;
+  uint32_t buckets = (uint32_t)(numUnits / GEN_BUCKET_LOAD) + 1;
+  int *slotOf = NULL;
+  uint16_t *disp = NULL;
+  for (;; size *= 2) {
+    free(slotOf);
+    free(disp);
+    slotOf = malloc(size * sizeof(int));
+    disp = malloc(buckets * sizeof(uint16_t));
+    for (uint32_t s = 0; s < size; s++)
+      slotOf[s] = -1;
+    if (build_table(size, buckets, slotOf, disp))
+      break;
+  }
+
+  FILE *f = fopen(argv[1], "w");
+  if (!f) {
+    fprintf(stderr, "gen_units: cannot write %s\n", argv[1]);
+    return 1;
+  }
+  fprintf(f, "// Generated by gen_units from units.def. Do not edit.\n");
+  fprintf(f, "#define UNIT_COUNT %d\n", numUnits);
+  fprintf(f, "#define UNIT_TABLE_SIZE %uu\n", size);
+  fprintf(f, "#define UNIT_BUCKETS %uu\n\n", buckets);
+  fprintf(f, "static const uint16_t UNIT_DISP[UNIT_BUCKETS] = {");
+  for (uint32_t b = 0; b < buckets; b++)
+    fprintf(f, "%s%u", !b ? "\n    " : b % 16 ? ", " : ",\n    ", disp[b]);
+  fprintf(f, "};\n\nstatic const UnitDef UNIT_TABLE[UNIT_TABLE_SIZE] = {\n");
+  for (uint32_t s = 0; s < size; s++) {
+    if (slotOf[s] < 0) {
+      fprintf(f, "    {0},\n");
+      continue;
+    }
+    const GenUnit *u = &units[slotOf[s]];
+    fprintf(f, "    {0x%016llxULL, %.17g, %.17g, {", (unsigned long long)u->hash,
+            u->scale, u->offset);
+    for (int k = 0; k < UNIT_DIMS; k++)
+      fprintf(f, "%s%d", k ? ", " : "", u->dim[k]);
+    fprintf(f, "}, ");
+    write_name(f, u->name);
+    fprintf(f, "},\n");
+  }
+  fprintf(f, "};\n");
+  if (fclose(f) != 0)
+    return 1;
+  fprintf(stderr, "gen_units: %d units in %u slots\n", numUnits, size);
+  free(slotOf);
+  free(disp);
+  return 0;
+}
@@ -0,0 +1,295 @@
+#ifndef GESTURE_H
+#define GESTURE_H
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GESTURE_X86 1
+#endif
+
+#define GESTURE_SIDE 28
+#define GESTURE_ROWS 32    // the last four always empty
+#define GESTURE_WORDS 16   // two rows per word, so a bitset is four ymm
+#define GESTURE_SHIFT 1    // cells the input is moved each way to match
+#define GESTURE_INK_WORD 2 // first word with template ink, rows 4 and 5
+#define GESTURE_LANE 0x0FFFFFFFu
+
+enum {
+  GESTURE_NONE,
+  GESTURE_HEART,
+  GESTURE_PLUS,
+  GESTURE_MINUS,
+  GESTURE_TIMES,
+  GESTURE_DIVIDE,
+  GESTURE_EQUALS,
+  GESTURE_SCRIBBLE
+};
+
+// What each gesture stands for, written as the calculator's keys are.
+static const char *const gestureSymbols[] = {"",  "<3", "+", "-",
+                                             "*", "/",  "=", "C"};
+
+// A 28x28 input thresholded to a bit per cell. Row r sits in the 32-bit
+// lane r & 1 of word r / 2 with column c at bit c, so a row moves sideways
+// by a shift that stays inside its lane.
+typedef struct {
+  uint64_t w[GESTURE_WORDS];
+} GestureBits;
+
+typedef struct {
+  int gesture;
+  float minScore; // IoU a drawing needs to be taken for it
+  GestureBits bits;
+} GestureTemplate;
+
+// Ideal strokes run through the pad's own preprocessing, so a gesture
+// drawn on the pad lands on the cells of its template.
+static const GestureTemplate gestureTemplates[] = {
+    {GESTURE_HEART, 0.46f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x001f9f8000000000ull, 0x0071f0e0003fffc0ull, 0x006060600070f0e0ull,
+       0x0060006000606060ull, 0x003000c0007000e0ull, 0x001c0380003801c0ull,
+       0x00070e00000e0700ull, 0x0001f80000039c00ull, 0x0000f0000000f000ull,
+       0x0000000000006000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_PLUS, 0.54f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000600000000000ull,
+       0x0000600000006000ull, 0x0000600000006000ull, 0x0000600000006000ull,
+       0x007fffe000006000ull, 0x00006000007fffe0ull, 0x0000600000006000ull,
+       0x0000600000006000ull, 0x0000600000006000ull, 0x0000000000006000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_MINUS, 0.49f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x007fffe000000000ull, 0x00000000007fffe0ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_TIMES, 0.44f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0060006000000000ull,
+       0x003801c0007000e0ull, 0x000e0700001c0380ull, 0x00039c0000070e00ull,
+       0x0000f0000001f800ull, 0x0001f8000000f000ull, 0x00070e0000039c00ull,
+       0x001c0380000e0700ull, 0x007000e0003801c0ull, 0x0000000000600060ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_DIVIDE, 0.43f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000600000000000ull, 0x0000000000006000ull, 0x0000000000000000ull,
+       0x007fffe000000000ull, 0x00000000007fffe0ull, 0x0000000000000000ull,
+       0x0000600000000000ull, 0x0000000000006000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_EQUALS, 0.5f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x007fffe0007fffe0ull,
+       0x00000000007fffe0ull, 0x007fffe000000000ull, 0x007fffe0007fffe0ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    // = with its bars further apart, in steps thin bars can still overlap
+    {GESTURE_EQUALS, 0.5f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x007fffe000000000ull, 0x007fffe0007fffe0ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x007fffe0007fffe0ull,
+       0x00000000007fffe0ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_EQUALS, 0.5f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x007fffe0003fffc0ull, 0x00000000007fffe0ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x007fffe000000000ull,
+       0x003fffc0007fffe0ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_EQUALS, 0.5f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x003fffc000000000ull, 0x007fffe0007fffe0ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x007fffe0007fffe0ull, 0x00000000003fffc0ull, 0x0000000000000000ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+    {GESTURE_SCRIBBLE, 0.7f,
+     {{0x0000000000000000ull, 0x0000000000000000ull, 0x003fffe000000000ull,
+       0x007fffe0007fffe0ull, 0x007fffe0007fffe0ull, 0x007fffe0007fffe0ull,
+       0x007fffe0007fffe0ull, 0x007fffe0007fffe0ull, 0x007fffe0007fffe0ull,
+       0x007fffe0007fffe0ull, 0x007fffe0007fffe0ull, 0x00000000003fffe0ull,
+       0x0000000000000000ull, 0x0000000000000000ull, 0x0000000000000000ull,
+       0x0000000000000000ull}}},
+};
+
+#define GESTURE_TEMPLATES                                                      \
+  (int)(sizeof(gestureTemplates) / sizeof(gestureTemplates[0]))
+
+static int gestureCounts[GESTURE_TEMPLATES]; // set by gesture_kernel
+
+// The gesture of the best scoring template, if that clears its minScore.
+static int gesture_pick(const float *best) {
+  int pick = 0;
+  for (int t = 1; t < GESTURE_TEMPLATES; t++)
+    if (best[t] > best[pick])
+      pick = t;
+  return best[pick] >= gestureTemplates[pick].minScore
+             ? gestureTemplates[pick].gesture
+             : GESTURE_NONE;
+}
+
+// Kernels threshold a preprocessed 28x28 input at half ink, then score it
+// against every template at each offset of up to GESTURE_SHIFT cells as
+// |A & T| / (|A| + |T| - |A & T|), so the inner loop is one AND and one
+// popcount per word. |T| is counted once, when the kernel is picked.
+typedef int (*GestureKernel)(const float *input);
+
+// Row pair i of rows moved dy down and dx right, packed as a bitset word.
+static inline __attribute__((always_inline)) uint64_t
+gesture_word(const uint32_t *rows, int i, int dy, int dx) {
+  uint32_t a = rows[GESTURE_SHIFT + 2 * i - dy];
+  uint32_t b = rows[GESTURE_SHIFT + 2 * i + 1 - dy];
+  a = (dx < 0 ? a >> -dx : a << dx) & GESTURE_LANE;
+  b = (dx < 0 ? b >> -dx : b << dx) & GESTURE_LANE;
+  return a | (uint64_t)b << 32;
+}
+
+static int gesture_match_scalar(const float *input) {
+  uint32_t rows[GESTURE_ROWS + 2 * GESTURE_SHIFT] = {0};
+  float best[GESTURE_TEMPLATES] = {0};
+  for (int r = 0; r < GESTURE_SIDE; r++)
+    for (int c = 0; c < GESTURE_SIDE; c++)
+      rows[GESTURE_SHIFT + r] |=
+          (uint32_t)(input[r * GESTURE_SIDE + c] > 0.5f) << c;
+
+  for (int dy = -GESTURE_SHIFT; dy <= GESTURE_SHIFT; dy++) {
+    for (int dx = -GESTURE_SHIFT; dx <= GESTURE_SHIFT; dx++) {
+      uint64_t s[GESTURE_WORDS];
+      int n = 0;
+      for (int i = 0; i < GESTURE_WORDS; i++) {
+        s[i] = gesture_word(rows, i, dy, dx);
+        n += __builtin_popcountll(s[i]);
+      }
+      for (int t = 0; t < GESTURE_TEMPLATES; t++) {
+        const uint64_t *w = gestureTemplates[t].bits.w;
+        int both = 0;
+        for (int i = GESTURE_INK_WORD; i < GESTURE_WORDS; i++)
+          both += __builtin_popcountll(s[i] & w[i]);
+        int either = n + gestureCounts[t] - both;
+        float iou = either > 0 ? (float)both / either : 0;
+        best[t] = iou > best[t] ? iou : best[t];
+      }
+    }
+  }
+  return gesture_pick(best);
+}
+
+#ifdef GESTURE_X86
+// Counts the bits of each byte with two nibble lookups.
+__attribute__((target("avx2"))) static inline __m256i
+gesture_popcnt8(__m256i v) {
+  const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2,
+                                       3, 3, 4, 0, 1, 1, 2, 1, 2, 2, 3, 1, 2,
+                                       2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  return _mm256_add_epi8(
+      _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low)),
+      _mm256_shuffle_epi8(lut,
+                          _mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+}
+
+// The rows as 32-bit lanes of ymm, moved dx columns right.
+__attribute__((target("avx2"))) static inline __m256i
+gesture_rows8(const uint32_t *rows, int dx) {
+  __m256i v = _mm256_loadu_si256((const __m256i *)rows);
+  v = dx < 0 ? _mm256_srl_epi32(v, _mm_cvtsi32_si128(-dx))
+             : _mm256_sll_epi32(v, _mm_cvtsi32_si128(dx));
+  return _mm256_and_si256(v, _mm256_set1_epi32(GESTURE_LANE));
+}
+
+__attribute__((target("avx2"))) static inline int
+gesture_sum8(__m256i bytes) {
+  __m256i c = _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+  __m128i q = _mm_add_epi64(_mm256_castsi256_si128(c),
+                            _mm256_extracti128_si256(c, 1));
+  return _mm_cvtsi128_si32(_mm_add_epi64(q, _mm_unpackhi_epi64(q, q)));
+}
+
+// On x86 a row pair's word is the two rows in memory order, so a moved
+// bitset is just the padded rows loaded from a moved base and shifted
+// lane-wise. Byte counts are added up before the one widening sum, since
+// none can pass 32.
+__attribute__((target("avx2,popcnt"))) static int
+gesture_match_avx2(const float *input) {
+  uint32_t rows[GESTURE_ROWS + 2 * GESTURE_SHIFT] = {0};
+  float best[GESTURE_TEMPLATES] = {0};
+  __m256 half = _mm256_set1_ps(0.5f);
+  for (int r = 0; r < GESTURE_SIDE; r++) {
+    const float *p = input + r * GESTURE_SIDE;
+    rows[GESTURE_SHIFT + r] =
+        _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p), half,
+                                         _CMP_GT_OQ)) |
+        _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p + 8), half,
+                                         _CMP_GT_OQ))
+            << 8 |
+        _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(p + 16), half,
+                                         _CMP_GT_OQ))
+            << 16 |
+        _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(p + 24),
+                                     _mm256_castps256_ps128(half)))
+            << 24;
+  }
+
+  for (int dy = -GESTURE_SHIFT; dy <= GESTURE_SHIFT; dy++) {
+    const uint32_t *base = rows + GESTURE_SHIFT - dy;
+    for (int dx = -GESTURE_SHIFT; dx <= GESTURE_SHIFT; dx++) {
+      int n = gesture_sum8(_mm256_add_epi8(
+          _mm256_add_epi8(gesture_popcnt8(gesture_rows8(base, dx)),
+                          gesture_popcnt8(gesture_rows8(base + 8, dx))),
+          _mm256_add_epi8(gesture_popcnt8(gesture_rows8(base + 16, dx)),
+                          gesture_popcnt8(gesture_rows8(base + 24, dx)))));
+      const uint32_t *ink = base + 2 * GESTURE_INK_WORD;
+      __m256i s0 = gesture_rows8(ink, dx);
+      __m256i s1 = gesture_rows8(ink + 8, dx);
+      __m256i s2 = gesture_rows8(ink + 16, dx);
+      for (int t = 0; t < GESTURE_TEMPLATES; t++) {
+        const __m256i *w =
+            (const __m256i *)(gestureTemplates[t].bits.w + GESTURE_INK_WORD);
+        int both = gesture_sum8(_mm256_add_epi8(
+            _mm256_add_epi8(
+                gesture_popcnt8(_mm256_and_si256(s0, _mm256_loadu_si256(w))),
+                gesture_popcnt8(
+                    _mm256_and_si256(s1, _mm256_loadu_si256(w + 1)))),
+            gesture_popcnt8(_mm256_and_si256(s2, _mm256_loadu_si256(w + 2)))));
+        int either = n + gestureCounts[t] - both;
+        float iou = either > 0 ? (float)both / either : 0;
+        best[t] = iou > best[t] ? iou : best[t];
+      }
+    }
+  }
+  // The caller is built for SSE, which dirty upper halves would slow down
+  _mm256_zeroupper();
+  return gesture_pick(best);
+}
+#endif
+
+static GestureKernel gesture_kernel(void) {
+  static GestureKernel kernel = NULL;
+  if (!kernel) {
+    for (int t = 0; t < GESTURE_TEMPLATES; t++)
+      for (int i = 0; i < GESTURE_WORDS; i++)
+        gestureCounts[t] +=
+            __builtin_popcountll(gestureTemplates[t].bits.w[i]);
+    kernel = gesture_match_scalar;
+#ifdef GESTURE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+      kernel = gesture_match_avx2;
+#endif
+  }
+  return kernel;
+}
+
+// Returns the GESTURE_* a preprocessed 28x28 input is drawn as, or
+// GESTURE_NONE when it reads as nothing in the library.
+static int gesture_match(const float *input) {
+  return gesture_kernel()(input);
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef INFER_H
+#define INFER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "stroke.h"
+
+#define INFER_QUEUE_CAP 16 // slots per queue, a power of two
+#define INFER_ROWS 28 // draw pad size in cells; one MNIST digit high
+#define INFER_COLS 64
+#define INFER_MAX_DIGITS 8
+#define INFER_RETRY_US 1000 // wait before retrying a full result queue
+
+// Single-producer single-consumer ring of fixed-size items. Only the
+// consumer moves head and only the producer moves tail; the release store
+// of an index publishes the slot contents to the acquire load on the other
+// side, so neither end ever takes a lock.
+typedef struct {
+  unsigned char *items;
+  size_t itemSize;
+  _Atomic size_t head, tail;
+} SpscQueue;
+
+static int spsc_init(SpscQueue *q, size_t itemSize) {
+  q->items = malloc(INFER_QUEUE_CAP * itemSize);
+  q->itemSize = itemSize;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  return q->items != NULL;
+}
+
+static void spsc_free(SpscQueue *q) {
+  free(q->items);
+  q->items = NULL;
+}
+
+// Returns 0 when the queue is full.
+static int spsc_push(SpscQueue *q, const void *item) {
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&q->head, memory_order_acquire);
+  if (tail - head == INFER_QUEUE_CAP)
+    return 0;
+  memcpy(q->items + (tail & (INFER_QUEUE_CAP - 1)) * q->itemSize, item,
+         q->itemSize);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+// Returns 0 when the queue is empty.
+static int spsc_pop(SpscQueue *q, void *item) {
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_acquire);
+  if (head == tail)
+    return 0;
+  memcpy(item, q->items + (head & (INFER_QUEUE_CAP - 1)) * q->itemSize,
+         q->itemSize);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return 1;
+}
+
+static int spsc_empty(SpscQueue *q) {
+  return atomic_load_explicit(&q->head, memory_order_acquire) ==
+         atomic_load_explicit(&q->tail, memory_order_acquire);
+}
+
+// A snapshot of the draw pad. Tentative requests refresh the running
+// guess while a stroke is drawn; a final one asks for the number to enter.
+// seq numbers the pad's contents, so results for a cleared pad can be told
+// apart from current ones.
+typedef struct {
+  uint32_t seq;
+  int final;
+  StrokeSet strokes; // in pad cells
+} InferRequest;
+
+// The number on the pad, most significant digit first. Each digit is 0-9
+// and a single -1 means the pad could not be read. When the pad holds one
+// of gesture.h's shapes instead, gesture names it and count is 0.
+typedef struct {
+  uint32_t seq;
+  int final;
+  int gesture;
+  int count;
+  int digits[INFER_MAX_DIGITS];
+} InferResult;
+
+typedef void (*InferFn)(void *ctx, const InferRequest *req, InferResult *res);
+
+// One thread running fn over requests from the render thread and handing
+// results back for it to poll. The mutex and condition variable only put
+// the idle worker to sleep; the data itself moves through the rings.
+typedef struct {
+  SpscQueue requests, results;
+  InferFn fn;
+  void *ctx;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  atomic_int stop;
+  int running;
+} InferWorker;
+
+static void *infer_run(void *arg) {
+  InferWorker *w = arg;
+  InferRequest req, next;
+  InferResult res;
+  for (;;) {
+    pthread_mutex_lock(&w->lock);
+    while (!atomic_load(&w->stop) && spsc_empty(&w->requests))
+      pthread_cond_wait(&w->wake, &w->lock);
+    int stop = atomic_load(&w->stop);
+    pthread_mutex_unlock(&w->lock);
+    if (stop)
+      return NULL;
+    if (!spsc_pop(&w->requests, &req))
+      continue;
+    // A tentative request that already has a newer one behind it is stale
+    while (!req.final && spsc_pop(&w->requests, &next))
+      req = next;
+    w->fn(w->ctx, &req, &res);
+    // Only a final result is worth waiting for room
+    while (!spsc_push(&w->results, &res) && res.final &&
+           !atomic_load(&w->stop))
+      usleep(INFER_RETRY_US);
+  }
+}
+
+static int infer_start(InferWorker *w, InferFn fn, void *ctx) {
+  memset(w, 0, sizeof(*w));
+  w->fn = fn;
+  w->ctx = ctx;
+  if (!spsc_init(&w->requests, sizeof(InferRequest)) ||
+      !spsc_init(&w->results, sizeof(InferResult))) {
+    spsc_free(&w->requests);
+    spsc_free(&w->results);
+    return 0;
+  }
+  pthread_mutex_init(&w->lock, NULL);
+  pthread_cond_init(&w->wake, NULL);
+  w->running = pthread_create(&w->thread, NULL, infer_run, w) == 0;
+  if (!w->running) {
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->wake);
+    spsc_free(&w->requests);
+    spsc_free(&w->results);
+  }
+  return w->running;
+}
+
+// Called from the render thread. Returns 0 when the queue is full, in
+// which case a final request should be resubmitted later.
+static int infer_submit(InferWorker *w, const InferRequest *req) {
+  if (!w->running || !spsc_push(&w->requests, req))
+    return 0;
+  pthread_mutex_lock(&w->lock);
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+  return 1;
+}
+
+static int infer_poll(InferWorker *w, InferResult *res) {
+  return w->running && spsc_pop(&w->results, res);
+}
+
+static void infer_stop(InferWorker *w) {
+  if (!w->running)
+    return;
+  pthread_mutex_lock(&w->lock);
+  atomic_store(&w->stop, 1);
+  pthread_cond_signal(&w->wake);
+  pthread_mutex_unlock(&w->lock);
+  pthread_join(w->thread, NULL);
+  pthread_mutex_destroy(&w->lock);
+  pthread_cond_destroy(&w->wake);
+  spsc_free(&w->requests);
+  spsc_free(&w->results);
+  w->running = 0;
+}
+
+#endif
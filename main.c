@@ -1,5 +1,23 @@
+#include "gesture.h"
+#include "infer.h"
+#include "matrix.h"
 #include "model.h"
 #include "nanovg.h"
+#include "prime.h"
+#include "program.h"
+#include "rpn.h"
+#include "stats.h"
+#include "stroke.h"
+#include "units.h"
+#include "cplx.h"
+#include "bits.h"
+#include "frac.h"
+#include "dtoa.h"
+#include "atod.h"
+#include "sheet.h"
+#include "undo.h"
+#include "solve.h"
+#include "series.h"
 #ifdef __APPLE__
 #include <OpenGL/gl3.h>
 #else
@@ -13,15 +31,13 @@
 #include <string.h>
 #define NANOVG_GL3_IMPLEMENTATION
 #include "nanovg_gl.h"
+#include "nanovg_gl_utils.h"
 typedef struct {
   char display[32];
   double storedValue;
   char pendingOp;
   int hasPendingOp;
   int clearOnNextDigit;
-
-  double stack[4];
-  int stackSize;
 } Calculator;
 typedef struct {
   float x, y, w, h;
@@ -55,8 +71,71 @@ SDL_Color _COLOR_OP = {255, 149, 0, 255};
 SDL_Color _COLOR_CLEAR = {165, 165, 165, 255};
 SDL_Color COLOR_TEXT = {255, 255, 255, 255};
 SDL_Color COLOR_DISPLAY = {45, 45, 45, 255};
-Calculator calc = {"0", 0, 0, 0, 0, {0, 0, 0, 0}, 0};
-Button buttons[40];
+Calculator calc = {"0", 0, 0, 0, 0};
+RpnStack rpnStack = {NULL, 0, 0, 0};
+int rpnScroll = 0;
+int rpnCtlPage = 0;
+
+// Keystroke programming (RPN mode)
+ProgProgram rpnProgram;
+ProgCode rpnCode;
+int rpnCodeValid = 0;
+double progRegs[PROG_REGS];
+int isProgRecording = 0;
+int progEntryDirty = 0;
+int progPendingOp = -1;
+
+// Matrix mode: A and B are edited in the panel, X and Y receive results
+// (QR leaves Q in Y, LU leaves the permutation there).
+Matrix matRegs[4];
+int matView = 0;
+int matCursorRow = 0, matCursorCol = 0;
+int matScrollRow = 0, matScrollCol = 0;
+char matStatus[64] = "";
+
+// Stats mode: one streaming accumulator fed from the keypad or dropped files
+StatsAcc statsAcc;
+double statsPendingX = 0;
+int statsHasX = 0;
+char statsStatus[64] = "";
+
+// Unit mode: a typed "from>to" query resolved through the unit registry
+char unitQuery[48] = "";
+
+// Complex mode: the left operand of a pending operator and the display form
+Cplx cxStored;
+int cxPolar = 0;
+
+// Fraction mode keeps the exact value behind the display; calc.display only
+// holds the text it was shown as, which may be an approximation
+Frac fracStored, fracValue;
+char fracShownText[32];
+int fracMixed = 0;
+
+// Every frame's changes to the watched state become one undo step
+UndoJournal undoLog;
+
+// Worksheet mode: the active line is edited in sheetEdit and only written
+// back (and recalculated) when the cursor leaves it
+Sheet sheet;
+int sheetCursor = 0, sheetScroll = 0;
+char sheetEdit[SHEET_TEXT_MAX] = "";
+char sheetStatus[64] = "";
+
+// Programmer mode: a wrapped integer word, its operator state and format
+Word progValue = 0, progStored = 0;
+char progOp = 0;
+int progHasOp = 0, progFresh = 0;
+int progBits = 64, progSigned = 1, progBase = 10;
+const int progWordSizes[] = {8, 16, 32, 64, 128};
+
+// The bit grid is kept in an offscreen image; only cells whose bit changed
+// since the last frame are repainted into it.
+NVGLUframebuffer *bitGridFb = NULL;
+Word bitGridShown = 0;
+int bitGridBits = 0; // 0 forces a full repaint
+float bitGridRatio = 0;
+Button buttons[128];
 int numButtons = 0;
 int divZeroCount = 0;
 int isCrashMode = 0;
@@ -69,6 +148,11 @@ Uint32 equalsPressTime = 0;
 int isEqualsDown = 0;
 char inputSequence[16] = "";
 int isPrimeResult = 0;
+char primeListText[128] = "";
+char solveQuery[96] = "";
+int solveEditing = 0;
+int solveRoot = -1; // root of solveResult shown in the display
+SolveResult solveResult;
 char specialMessage[32] = "";
 int isDevMode = 0;
 Uint32 frameCount = 0;
@@ -79,6 +163,31 @@ int equalsCount = 0;
 int numberSequence[10];
 int seqIndex = 0;
 #define KONAMI_LENGTH 10
+// Lehmer's pi(x) runs on the UI thread and takes seconds at 1e13, so the
+// counts and the nth prime are bounded by where they end up, not just x
+#define PRIME_INPUT_MAX 1e13
+#define PRIME_NTH_MAX 3.4e11 // about pi(PRIME_INPUT_MAX)
+#define PRIME_NEXT_MAX 1e14  // nxtP only runs primality tests
+#define PRIME_LIST_MAX 32
+#define RPN_ROW_H 30
+#define STATE_MAGIC 0x434C4332
+#define PROG_FILE "calc_prog.dat"
+#define MATRIX_PANEL_W 400
+#define MAT_CELL_W 64
+#define MAT_CELL_H 24
+#define MAT_HEADER_H 70
+#define MAT_EDIT_DIM 3
+#define STATS_PANEL_W 220
+#define STATS_ROW_H 22
+#define MAX_FUNC_COLS 6
+#define DISPLAY_DIGITS 15 // results keep every bit, the display rounds
+#define PROG_PANEL_W 360
+#define PROG_CELL 19
+#define PROG_GRID_COLS 16
+#define PROG_GRID_Y 200
+#define SHEET_FILE "calc_sheet.dat"
+#define SHEET_ROW_H 26
+#define SHEET_TOP 50
 int konamiSequence[KONAMI_LENGTH];
 int konamiIndex = 0;
 int isRainbowMode = 0;
@@ -97,7 +206,13 @@ typedef enum {
   MODE_SCIENTIFIC,
   MODE_UNIT,
   MODE_RPN,
-  MODE_GRAPH
+  MODE_GRAPH,
+  MODE_MATRIX,
+  MODE_STATS,
+  MODE_COMPLEX,
+  MODE_PROGRAMMER,
+  MODE_FRACTION,
+  MODE_SHEET
 } CalculatorMode;
 CalculatorMode currentMode = MODE_BASIC;
 int showHistory = 0;
@@ -149,29 +264,20 @@ int lastMouseX = 0;
 int lastMouseY = 0;
 
 void calc_inputEquals(void);
+void updateLayout(int width, int height);
 void save_state(void);
 void load_state(void);
+void initUndo(void);
 int isPrime(double val) {
-  if (val != floor(val))
-    return 0;
-  long n = (long)val;
-  if (n <= 1)
-    return 0;
-  if (n <= 3)
-    return 1;
-  if (n % 2 == 0 || n % 3 == 0)
+  if (val != floor(val) || val <= 1 || val >= 18446744073709551616.0)
     return 0;
-  for (long i = 5; i * i <= n; i += 6) {
-    if (n % i == 0 || n % (i + 2) == 0)
-      return 0;
-  }
-  return 1;
+  return prime_is_prime((uint64_t)val);
 }
 double signum(double x) { return (x > 0) - (x < 0); }
 
 // Expression Parser for Graphing
 typedef struct {
-  const char *ptr;
+  const char *ptr, *end;
 } GraphParser;
 double parse_graph_expr(GraphParser *p, double xVal);
 double parse_graph_factor(GraphParser *p, double xVal) {
@@ -287,8 +393,10 @@ double parse_graph_factor(GraphParser *p, double xVal) {
     return log(parse_graph_factor(p, xVal));
   }
   if (isdigit(*p->ptr) || *p->ptr == '.') {
-    char *end;
-    double val = strtod(p->ptr, &end);
+    double val;
+    const char *end = atod_parse(p->ptr, p->end, &val);
+    if (!end)
+      return 0;
     p->ptr = end;
     return val;
   }
@@ -415,10 +523,30 @@ double evaluate_graph(const char *expr, double xVal) {
   if (!*actualExpr)
     return 0;
 
-  GraphParser p = {actualExpr};
+  GraphParser p = {actualExpr, actualExpr + strlen(actualExpr)};
   return parse_graph_comparison(&p, xVal);
 }
 
+// A point entry "(x, y)". Trailing text after y is ignored.
+int parse_graph_point(const char *s, double *px, double *py) {
+  const char *end = s + strlen(s);
+  while (isspace(*s))
+    s++;
+  if (*s++ != '(')
+    return 0;
+  while (isspace(*s))
+    s++;
+  if (!(s = atod_parse(s, end, px)))
+    return 0;
+  while (isspace(*s))
+    s++;
+  if (*s++ != ',')
+    return 0;
+  while (isspace(*s))
+    s++;
+  return atod_parse(s, end, py) != NULL;
+}
+
 void find_closest_point_on_line(float graphX, float *outY, int *outEqIdx) {
   float minDist = 1e9;
   *outY = 0;
@@ -499,6 +627,12 @@ NVGcolor hsvToRgb(float h, float s, float v) {
   return nvgRGBf((r + m), (g + m), (b + m));
 }
 
+// Results go into the display as the shortest text that reads back to the
+// same double, so reusing or recalling one never loses bits.
+void calc_setDisplay(double v) {
+  dtoa_format(v, DTOA_SHORTEST, 0, calc.display, sizeof(calc.display));
+}
+
 void calc_inputDigit(const char *digit) {
   if (strcmp(digit, ".") == 0) {
 
@@ -517,86 +651,564 @@ void calc_inputDigit(const char *digit) {
     }
     calc.clearOnNextDigit = 0;
     isPrimeResult = 0;
+    primeListText[0] = '\0';
   } else if (strlen(calc.display) < 15) {
     strcat(calc.display, digit);
     isPrimeResult = 0;
   }
+  if (isProgRecording)
+    progEntryDirty = 1;
 }
 
 void calc_inputConstant(const char *name) {
   if (strcmp(name, "PI") == 0) {
-    snprintf(calc.display, sizeof(calc.display), "%.10g", M_PI);
+    calc_setDisplay(M_PI);
   } else if (strcmp(name, "e") == 0) {
-    snprintf(calc.display, sizeof(calc.display), "%.10g", M_E);
+    calc_setDisplay(M_E);
   }
   calc.clearOnNextDigit = 1;
+  if (isProgRecording)
+    progEntryDirty = 1;
 }
 
-void calc_inputUnit(const char *type) {
-  double val = atof(calc.display);
-
-  if (strcmp(type, "cm2in") == 0)
-    val *= 0.393701;
-  else if (strcmp(type, "in2cm") == 0)
-    val *= 2.54;
-  else if (strcmp(type, "kg2lb") == 0)
-    val *= 2.20462;
-  else if (strcmp(type, "lb2kg") == 0)
-    val /= 2.20462;
-  else if (strcmp(type, "km2mi") == 0)
-    val *= 0.621371;
-  else if (strcmp(type, "mi2km") == 0)
-    val *= 1.60934;
-  else if (strcmp(type, "C2F") == 0)
-    val = val * 9.0 / 5.0 + 32.0;
-  else if (strcmp(type, "F2C") == 0)
-    val = (val - 32.0) * 5.0 / 9.0;
-
-  snprintf(calc.display, sizeof(calc.display), "%.10g", val);
-  calc.clearOnNextDigit = 1;
+// The fixed conversion keys are shortcuts into the unit registry.
+typedef struct {
+  const char *label, *from, *to;
+} UnitKey;
+
+const UnitKey unitKeys[] = {
+    {"cm2in", "cm", "in"},   {"in2cm", "in", "cm"},  {"kg2lb", "kg", "lb"},
+    {"lb2kg", "lb", "kg"},   {"km2mi", "km", "mi"},  {"mi2km", "mi", "km"},
+    {"C2F", "degC", "degF"}, {"F2C", "degF", "degC"},
+};
+#define NUM_UNIT_KEYS (int)(sizeof(unitKeys) / sizeof(unitKeys[0]))
+
+// Splits unitQuery at '>' into its two unit expressions.
+int unitQuerySides(char *from, char *to) {
+  const char *sep = strchr(unitQuery, '>');
+  if (!sep || sep == unitQuery || !sep[1])
+    return 0;
+  size_t n = sep - unitQuery;
+  memcpy(from, unitQuery, n);
+  from[n] = '\0';
+  strcpy(to, sep + 1);
+  return 1;
 }
-void calc_stackPush(double val) {
 
-  calc.stack[3] = calc.stack[2];
-  calc.stack[2] = calc.stack[1];
-  calc.stack[1] = calc.stack[0];
-  calc.stack[0] = val;
+int calc_unitConversion(const char *from, const char *to, UnitConv *conv) {
+  int r = unit_conversion(from, to, conv);
+  if (r == 0)
+    strcpy(specialMessage, "UNKNOWN UNIT");
+  else if (r < 0)
+    strcpy(specialMessage, "INCOMPATIBLE");
+  return r == 1;
+}
+
+void calc_convertDisplay(const char *from, const char *to) {
+  UnitConv conv;
+  if (!calc_unitConversion(from, to, &conv))
+    return;
+  double val = unit_apply(conv, atod(calc.display));
+  calc_setDisplay(val);
+  calc.clearOnNextDigit = 1;
 }
 
-double calc_stackPop() {
-  double val = calc.stack[0];
+// Unit mode keys. Returns 1 when the label was one of them.
+int calc_inputUnit(const char *label) {
+  char from[sizeof(unitQuery)], to[sizeof(unitQuery)];
 
-  calc.stack[0] = calc.stack[1];
-  calc.stack[1] = calc.stack[2];
-  calc.stack[2] = calc.stack[3];
+  for (int i = 0; i < NUM_UNIT_KEYS; i++) {
+    if (strcmp(label, unitKeys[i].label) == 0) {
+      calc_convertDisplay(unitKeys[i].from, unitKeys[i].to);
+      return 1;
+    }
+  }
 
-  calc.stack[3] = 0;
-  return val;
+  if (strcmp(label, "CLRU") == 0) {
+    unitQuery[0] = '\0';
+    return 1;
+  }
+  if (strcmp(label, "CONV") != 0 && strcmp(label, "FLIP") != 0 &&
+      strcmp(label, "STK") != 0)
+    return 0;
+  if (!unitQuerySides(from, to)) {
+    strcpy(specialMessage, "FROM>TO");
+    return 1;
+  }
+
+  if (strcmp(label, "CONV") == 0) {
+    calc_convertDisplay(from, to);
+  } else if (strcmp(label, "FLIP") == 0) {
+    size_t fl = strlen(from), tl = strlen(to);
+    memcpy(unitQuery, to, tl);
+    unitQuery[tl] = '>';
+    memcpy(unitQuery + tl + 1, from, fl + 1);
+  } else {
+    // Converts every RPN stack level in one pass
+    UnitConv conv;
+    if (calc_unitConversion(from, to, &conv)) {
+      unit_convert_batch(conv, rpnStack.data, rpnStack.depth);
+      rpn_touch(&rpnStack, 0);
+    }
+  }
+  return 1;
+}
+
+// Unit mode types its query from the keyboard: letters (shift for upper
+// case), space for the '>' separator and * / ^ between units. Digits and a
+// minus only join the query inside a power. Returns 1 when the key was used.
+int unitQueryKey(SDL_Keycode key) {
+  size_t len = strlen(unitQuery);
+  char last = len ? unitQuery[len - 1] : '\0';
+  size_t p = len;
+  while (p > 0 && (isdigit((unsigned char)unitQuery[p - 1]) ||
+                   unitQuery[p - 1] == '-'))
+    p--;
+  int inPower = p > 0 && unitQuery[p - 1] == '^';
+  char c = '\0';
+
+  if (key >= SDLK_a && key <= SDLK_z)
+    c = (char)((SDL_GetModState() & KMOD_SHIFT) ? 'A' + (key - SDLK_a) : key);
+  else if (key == SDLK_SPACE && len && !strchr(unitQuery, '>'))
+    c = '>';
+  else if (len && last != '>' && last != '^' && last != '*' && last != '/' &&
+           (key == SDLK_ASTERISK || key == SDLK_KP_MULTIPLY))
+    c = '*';
+  else if (len && last != '>' && last != '^' && last != '*' && last != '/' &&
+           (key == SDLK_SLASH || key == SDLK_KP_DIVIDE))
+    c = '/';
+  else if (len && last != '>' && last != '^' && !inPower && key == SDLK_CARET)
+    c = '^';
+  else if (inPower && key >= SDLK_0 && key <= SDLK_9)
+    c = (char)key;
+  else if (last == '^' && (key == SDLK_MINUS || key == SDLK_KP_MINUS))
+    c = '-';
+  else if (key == SDLK_BACKSPACE && len) {
+    unitQuery[len - 1] = '\0';
+    return 1;
+  } else if (key == SDLK_DELETE) {
+    unitQuery[0] = '\0';
+    return 1;
+  } else if ((key == SDLK_RETURN || key == SDLK_KP_ENTER) &&
+             strchr(unitQuery, '>')) {
+    calc_inputUnit("CONV");
+    return 1;
+  }
+
+  if (!c)
+    return 0;
+  if (len + 1 < sizeof(unitQuery)) {
+    unitQuery[len] = c;
+    unitQuery[len + 1] = '\0';
+  }
+  return 1;
 }
+void calc_stackPush(double val) { rpn_push(&rpnStack, val); }
+
+double calc_stackPop() { return rpn_pop(&rpnStack); }
 
+// Stack-count ops (PICK, ROLL, DUPN, DRPN) take n from the display.
 void calc_inputRPN(const char *op) {
+  size_t n = rpn_count(&rpnStack, atod(calc.display));
+
   if (strcmp(op, "ENT") == 0) {
-    calc_stackPush(atof(calc.display));
+    calc_stackPush(atod(calc.display));
     calc.clearOnNextDigit = 1;
+    return;
   } else if (strcmp(op, "SWP") == 0) {
-    double tmp = calc.stack[0];
-    calc.stack[0] = calc.stack[1];
-    calc.stack[1] = tmp;
-
-    snprintf(calc.display, sizeof(calc.display), "%.10g", calc.stack[0]);
+    rpn_swap(&rpnStack);
   } else if (strcmp(op, "DRP") == 0) {
     calc_stackPop();
-    snprintf(calc.display, sizeof(calc.display), "%.10g", calc.stack[0]);
+  } else if (strcmp(op, "PICK") == 0) {
+    rpn_pick(&rpnStack, n);
+  } else if (strcmp(op, "ROLL") == 0) {
+    rpn_roll(&rpnStack, n);
+  } else if (strcmp(op, "DUPN") == 0) {
+    rpn_dupn(&rpnStack, n);
+  } else if (strcmp(op, "DRPN") == 0) {
+    rpn_dropn(&rpnStack, n);
+  } else if (strcmp(op, "ΣSTK") == 0 || strcmp(op, "MEAN") == 0 ||
+             strcmp(op, "PROD") == 0) {
+    // Reductions leave the stack alone; ENT pushes the result
+    double res = (op[0] == 'M')   ? rpn_mean(&rpnStack)
+                 : (op[0] == 'P') ? rpn_product(&rpnStack)
+                                  : rpn_sum(&rpnStack);
+    calc_setDisplay(res);
+    calc.clearOnNextDigit = 1;
+    return;
   } else if (strcmp(op, "CLR") == 0) {
-
-    for (int i = 0; i < 4; i++)
-      calc.stack[i] = 0;
+    rpn_clear(&rpnStack);
+    rpnScroll = 0;
     snprintf(calc.display, sizeof(calc.display), "0");
+    return;
+  }
+
+  calc_setDisplay(rpn_peek(&rpnStack, 1));
+  calc.clearOnNextDigit = 1;
+}
+
+void calc_runProgram(void) {
+  if (!rpnCodeValid) {
+    snprintf(specialMessage, sizeof(specialMessage), "NO PROGRAM");
+    return;
   }
+  double x = atod(calc.display);
+  if (!prog_run(&rpnCode, &rpnStack, &x, progRegs))
+    snprintf(specialMessage, sizeof(specialMessage), "RUNAWAY LOOP");
+  calc_setDisplay(x);
+  calc.clearOnNextDigit = 1;
+}
+
+// Programming keys in RPN mode. While recording, every programmable key is
+// stored instead of executed; digits still build the literal on the display.
+// Returns 1 when the key was consumed.
+int calc_inputProgram(const char *label) {
+  if (strcmp(label, "PRGM") == 0) {
+    if (!isProgRecording) {
+      rpnProgram.numSteps = 0;
+      progEntryDirty = 0;
+      progPendingOp = -1;
+      isProgRecording = 1;
+    } else {
+      if (progEntryDirty)
+        prog_append(&rpnProgram, PROG_LOADX, 0, atod(calc.display));
+      isProgRecording = 0;
+      progEntryDirty = 0;
+      progPendingOp = -1;
+      rpnCodeValid = prog_compile(&rpnProgram, &rpnCode);
+      if (!rpnCodeValid)
+        snprintf(specialMessage, sizeof(specialMessage), "NO LABEL");
+      prog_save(PROG_FILE, &rpnProgram, progRegs);
+    }
+    return 1;
+  }
+  if (strcmp(label, "RUN") == 0) {
+    if (!isProgRecording)
+      calc_runProgram();
+    return 1;
+  }
+  if (strcmp(label, "CTL") == 0) {
+    rpnCtlPage = !rpnCtlPage;
+    updateLayout(winWidth, winHeight);
+    return 1;
+  }
+
+  // STO, RCL, LBL, GTO and DSZ take the next digit key as their index
+  if (progPendingOp >= 0) {
+    if (!isdigit((unsigned char)label[0]) || label[1] != '\0')
+      return 1;
+    int idx = label[0] - '0';
+    if (isProgRecording) {
+      prog_append(&rpnProgram, progPendingOp, idx, 0);
+      calc.clearOnNextDigit = 1;
+    } else if (progPendingOp == PROG_STO) {
+      progRegs[idx] = atod(calc.display);
+    } else if (progPendingOp == PROG_RCL) {
+      calc_setDisplay(progRegs[idx]);
+      calc.clearOnNextDigit = 1;
+    }
+    progPendingOp = -1;
+    return 1;
+  }
+
+  int op = prog_op_for_key(label);
+  if (op < 0)
+    return 0;
+  if (!isProgRecording) {
+    // Only STO/RCL act live; the other control keys (ordered after them in
+    // WordOp) are swallowed
+    if (op == PROG_STO || op == PROG_RCL)
+      progPendingOp = op;
+    return op >= PROG_STO;
+  }
+
+  if (progEntryDirty) {
+    prog_append(&rpnProgram, PROG_LOADX, 0, atod(calc.display));
+    progEntryDirty = 0;
+  }
+  if (prog_takes_index(op)) {
+    progPendingOp = op;
+  } else {
+    prog_append(&rpnProgram, op, 0, 0);
+    calc.clearOnNextDigit = 1;
+  }
+  return 1;
+}
+
+const char MAT_REG_NAMES[] = "ABXY";
+
+int matVisibleRows(int h) {
+  int rows = (h - MAT_HEADER_H - 10) / MAT_CELL_H;
+  return rows < 1 ? 1 : rows;
+}
+
+int matVisibleCols(void) { return (MATRIX_PANEL_W - 50) / MAT_CELL_W; }
+
+void clampMatScroll(int h) {
+  const Matrix *m = &matRegs[matView];
+  int maxRow = m->rows - matVisibleRows(h);
+  int maxCol = m->cols - matVisibleCols();
+  if (matScrollRow > maxRow)
+    matScrollRow = maxRow;
+  if (matScrollRow < 0)
+    matScrollRow = 0;
+  if (matScrollCol > maxCol)
+    matScrollCol = maxCol;
+  if (matScrollCol < 0)
+    matScrollCol = 0;
+}
+
+// Moves the cell cursor, clamped to the viewed matrix, and scrolls it into
+// view.
+void matMoveCursor(int row, int col) {
+  const Matrix *m = &matRegs[matView];
+  if (m->rows == 0)
+    return;
+  row = row < 0 ? 0 : row >= m->rows ? m->rows - 1 : row;
+  col = col < 0 ? 0 : col >= m->cols ? m->cols - 1 : col;
+  matCursorRow = row;
+  matCursorCol = col;
+  int vr = matVisibleRows(winHeight), vc = matVisibleCols();
+  if (row < matScrollRow)
+    matScrollRow = row;
+  else if (row >= matScrollRow + vr)
+    matScrollRow = row - vr + 1;
+  if (col < matScrollCol)
+    matScrollCol = col;
+  else if (col >= matScrollCol + vc)
+    matScrollCol = col - vc + 1;
+}
+
+void matSetView(int view) {
+  matView = view;
+  matCursorRow = matCursorCol = 0;
+  matScrollRow = matScrollCol = 0;
+}
+
+// P with P A = L U, rebuilt from the row swaps recorded by matrix_lu.
+int matPermutation(const int *piv, int n, Matrix *out) {
+  int *order = malloc(n * sizeof(int));
+  Matrix p = {0, 0, NULL};
+  if (!order || !matrix_create(&p, n, n)) {
+    free(order);
+    return 0;
+  }
+  for (int i = 0; i < n; i++)
+    order[i] = i;
+  for (int j = 0; j < n; j++) {
+    int t = order[j];
+    order[j] = order[piv[j]];
+    order[piv[j]] = t;
+  }
+  for (int i = 0; i < n; i++)
+    p.data[(size_t)i * n + order[i]] = 1.0;
+  free(order);
+  matrix_free(out);
+  *out = p;
+  return 1;
+}
+
+// Matrix mode keys. Digits build a cell value on the display and ENT stores
+// it at the cursor; + - * / combine A and B, the function keys act on A.
+// Results land in X (and Y) and the panel switches to show them.
+// Returns 1 when the key was consumed.
+int calc_inputMatrix(const char *label) {
+  Matrix *a = &matRegs[0], *b = &matRegs[1];
+  Matrix *x = &matRegs[2], *y = &matRegs[3];
+  Matrix *cur = &matRegs[matView];
+  int editable = matView < 2;
+
+  if (strcmp(label, "=") == 0 || strcmp(label, "ENT") == 0) {
+    if (!editable) {
+      snprintf(specialMessage, sizeof(specialMessage), "READ ONLY");
+      return 1;
+    }
+    cur->data[(size_t)matCursorRow * cur->cols + matCursorCol] =
+        atod(calc.display);
+    int row = matCursorRow, col = matCursorCol + 1;
+    if (col >= cur->cols) {
+      col = 0;
+      row = (row + 1) % cur->rows;
+    }
+    matMoveCursor(row, col);
+    calc.clearOnNextDigit = 1;
+    return 1;
+  }
+  if (strcmp(label, "VIEW") == 0) {
+    matSetView((matView + 1) % 4);
+    return 1;
+  }
+  if (strcmp(label, "ROWS") == 0 || strcmp(label, "COLS") == 0 ||
+      strcmp(label, "IDN") == 0 || strcmp(label, "RAND") == 0 ||
+      strcmp(label, "ZERO") == 0) {
+    if (!editable) {
+      snprintf(specialMessage, sizeof(specialMessage), "READ ONLY");
+      return 1;
+    }
+    if (strcmp(label, "ROWS") == 0 || strcmp(label, "COLS") == 0) {
+      int n = (int)fabs(atod(calc.display));
+      n = n < 1 ? 1 : n > MAT_MAX_DIM ? MAT_MAX_DIM : n;
+      int rows = label[0] == 'R' ? n : cur->rows;
+      int cols = label[0] == 'C' ? n : cur->cols;
+      if (!matrix_resize(cur, rows, cols))
+        snprintf(specialMessage, sizeof(specialMessage), "NO MEMORY");
+      matMoveCursor(matCursorRow, matCursorCol);
+      calc.clearOnNextDigit = 1;
+    } else if (label[0] == 'I') {
+      matrix_identity(cur);
+    } else if (label[0] == 'R') {
+      matrix_random(cur);
+    } else {
+      memset(cur->data, 0, (size_t)cur->rows * cur->cols * sizeof(double));
+    }
+    return 1;
+  }
+
+  int square = a->rows == a->cols;
+  int dimOk = 1, ok = 0;
+  const char *desc = NULL;
+  if (label[1] == '\0' && (label[0] == '+' || label[0] == '-'))
+    dimOk = a->rows == b->rows && a->cols == b->cols;
+  else if (strcmp(label, "*") == 0)
+    dimOk = a->cols == b->rows;
+  else if (strcmp(label, "/") == 0)
+    dimOk = square && b->rows == a->rows;
+  else if (strcmp(label, "INV") == 0 || strcmp(label, "det") == 0 ||
+           strcmp(label, "LU") == 0)
+    dimOk = square;
+  else if (strcmp(label, "TRN") != 0 && strcmp(label, "QR") != 0 &&
+           strcmp(label, "X2A") != 0)
+    return 0;
+  if (!dimOk) {
+    snprintf(specialMessage, sizeof(specialMessage), "DIM ERROR");
+    return 1;
+  }
+
+  Uint64 start = SDL_GetPerformanceCounter();
+  if (strcmp(label, "+") == 0) {
+    ok = matrix_add(a, b, 1.0, x);
+    desc = "X = A+B";
+  } else if (strcmp(label, "-") == 0) {
+    ok = matrix_add(a, b, -1.0, x);
+    desc = "X = A-B";
+  } else if (strcmp(label, "*") == 0) {
+    ok = matrix_multiply(a, b, x);
+    desc = "X = AB";
+  } else if (strcmp(label, "/") == 0) {
+    ok = matrix_solve(a, b, x);
+    desc = "AX = B";
+  } else if (strcmp(label, "TRN") == 0) {
+    ok = matrix_transpose(a, x);
+    desc = "X = A^T";
+  } else if (strcmp(label, "INV") == 0) {
+    ok = matrix_inverse(a, x);
+    desc = "X = A^-1";
+  } else if (strcmp(label, "det") == 0) {
+    calc_setDisplay(matrix_det(a));
+    calc.clearOnNextDigit = 1;
+    ok = 1;
+    desc = "det A";
+  } else if (strcmp(label, "LU") == 0) {
+    int *piv = malloc(a->rows * sizeof(int));
+    int sign;
+    if (piv && matrix_copy(x, a)) {
+      ok = matrix_lu(x, piv, &sign);
+      matPermutation(piv, a->rows, y);
+    }
+    free(piv);
+    desc = "PA = LU  X = L\\U  Y = P";
+  } else if (strcmp(label, "QR") == 0) {
+    ok = matrix_qr(a, y, x);
+    desc = "A = QR  X = R  Y = Q";
+  } else if (strcmp(label, "X2A") == 0) {
+    if (x->rows == 0) {
+      snprintf(specialMessage, sizeof(specialMessage), "NO RESULT");
+      return 1;
+    }
+    ok = matrix_copy(a, x);
+    desc = "A = X";
+  }
+  double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+              SDL_GetPerformanceFrequency();
+
+  if (!ok)
+    snprintf(specialMessage, sizeof(specialMessage), "SINGULAR");
+  snprintf(matStatus, sizeof(matStatus), "%s  %.1f ms", desc, ms);
+  if (strcmp(label, "X2A") == 0)
+    matSetView(0);
+  else if (strcmp(label, "det") != 0)
+    matSetView(2);
+  return 1;
+}
+
+// Stats mode keys. Σ+ adds the display as a sample; after x,y it adds the
+// pair (x, display), whose x also feeds the summary. The other keys copy one
+// summary value to the display. Returns 1 when the key was consumed.
+int calc_inputStats(const char *label) {
+  double v = atod(calc.display);
+  double res;
+
+  if (strcmp(label, "Σ+") == 0) {
+    stats_add(&statsAcc, statsHasX ? statsPendingX : v);
+    if (statsHasX)
+      stats_add_pair(&statsAcc, statsPendingX, v);
+    statsHasX = 0;
+    snprintf(calc.display, sizeof(calc.display), "%llu",
+             (unsigned long long)statsAcc.n);
+    calc.clearOnNextDigit = 1;
+    return 1;
+  } else if (strcmp(label, "x,y") == 0) {
+    statsPendingX = v;
+    statsHasX = 1;
+    calc.clearOnNextDigit = 1;
+    return 1;
+  } else if (strcmp(label, "CLRΣ") == 0) {
+    stats_init(&statsAcc);
+    statsHasX = 0;
+    statsStatus[0] = '\0';
+    return 1;
+  } else if (strcmp(label, "mean") == 0) {
+    res = statsAcc.n ? statsAcc.mean : NAN;
+  } else if (strcmp(label, "sdev") == 0) {
+    res = stats_stddev(&statsAcc);
+  } else if (strcmp(label, "med") == 0) {
+    res = stats_quantile(&statsAcc, 0.5);
+  } else if (strcmp(label, "min") == 0) {
+    res = statsAcc.n ? statsAcc.min : NAN;
+  } else if (strcmp(label, "max") == 0) {
+    res = statsAcc.n ? statsAcc.max : NAN;
+  } else if (strcmp(label, "Σx") == 0) {
+    res = stats_sum(&statsAcc);
+  } else if (strcmp(label, "slope") == 0) {
+    res = stats_slope(&statsAcc);
+  } else if (strcmp(label, "icpt") == 0) {
+    res = stats_intercept(&statsAcc);
+  } else if (strcmp(label, "corr") == 0) {
+    res = stats_correlation(&statsAcc);
+  } else {
+    return 0;
+  }
+
+  calc_setDisplay(res);
+  calc.clearOnNextDigit = 1;
+  return 1;
+}
+
+// Streams a dropped data file into the running statistics.
+void calc_loadStatsFile(const char *path) {
+  Uint64 start = SDL_GetPerformanceCounter();
+  long long n = stats_load_file(path, &statsAcc);
+  double secs = (double)(SDL_GetPerformanceCounter() - start) /
+                SDL_GetPerformanceFrequency();
+  if (n < 0) {
+    snprintf(specialMessage, sizeof(specialMessage), "CAN'T READ FILE");
+    return;
+  }
+  snprintf(statsStatus, sizeof(statsStatus), "+%lld values  %.2f s", n, secs);
 }
 
 void calc_inputUnary(const char *func) {
-  double current = atof(calc.display);
+  double current = atod(calc.display);
   double result = current;
 
   if (strcmp(func, "sin") == 0)
@@ -614,13 +1226,546 @@ void calc_inputUnary(const char *func) {
   else if (strcmp(func, "sqr") == 0)
     result = current * current;
 
-  snprintf(calc.display, sizeof(calc.display), "%.10g", result);
+  calc_setDisplay(result);
   calc.clearOnNextDigit = 1;
 }
+// Number theory keys: pi(x), nth prime and next prime after x.
+void calc_inputPrime(const char *func) {
+  double current = atod(calc.display);
+  double result = NAN;
+
+  if (current >= 0 && current <= PRIME_NEXT_MAX) {
+    uint64_t n = (uint64_t)current;
+    if (strcmp(func, "π(x)") == 0 && current <= PRIME_INPUT_MAX) {
+      result = (double)prime_count(n);
+    } else if (strcmp(func, "nthP") == 0 && current <= PRIME_NTH_MAX) {
+      result = (double)prime_nth(n);
+    } else if (strcmp(func, "nxtP") == 0 && current <= PRIME_NEXT_MAX) {
+      uint64_t p = n + 1;
+      while (!prime_is_prime(p))
+        p++;
+      result = (double)p;
+    }
+  }
+
+  calc_setDisplay(result);
+  calc.clearOnNextDigit = 1;
+  isPrimeResult = isPrime(result);
+}
+
+void formatPrimeList(double lo, double hi) {
+  uint64_t found[PRIME_LIST_MAX];
+  size_t n = prime_list((uint64_t)lo, (uint64_t)hi, found, PRIME_LIST_MAX);
+  int len = 0;
+  primeListText[0] = '\0';
+  for (size_t i = 0; i < n && len < (int)sizeof(primeListText) - 24; i++) {
+    len += snprintf(primeListText + len, sizeof(primeListText) - len, "%s%llu",
+                    i ? " " : "", (unsigned long long)found[i]);
+  }
+  if (n == PRIME_LIST_MAX || len >= (int)sizeof(primeListText) - 24)
+    snprintf(primeListText + len, sizeof(primeListText) - len, " ...");
+}
+
+// Fills the line under the display with the roots, complex ones included,
+// as many as fit.
+void formatSolveList(double ms) {
+  int len = snprintf(primeListText, sizeof(primeListText), "%d root%s, %.1f ms:",
+                     solveResult.count, solveResult.count == 1 ? "" : "s", ms);
+  int i = 0;
+  for (; i < solveResult.count && len < (int)sizeof(primeListText) - 28; i++) {
+    char z[40];
+    cplx_format(solveResult.roots[i], 0, 6, z, sizeof(z));
+    len += snprintf(primeListText + len, sizeof(primeListText) - len, " %s", z);
+  }
+  if (i < solveResult.count)
+    snprintf(primeListText + len, sizeof(primeListText) - len, " ...");
+}
+
+// Shows the next real root after solveRoot in the display.
+int solveShowNextRoot(void) {
+  for (int k = 1; k <= solveResult.count; k++) {
+    int i = (solveRoot + k) % solveResult.count;
+    if (solveResult.roots[i].im == 0) {
+      solveRoot = i;
+      calc_setDisplay(solveResult.roots[i].re);
+      calc.clearOnNextDigit = 1;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// A sum( or prod( line: the value goes to the display, how it was reached
+// to the line under it.
+void seriesRun(void) {
+  SeriesResult r;
+  Uint64 start = SDL_GetPerformanceCounter();
+  int ok = series_eval(solveQuery, &r);
+  double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+              SDL_GetPerformanceFrequency();
+  solveResult.count = 0;
+  if (!ok) {
+    snprintf(primeListText, sizeof(primeListText), "%s", r.err);
+    return;
+  }
+  solveEditing = 0;
+  calc_setDisplay(r.value);
+  calc.clearOnNextDigit = 1;
+  if (r.error > 0)
+    snprintf(primeListText, sizeof(primeListText),
+             "%s limit from %.0f terms, error ~%.2g, %.1f ms", r.method,
+             r.terms, r.error, ms);
+  else
+    snprintf(primeListText, sizeof(primeListText), "%.0f terms, %s, %.1f ms",
+             r.terms, r.method, ms);
+}
+
+void solveRun(void) {
+  if (series_is(solveQuery)) {
+    seriesRun();
+    return;
+  }
+  Uint64 start = SDL_GetPerformanceCounter();
+  int ok = solve_equation(solveQuery, &solveResult);
+  double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+              SDL_GetPerformanceFrequency();
+  solveRoot = -1;
+  if (!ok) {
+    snprintf(primeListText, sizeof(primeListText), "%s", solveResult.err);
+    return;
+  }
+  solveEditing = 0;
+  formatSolveList(ms);
+  if (!solveShowNextRoot())
+    strcpy(calc.display, "no real root");
+  calc.clearOnNextDigit = 1;
+}
+
+void solveTypeText(const char *text) {
+  size_t len = strlen(solveQuery);
+  for (; *text && len + 1 < sizeof(solveQuery); text++)
+    if (*text >= 32 && *text <= 126)
+      solveQuery[len++] = *text;
+  solveQuery[len] = '\0';
+}
+
+// "solve" opens the equation line, or solves what is typed in it; "root"
+// steps the display through the real roots of the last solve. Σ and Π
+// open it with a sum( or prod( started.
+void calc_inputSolve(const char *label) {
+  if (strcmp(label, "root") == 0) {
+    if (solveResult.count)
+      solveShowNextRoot();
+  } else if (strcmp(label, "Σ") == 0 || strcmp(label, "Π") == 0) {
+    if (!solveEditing)
+      solveQuery[0] = '\0';
+    solveEditing = 1;
+    solveTypeText(strcmp(label, "Σ") == 0 ? "sum(" : "prod(");
+  } else if (solveEditing && solveQuery[0]) {
+    solveRun();
+  } else {
+    solveEditing = 1;
+  }
+}
+
+// While the equation line is open every key belongs to it; the characters
+// themselves arrive as text input.
+int solveKey(SDL_Keycode key) {
+  size_t len = strlen(solveQuery);
+  if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+    if (len)
+      solveRun();
+  } else if (key == SDLK_BACKSPACE && len > 0) {
+    solveQuery[len - 1] = '\0';
+  } else if (key == SDLK_DELETE) {
+    solveQuery[0] = '\0';
+  } else if (key == SDLK_ESCAPE) {
+    solveEditing = 0;
+  }
+  return 1;
+}
+
+void calc_showComplex(Cplx z) {
+  cplx_format(z, cxPolar, 10, calc.display, sizeof(calc.display));
+  calc.clearOnNextDigit = 1;
+}
+
+// Complex mode keys. Returns 1 when the label was one of them.
+int calc_inputComplex(const char *label) {
+  Cplx z = cplx_parse(calc.display);
+
+  if (strcmp(label, "i") == 0) {
+    // On a fresh entry i is the unit itself, otherwise it scales the entry
+    if (strcmp(calc.display, "0") == 0)
+      z = cplx(0, 1);
+    else
+      z = cplx_mul(z, cplx(0, 1));
+  } else if (strcmp(label, "conj") == 0) {
+    z = cplx_conj(z);
+  } else if (strcmp(label, "R/P") == 0) {
+    cxPolar = !cxPolar;
+  } else if (strcmp(label, "|z|") == 0) {
+    z = cplx(cplx_abs(z), 0);
+  } else if (strcmp(label, "arg") == 0) {
+    z = cplx(cplx_arg(z), 0);
+  } else if (strcmp(label, "sin") == 0) {
+    z = cplx_sin(z);
+  } else if (strcmp(label, "cos") == 0) {
+    z = cplx_cos(z);
+  } else if (strcmp(label, "tan") == 0) {
+    z = cplx_tan(z);
+  } else if (strcmp(label, "ln") == 0) {
+    z = cplx_log(z);
+  } else if (strcmp(label, "log") == 0) {
+    z = cplx_log10(z);
+  } else if (strcmp(label, "sqrt") == 0) {
+    z = cplx_sqrt(z);
+  } else {
+    return 0;
+  }
+  calc_showComplex(z);
+  return 1;
+}
+
+void calc_complexEquals(void) {
+  Cplx b = cplx_parse(calc.display), r = cplx(0, 0);
+
+  switch (calc.pendingOp) {
+  case '+':
+    r = cplx_add(cxStored, b);
+    break;
+  case '-':
+    r = cplx_sub(cxStored, b);
+    break;
+  case '*':
+    r = cplx_mul(cxStored, b);
+    break;
+  case '/':
+    if (b.re == 0 && b.im == 0)
+      strcpy(specialMessage, "DIV BY 0");
+    else
+      r = cplx_div(cxStored, b);
+    break;
+  case '^':
+    r = cplx_pow(cxStored, b);
+    break;
+  }
+  calc.hasPendingOp = 0;
+  calc_showComplex(r);
+}
+
+// The exact value of the display: the last result while it is still shown,
+// otherwise whatever has been typed.
+int calc_fracOperand(Frac *out) {
+  if (calc.clearOnNextDigit && strcmp(calc.display, fracShownText) == 0) {
+    *out = fracValue;
+    return 1;
+  }
+  return frac_parse(calc.display, out);
+}
+
+// Returns 1 when calc.display holds the exact text rather than a decimal
+// approximation.
+int calc_showFrac(const Frac *f) {
+  char text[FRAC_TEXT_MAX];
+  int exact;
+
+  fracValue = *f;
+  frac_format(f, fracMixed, text, sizeof(text));
+  exact = strlen(text) < sizeof(calc.display);
+  if (exact)
+    strcpy(calc.display, text);
+  else
+    dtoa_format(frac_to_double(f), 10, 0, calc.display, sizeof(calc.display));
+  strcpy(fracShownText, calc.display);
+  calc.clearOnNextDigit = 1;
+  return exact;
+}
+
+// Fraction mode keys. Returns 1 when the label was one of them.
+int calc_inputFraction(const char *label) {
+  Frac z;
+
+  if (strcmp(label, "ab/c") != 0 && strcmp(label, "1/x") != 0 &&
+      strcmp(label, "NEG") != 0)
+    return 0;
+  if (!calc_fracOperand(&z)) {
+    strcpy(specialMessage, "ERROR");
+    return 1;
+  }
+  if (strcmp(label, "ab/c") == 0) {
+    fracMixed = !fracMixed;
+  } else if (strcmp(label, "1/x") == 0) {
+    if (frac_is_zero(&z)) {
+      strcpy(specialMessage, "DIV BY 0");
+      return 1;
+    }
+    frac_recip(&z, &z);
+  } else {
+    z.neg = !z.neg && !frac_is_zero(&z);
+  }
+  calc_showFrac(&z);
+  return 1;
+}
+
+typedef struct {
+  const char *label;
+  char op;
+} WordOp;
+
+const WordOp wordOps[] = {
+    {"+", '+'},   {"-", '-'},   {"*", '*'},   {"/", '/'},
+    {"MOD", '%'}, {"AND", '&'}, {"OR", '|'},  {"XOR", '^'},
+    {"SHL", '<'}, {"SHR", '>'}, {"ROL", 'l'}, {"ROR", 'r'},
+};
+#define NUM_WORD_OPS (int)(sizeof(wordOps) / sizeof(wordOps[0]))
+
+// Returns 0 on division by zero.
+int prog_apply(char op, Word a, Word b, Word *out) {
+  unsigned n = b > 255 ? 255 : (unsigned)b; // shift and rotate counts
+
+  switch (op) {
+  case '+':
+    *out = word_wrap(a + b, progBits);
+    break;
+  case '-':
+    *out = word_wrap(a - b, progBits);
+    break;
+  case '*':
+    *out = word_wrap(a * b, progBits);
+    break;
+  case '/':
+  case '%':
+    return word_div(a, b, progBits, progSigned, op == '%', out);
+  case '&':
+    *out = a & b;
+    break;
+  case '|':
+    *out = a | b;
+    break;
+  case '^':
+    *out = a ^ b;
+    break;
+  case '<':
+    *out = word_shl(a, n, progBits);
+    break;
+  case '>':
+    *out = word_shr(a, n, progBits, progSigned);
+    break;
+  case 'l':
+    *out = word_rol(a, n, progBits);
+    break;
+  case 'r':
+    *out = word_ror(a, n, progBits);
+    break;
+  }
+  return 1;
+}
+
+void prog_equals(void) {
+  Word r;
+  if (!progHasOp)
+    return;
+  if (prog_apply(progOp, progStored, progValue, &r))
+    progValue = r;
+  else
+    strcpy(specialMessage, "DIV BY 0");
+  progHasOp = 0;
+  progFresh = 1;
+}
+
+// Drops the last digit, keeping the sign of a signed decimal entry.
+void prog_backspace(void) {
+  int neg = progBase == 10 && word_is_negative(progValue, progBits, progSigned);
+  Word mag = neg ? word_wrap((Word)0 - progValue, progBits) : progValue;
+  mag /= (Word)progBase;
+  progValue = neg ? word_wrap((Word)0 - mag, progBits) : mag;
+}
+
+// Programmer mode keys. Returns 1 when the label was one of them.
+int calc_inputProgrammer(const char *label) {
+  int digit = -1;
+
+  if (label[0] >= '0' && label[0] <= '9' && !label[1])
+    digit = label[0] - '0';
+  else if (label[0] >= 'A' && label[0] <= 'F' && !label[1])
+    digit = label[0] - 'A' + 10;
+  if (digit >= 0) {
+    if (digit >= progBase)
+      return 1;
+    if (progFresh) {
+      progValue = 0;
+      progFresh = 0;
+    }
+    word_push_digit(&progValue, digit, progBase, progBits, progSigned);
+    return 1;
+  }
+
+  for (int i = 0; i < NUM_WORD_OPS; i++) {
+    if (strcmp(label, wordOps[i].label) == 0) {
+      if (progHasOp && !progFresh)
+        prog_equals();
+      progStored = progValue;
+      progOp = wordOps[i].op;
+      progHasOp = 1;
+      progFresh = 1;
+      return 1;
+    }
+  }
+
+  if (strcmp(label, "=") == 0 || strcmp(label, "ENT") == 0) {
+    prog_equals();
+    return 1;
+  } else if (strcmp(label, "NOT") == 0) {
+    progValue = word_wrap(~progValue, progBits);
+  } else if (strcmp(label, "NEG") == 0) {
+    progValue = word_wrap((Word)0 - progValue, progBits);
+  } else if (strcmp(label, "POP") == 0) {
+    progValue = (Word)word_popcount(progValue);
+  } else if (strcmp(label, "CLZ") == 0) {
+    progValue = (Word)word_clz(progValue, progBits);
+  } else if (strcmp(label, "CTZ") == 0) {
+    progValue = (Word)word_ctz(progValue, progBits);
+  } else if (strcmp(label, "BSWP") == 0) {
+    progValue = word_bswap(progValue, progBits);
+  } else if (strcmp(label, "BASE") == 0) {
+    progBase = progBase == 10 ? 16 : progBase == 16 ? 8 : progBase == 8 ? 2 : 10;
+    return 1;
+  } else if (strcmp(label, "WORD") == 0) {
+    int n = sizeof(progWordSizes) / sizeof(progWordSizes[0]), i = 0;
+    while (i < n && progWordSizes[i] != progBits)
+      i++;
+    progBits = progWordSizes[(i + 1) % n];
+    progValue = word_wrap(progValue, progBits);
+    progStored = word_wrap(progStored, progBits);
+    return 1;
+  } else if (strcmp(label, "SGN") == 0) {
+    progSigned = !progSigned;
+    return 1;
+  } else if (strcmp(label, ".") == 0) {
+    return 1;
+  } else {
+    return 0;
+  }
+  progFresh = 1;
+  return 1;
+}
+
+// Writes the edited line back, timing the incremental recalc it triggers.
+void sheetCommit(void) {
+  if (strcmp(sheet_line(&sheet, sheetCursor)->text, sheetEdit) == 0)
+    return;
+  Uint64 start = SDL_GetPerformanceCounter();
+  sheet_set(&sheet, sheetCursor, sheetEdit);
+  double ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 /
+              SDL_GetPerformanceFrequency();
+  snprintf(sheetStatus, sizeof(sheetStatus), "%d recalculated in %.2f ms",
+           sheet.lastRecalc, ms);
+}
+
+int sheetVisibleRows(int h) {
+  int rows = (h - SHEET_TOP - 30) / SHEET_ROW_H;
+  return rows > 1 ? rows : 1;
+}
+
+void sheetMoveTo(int pos) {
+  if (sheet.numLines == 0)
+    sheet_insert(&sheet, 0, "");
+  sheetCommit();
+  if (pos >= sheet.numLines)
+    pos = sheet.numLines - 1;
+  if (pos < 0)
+    pos = 0;
+  sheetCursor = pos;
+  snprintf(sheetEdit, sizeof(sheetEdit), "%s", sheet_line(&sheet, pos)->text);
+  int rows = sheetVisibleRows(winHeight);
+  if (sheetCursor < sheetScroll)
+    sheetScroll = sheetCursor;
+  if (sheetCursor >= sheetScroll + rows)
+    sheetScroll = sheetCursor - rows + 1;
+}
+
+void clampSheetScroll(int h) {
+  int maxScroll = sheet.numLines - sheetVisibleRows(h);
+  if (sheetScroll > maxScroll)
+    sheetScroll = maxScroll;
+  if (sheetScroll < 0)
+    sheetScroll = 0;
+}
+
+// Printable ASCII from SDL text input goes into the active line.
+void sheetTypeText(const char *text) {
+  size_t len = strlen(sheetEdit);
+  for (; *text && len + 1 < sizeof(sheetEdit); text++)
+    if (*text >= 32 && *text <= 126)
+      sheetEdit[len++] = *text;
+  sheetEdit[len] = '\0';
+}
+
+void sheetKey(SDL_Keycode key) {
+  size_t len = strlen(sheetEdit);
+  if (key == SDLK_RETURN || key == SDLK_KP_ENTER) {
+    sheetCommit();
+    if (sheet_insert(&sheet, sheetCursor + 1, "") >= 0) {
+      sheetCursor++;
+      sheetEdit[0] = '\0';
+    }
+    sheetMoveTo(sheetCursor);
+  } else if (key == SDLK_UP) {
+    sheetMoveTo(sheetCursor - 1);
+  } else if (key == SDLK_DOWN) {
+    sheetMoveTo(sheetCursor + 1);
+  } else if (key == SDLK_BACKSPACE && len > 0) {
+    sheetEdit[len - 1] = '\0';
+  } else if (key == SDLK_BACKSPACE && sheet.numLines > 1) {
+    // Backspace on an empty line removes it and steps up
+    sheet_remove(&sheet, sheetCursor);
+    snprintf(sheetStatus, sizeof(sheetStatus), "%d recalculated",
+             sheet.lastRecalc);
+    if (sheetCursor > 0)
+      sheetCursor--;
+    snprintf(sheetEdit, sizeof(sheetEdit), "%s",
+             sheet_line(&sheet, sheetCursor)->text);
+    sheetMoveTo(sheetCursor);
+  } else if (key == SDLK_DELETE) {
+    sheetEdit[0] = '\0';
+  } else if (key == SDLK_ESCAPE) {
+    snprintf(sheetEdit, sizeof(sheetEdit), "%s",
+             sheet_line(&sheet, sheetCursor)->text);
+  }
+}
+
+// Keyboard entry for programmer mode: digits, a-f, the four operators,
+// Enter and Backspace. Returns 1 when the key was used.
+int progKey(SDL_Keycode key) {
+  char label[2] = {0, 0};
+
+  if (key >= SDLK_0 && key <= SDLK_9)
+    label[0] = (char)key;
+  else if (key >= SDLK_a && key <= SDLK_f)
+    label[0] = (char)('A' + (key - SDLK_a));
+  else if (key == SDLK_PLUS || key == SDLK_KP_PLUS)
+    label[0] = '+';
+  else if (key == SDLK_MINUS || key == SDLK_KP_MINUS)
+    label[0] = '-';
+  else if (key == SDLK_ASTERISK || key == SDLK_KP_MULTIPLY)
+    label[0] = '*';
+  else if (key == SDLK_SLASH || key == SDLK_KP_DIVIDE)
+    label[0] = '/';
+  else if (key == SDLK_RETURN || key == SDLK_KP_ENTER ||
+           key == SDLK_EQUALS || key == SDLK_KP_EQUALS)
+    label[0] = '=';
+  else if (key == SDLK_BACKSPACE) {
+    prog_backspace();
+    return 1;
+  }
+  return label[0] && calc_inputProgrammer(label);
+}
+
 void calc_inputOperator(char op) {
   if (currentMode == MODE_RPN) {
 
-    double x = atof(calc.display);
+    double x = atod(calc.display);
 
     double y = calc_stackPop();
 
@@ -637,7 +1782,7 @@ void calc_inputOperator(char op) {
       res = pow(y, x);
 
     calc_stackPush(res);
-    snprintf(calc.display, sizeof(calc.display), "%.10g", res);
+    calc_setDisplay(res);
     calc.clearOnNextDigit = 1;
     return;
   }
@@ -645,7 +1790,13 @@ void calc_inputOperator(char op) {
   if (calc.hasPendingOp) {
     calc_inputEquals();
   }
-  calc.storedValue = atof(calc.display);
+  calc.storedValue = atod(calc.display);
+  if (currentMode == MODE_COMPLEX)
+    cxStored = cplx_parse(calc.display);
+  if (currentMode == MODE_FRACTION && !calc_fracOperand(&fracStored)) {
+    strcpy(specialMessage, "ERROR");
+    frac_from_int(&fracStored, 0);
+  }
   calc.pendingOp = op;
   calc.hasPendingOp = 1;
   strcpy(calc.display, "0");
@@ -653,12 +1804,14 @@ void calc_inputOperator(char op) {
 typedef struct {
   char equation[64];
   double result;
+  char exact[32]; // fraction results, when the text fits
 } HistoryEntry;
 
 HistoryEntry history[8];
 int historyCount = 0;
 
-void addToHistory(const char *opA, char op, const char *opB, double result) {
+void addToHistory(const char *opA, char op, const char *opB, double result,
+                  const char *exact) {
 
   if (historyCount == 8) {
     for (int i = 0; i < 7; i++) {
@@ -671,22 +1824,81 @@ void addToHistory(const char *opA, char op, const char *opB, double result) {
   snprintf(entry->equation, sizeof(entry->equation), "%s %c %s =", opA, op,
            opB);
   entry->result = result;
+  snprintf(entry->exact, sizeof(entry->exact), "%s", exact ? exact : "");
 }
 
 void loadHistory(int index) {
   if (index >= 0 && index < historyCount) {
-    snprintf(calc.display, sizeof(calc.display), "%g", history[index].result);
+    if (currentMode == MODE_FRACTION && history[index].exact[0])
+      strcpy(calc.display, history[index].exact);
+    else
+      calc_setDisplay(history[index].result);
     calc.storedValue = 0;
     calc.hasPendingOp = 0;
     calc.clearOnNextDigit = 1;
   }
 }
 
+void calc_fracEquals(void) {
+  Frac b, r;
+  char opA[32], opB[32];
+  int ok;
+
+  calc.hasPendingOp = 0;
+  if (!calc_fracOperand(&b)) {
+    strcpy(specialMessage, "ERROR");
+    return;
+  }
+  switch (calc.pendingOp) {
+  case '+':
+  case '-':
+    ok = frac_add(&r, &fracStored, &b, calc.pendingOp == '-');
+    break;
+  case '*':
+    ok = frac_mul(&r, &fracStored, &b);
+    break;
+  case '/':
+    ok = frac_div(&r, &fracStored, &b);
+    break;
+  case '^':
+    // Only integer powers stay exact
+    if (!fnat_is_one(&b.den) || !fnat_small(&b.num) ||
+        fnat_u64(&b.num) > FRAC_POW_MAX) {
+      strcpy(specialMessage, "NOT EXACT");
+      return;
+    }
+    ok = frac_pow(&r, &fracStored, b.neg ? -(long)fnat_u64(&b.num)
+                                         : (long)fnat_u64(&b.num));
+    break;
+  default:
+    return;
+  }
+  if (ok != 1) {
+    strcpy(specialMessage, ok < 0 ? "DIV BY 0" : "OVERFLOW");
+    return;
+  }
+
+  frac_format(&fracStored, 0, opA, sizeof(opA));
+  snprintf(opB, sizeof(opB), "%s", calc.display);
+  ok = calc_showFrac(&r);
+  addToHistory(opA, calc.pendingOp, opB, frac_to_double(&r),
+               ok ? calc.display : NULL);
+  save_state();
+}
+
 void calc_inputEquals(void) {
   if (!calc.hasPendingOp)
     return;
+  if (currentMode == MODE_COMPLEX) {
+    calc_complexEquals();
+    return;
+  }
+  if (currentMode == MODE_FRACTION) {
+    calc_fracEquals();
+    return;
+  }
 
-  double current = atof(calc.display);
+  double current = atod(calc.display);
   double result = 0;
 
   switch (calc.pendingOp) {
@@ -716,14 +1928,26 @@ void calc_inputEquals(void) {
   case '^':
     result = pow(calc.storedValue, current);
     break;
+  case 'p':
+    // Number of primes in [stored, current]; the first few are listed
+    if (calc.storedValue >= 0 && current >= calc.storedValue &&
+        current <= PRIME_INPUT_MAX) {
+      uint64_t lo = (uint64_t)calc.storedValue;
+      result = (double)(prime_count((uint64_t)current) -
+                        (lo ? prime_count(lo - 1) : 0));
+      formatPrimeList(calc.storedValue, current);
+    } else {
+      result = NAN;
+    }
+    break;
   }
 
   char opA[32];
-  snprintf(opA, sizeof(opA), "%g", calc.storedValue);
-  addToHistory(opA, calc.pendingOp, calc.display, result);
+  dtoa_format(calc.storedValue, 10, 0, opA, sizeof(opA));
+  addToHistory(opA, calc.pendingOp, calc.display, result, NULL);
   save_state();
 
-  snprintf(calc.display, sizeof(calc.display), "%g", result);
+  calc_setDisplay(result);
   calc.hasPendingOp = 0;
   calc.clearOnNextDigit = 1;
 
@@ -758,10 +1982,16 @@ void calc_inputClear(void) {
   calc.clearOnNextDigit = 0;
   isCrashMode = 0;
   is404Mode = 0;
+  primeListText[0] = '\0';
 
   if (currentMode == MODE_RPN) {
-    for (int i = 0; i < 4; i++)
-      calc.stack[i] = 0;
+    rpn_clear(&rpnStack);
+    rpnScroll = 0;
+  }
+  if (currentMode == MODE_PROGRAMMER) {
+    progValue = progStored = 0;
+    progHasOp = 0;
+    progFresh = 0;
   }
 }
 
@@ -773,139 +2003,144 @@ void calc_inputBackspace(void) {
     strcpy(calc.display, "0");
   }
 }
+// Groups the integer digits of typed text, keeping what a reformat would
+// drop (a trailing point, trailing zeros). Results go through dtoa_format,
+// which groups as it writes.
 void formatNumber(const char *src, char *dest, size_t destSize) {
-  const char *dot = strchr(src, '.');
-  int integerLen = dot ? (int)(dot - src) : (int)strlen(src);
-  int isNegative = (src[0] == '-');
-
-  char intPart[64];
-  int intIdx = 0;
-
-  int srcIdx = integerLen - 1;
-  int digitCount = 0;
-
-  while (srcIdx >= (isNegative ? 1 : 0)) {
-    if (digitCount > 0 && digitCount % 3 == 0) {
-      if (intIdx < 60)
-        intPart[intIdx++] = ',';
-    }
-    if (intIdx < 60)
-      intPart[intIdx++] = src[srcIdx--];
-    digitCount++;
-  }
-
-  if (isNegative) {
-    if (intIdx < 60)
-      intPart[intIdx++] = '-';
-  }
-
-  int destIdx = 0;
-  for (int i = intIdx - 1; i >= 0 && destIdx < destSize - 1; i--) {
-    dest[destIdx++] = intPart[i];
+  size_t n = 0, digits = strspn(src + (src[0] == '-'), "0123456789");
+
+  if (*src == '-')
+    dtoa_put(dest, destSize, &n, *src++);
+  for (size_t i = 0; i < digits; i++) {
+    if (i && (digits - i) % 3 == 0)
+      dtoa_put(dest, destSize, &n, ',');
+    dtoa_put(dest, destSize, &n, *src++);
   }
-
-  if (dot) {
-    int i = 0;
-    while (dot[i] && destIdx < destSize - 1) {
-      dest[destIdx++] = dot[i++];
-    }
-  }
-
-  dest[destIdx] = '\0';
+  while (*src)
+    dtoa_put(dest, destSize, &n, *src++);
+  dtoa_finish(dest, destSize, n);
 }
 Button histBtn;
 int showDraw = 0;
 Button drawBtn;
-unsigned char drawGrid[28][28] = {0};
+StrokeSet drawStrokes;
 int isDrawing = 0;
-NeuralNetwork nn;
+Model model;
 int modelLoaded = 0;
-int predictedDigit = -1;
 Uint32 lastDrawTime = 0;
 int hasDrawnSomething = 0;
-#define AUTO_PREDICT_DELAY 800
-int predictDigit(void) {
-  if (!modelLoaded) {
-    printf("Model not loaded, cannot predict.\n");
-    return -1;
-  }
-
-  int minR = 28, maxR = -1;
-  int minC = 28, maxC = -1;
-
-  for (int r = 0; r < 28; r++) {
-    for (int c = 0; c < 28; c++) {
-      if (drawGrid[r][c]) {
-        if (r < minR)
-          minR = r;
-        if (r > maxR)
-          maxR = r;
-        if (c < minC)
-          minC = c;
-        if (c > maxC)
-          maxC = c;
-      }
+int guessCurrent = 0; // the tentative guess has seen every stroke so far
+// The guess is refreshed soon after the pen lifts, but the pad is only
+// entered and cleared after a pause longer than the gap between the
+// strokes of one digit or gesture.
+#define AUTO_PREDICT_DELAY 100
+#define AUTO_COMMIT_DELAY 800
+// Owned by the inference thread: for each digit of a pad snapshot, its
+// hidden-layer pre-activations (model.hidden floats apart) with the input
+// and framing (stroke bounding box, then the centre-of-mass shift) they
+// were computed from. Snapshots alternate between the two states so the next
+// can be updated from the last.
+typedef struct {
+  float input[INFER_MAX_DIGITS][784];
+  float pre[INFER_MAX_DIGITS * MODEL_MAX_HIDDEN];
+  float frame[INFER_MAX_DIGITS][6];
+  int count;
+} DigitState;
+DigitState digitStates[2];
+InferWorker inferWorker;
+uint32_t drawSeq = 0; // bumped whenever the pad is cleared
+char tentativeDigits[INFER_MAX_DIGITS + 1];
+
+// Splits the strokes into digits, numbering each stroke's digit 1..count
+// from left to right in group. Strokes whose column spans mostly overlap
+// (the bar of a 5, a 4 drawn in two strokes) make one digit. Returns the
+// count, or -1 past INFER_MAX_DIGITS.
+int segmentDigits(const StrokeSet *s, unsigned char *group) {
+  float minX[STROKE_MAX], maxX[STROKE_MAX];
+  int order[STROKE_MAX];
+
+  for (int i = 0; i < s->strokes; i++) {
+    int end = stroke_end(s, i);
+    minX[i] = maxX[i] = s->pts[s->start[i]].x;
+    for (int k = s->start[i] + 1; k < end; k++) {
+      if (s->pts[k].x < minX[i])
+        minX[i] = s->pts[k].x;
+      if (s->pts[k].x > maxX[i])
+        maxX[i] = s->pts[k].x;
     }
+    // Half a cell of pen either side
+    minX[i] -= 0.5f;
+    maxX[i] += 0.5f;
+
+    int j = i;
+    for (; j > 0 && minX[order[j - 1]] > minX[i]; j--)
+      order[j] = order[j - 1];
+    order[j] = i;
   }
 
-  if (maxR == -1)
-    return -1;
-
-  int w = maxC - minC + 1;
-  int h = maxR - minR + 1;
-
-  float scale = 20.0f / (w > h ? w : h);
-
-  float scaled20[20][20];
-  memset(scaled20, 0, sizeof(scaled20));
-
-  int targetW = (int)(w * scale);
-  int targetH = (int)(h * scale);
-
-  int offR = (20 - targetH) / 2;
-  int offC = (20 - targetW) / 2;
-
-  for (int r = 0; r < 20; r++) {
-    for (int c = 0; c < 20; c++) {
-
-      if (r < offR || r >= offR + targetH || c < offC || c >= offC + targetW) {
-        scaled20[r][c] = 0.0f;
-        continue;
-      }
-
-      float srcR = (r - offR) / scale + minR;
-      float srcC = (c - offC) / scale + minC;
-
-      int r0 = (int)srcR;
-      int c0 = (int)srcC;
-
-      if (r0 >= 0 && r0 < 27 && c0 >= 0 && c0 < 27) {
-        float dr = srcR - r0;
-        float dc = srcC - c0;
+  int count = 0;
+  float gMin = 0, gMax = 0;
+  for (int k = 0; k < s->strokes; k++) {
+    int i = order[k];
+    float overlap = (maxX[i] < gMax ? maxX[i] : gMax) - minX[i];
+    float narrow = maxX[i] - minX[i] < gMax - gMin ? maxX[i] - minX[i]
+                                                   : gMax - gMin;
+    if (count == 0 || 2 * overlap < narrow) {
+      if (++count > INFER_MAX_DIGITS)
+        return -1;
+      gMin = minX[i];
+      gMax = maxX[i];
+    } else if (maxX[i] > gMax) {
+      gMax = maxX[i];
+    }
+    group[i] = count;
+  }
+  return count;
+}
 
-        float v00 = drawGrid[r0][c0];
-        float v01 = drawGrid[r0][c0 + 1];
-        float v10 = drawGrid[r0 + 1][c0];
-        float v11 = drawGrid[r0 + 1][c0 + 1];
+#define DIGIT_PEN 1.2f // pen radius in pixels of the 20x20 box
 
-        scaled20[r][c] = (1 - dr) * (1 - dc) * v00 + (1 - dr) * dc * v01 +
-                         dr * (1 - dc) * v10 + dr * dc * v11;
-      } else if (r0 >= 0 && r0 < 28 && c0 >= 0 && c0 < 28) {
+// Scales the strokes of digit id to fit the 20x20 box, rasterizes them
+// there with an anti-aliased pen of MNIST's weight and centres their mass
+// in the 28x28 input. Returns 0 when the digit has no strokes.
+int preprocessDigit(const StrokeSet *s, const unsigned char *group, int id,
+                    float *input, float *frame) {
+  float minX = 1e30f, maxX = -1e30f;
+  float minY = 1e30f, maxY = -1e30f;
 
-        scaled20[r][c] = (float)drawGrid[r0][c0];
-      }
+  for (int i = 0; i < s->strokes; i++) {
+    if (group[i] != id)
+      continue;
+    for (int k = s->start[i]; k < stroke_end(s, i); k++) {
+      const StrokePoint *p = &s->pts[k];
+      minX = p->x < minX ? p->x : minX;
+      maxX = p->x > maxX ? p->x : maxX;
+      minY = p->y < minY ? p->y : minY;
+      maxY = p->y > maxY ? p->y : maxY;
     }
   }
 
+  if (maxX < minX)
+    return 0;
+
+  float w = maxX - minX;
+  float h = maxY - minY;
+  float span = w > h ? w : h;
+  float scale = span > 0 ? (STROKE_BOX - 2 * DIGIT_PEN - 1) / span : 1;
+  float box[STROKE_BOX * STROKE_STRIDE];
+  stroke_render(s, group, id, minX - (STROKE_BOX / scale - w) / 2,
+                minY - (STROKE_BOX / scale - h) / 2, scale, DIGIT_PEN, box);
+
   float sumMass = 0;
   float sumX = 0;
   float sumY = 0;
 
-  for (int r = 0; r < 20; r++) {
-    for (int c = 0; c < 20; c++) {
-      sumMass += scaled20[r][c];
-      sumX += c * scaled20[r][c];
-      sumY += r * scaled20[r][c];
+  for (int r = 0; r < STROKE_BOX; r++) {
+    for (int c = 0; c < STROKE_BOX; c++) {
+      float v = box[r * STROKE_STRIDE + c];
+      sumMass += v;
+      sumX += c * v;
+      sumY += r * v;
     }
   }
 
@@ -919,108 +2154,202 @@ int predictDigit(void) {
   int shiftR = (int)roundf(9.5f - comY);
   int shiftC = (int)roundf(9.5f - comX);
 
-  float processed[28][28] = {0};
-
-  for (int r = 0; r < 20; r++) {
-    for (int c = 0; c < 20; c++) {
+  memset(input, 0, 784 * sizeof(float));
+  for (int r = 0; r < STROKE_BOX; r++) {
+    for (int c = 0; c < STROKE_BOX; c++) {
       int pr = r + 4 + shiftR;
       int pc = c + 4 + shiftC;
 
       if (pr >= 0 && pr < 28 && pc >= 0 && pc < 28) {
-        processed[pr][pc] = scaled20[r][c];
+        input[pr * 28 + pc] = box[r * STROKE_STRIDE + c];
       }
     }
   }
 
-  float input[784];
-  for (int i = 0; i < 28; i++) {
-    for (int j = 0; j < 28; j++) {
-      input[i * 28 + j] = processed[i][j];
-    }
-  }
-
-  static const int HEART_TEMPLATE[28][28] = {
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 1, 1, 1, 0, 0, 0, 0, 0,
-       0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1,
-       1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 1,
-       1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1,
-       1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1,
-       1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}};
-
-  float intersection = 0;
-  float union_val = 0;
-
-  for (int i = 0; i < 28; i++) {
-    for (int j = 0; j < 28; j++) {
-      float p = processed[i][j];
-      float t = HEART_TEMPLATE[i][j];
-      if (p > 0.5 && t > 0.5)
-        intersection++;
-      if (p > 0.5 || t > 0.5)
-        union_val++;
-    }
-  }
-
-  if (union_val > 0) {
-    float iou = intersection / union_val;
-
-    if (iou > 0.4) {
-      return -2;
-    }
-  }
-
-  return model_predict(&nn, input);
+  float f[6] = {minX, minY, maxX, maxY, shiftR, shiftC};
+  memcpy(frame, f, sizeof(f));
+  return 1;
+}
+
+// Maps the CNN when there is one, then the int8 MLP, then the float one;
+// each file's header says which network it holds. The pad feeds 28x28
+// inputs, so other input sizes are rejected.
+void loadModel(void) {
+  const char *files[] = {"model_cnn.bin", "model_q8.bin", "model.bin"};
+  for (int i = 0; i < 3; i++) {
+    const char *err = model_open(files[i], &model, 0);
+    if (!err && model.inputs != 784) {
+      model_close(&model);
+      err = "model does not take 28x28 input";
+    }
+    if (!err) {
+      if (model.kind == MODEL_CNN)
+        printf("Successfully loaded %s (CNN %d-%d channels, %d-%d)\n",
+               files[i], model.conv1, model.conv2, model.hidden,
+               model.outputs);
+      else
+        printf("Successfully loaded %s (%d-%d-%d, %s)\n", files[i],
+               model.inputs, model.hidden, model.outputs,
+               model.dtype == MODEL_Q8 ? "int8" : "float");
+      modelLoaded = 1;
+      return;
+    }
+    if (access(files[i], F_OK) == 0)
+      printf("Skipping %s: %s\n", files[i], err);
+  }
+}
+
+// Appends a final prediction to debug.log, off the render thread.
+void logPrediction(const InferResult *res) {
+  static FILE *debugLog = NULL;
+  if (!debugLog)
+    debugLog = fopen("debug.log", "a");
+  if (!debugLog)
+    return;
+  if (res->gesture) {
+    fprintf(debugLog, "Gesture: %s\n", gestureSymbols[res->gesture]);
+    fflush(debugLog);
+    return;
+  }
+  fprintf(debugLog, "Prediction: ");
+  for (int i = 0; i < res->count; i++)
+    fprintf(debugLog, "%d", res->digits[i]);
+  fprintf(debugLog, " (%s)\n", res->digits[0] >= 0 ? "Valid" : "INVALID");
+  fflush(debugLog);
+}
+
+// Runs on the inference thread. A pad holding a single shape is first
+// matched against the gesture templates, which costs far less than the
+// network. Otherwise, while a digit's framing holds, a new
+// snapshot only changes the few input cells under the pen of its new
+// points, so just their w1 rows are added; a moved
+// bounding box or centre of mass shifts every cell and that digit's hidden
+// layer is recomputed. The digits are then classified as one batch.
+void recogniseDigits(void *ctx, const InferRequest *req, InferResult *res) {
+  static int side = 0;
+  static unsigned char group[STROKE_MAX];
+  DigitState *last = (DigitState *)ctx + side;
+  DigitState *st = (DigitState *)ctx + !side;
+  int hidden = model.hidden;
+
+  res->seq = req->seq;
+  res->final = req->final;
+  res->gesture = GESTURE_NONE;
+  res->count = 0;
+  int count = segmentDigits(&req->strokes, group);
+  if (count <= 0) {
+    last->count = 0;
+    if (count < 0) {
+      res->count = 1;
+      res->digits[0] = -1;
+      if (req->final)
+        logPrediction(res);
+    }
+    return;
+  }
+
+  for (int i = 0; i < count; i++)
+    preprocessDigit(&req->strokes, group, i + 1, st->input[i], st->frame[i]);
+  if (count == 1)
+    res->gesture = gesture_match(st->input[0]);
+  if (res->gesture) {
+    last->count = 0;
+    if (req->final)
+      logPrediction(res);
+    return;
+  }
+
+  for (int i = 0; i < count; i++) {
+    float *pre = st->pre + (size_t)i * hidden;
+    int j = 0;
+    while (j < last->count &&
+           memcmp(st->frame[i], last->frame[j], sizeof(st->frame[i])) != 0)
+      j++;
+    if (j < last->count) {
+      memcpy(pre, last->pre + (size_t)j * hidden, hidden * sizeof(float));
+      model_update(&model, pre, last->input[j], st->input[i]);
+    } else {
+      model_hidden(&model, st->input[i], pre);
+    }
+  }
+  st->count = count;
+  side = !side;
+
+  res->count = count;
+  model_classify_batch(&model, st->pre, count, res->digits);
+  if (req->final)
+    logPrediction(res);
+}
+
+// Tentative results for a pad that has since been cleared are dropped;
+// final ones are entered whatever the pad shows now.
+void applyInferResult(const InferResult *res) {
+  if (!res->final) {
+    if (res->seq != drawSeq)
+      return;
+    if (res->gesture) {
+      strcpy(tentativeDigits, gestureSymbols[res->gesture]);
+      return;
+    }
+    for (int i = 0; i < res->count; i++)
+      tentativeDigits[i] = res->digits[i] >= 0 ? '0' + res->digits[i] : '?';
+    tentativeDigits[res->count] = '\0';
+    return;
+  }
+  if (res->gesture == GESTURE_HEART) {
+    isHeartAnimActive = 1;
+    easterEggStart = SDL_GetTicks();
+  } else if (res->gesture == GESTURE_EQUALS) {
+    if (currentMode == MODE_RPN)
+      calc_inputRPN("ENT");
+    else
+      calc_inputEquals();
+  } else if (res->gesture == GESTURE_SCRIBBLE) {
+    calc_inputClear();
+  } else if (res->gesture) {
+    calc_inputOperator(gestureSymbols[res->gesture][0]);
+  } else if (res->count > 0 && res->digits[0] >= 0) {
+    for (int i = 0; i < res->count; i++) {
+      char digit[2] = {'0' + res->digits[i], '\0'};
+      calc_inputDigit(digit);
+    }
+  } else {
+    printf("Ignored invalid prediction: %d\n",
+           res->count > 0 ? res->digits[0] : -1);
+  }
+}
+
+// Hands a snapshot of the pad to the inference thread, or runs it inline
+// when the thread could not be started. Returns 0 when the queue is full.
+int drawSubmit(int final) {
+  InferRequest req;
+  req.seq = drawSeq;
+  req.final = final;
+  req.strokes = drawStrokes;
+  if (inferWorker.running)
+    return infer_submit(&inferWorker, &req);
+  InferResult res;
+  recogniseDigits(digitStates, &req, &res);
+  applyInferResult(&res);
+  return 1;
+}
+
+void drawClear(void) {
+  stroke_clear(&drawStrokes);
+  hasDrawnSomething = 0;
+  drawSeq++;
+  tentativeDigits[0] = '\0';
 }
 float displayX, displayY, displayW, displayH;
 
+// Modes whose keypad carries function columns left of the digits.
+int hasFuncPad(void) {
+  return currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
+         currentMode == MODE_RPN || currentMode == MODE_MATRIX ||
+         currentMode == MODE_STATS || currentMode == MODE_COMPLEX ||
+         currentMode == MODE_PROGRAMMER || currentMode == MODE_FRACTION;
+}
+
 void updateLayout(int width, int height) {
   winWidth = width;
   winHeight = height;
@@ -1064,8 +2393,18 @@ void updateLayout(int width, int height) {
     return;
   }
 
-  if (currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
-      currentMode == MODE_RPN) {
+  if (currentMode == MODE_SHEET) {
+    modeBtn.x = 10;
+    modeBtn.y = 10;
+    modeBtn.w = 40;
+    modeBtn.h = 30;
+    cBtn.w = cBtn.h = 0;
+    histBtn.w = histBtn.h = 0;
+    clampSheetScroll(height);
+    return;
+  }
+
+  if (hasFuncPad()) {
 
   } else {
   }
@@ -1074,7 +2413,14 @@ void updateLayout(int width, int height) {
   int controlH = 30;
   int startY = 120;
 
-  int calcWidth = width - ((showHistory || currentMode == MODE_RPN) ? 200 : 0);
+  int sideW = (showHistory || currentMode == MODE_RPN) ? 200 : 0;
+  if (currentMode == MODE_MATRIX)
+    sideW = MATRIX_PANEL_W;
+  if (currentMode == MODE_STATS)
+    sideW = STATS_PANEL_W;
+  if (currentMode == MODE_PROGRAMMER)
+    sideW = PROG_PANEL_W;
+  int calcWidth = width - sideW;
   int padW = calcWidth - 40;
 
   displayX = 20;
@@ -1105,10 +2451,7 @@ void updateLayout(int width, int height) {
   modeBtn.w = 0;
   modeBtn.h = 0;
 
-  int numControl = (currentMode == MODE_SCIENTIFIC ||
-                    currentMode == MODE_UNIT || currentMode == MODE_RPN)
-                       ? 6
-                       : 4;
+  int numControl = hasFuncPad() ? 6 : 4;
   int gap = 10;
   float ctrlBtnW = (float)(padW - gap * (numControl - 1)) / numControl;
 
@@ -1136,8 +2479,8 @@ void updateLayout(int width, int height) {
     }
   }
 
-  if (currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
-      currentMode == MODE_RPN) {
+  if (hasFuncPad() && currentMode != MODE_PROGRAMMER &&
+      currentMode != MODE_FRACTION) {
     for (int i = 0; i < numButtons; i++) {
       if (strcmp(buttons[i].label, "PI") == 0) {
         buttons[i].x = 20 + 4 * (ctrlBtnW + gap);
@@ -1154,10 +2497,10 @@ void updateLayout(int width, int height) {
     }
   }
 
-  int cols = (currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
-              currentMode == MODE_RPN)
-                 ? 6
-                 : 4;
+  int funcCols = currentMode == MODE_PROGRAMMER    ? MAX_FUNC_COLS
+                 : currentMode == MODE_SCIENTIFIC ? 4
+                                                  : 3;
+  int cols = hasFuncPad() ? 4 + funcCols : 4;
   float bw = (float)(padW - gap * (cols - 1)) / cols;
 
   int padH = height - startY - 20;
@@ -1166,10 +2509,7 @@ void updateLayout(int width, int height) {
     padH = 50;
   float bh = (float)(padH - 3 * gap) / 4;
 
-  int colOffset = (currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
-                   currentMode == MODE_RPN)
-                      ? 2
-                      : 0;
+  int colOffset = hasFuncPad() ? funcCols : 0;
   int startX = 20;
 
   if (currentMode != MODE_DRAW && !showDraw) {
@@ -1237,19 +2577,29 @@ void updateLayout(int width, int height) {
     }
   }
 
-  if (currentMode == MODE_SCIENTIFIC || currentMode == MODE_UNIT ||
-      currentMode == MODE_RPN) {
-    char *labels[4][2];
+  if (hasFuncPad()) {
+    char *labels[4][MAX_FUNC_COLS];
+    for (int r = 0; r < 4; r++)
+      for (int c = 0; c < MAX_FUNC_COLS; c++)
+        labels[r][c] = "";
 
     if (currentMode == MODE_SCIENTIFIC) {
       labels[0][0] = "sin";
       labels[0][1] = "sqrt";
+      labels[0][2] = "π(x)";
       labels[1][0] = "cos";
       labels[1][1] = "sqr";
+      labels[1][2] = "nthP";
       labels[2][0] = "tan";
       labels[2][1] = "x^y";
+      labels[2][2] = "nxtP";
       labels[3][0] = "log";
       labels[3][1] = "ln";
+      labels[3][2] = "Prng";
+      labels[0][3] = "solve";
+      labels[1][3] = "root";
+      labels[2][3] = "Σ";
+      labels[3][3] = "Π";
     } else if (currentMode == MODE_UNIT) {
       labels[0][0] = "cm2in";
       labels[0][1] = "in2cm";
@@ -1259,19 +2609,90 @@ void updateLayout(int width, int height) {
       labels[2][1] = "mi2km";
       labels[3][0] = "C2F";
       labels[3][1] = "F2C";
+      labels[0][2] = "CONV";
+      labels[1][2] = "FLIP";
+      labels[2][2] = "STK";
+      labels[3][2] = "CLRU";
+    } else if (currentMode == MODE_MATRIX) {
+      labels[0][0] = "VIEW";
+      labels[0][1] = "ROWS";
+      labels[0][2] = "COLS";
+      labels[1][0] = "TRN";
+      labels[1][1] = "INV";
+      labels[1][2] = "det";
+      labels[2][0] = "LU";
+      labels[2][1] = "QR";
+      labels[2][2] = "X2A";
+      labels[3][0] = "IDN";
+      labels[3][1] = "RAND";
+      labels[3][2] = "ZERO";
+    } else if (currentMode == MODE_STATS) {
+      labels[0][0] = "Σ+";
+      labels[0][1] = "x,y";
+      labels[0][2] = "CLRΣ";
+      labels[1][0] = "mean";
+      labels[1][1] = "sdev";
+      labels[1][2] = "med";
+      labels[2][0] = "min";
+      labels[2][1] = "max";
+      labels[2][2] = "Σx";
+      labels[3][0] = "slope";
+      labels[3][1] = "icpt";
+      labels[3][2] = "corr";
+    } else if (currentMode == MODE_PROGRAMMER) {
+      char *progLabels[4][MAX_FUNC_COLS] = {
+          {"A", "B", "C", "AND", "OR", "XOR"},
+          {"D", "E", "F", "NOT", "SHL", "SHR"},
+          {"BASE", "WORD", "SGN", "ROL", "ROR", "MOD"},
+          {"POP", "CLZ", "CTZ", "BSWP", "NEG", ""}};
+      memcpy(labels, progLabels, sizeof(labels));
+    } else if (currentMode == MODE_FRACTION) {
+      labels[0][0] = "1/x";
+      labels[0][1] = "NEG";
+      labels[0][2] = "x^y";
+      labels[1][0] = "ab/c";
+    } else if (currentMode == MODE_COMPLEX) {
+      labels[0][0] = "i";
+      labels[0][1] = "conj";
+      labels[0][2] = "R/P";
+      labels[1][0] = "sin";
+      labels[1][1] = "cos";
+      labels[1][2] = "tan";
+      labels[2][0] = "ln";
+      labels[2][1] = "log";
+      labels[2][2] = "sqrt";
+      labels[3][0] = "x^y";
+      labels[3][1] = "|z|";
+      labels[3][2] = "arg";
+    } else if (rpnCtlPage) {
+      labels[0][0] = "LBL";
+      labels[0][1] = "GTO";
+      labels[0][2] = "RTN";
+      labels[1][0] = "x=0?";
+      labels[1][1] = "x<y?";
+      labels[1][2] = "x>y?";
+      labels[2][0] = "STO";
+      labels[2][1] = "RCL";
+      labels[2][2] = "DSZ";
     } else {
       labels[0][0] = "SWP";
       labels[0][1] = "DRP";
-      labels[1][0] = "";
-      labels[1][1] = "";
-      labels[2][0] = "";
-      labels[2][1] = "";
-      labels[3][0] = "";
-      labels[3][1] = "";
+      labels[0][2] = "ΣSTK";
+      labels[1][0] = "ROLL";
+      labels[1][1] = "PICK";
+      labels[1][2] = "MEAN";
+      labels[2][0] = "DUPN";
+      labels[2][1] = "DRPN";
+      labels[2][2] = "PROD";
+    }
+    if (currentMode == MODE_RPN) {
+      labels[3][0] = "PRGM";
+      labels[3][1] = "RUN";
+      labels[3][2] = "CTL";
     }
 
     for (int r = 0; r < 4; r++) {
-      for (int c = 0; c < 2; c++) {
+      for (int c = 0; c < funcCols; c++) {
         char *lbl = labels[r][c];
         if (strlen(lbl) > 0) {
           for (int k = 0; k < numButtons; k++) {
@@ -1433,24 +2854,96 @@ void initButtons(void) {
                          "sqrt", "sqr", "x^y", "PI",  "e"};
     for (int i = 0; i < 10; i++) {
       Button *b = &buttons[numButtons++];
-      strcpy(b->label, sciLabels[i]);
+      strcpy(b->label, sciLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *unitLabels[] = {"cm2in", "in2cm", "kg2lb", "lb2kg",
+                          "km2mi", "mi2km", "C2F",   "F2C",
+                          "CONV",  "FLIP",  "STK",   "CLRU"};
+    for (int i = 0; i < 12; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, unitLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *rpnLabels[] = {"SWP",  "DRP",  "ROLL", "PICK", "DUPN",
+                         "DRPN", "ΣSTK", "MEAN", "PROD"};
+    for (int i = 0; i < 9; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, rpnLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *progLabels[] = {"PRGM", "RUN",  "CTL",  "LBL", "GTO", "RTN",
+                          "x=0?", "x<y?", "x>y?", "STO", "RCL", "DSZ"};
+    for (int i = 0; i < 12; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, progLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *primeLabels[] = {"π(x)", "nthP", "nxtP", "Prng"};
+    for (int i = 0; i < 4; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, primeLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *matLabels[] = {"VIEW", "ROWS", "COLS", "TRN", "INV",  "det",
+                         "LU",   "QR",   "X2A",  "IDN", "RAND", "ZERO"};
+    for (int i = 0; i < 12; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, matLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *statLabels[] = {"Σ+",  "x,y", "CLRΣ", "mean",  "sdev", "med",
+                          "min", "max", "Σx",   "slope", "icpt", "corr"};
+    for (int i = 0; i < 12; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, statLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *complexLabels[] = {"i", "conj", "R/P", "|z|", "arg"};
+    for (int i = 0; i < 5; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, complexLabels[i]);
       b->role = 2;
       b->color = current_theme->btn_bg_action;
     }
 
-    char *unitLabels[] = {"cm2in", "in2cm", "kg2lb", "lb2kg",
-                          "km2mi", "mi2km", "C2F",   "F2C"};
-    for (int i = 0; i < 8; i++) {
+    char *wordLabels[] = {"A",   "B",   "C",   "D",    "E",    "F",
+                          "AND", "OR",  "XOR", "NOT",  "SHL",  "SHR",
+                          "ROL", "ROR", "MOD", "NEG",  "POP",  "CLZ",
+                          "CTZ", "BSWP", "BASE", "WORD", "SGN"};
+    for (int i = 0; i < 23; i++) {
       Button *b = &buttons[numButtons++];
-      strcpy(b->label, unitLabels[i]);
+      strcpy(b->label, wordLabels[i]);
       b->role = 2;
       b->color = current_theme->btn_bg_action;
     }
 
-    char *rpnLabels[] = {"SWP", "DRP"};
+    char *fracLabels[] = {"1/x", "ab/c"};
     for (int i = 0; i < 2; i++) {
       Button *b = &buttons[numButtons++];
-      strcpy(b->label, rpnLabels[i]);
+      strcpy(b->label, fracLabels[i]);
+      b->role = 2;
+      b->color = current_theme->btn_bg_action;
+    }
+
+    char *solveLabels[] = {"solve", "root", "Σ", "Π"};
+    for (int i = 0; i < 4; i++) {
+      Button *b = &buttons[numButtons++];
+      strcpy(b->label, solveLabels[i]);
       b->role = 2;
       b->color = current_theme->btn_bg_action;
     }
@@ -1461,6 +2954,43 @@ void initButtons(void) {
   updateLayout(winWidth, winHeight);
 }
 
+// Entries of the mode dropdown, top to bottom. A height of 0 keeps the
+// current window height.
+typedef struct {
+  const char *name;
+  CalculatorMode mode;
+  int width, height;
+} ModeEntry;
+
+const ModeEntry modeMenu[] = {
+    {"Basic", MODE_BASIC, 300, 0},   {"Scientific", MODE_SCIENTIFIC, 600, 0},
+    {"Unit", MODE_UNIT, 520, 0},     {"RPN", MODE_RPN, 650, 0},
+    {"Draw", MODE_DRAW, 640, 0},     {"Graphing", MODE_GRAPH, 1000, 500},
+    {"Matrix", MODE_MATRIX, 900, 0}, {"Stats", MODE_STATS, 750, 0},
+    {"Complex", MODE_COMPLEX, 520, 0},  {"Programmer", MODE_PROGRAMMER, 1040, 0},
+    {"Fraction", MODE_FRACTION, 520, 0}, {"Worksheet", MODE_SHEET, 640, 480},
+};
+#define NUM_MODES (int)(sizeof(modeMenu) / sizeof(modeMenu[0]))
+#define MODE_ITEM_H 30
+#define MODE_MENU_W 120
+
+void selectMode(const ModeEntry *m, int h) {
+  currentMode = m->mode;
+  isDropdownOpen = 0;
+  showDraw = m->mode == MODE_DRAW;
+  if (m->mode == MODE_DRAW || m->mode == MODE_GRAPH)
+    showHistory = 0;
+  if (m->mode == MODE_GRAPH) {
+    graphKeypadPage = 0;
+    initGraphButtons(0);
+  }
+  int height = m->height ? m->height : h;
+  SDL_SetWindowSize(gWindow, m->width, height);
+  updateLayout(m->width, height);
+  if (m->mode == MODE_SHEET)
+    sheetMoveTo(sheetCursor);
+}
+
 void handleButtonClick(int x, int y) {
   SDL_Window *win = gWindow;
   int w, h;
@@ -1484,79 +3014,28 @@ void handleButtonClick(int x, int y) {
   }
 
   if (isDropdownOpen) {
-
     float rx = modeBtn.x;
     float ry = modeBtn.y;
     float rh = modeBtn.h;
-    int itemH = 30;
-
-    if (x >= rx && x < rx + 100 && y >= ry + rh && y < ry + rh + itemH) {
-      currentMode = MODE_BASIC;
-      isDropdownOpen = 0;
-      showDraw = 0;
-      SDL_SetWindowSize(win, 300, h);
-      updateLayout(300, h);
-      return;
-    }
-
-    if (x >= rx && x < rx + 100 && y >= ry + rh + itemH &&
-        y < ry + rh + 2 * itemH) {
-      currentMode = MODE_SCIENTIFIC;
-      isDropdownOpen = 0;
-      showDraw = 0;
-      SDL_SetWindowSize(win, 450, h);
-      updateLayout(450, h);
-      return;
-    }
-
-    if (x >= rx && x < rx + 100 && y >= ry + rh + 2 * itemH &&
-        y < ry + rh + 3 * itemH) {
-      currentMode = MODE_UNIT;
-      isDropdownOpen = 0;
-      showDraw = 0;
-      SDL_SetWindowSize(win, 450, h);
-      updateLayout(450, h);
-      return;
-    }
-
-    if (x >= rx && x < rx + 100 && y >= ry + rh + 3 * itemH &&
-        y < ry + rh + 4 * itemH) {
-      currentMode = MODE_RPN;
-      isDropdownOpen = 0;
-      showDraw = 0;
-      SDL_SetWindowSize(win, 650, h);
-      updateLayout(650, h);
-      return;
-    }
-
-    if (x >= rx && x < rx + 100 && y >= ry + rh + 4 * itemH &&
-        y < ry + rh + 5 * itemH) {
-      currentMode = MODE_DRAW;
-      showDraw = 1;
-      showHistory = 0;
-      isDropdownOpen = 0;
-      SDL_SetWindowSize(win, 300, h);
-      updateLayout(300, h);
-      return;
-    }
 
-    if (x >= rx && x < rx + 100 && y >= ry + rh + 5 * itemH &&
-        y < ry + rh + 6 * itemH) {
-      currentMode = MODE_GRAPH;
-      showDraw = 0;
-      showHistory = 0;
-      isDropdownOpen = 0;
-      graphKeypadPage = 0;
-      initGraphButtons(0);
-      SDL_SetWindowSize(win, 1000, 500);
-      updateLayout(1000, 500);
-      return;
+    if (x >= rx && x < rx + MODE_MENU_W && y >= ry + rh) {
+      int item = (int)((y - ry - rh) / MODE_ITEM_H);
+      if (item < NUM_MODES) {
+        selectMode(&modeMenu[item], h);
+        return;
+      }
     }
 
     isDropdownOpen = 0;
     return;
   }
 
+  if (currentMode == MODE_SHEET) {
+    if (y >= SHEET_TOP)
+      sheetMoveTo(sheetScroll + (y - SHEET_TOP) / SHEET_ROW_H);
+    return;
+  }
+
   if (currentMode == MODE_GRAPH) {
     // Handle switching active equation
     if (isSidebarExpanded && x < sidebarW && y > 80 && y < 80 + 5 * 50) {
@@ -1699,10 +3178,11 @@ void handleButtonClick(int x, int y) {
     if (padH < 100)
       padH = 100;
 
-    int cellSize = (padW < padH ? padW : padH) / 28;
-    int gridSize = 28 * cellSize;
-    int gridX = 20 + (padW - gridSize) / 2;
-    int gridY = gridStartY + (padH - gridSize) / 2;
+    int cellSize = padW / INFER_COLS < padH / INFER_ROWS ? padW / INFER_COLS
+                                                        : padH / INFER_ROWS;
+    int gridW = INFER_COLS * cellSize, gridH = INFER_ROWS * cellSize;
+    int gridX = 20 + (padW - gridW) / 2;
+    int gridY = gridStartY + (padH - gridH) / 2;
 
     int numDrBtns = 5;
     char *drLabels[] = {"+", "-", "*", "/", "CLR"};
@@ -1724,12 +3204,7 @@ void handleButtonClick(int x, int y) {
       if (x >= bx && x < bx + bw && y >= by && y < by + bh) {
         triggerClickAnim(4, i);
         if (strcmp(drLabels[i], "CLR") == 0) {
-          for (int r = 0; r < 28; r++) {
-            for (int c = 0; c < 28; c++) {
-              drawGrid[r][c] = 0;
-            }
-          }
-          hasDrawnSomething = 0;
+          drawClear();
           return;
         } else {
 
@@ -1739,21 +3214,45 @@ void handleButtonClick(int x, int y) {
       }
     }
 
-    if (x >= gridX && x < gridX + gridSize && y >= gridY &&
-        y < gridY + gridSize) {
-      int col = (x - gridX) / cellSize;
-      int row = (y - gridY) / cellSize;
-      if (col >= 0 && col < 28 && row >= 0 && row < 28) {
-        drawGrid[row][col] = 1;
-        isDrawing = 1;
-        lastDrawTime = SDL_GetTicks();
-        hasDrawnSomething = 1;
-      }
+    if (x >= gridX && x < gridX + gridW && y >= gridY &&
+        y < gridY + gridH) {
+      isDrawing = 1;
+      lastDrawTime = SDL_GetTicks();
+      hasDrawnSomething = 1;
+      guessCurrent = 0;
+      if (stroke_begin(&drawStrokes, (float)(x - gridX) / cellSize,
+                       (float)(y - gridY) / cellSize, lastDrawTime) &&
+          modelLoaded)
+        drawSubmit(0);
       return;
     }
     return;
   }
 
+  if (currentMode == MODE_MATRIX && x >= w - MATRIX_PANEL_W) {
+    int col = (x - (w - MATRIX_PANEL_W) - 40) / MAT_CELL_W;
+    int row = (y - MAT_HEADER_H) / MAT_CELL_H;
+    if (x - (w - MATRIX_PANEL_W) >= 40 && y >= MAT_HEADER_H &&
+        col < matVisibleCols())
+      matMoveCursor(matScrollRow + row, matScrollCol + col);
+    return;
+  }
+
+  if (currentMode == MODE_STATS && x >= w - STATS_PANEL_W)
+    return;
+
+  if (currentMode == MODE_PROGRAMMER && x >= w - PROG_PANEL_W) {
+    // A click on the grid flips that bit
+    float gx = w - PROG_PANEL_W + 36;
+    int col = (int)((x - gx) / PROG_CELL), row = (y - PROG_GRID_Y) / PROG_CELL;
+    int pos = row * PROG_GRID_COLS + col;
+    if (x >= gx && y >= PROG_GRID_Y && col < PROG_GRID_COLS && pos < progBits) {
+      progValue ^= (Word)1 << (progBits - 1 - pos);
+      progFresh = 1;
+    }
+    return;
+  }
+
   if (showHistory) {
     if (x > w - 200) {
       int startY = 20;
@@ -1772,6 +3271,38 @@ void handleButtonClick(int x, int y) {
     if (b->w > 0 && b->h > 0 && x >= b->x && x < b->x + b->w && y >= b->y &&
         y < b->y + b->h) {
       char *label = b->label;
+      if (currentMode == MODE_RPN && calc_inputProgram(label)) {
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_STATS && calc_inputStats(label)) {
+        recordInput(label);
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_PROGRAMMER && calc_inputProgrammer(label)) {
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_FRACTION && calc_inputFraction(label)) {
+        recordInput(label);
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_COMPLEX && calc_inputComplex(label)) {
+        recordInput(label);
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_UNIT && calc_inputUnit(label)) {
+        triggerClickAnim(0, i);
+        break;
+      }
+      if (currentMode == MODE_MATRIX && calc_inputMatrix(label)) {
+        recordInput(label);
+        triggerClickAnim(0, i);
+        break;
+      }
       if ((label[0] >= '0' && label[0] <= '9')) {
         recordInput(label);
         calc_inputDigit(label);
@@ -1805,13 +3336,23 @@ void handleButtonClick(int x, int y) {
         calc_inputOperator('^');
       } else if (strcmp(label, "PI") == 0 || strcmp(label, "e") == 0) {
         calc_inputConstant(label);
-      } else if (strcmp(label, "cm2in") == 0 || strcmp(label, "in2cm") == 0 ||
-                 strcmp(label, "kg2lb") == 0 || strcmp(label, "lb2kg") == 0 ||
-                 strcmp(label, "km2mi") == 0 || strcmp(label, "mi2km") == 0 ||
-                 strcmp(label, "C2F") == 0 || strcmp(label, "F2C") == 0) {
-        calc_inputUnit(label);
-      } else if (strcmp(label, "SWP") == 0 || strcmp(label, "DRP") == 0) {
+      } else if (strcmp(label, "SWP") == 0 || strcmp(label, "DRP") == 0 ||
+                 strcmp(label, "ROLL") == 0 || strcmp(label, "PICK") == 0 ||
+                 strcmp(label, "DUPN") == 0 || strcmp(label, "DRPN") == 0 ||
+                 strcmp(label, "ΣSTK") == 0 || strcmp(label, "MEAN") == 0 ||
+                 strcmp(label, "PROD") == 0) {
+        recordInput(label);
         calc_inputRPN(label);
+      } else if (strcmp(label, "π(x)") == 0 || strcmp(label, "nthP") == 0 ||
+                 strcmp(label, "nxtP") == 0) {
+        recordInput(label);
+        calc_inputPrime(label);
+      } else if (strcmp(label, "Prng") == 0) {
+        recordInput(label);
+        calc_inputOperator('p');
+      } else if (strcmp(label, "solve") == 0 || strcmp(label, "root") == 0 ||
+                 strcmp(label, "Σ") == 0 || strcmp(label, "Π") == 0) {
+        calc_inputSolve(label);
       }
       triggerClickAnim(0, i);
       break;
@@ -1842,6 +3383,21 @@ void handleKeyboard(SDL_Keycode key) {
     konamiIndex = 0;
   }
 
+  if (currentMode == MODE_SHEET) {
+    sheetKey(key);
+    return;
+  }
+
+  // Ctrl+Z undoes, Ctrl+Shift+Z or Ctrl+Y redoes (Cmd on macOS)
+  SDL_Keymod mod = SDL_GetModState();
+  if ((mod & (KMOD_CTRL | KMOD_GUI)) && (key == SDLK_z || key == SDLK_y)) {
+    if (key == SDLK_y || (mod & KMOD_SHIFT))
+      undo_redo(&undoLog);
+    else
+      undo_undo(&undoLog);
+    return;
+  }
+
   if (currentMode == MODE_GRAPH) {
     if (key >= SDLK_1 && key <= SDLK_5 && (SDL_GetModState() & KMOD_ALT)) {
       activeEqIdx = key - SDLK_1;
@@ -1875,6 +3431,67 @@ void handleKeyboard(SDL_Keycode key) {
     return;
   }
 
+  if (currentMode == MODE_RPN) {
+    char keyLabel[4] = "";
+    if (key >= SDLK_0 && key <= SDLK_9)
+      keyLabel[0] = (char)key;
+    else if (key == SDLK_PLUS || key == SDLK_KP_PLUS)
+      keyLabel[0] = '+';
+    else if (key == SDLK_MINUS || key == SDLK_KP_MINUS)
+      keyLabel[0] = '-';
+    else if (key == SDLK_ASTERISK || key == SDLK_KP_MULTIPLY)
+      keyLabel[0] = '*';
+    else if (key == SDLK_SLASH || key == SDLK_KP_DIVIDE)
+      keyLabel[0] = '/';
+    else if (key == SDLK_CARET)
+      keyLabel[0] = '^';
+    else if (key == SDLK_RETURN || key == SDLK_KP_ENTER ||
+             key == SDLK_EQUALS || key == SDLK_KP_EQUALS)
+      strcpy(keyLabel, "ENT");
+    if (keyLabel[0] && calc_inputProgram(keyLabel))
+      return;
+  }
+
+  if (currentMode == MODE_MATRIX) {
+    const char *keyLabel = NULL;
+    if (key == SDLK_PLUS || key == SDLK_KP_PLUS)
+      keyLabel = "+";
+    else if (key == SDLK_MINUS || key == SDLK_KP_MINUS)
+      keyLabel = "-";
+    else if (key == SDLK_ASTERISK || key == SDLK_KP_MULTIPLY)
+      keyLabel = "*";
+    else if (key == SDLK_SLASH || key == SDLK_KP_DIVIDE)
+      keyLabel = "/";
+    else if (key == SDLK_RETURN || key == SDLK_KP_ENTER ||
+             key == SDLK_EQUALS || key == SDLK_KP_EQUALS)
+      keyLabel = "ENT";
+    if (keyLabel) {
+      calc_inputMatrix(keyLabel);
+      return;
+    }
+    // Arrow keys walk the cell cursor
+    int dr = (key == SDLK_DOWN) - (key == SDLK_UP);
+    int dc = (key == SDLK_RIGHT) - (key == SDLK_LEFT);
+    if (dr || dc) {
+      matMoveCursor(matCursorRow + dr, matCursorCol + dc);
+      return;
+    }
+  }
+
+  if (currentMode == MODE_SCIENTIFIC && solveEditing && solveKey(key))
+    return;
+
+  if (currentMode == MODE_UNIT && unitQueryKey(key))
+    return;
+
+  if (currentMode == MODE_PROGRAMMER && progKey(key))
+    return;
+
+  if (currentMode == MODE_COMPLEX && key == SDLK_i) {
+    calc_inputComplex("i");
+    return;
+  }
+
   if (key >= SDLK_0 && key <= SDLK_9) {
     char digit[2] = {(char)key, '\0'};
     calc_inputDigit(digit);
@@ -2101,7 +3718,7 @@ void draw_graph_grid(NVGcontext *vg, float x, float y, float w, float h) {
     if (fabs(i) < 0.1)
       continue;
     float px = x + (i - xMin) * scaleX;
-    snprintf(label, sizeof(label), "%.0f", i);
+    dtoa_fixed(i, 0, 0, label, sizeof(label));
     nvgTextAlign(vg, NVG_ALIGN_CENTER | NVG_ALIGN_TOP);
     nvgText(vg, px, zeroY + 5 > y + h - 15 ? zeroY - 15 : zeroY + 5, label,
             NULL);
@@ -2112,7 +3729,7 @@ void draw_graph_grid(NVGcontext *vg, float x, float y, float w, float h) {
     if (fabs(j) < 0.1)
       continue;
     float py = y + h - (j - yMin) * scaleY;
-    snprintf(label, sizeof(label), "%.0f", j);
+    dtoa_fixed(j, 0, 0, label, sizeof(label));
     nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
     nvgText(vg, zeroX - 5 < x + 5 ? zeroX + 25 : zeroX - 5, py, label, NULL);
   }
@@ -2120,6 +3737,21 @@ void draw_graph_grid(NVGcontext *vg, float x, float y, float w, float h) {
   nvgRestore(vg);
 }
 
+// "(x, y)" with two decimals, for point and cursor labels. Each part is
+// written straight into buf after the last, so a huge coordinate is cut
+// at the end of buf. size must be at least 1.
+void formatPoint(double px, double py, char *buf, size_t size) {
+  double v[2] = {px, py};
+  size_t n = 0;
+  for (int i = 0; i < 2; i++) {
+    n += snprintf(buf + n, size - n, i ? ", " : "(");
+    n = n < size ? n : size - 1;
+    n += dtoa_fixed(v[i], 2, 0, buf + n, size - n);
+    n = n < size ? n : size - 1;
+  }
+  snprintf(buf + n, size - n, ")");
+}
+
 void draw_graph_curve(NVGcontext *vg, float x, float y, float w, float h) {
   nvgSave(vg);
   nvgScissor(vg, x, y, w, h);
@@ -2132,8 +3764,8 @@ void draw_graph_curve(NVGcontext *vg, float x, float y, float w, float h) {
     NVGcolor color = graphEquations[eqIdx].color;
 
     // Check if it's a point expression "(x, y)"
-    float pxVal, pyVal;
-    if (sscanf(eqStr, " (%f, %f)", &pxVal, &pyVal) == 2) {
+    double pxVal, pyVal;
+    if (parse_graph_point(eqStr, &pxVal, &pyVal)) {
       float scaleY = h / (yMax - yMin);
       float sx = x + (pxVal - xMin) / (xMax - xMin) * w;
       float sy = y + h - (pyVal - yMin) * scaleY;
@@ -2239,7 +3871,7 @@ void draw_graph_curve(NVGcontext *vg, float x, float y, float w, float h) {
 
     // Draw coordinate label
     char coordText[64];
-    snprintf(coordText, sizeof(coordText), "(%.2f, %.2f)", pt->x, pt->y);
+    formatPoint(pt->x, pt->y, coordText, sizeof(coordText));
     nvgFontSize(vg, 12);
     nvgFillColor(vg, nvgRGB(255, 255, 255));
     nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_BOTTOM);
@@ -2353,6 +3985,317 @@ void draw_graph_keypad(NVGcontext *vg, float x, float y, float w, float h) {
   }
 }
 
+int rpnVisibleRows(int h) {
+  int rows = (h - 140) / RPN_ROW_H + 1;
+  return rows < 1 ? 1 : rows;
+}
+
+void clampRpnScroll(int h) {
+  int maxScroll = (int)rpnStack.depth - rpnVisibleRows(h);
+  if (rpnScroll > maxScroll)
+    rpnScroll = maxScroll;
+  if (rpnScroll < 0)
+    rpnScroll = 0;
+}
+
+// Only the cells inside the panel are formatted, so huge matrices cost the
+// same to draw as small ones.
+void draw_matrix_panel(NVGcontext *vg, float px, int h) {
+  const Matrix *m = &matRegs[matView];
+
+  nvgBeginPath(vg);
+  nvgRect(vg, px, 0, MATRIX_PANEL_W, h);
+  nvgFillColor(vg, nvgRGB(40, 40, 40));
+  nvgFill(vg);
+
+  char header[64];
+  snprintf(header, sizeof(header), "%c  %d x %d", MAT_REG_NAMES[matView],
+           m->rows, m->cols);
+  nvgFillColor(vg, nvgRGB(200, 200, 200));
+  nvgFontSize(vg, 16);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  nvgText(vg, px + 10, 20, header, NULL);
+  if (m->rows > 0) {
+    snprintf(header, sizeof(header), "r%d c%d", matCursorRow + 1,
+             matCursorCol + 1);
+    nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+    nvgText(vg, px + MATRIX_PANEL_W - 10, 20, header, NULL);
+  }
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  nvgFontSize(vg, 12);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  nvgText(vg, px + 10, 40, matStatus, NULL);
+  if (m->rows == 0) {
+    nvgText(vg, px + 10, MAT_HEADER_H, "empty", NULL);
+    return;
+  }
+
+  clampMatScroll(h);
+  int rowEnd = matScrollRow + matVisibleRows(h);
+  int colEnd = matScrollCol + matVisibleCols();
+  if (rowEnd > m->rows)
+    rowEnd = m->rows;
+  if (colEnd > m->cols)
+    colEnd = m->cols;
+
+  char buf[24];
+  nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+  for (int c = matScrollCol; c < colEnd; c++) {
+    snprintf(buf, sizeof(buf), "%d", c + 1);
+    nvgText(vg, px + 40 + (c - matScrollCol + 1) * MAT_CELL_W - 4,
+            MAT_HEADER_H - 10, buf, NULL);
+  }
+  for (int r = matScrollRow; r < rowEnd; r++) {
+    float cy = MAT_HEADER_H + (r - matScrollRow) * MAT_CELL_H;
+    nvgFillColor(vg, nvgRGB(120, 120, 120));
+    snprintf(buf, sizeof(buf), "%d", r + 1);
+    nvgText(vg, px + 34, cy + MAT_CELL_H / 2, buf, NULL);
+    for (int c = matScrollCol; c < colEnd; c++) {
+      float cx = px + 40 + (c - matScrollCol) * MAT_CELL_W;
+      if (r == matCursorRow && c == matCursorCol) {
+        nvgBeginPath(vg);
+        nvgRect(vg, cx, cy, MAT_CELL_W, MAT_CELL_H);
+        nvgFillColor(vg, nvgRGB(70, 90, 140));
+        nvgFill(vg);
+      }
+      dtoa_format(m->data[(size_t)r * m->cols + c], 4, 0, buf, sizeof(buf));
+      nvgFillColor(vg, nvgRGB(220, 220, 220));
+      nvgText(vg, cx + MAT_CELL_W - 4, cy + MAT_CELL_H / 2, buf, NULL);
+    }
+  }
+}
+
+void draw_stats_panel(NVGcontext *vg, float px, int h) {
+  nvgBeginPath(vg);
+  nvgRect(vg, px, 0, STATS_PANEL_W, h);
+  nvgFillColor(vg, nvgRGB(40, 40, 40));
+  nvgFill(vg);
+
+  struct {
+    const char *name;
+    double value;
+  } rows[] = {
+      {"n", (double)statsAcc.n},
+      {"mean", statsAcc.n ? statsAcc.mean : NAN},
+      {"sdev", stats_stddev(&statsAcc)},
+      {"var", stats_variance(&statsAcc)},
+      {"skew", stats_skewness(&statsAcc)},
+      {"kurt", stats_kurtosis(&statsAcc)},
+      {"min", statsAcc.n ? statsAcc.min : NAN},
+      {"q1", stats_quantile(&statsAcc, 0.25)},
+      {"median", stats_quantile(&statsAcc, 0.5)},
+      {"q3", stats_quantile(&statsAcc, 0.75)},
+      {"max", statsAcc.n ? statsAcc.max : NAN},
+      {"sum", stats_sum(&statsAcc)},
+      {"pairs", (double)statsAcc.np},
+      {"slope", stats_slope(&statsAcc)},
+      {"icpt", stats_intercept(&statsAcc)},
+      {"r", stats_correlation(&statsAcc)},
+  };
+  int numRows = statsAcc.np ? 16 : 12;
+
+  nvgFontSize(vg, 14);
+  for (int i = 0; i < numRows; i++) {
+    float y = 20 + i * STATS_ROW_H;
+    char buf[32];
+    dtoa_format(rows[i].value, 8, ',', buf, sizeof(buf));
+    nvgFillColor(vg, nvgRGB(120, 120, 120));
+    nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+    nvgText(vg, px + 10, y, rows[i].name, NULL);
+    nvgFillColor(vg, nvgRGB(200, 200, 200));
+    nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+    nvgText(vg, px + STATS_PANEL_W - 10, y, buf, NULL);
+  }
+
+  char status[64];
+  if (statsHasX) {
+    char x[32];
+    dtoa_format(statsPendingX, 8, 0, x, sizeof(x));
+    snprintf(status, sizeof(status), "x = %s, enter y", x);
+  }
+  else if (statsAcc.n == 0)
+    snprintf(status, sizeof(status), "Drop a data file here");
+  else
+    snprintf(status, sizeof(status), "%s", statsStatus);
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  nvgFontSize(vg, 12);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  nvgText(vg, px + 10, h - 20, status, NULL);
+}
+
+// Only the visible lines are formatted; values come from the last recalc.
+void draw_sheet(NVGcontext *vg, int w, int h) {
+  int rows = sheetVisibleRows(h);
+  clampSheetScroll(h);
+  nvgFontSize(vg, 16);
+  for (int r = 0; r < rows && sheetScroll + r < sheet.numLines; r++) {
+    int pos = sheetScroll + r;
+    const SheetCell *c = sheet_line(&sheet, pos);
+    float y = SHEET_TOP + r * SHEET_ROW_H;
+    if (pos == sheetCursor) {
+      nvgBeginPath(vg);
+      nvgRect(vg, 0, y, w, SHEET_ROW_H);
+      nvgFillColor(vg, nvgRGB(40, 40, 40));
+      nvgFill(vg);
+    }
+    char text[SHEET_TEXT_MAX + 1];
+    snprintf(text, sizeof(text), "%s%s", pos == sheetCursor ? sheetEdit : c->text,
+             pos == sheetCursor ? "|" : "");
+    nvgFillColor(vg, current_theme->text_primary);
+    nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+    nvgText(vg, 20, y + SHEET_ROW_H / 2, text, NULL);
+
+    char value[40];
+    if (c->status == SHEET_OK) {
+      dtoa_format(c->value, 10, ',', value, sizeof(value));
+      nvgFillColor(vg, nvgRGB(200, 200, 200));
+    } else {
+      snprintf(value, sizeof(value), "%s", sheet_status_text(c->status));
+      nvgFillColor(vg, nvgRGB(200, 90, 90));
+    }
+    nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+    nvgText(vg, w - 20, y + SHEET_ROW_H / 2, value, NULL);
+  }
+
+  char status[96];
+  snprintf(status, sizeof(status), "%d lines  %s", sheet.numLines,
+           sheetStatus);
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  nvgFontSize(vg, 12);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  nvgText(vg, 20, h - 15, status, NULL);
+}
+
+// Repaints the cells whose bit differs from what the offscreen grid shows.
+// Runs before the main frame since NanoVG frames cannot nest.
+void update_bit_grid(float pxRatio, int fbW, int fbH) {
+  int gw = PROG_GRID_COLS * PROG_CELL;
+  int gh = WORD_MAX_BITS / PROG_GRID_COLS * PROG_CELL;
+
+  if (!bitGridFb || bitGridRatio != pxRatio) {
+    if (bitGridFb)
+      nvgluDeleteFramebuffer(bitGridFb);
+    bitGridFb = nvgluCreateFramebuffer(vg, (int)(gw * pxRatio),
+                                       (int)(gh * pxRatio), 0);
+    bitGridRatio = pxRatio;
+    bitGridBits = 0;
+    if (!bitGridFb)
+      return;
+  }
+
+  Word v = word_wrap(progValue, progBits);
+  int full = bitGridBits != progBits;
+  Word changed = full ? word_mask(progBits) : v ^ bitGridShown;
+  if (!changed)
+    return;
+
+  nvgluBindFramebuffer(bitGridFb);
+  glViewport(0, 0, (int)(gw * pxRatio), (int)(gh * pxRatio));
+  if (full) {
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+  } else {
+    glClear(GL_STENCIL_BUFFER_BIT);
+  }
+  nvgBeginFrame(vg, gw, gh, pxRatio);
+  nvgFontFace(vg, "sans");
+  nvgFontSize(vg, 11);
+  nvgTextAlign(vg, NVG_ALIGN_CENTER | NVG_ALIGN_MIDDLE);
+  for (int bit = 0; bit < progBits; bit++) {
+    if (!((changed >> bit) & 1))
+      continue;
+    int pos = progBits - 1 - bit, on = (int)((v >> bit) & 1);
+    float cx = (pos % PROG_GRID_COLS) * PROG_CELL;
+    float cy = (pos / PROG_GRID_COLS) * PROG_CELL;
+    nvgBeginPath(vg);
+    nvgRect(vg, cx, cy, PROG_CELL, PROG_CELL);
+    nvgFillColor(vg, nvgRGB(40, 40, 40));
+    nvgFill(vg);
+    nvgBeginPath(vg);
+    nvgRoundedRect(vg, cx + 1, cy + 1, PROG_CELL - 2, PROG_CELL - 2, 3);
+    nvgFillColor(vg, on ? nvgRGB(47, 128, 255) : nvgRGB(60, 60, 60));
+    nvgFill(vg);
+    nvgFillColor(vg, on ? nvgRGB(255, 255, 255) : nvgRGB(140, 140, 140));
+    nvgText(vg, cx + PROG_CELL / 2.0f, cy + PROG_CELL / 2.0f, on ? "1" : "0",
+            NULL);
+  }
+  nvgEndFrame(vg);
+  nvgluBindFramebuffer(NULL);
+  glViewport(0, 0, fbW, fbH);
+
+  bitGridShown = v;
+  bitGridBits = progBits;
+}
+
+void draw_prog_panel(NVGcontext *vg, float px, int h) {
+  char buf[WORD_TEXT_MAX];
+  const char *names[] = {"HEX", "DEC", "OCT"};
+  const int bases[] = {16, 10, 8};
+
+  nvgBeginPath(vg);
+  nvgRect(vg, px, 0, PROG_PANEL_W, h);
+  nvgFillColor(vg, nvgRGB(40, 40, 40));
+  nvgFill(vg);
+
+  nvgFontSize(vg, 12);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  for (int i = 0; i < 3; i++) {
+    word_format(progValue, progBits, progSigned, bases[i], buf, sizeof(buf));
+    nvgFillColor(vg, nvgRGB(120, 120, 120));
+    nvgText(vg, px + 10, 20 + i * 20, names[i], NULL);
+    nvgFillColor(vg, nvgRGB(200, 200, 200));
+    nvgText(vg, px + 44, 20 + i * 20, buf, NULL);
+  }
+
+  // Binary in rows of 32 bits, grouped by byte
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  nvgText(vg, px + 10, 80, "BIN", NULL);
+  nvgFillColor(vg, nvgRGB(200, 200, 200));
+  for (int row = 0; row * 32 < progBits; row++) {
+    int top = progBits - row * 32, n = top < 32 ? top : 32;
+    Word part = word_wrap(progValue >> (top - n), n);
+    char bin[48], *q = bin;
+    for (int b = n - 1; b >= 0; b--) {
+      *q++ = (char)('0' + (int)((part >> b) & 1));
+      if (b && b % 8 == 0)
+        *q++ = ' ';
+    }
+    *q = '\0';
+    nvgText(vg, px + 44, 80 + row * 18, bin, NULL);
+  }
+
+  // Bit grid: the cells come from the offscreen image, labels are cheap text
+  float gx = px + 36;
+  int rows = (progBits + PROG_GRID_COLS - 1) / PROG_GRID_COLS;
+  nvgFontSize(vg, 11);
+  nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_MIDDLE);
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  for (int r = 0; r < rows; r++) {
+    snprintf(buf, sizeof(buf), "%d", progBits - 1 - r * PROG_GRID_COLS);
+    nvgText(vg, gx - 6, PROG_GRID_Y + r * PROG_CELL + PROG_CELL / 2.0f, buf,
+            NULL);
+  }
+  if (bitGridFb) {
+    float gw = PROG_GRID_COLS * PROG_CELL;
+    float gh = WORD_MAX_BITS / PROG_GRID_COLS * PROG_CELL;
+    NVGpaint img =
+        nvgImagePattern(vg, gx, PROG_GRID_Y, gw, gh, 0, bitGridFb->image, 1);
+    nvgBeginPath(vg);
+    nvgRect(vg, gx, PROG_GRID_Y, gw, rows * PROG_CELL);
+    nvgFillPaint(vg, img);
+    nvgFill(vg);
+  }
+
+  char status[48];
+  snprintf(status, sizeof(status), "%d bits set, %s pending",
+           word_popcount(word_wrap(progValue, progBits)),
+           progHasOp ? "op" : "no op");
+  nvgFillColor(vg, nvgRGB(120, 120, 120));
+  nvgFontSize(vg, 12);
+  nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
+  nvgText(vg, px + 10, h - 20, status, NULL);
+}
+
 void ui_render(SDL_Window *win) {
   int w, h;
   SDL_GetWindowSize(win, &w, &h);
@@ -2368,6 +4311,9 @@ void ui_render(SDL_Window *win) {
     lastH = h;
   }
 
+  if (currentMode == MODE_PROGRAMMER)
+    update_bit_grid(pxRatio, winWidth, winHeight);
+
   nvgBeginFrame(vg, w, h, pxRatio);
 
   if (is404Mode) {
@@ -2414,16 +4360,25 @@ void ui_render(SDL_Window *win) {
       float yv = yMin + (graphAreaY + graphAreaH - mouseY) / graphAreaH *
                             (yMax - yMin);
       char coordText[64];
-      snprintf(coordText, sizeof(coordText), "(%.2f, %.2f)", xv, yv);
+      formatPoint(xv, yv, coordText, sizeof(coordText));
       nvgFontSize(vg, 16);
       nvgFillColor(vg, current_theme->text_primary);
       nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
       nvgText(vg, mouseX + 15, mouseY + 15, coordText, NULL);
     }
 
+    draw_button_render(vg, &modeBtn, dt);
+  } else if (currentMode == MODE_SHEET) {
+    draw_sheet(vg, w, h);
     draw_button_render(vg, &modeBtn, dt);
   } else {
-    if (showHistory || currentMode == MODE_RPN) {
+    if (currentMode == MODE_MATRIX) {
+      draw_matrix_panel(vg, w - MATRIX_PANEL_W, h);
+    } else if (currentMode == MODE_STATS) {
+      draw_stats_panel(vg, w - STATS_PANEL_W, h);
+    } else if (currentMode == MODE_PROGRAMMER) {
+      draw_prog_panel(vg, w - PROG_PANEL_W, h);
+    } else if (showHistory || currentMode == MODE_RPN) {
       nvgBeginPath(vg);
       nvgRect(vg, w - 200, 0, 200, h);
       nvgFillColor(vg, nvgRGB(40, 40, 40));
@@ -2434,16 +4389,49 @@ void ui_render(SDL_Window *win) {
       nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
 
       if (currentMode == MODE_RPN) {
-        for (int i = 0; i < 4; i++) {
+        // Only the rows that fit are formatted and drawn
+        int visible = rpnVisibleRows(h);
+        clampRpnScroll(h);
+        size_t end = rpnScroll + visible;
+        if (end > rpnStack.depth)
+          end = rpnStack.depth;
+        for (size_t i = rpnScroll; i < end; i++) {
           char buf[64];
-          snprintf(buf, sizeof(buf), "%d: %.5g", i, calc.stack[i]);
-          nvgText(vg, w - 190, h - 100 - i * 50, buf, NULL);
+          int len = snprintf(buf, sizeof(buf), "%zu: ", i + 1);
+          dtoa_format(rpn_peek(&rpnStack, i + 1), 5, ',', buf + len,
+                      sizeof(buf) - len);
+          nvgText(vg, w - 190, h - 100 - (int)(i - rpnScroll) * RPN_ROW_H, buf,
+                  NULL);
+        }
+        char depthText[32];
+        snprintf(depthText, sizeof(depthText), "depth %zu", rpnStack.depth);
+        nvgFillColor(vg, nvgRGB(120, 120, 120));
+        nvgFontSize(vg, 12);
+        nvgText(vg, w - 190, 20, depthText, NULL);
+
+        char progText[48];
+        if (isProgRecording) {
+          const ProgStep *last = rpnProgram.numSteps
+                                     ? &rpnProgram.steps[rpnProgram.numSteps - 1]
+                                     : NULL;
+          snprintf(progText, sizeof(progText), "REC %03d %s", rpnProgram.numSteps,
+                   progPendingOp >= 0 ? prog_op_name(progPendingOp)
+                   : last             ? prog_op_name(last->op)
+                                      : "");
+          nvgFillColor(vg, nvgRGB(255, 80, 80));
+        } else {
+          snprintf(progText, sizeof(progText), "PRGM %d steps",
+                   rpnProgram.numSteps);
         }
+        nvgText(vg, w - 190, 38, progText, NULL);
       } else {
         for (int i = 0; i < historyCount; i++) {
           nvgText(vg, w - 190, 30 + i * 40, history[i].equation, NULL);
-          char res[64];
-          snprintf(res, sizeof(res), "= %.5g", history[i].result);
+          char res[64] = "= ";
+          if (history[i].exact[0])
+            snprintf(res, sizeof(res), "= %s", history[i].exact);
+          else
+            dtoa_format(history[i].result, 5, ',', res + 2, sizeof(res) - 2);
           nvgText(vg, w - 190, 50 + i * 40, res, NULL);
         }
       }
@@ -2459,9 +4447,33 @@ void ui_render(SDL_Window *win) {
       snprintf(formattedText, sizeof(formattedText), "%s", specialMessage);
     } else if (isEqualsDown && SDL_GetTicks() - equalsPressTime > 2000) {
       snprintf(formattedText, sizeof(formattedText), "why are you holding me");
+    } else if (currentMode == MODE_COMPLEX) {
+      snprintf(formattedText, sizeof(formattedText), "%s", calc.display);
+    } else if (currentMode == MODE_FRACTION) {
+      // A shown result is drawn from the exact value when it fits
+      char exact[FRAC_TEXT_MAX];
+      Frac f;
+      if (calc_fracOperand(&f) && calc.clearOnNextDigit) {
+        frac_format(&f, fracMixed, exact, sizeof(exact));
+        size_t len = strlen(exact);
+        if (len < sizeof(formattedText))
+          memcpy(formattedText, exact, len + 1);
+        else
+          dtoa_format(frac_to_double(&f), 15, ',', formattedText,
+                      sizeof(formattedText));
+      } else {
+        snprintf(formattedText, sizeof(formattedText), "%s", calc.display);
+      }
+    } else if (currentMode == MODE_PROGRAMMER) {
+      word_format(progValue, progBits, progSigned, progBase, formattedText,
+                  sizeof(formattedText));
     } else {
-      formatNumber(calc.display, formattedText, sizeof(formattedText));
-      double val = atof(calc.display);
+      double val = atod(calc.display);
+      if (calc.clearOnNextDigit)
+        dtoa_format(val, DISPLAY_DIGITS, ',', formattedText,
+                    sizeof(formattedText));
+      else
+        formatNumber(calc.display, formattedText, sizeof(formattedText));
       if (fabs(val - 80085) < 1e-9)
         snprintf(formattedText, sizeof(formattedText), "BOOBS");
       else if (fabs(val - 69) < 1e-9)
@@ -2501,10 +4513,77 @@ void ui_render(SDL_Window *win) {
       nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
       nvgText(vg, displayX + 10, displayY + 5, "PRIME", NULL);
     }
+    if (currentMode == MODE_PROGRAMMER) {
+      char mode[32];
+      snprintf(mode, sizeof(mode), "%s %d-bit %s",
+               progBase == 16  ? "HEX"
+               : progBase == 8 ? "OCT"
+               : progBase == 2 ? "BIN"
+                               : "DEC",
+               progBits, progSigned ? "signed" : "unsigned");
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 14);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+      nvgText(vg, displayX + 10, displayY + 5, mode, NULL);
+    }
+    if (currentMode == MODE_COMPLEX) {
+      char pending[48] = "";
+      if (calc.hasPendingOp) {
+        cplx_format(cxStored, cxPolar, 6, pending, 40);
+        size_t len = strlen(pending);
+        snprintf(pending + len, sizeof(pending) - len, " %c", calc.pendingOp);
+      }
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 14);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+      nvgText(vg, displayX + 10, displayY + 5, cxPolar ? "POLAR" : "RECT",
+              NULL);
+      nvgText(vg, displayX + 60, displayY + 5, pending, NULL);
+    }
+    if (currentMode == MODE_FRACTION) {
+      char info[80] = "";
+      Frac f;
+      if (calc.hasPendingOp) {
+        frac_format(&fracStored, fracMixed, info, 40);
+        size_t len = strlen(info);
+        snprintf(info + len, sizeof(info) - len, " %c   ", calc.pendingOp);
+      }
+      if (calc_fracOperand(&f) && !fnat_is_one(&f.den)) {
+        size_t len = strlen(info);
+        len += snprintf(info + len, sizeof(info) - len, "≈ ");
+        dtoa_format(frac_to_double(&f), 12, 0, info + len, sizeof(info) - len);
+      }
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 14);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+      nvgText(vg, displayX + 10, displayY + 5, info, NULL);
+    }
+    if (currentMode == MODE_UNIT) {
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 14);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+      nvgText(vg, displayX + 10, displayY + 5,
+              unitQuery[0] ? unitQuery : "type from>to (space = >)", NULL);
+    }
+    if (currentMode == MODE_SCIENTIFIC && solveEditing) {
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 14);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_TOP);
+      nvgText(vg, displayX + 10, displayY + 5,
+              solveQuery[0] ? solveQuery
+                            : "f(x) = g(x) or sum(k=1, n, f), Enter",
+              NULL);
+    }
+    if (strlen(primeListText) > 0) {
+      nvgFillColor(vg, current_theme->text_secondary);
+      nvgFontSize(vg, 12);
+      nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_BOTTOM);
+      nvgText(vg, displayX + 10, displayY + displayH - 2, primeListText, NULL);
+    }
     for (int i = 0; i < numButtons; i++) {
       if (strcmp(buttons[i].label, "=") == 0 ||
           strcmp(buttons[i].label, "ENT") == 0) {
-        if (currentMode == MODE_RPN)
+        if (currentMode == MODE_RPN || currentMode == MODE_MATRIX)
           strcpy(buttons[i].label, "ENT");
         else
           strcpy(buttons[i].label, "=");
@@ -2523,19 +4602,15 @@ void ui_render(SDL_Window *win) {
   if (isDropdownOpen) {
     float rx = modeBtn.x;
     float ry = modeBtn.y + modeBtn.h + 5;
-    float Rw = 120, Rh = 180;
+    float Rw = MODE_MENU_W, Rh = NUM_MODES * MODE_ITEM_H;
 
     draw_rrect_shadow(vg, rx, ry, Rw, Rh, 5, nvgRGB(50, 50, 50),
                       nvgRGBA(0, 0, 0, 100));
 
     nvgFillColor(vg, nvgRGB(255, 255, 255));
     nvgTextAlign(vg, NVG_ALIGN_LEFT | NVG_ALIGN_MIDDLE);
-    nvgText(vg, rx + 10, ry + 20, "Basic", NULL);
-    nvgText(vg, rx + 10, ry + 50, "Scientific", NULL);
-    nvgText(vg, rx + 10, ry + 80, "Unit", NULL);
-    nvgText(vg, rx + 10, ry + 110, "RPN", NULL);
-    nvgText(vg, rx + 10, ry + 140, "Draw", NULL);
-    nvgText(vg, rx + 10, ry + 170, "Graphing", NULL);
+    for (int i = 0; i < NUM_MODES; i++)
+      nvgText(vg, rx + 10, ry + 20 + i * MODE_ITEM_H, modeMenu[i].name, NULL);
   }
 
   if (showDraw || currentMode == MODE_DRAW) {
@@ -2546,26 +4621,48 @@ void ui_render(SDL_Window *win) {
     int padW = calcWidth - 40;
     if (padH < 100)
       padH = 100;
-    int cellSize = (padW < padH ? padW : padH) / 28;
-    int gridSize = 28 * cellSize;
-    int gridX = 20 + (padW - gridSize) / 2;
-    int gridY = gridStartY + (padH - gridSize) / 2;
+    int cellSize = padW / INFER_COLS < padH / INFER_ROWS ? padW / INFER_COLS
+                                                        : padH / INFER_ROWS;
+    int gridW = INFER_COLS * cellSize, gridH = INFER_ROWS * cellSize;
+    int gridX = 20 + (padW - gridW) / 2;
+    int gridY = gridStartY + (padH - gridH) / 2;
 
     nvgBeginPath(vg);
-    nvgRect(vg, gridX - 2, gridY - 2, gridSize + 4, gridSize + 4);
+    nvgRect(vg, gridX - 2, gridY - 2, gridW + 4, gridH + 4);
     nvgStrokeColor(vg, nvgRGB(100, 100, 100));
     nvgStroke(vg);
 
-    for (int r = 0; r < 28; r++) {
-      for (int c = 0; c < 28; c++) {
-        if (drawGrid[r][c]) {
-          nvgBeginPath(vg);
-          nvgRect(vg, gridX + c * cellSize, gridY + r * cellSize, cellSize,
-                  cellSize);
-          nvgFillColor(vg, nvgRGB(50, 50, 50));
-          nvgFill(vg);
-        }
+    // Strokes a cell wide; a lone point is a dot
+    nvgSave(vg);
+    nvgStrokeColor(vg, nvgRGB(50, 50, 50));
+    nvgFillColor(vg, nvgRGB(50, 50, 50));
+    nvgStrokeWidth(vg, cellSize);
+    nvgLineCap(vg, NVG_ROUND);
+    nvgLineJoin(vg, NVG_ROUND);
+    for (int i = 0; i < drawStrokes.strokes; i++) {
+      int start = drawStrokes.start[i], end = stroke_end(&drawStrokes, i);
+      const StrokePoint *p = &drawStrokes.pts[start];
+      nvgBeginPath(vg);
+      if (end - start == 1) {
+        nvgCircle(vg, gridX + p->x * cellSize, gridY + p->y * cellSize,
+                  cellSize / 2.0f);
+        nvgFill(vg);
+        continue;
       }
+      nvgMoveTo(vg, gridX + p->x * cellSize, gridY + p->y * cellSize);
+      for (int k = start + 1; k < end; k++)
+        nvgLineTo(vg, gridX + drawStrokes.pts[k].x * cellSize,
+                  gridY + drawStrokes.pts[k].y * cellSize);
+      nvgStroke(vg);
+    }
+    nvgRestore(vg);
+
+    // Running guess from the live hidden layers
+    if (tentativeDigits[0]) {
+      nvgFontSize(vg, 24);
+      nvgTextAlign(vg, NVG_ALIGN_RIGHT | NVG_ALIGN_TOP);
+      nvgFillColor(vg, nvgRGBA(128, 128, 128, 160));
+      nvgText(vg, gridX + gridW - 6, gridY + 4, tentativeDigits, NULL);
     }
 
     int numDrBtns = 5;
@@ -2628,14 +4725,20 @@ void ui_render(SDL_Window *win) {
     snprintf(debugText, sizeof(debugText), "FPS: %.1f", fps);
     nvgText(vg, w - 100, 5, debugText, NULL);
 
+    snprintf(debugText, sizeof(debugText), "Undo: %d/%d, %zu KB",
+             undoLog.cursor, undoLog.numSteps, undo_bytes(&undoLog) / 1024);
+    nvgText(vg, w - 160, 20, debugText, NULL);
+
     snprintf(debugText, sizeof(debugText), "Input: %s", inputSequence);
     nvgText(vg, 10, h - 60, debugText, NULL);
 
     snprintf(debugText, sizeof(debugText), "Display: %s", calc.display);
     nvgText(vg, 10, h - 45, debugText, NULL);
 
-    snprintf(debugText, sizeof(debugText), "Stored: %.5g | Op: %c",
-             calc.storedValue, calc.pendingOp ? calc.pendingOp : ' ');
+    char stored[32];
+    dtoa_format(calc.storedValue, 5, 0, stored, sizeof(stored));
+    snprintf(debugText, sizeof(debugText), "Stored: %s | Op: %c", stored,
+             calc.pendingOp ? calc.pendingOp : ' ');
     nvgText(vg, 10, h - 30, debugText, NULL);
 
     snprintf(debugText, sizeof(debugText), "Pending: %d | Mode: %d",
@@ -2691,13 +4794,17 @@ int main(int argc, char *argv[]) {
 
   ui_init_nanovg();
 
-  if (model_load("model.bin", &nn)) {
-    printf("Successfully loaded model.bin\n");
-    modelLoaded = 1;
-  } else {
-  }
+  loadModel();
+  if (modelLoaded)
+    infer_start(&inferWorker, recogniseDigits, digitStates);
 
   load_state();
+  for (int i = 0; i < 2; i++) {
+    matrix_create(&matRegs[i], MAT_EDIT_DIM, MAT_EDIT_DIM);
+    matrix_identity(&matRegs[i]);
+  }
+  stats_init(&statsAcc);
+  initUndo();
 
   time_t now = time(NULL);
   struct tm *local = localtime(&now);
@@ -2773,91 +4880,131 @@ int main(int argc, char *argv[]) {
           if (padH < 100)
             padH = 100;
 
-          int cellSize = (padW < padH ? padW : padH) / 28;
-          int gridSize = 28 * cellSize;
-          int gridX = 20 + (padW - gridSize) / 2;
-          int gridY = startY + (padH - gridSize) / 2;
-
-          if (x >= gridX && x < gridX + gridSize && y >= gridY &&
-              y < gridY + gridSize) {
-            int col = (x - gridX) / cellSize;
-            int row = (y - gridY) / cellSize;
-            if (col >= 0 && col < 28 && row >= 0 && row < 28) {
-              drawGrid[row][col] = 1;
-              lastDrawTime = SDL_GetTicks();
-              hasDrawnSomething = 1;
-            }
+          int cellSize = padW / INFER_COLS < padH / INFER_ROWS
+                             ? padW / INFER_COLS
+                             : padH / INFER_ROWS;
+          int gridW = INFER_COLS * cellSize, gridH = INFER_ROWS * cellSize;
+          int gridX = 20 + (padW - gridW) / 2;
+          int gridY = startY + (padH - gridH) / 2;
+
+          if (x >= gridX && x < gridX + gridW && y >= gridY &&
+              y < gridY + gridH) {
+            lastDrawTime = SDL_GetTicks();
+            hasDrawnSomething = 1;
+            guessCurrent = 0;
+            if (stroke_add(&drawStrokes, (float)(x - gridX) / cellSize,
+                           (float)(y - gridY) / cellSize, lastDrawTime) &&
+                modelLoaded)
+              drawSubmit(0);
           }
-        } else if (e.type == SDL_KEYDOWN) {
-          handleKeyboard(e.key.keysym.sym);
-        } else if (e.type == SDL_MOUSEWHEEL && currentMode == MODE_GRAPH) {
-          float scale = (e.wheel.y > 0) ? 0.9f : 1.1f;
-          float xRange = xMax - xMin;
-          float yRange = yMax - yMin;
-          float xMid = (xMax + xMin) / 2.0f;
-          float yMid = (yMax + yMin) / 2.0f;
-
-          xMin = xMid - (xRange * scale) / 2.0f;
-          xMax = xMid + (xRange * scale) / 2.0f;
-          yMin = yMid - (yRange * scale) / 2.0f;
-          yMax = yMid + (yRange * scale) / 2.0f;
         }
+      } else if (e.type == SDL_KEYDOWN) {
+        handleKeyboard(e.key.keysym.sym);
+      } else if (e.type == SDL_TEXTINPUT && currentMode == MODE_SHEET) {
+        sheetTypeText(e.text.text);
+      } else if (e.type == SDL_TEXTINPUT && currentMode == MODE_SCIENTIFIC &&
+                 solveEditing) {
+        solveTypeText(e.text.text);
+      } else if (e.type == SDL_MOUSEWHEEL && currentMode == MODE_GRAPH) {
+        float scale = (e.wheel.y > 0) ? 0.9f : 1.1f;
+        float xRange = xMax - xMin;
+        float yRange = yMax - yMin;
+        float xMid = (xMax + xMin) / 2.0f;
+        float yMid = (yMax + yMin) / 2.0f;
+
+        xMin = xMid - (xRange * scale) / 2.0f;
+        xMax = xMid + (xRange * scale) / 2.0f;
+        yMin = yMid - (yRange * scale) / 2.0f;
+        yMax = yMid + (yRange * scale) / 2.0f;
+      } else if (e.type == SDL_MOUSEWHEEL && currentMode == MODE_RPN) {
+        // Wheel up scrolls towards deeper stack levels
+        int w, h;
+        SDL_GetWindowSize(gWindow, &w, &h);
+        rpnScroll += (e.wheel.y > 0) ? 3 : -3;
+        clampRpnScroll(h);
+      } else if (e.type == SDL_MOUSEWHEEL && currentMode == MODE_SHEET) {
+        sheetScroll += (e.wheel.y > 0) ? -3 : 3;
+        clampSheetScroll(winHeight);
+      } else if (e.type == SDL_MOUSEWHEEL && currentMode == MODE_MATRIX) {
+        // Shift scrolls the cell panel sideways
+        if (SDL_GetModState() & KMOD_SHIFT)
+          matScrollCol += (e.wheel.y > 0) ? -2 : 2;
+        else
+          matScrollRow += (e.wheel.y > 0) ? -3 : 3;
+        clampMatScroll(winHeight);
+      } else if (e.type == SDL_DROPFILE) {
+        if (currentMode == MODE_STATS)
+          calc_loadStatsFile(e.drop.file);
+        SDL_free(e.drop.file);
       }
+    }
 
-      if (showDraw && hasDrawnSomething && !isDrawing) {
-        Uint32 now = SDL_GetTicks();
-        if (now - lastDrawTime > AUTO_PREDICT_DELAY) {
-          predictedDigit = predictDigit();
-
-          if (predictedDigit == -2) {
-
-            isHeartAnimActive = 1;
-            easterEggStart = SDL_GetTicks();
-          } else if (predictedDigit >= 0 && predictedDigit <= 9) {
-
-            char digit[2] = {'0' + predictedDigit, '\0'};
-            calc_inputDigit(digit);
-
-            FILE *f = fopen("debug.log", "a");
-            if (f) {
-              fprintf(f, "Prediction: %d (Valid)\n", predictedDigit);
-              fclose(f);
-            }
+    undo_commit(&undoLog);
 
-          } else {
-            printf("Ignored invalid prediction: %d\n", predictedDigit);
-            FILE *f = fopen("debug.log", "a");
-            if (f) {
-              fprintf(f, "Prediction: %d (INVALID)\n", predictedDigit);
-              fclose(f);
-            }
-          }
+    InferResult inferRes;
+    while (infer_poll(&inferWorker, &inferRes))
+      applyInferResult(&inferRes);
 
-          for (int r = 0; r < 28; r++) {
-            for (int c = 0; c < 28; c++) {
-              drawGrid[r][c] = 0;
-            }
-          }
-          hasDrawnSomething = 0;
+    if (showDraw && hasDrawnSomething && !isDrawing) {
+      Uint32 now = SDL_GetTicks();
+      if (now - lastDrawTime > AUTO_COMMIT_DELAY) {
+        if (!modelLoaded) {
+          printf("Model not loaded, cannot predict.\n");
+          drawClear();
+        } else if (drawSubmit(1)) {
+          drawClear();
         }
+      } else if (!guessCurrent && modelLoaded &&
+                 now - lastDrawTime > AUTO_PREDICT_DELAY) {
+        guessCurrent = drawSubmit(0);
       }
-
-      if (isRainbowMode) {
-        rainbowHue += 2.0f;
-        if (rainbowHue >= 360.0f)
-          rainbowHue -= 360.0f;
-      }
-
-      ui_render(win);
     }
 
-    save_state();
+    if (isRainbowMode) {
+      rainbowHue += 2.0f;
+      if (rainbowHue >= 360.0f)
+        rainbowHue -= 360.0f;
+    }
 
-    SDL_GL_DeleteContext(glContext);
-    SDL_DestroyWindow(win);
-    SDL_Quit();
-    return 0;
+    ui_render(win);
   }
+
+  save_state();
+  infer_stop(&inferWorker);
+  if (modelLoaded)
+    model_close(&model);
+  solve_free(&solveResult);
+
+  SDL_GL_DeleteContext(glContext);
+  SDL_DestroyWindow(win);
+  SDL_Quit();
+  return 0;
+}
+
+// The journal watches the calculator, history, RPN stack, graph entries and
+// the per-mode operands. Matrices, stats data and the worksheet are not
+// journaled.
+void initUndo(void) {
+  undo_watch(&undoLog, &calc, sizeof(calc));
+  undo_watch(&undoLog, history, sizeof(history));
+  undo_watch(&undoLog, &historyCount, sizeof(historyCount));
+  undo_watch_stack(&undoLog, &rpnStack);
+  undo_watch(&undoLog, graphEquations, sizeof(graphEquations));
+  undo_watch(&undoLog, graphPoints, sizeof(graphPoints));
+  undo_watch(&undoLog, &numGraphPoints, sizeof(numGraphPoints));
+  undo_watch(&undoLog, unitQuery, sizeof(unitQuery));
+  undo_watch(&undoLog, solveQuery, sizeof(solveQuery));
+  undo_watch(&undoLog, &cxStored, sizeof(cxStored));
+  undo_watch(&undoLog, &fracStored, sizeof(fracStored));
+  undo_watch(&undoLog, &fracValue, sizeof(fracValue));
+  undo_watch(&undoLog, fracShownText, sizeof(fracShownText));
+  undo_watch(&undoLog, &progValue, sizeof(progValue));
+  undo_watch(&undoLog, &progStored, sizeof(progStored));
+  undo_watch(&undoLog, &progOp, sizeof(progOp));
+  undo_watch(&undoLog, &progHasOp, sizeof(progHasOp));
+  undo_watch(&undoLog, &progFresh, sizeof(progFresh));
+  undo_watch(&undoLog, &statsPendingX, sizeof(statsPendingX));
+  undo_watch(&undoLog, &statsHasX, sizeof(statsHasX));
 }
 
 void save_state() {
@@ -2865,25 +5012,61 @@ void save_state() {
   if (!f)
     return;
 
+  uint32_t magic = STATE_MAGIC;
+  fwrite(&magic, sizeof(magic), 1, f);
   fwrite(&calc, sizeof(Calculator), 1, f);
 
   fwrite(&historyCount, sizeof(int), 1, f);
   fwrite(history, sizeof(HistoryEntry), 8, f);
 
+  uint64_t depth = rpnStack.depth;
+  fwrite(&depth, sizeof(depth), 1, f);
+  fwrite(rpnStack.data, sizeof(double), rpnStack.depth, f);
+
   fclose(f);
+
+  if (!isProgRecording)
+    prog_save(PROG_FILE, &rpnProgram, progRegs);
+  if (currentMode == MODE_SHEET)
+    sheetCommit();
+  sheet_save(SHEET_FILE, &sheet);
 }
 
 void load_state() {
+  if (prog_load(PROG_FILE, &rpnProgram, progRegs))
+    rpnCodeValid = prog_compile(&rpnProgram, &rpnCode);
+  sheet_load(SHEET_FILE, &sheet);
+
   FILE *f = fopen("calc_state.dat", "rb");
   if (!f)
     return;
 
+  uint32_t magic = 0;
+  if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != STATE_MAGIC) {
+    fclose(f);
+    return;
+  }
   fread(&calc, sizeof(Calculator), 1, f);
 
   fread(&historyCount, sizeof(int), 1, f);
   if (historyCount > 8)
     historyCount = 8;
+  if (historyCount < 0)
+    historyCount = 0;
   fread(history, sizeof(HistoryEntry), 8, f);
 
+  // A corrupt depth must not size the stack past what the file holds
+  uint64_t depth = 0;
+  long at = ftell(f);
+  if (fread(&depth, sizeof(depth), 1, f) == 1 && at >= 0 &&
+      fseek(f, 0, SEEK_END) == 0) {
+    long end = ftell(f);
+    uint64_t left = end > at ? (uint64_t)(end - at) - sizeof(depth) : 0;
+    if (depth <= left / sizeof(double) &&
+        fseek(f, at + (long)sizeof(depth), SEEK_SET) == 0 &&
+        rpn_reserve(&rpnStack, (size_t)depth))
+      rpnStack.depth = fread(rpnStack.data, sizeof(double), depth, f);
+  }
+
   fclose(f);
 }
\ No newline at end of file
@@ -0,0 +1,609 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATRIX_X86 1
+#endif
+
+// GEMM blocking: an MR x NR register tile, KC x NR B panels sized for L1,
+// MC x KC A blocks for L2.
+#define MAT_MR 4
+#define MAT_NR 8
+#define MAT_MC 128
+#define MAT_KC 256
+#define MAT_NC 1024
+#define MAT_NB 64 // panel width of the blocked LU and triangular solves
+#define MAT_MAX_THREADS 16
+#define MAT_MAX_DIM 4096
+#define MAT_PARALLEL_FLOPS (1 << 21)
+
+// Row-major, 64-byte aligned.
+typedef struct {
+  int rows, cols;
+  double *data;
+} Matrix;
+
+typedef void (*MatrixKernel)(int kc, const double *a, const double *b,
+                             double *c, int ldc, double alpha);
+
+static int matrix_create(Matrix *m, int rows, int cols) {
+  void *p = NULL;
+  size_t n = (size_t)(rows > 0 ? rows : 1) * (cols > 0 ? cols : 1);
+  if (posix_memalign(&p, 64, n * sizeof(double)) != 0)
+    return 0;
+  memset(p, 0, n * sizeof(double));
+  m->rows = rows;
+  m->cols = cols;
+  m->data = p;
+  return 1;
+}
+
+static void matrix_free(Matrix *m) {
+  free(m->data);
+  m->data = NULL;
+  m->rows = m->cols = 0;
+}
+
+static int matrix_copy(Matrix *dst, const Matrix *src) {
+  Matrix t;
+  if (!matrix_create(&t, src->rows, src->cols))
+    return 0;
+  memcpy(t.data, src->data, (size_t)src->rows * src->cols * sizeof(double));
+  matrix_free(dst);
+  *dst = t;
+  return 1;
+}
+
+// Keeps the overlapping top-left block.
+static int matrix_resize(Matrix *m, int rows, int cols) {
+  Matrix t;
+  if (!matrix_create(&t, rows, cols))
+    return 0;
+  int r = rows < m->rows ? rows : m->rows;
+  int c = cols < m->cols ? cols : m->cols;
+  for (int i = 0; i < r; i++)
+    memcpy(t.data + (size_t)i * cols, m->data + (size_t)i * m->cols,
+           c * sizeof(double));
+  matrix_free(m);
+  *m = t;
+  return 1;
+}
+
+static void matrix_identity(Matrix *m) {
+  memset(m->data, 0, (size_t)m->rows * m->cols * sizeof(double));
+  for (int i = 0; i < m->rows && i < m->cols; i++)
+    m->data[(size_t)i * m->cols + i] = 1.0;
+}
+
+static void matrix_random(Matrix *m) {
+  for (size_t i = 0; i < (size_t)m->rows * m->cols; i++)
+    m->data[i] = 2.0 * rand() / RAND_MAX - 1.0;
+}
+
+static int matrix_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > MAT_MAX_THREADS)
+    n = MAT_MAX_THREADS;
+  return (int)n;
+}
+
+typedef struct {
+  void (*fn)(void *ctx, int begin, int end);
+  void *ctx;
+  int begin, end;
+} MatrixTask;
+
+static void *matrix_task_run(void *arg) {
+  MatrixTask *t = arg;
+  if (t->begin < t->end)
+    t->fn(t->ctx, t->begin, t->end);
+  return NULL;
+}
+
+// Splits [0, count) into per-thread ranges aligned to `grain`.
+static void matrix_parallel_for(int count, int grain, double flops,
+                                void (*fn)(void *, int, int), void *ctx) {
+  int nthreads = flops < MAT_PARALLEL_FLOPS ? 1 : matrix_thread_count();
+  int chunks = (count + grain - 1) / grain;
+  if (nthreads > chunks)
+    nthreads = chunks;
+  if (nthreads <= 1) {
+    fn(ctx, 0, count);
+    return;
+  }
+  MatrixTask tasks[MAT_MAX_THREADS];
+  pthread_t threads[MAT_MAX_THREADS];
+  int per = (chunks + nthreads - 1) / nthreads * grain;
+  for (int t = 0; t < nthreads; t++) {
+    tasks[t].fn = fn;
+    tasks[t].ctx = ctx;
+    tasks[t].begin = t * per < count ? t * per : count;
+    tasks[t].end = (t + 1) * per < count ? (t + 1) * per : count;
+    if (t > 0)
+      pthread_create(&threads[t], NULL, matrix_task_run, &tasks[t]);
+  }
+  matrix_task_run(&tasks[0]);
+  for (int t = 1; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+}
+
+static void matrix_kernel_scalar(int kc, const double *a, const double *b,
+                                 double *c, int ldc, double alpha) {
+  double acc[MAT_MR][MAT_NR] = {{0}};
+  for (int p = 0; p < kc; p++) {
+    for (int i = 0; i < MAT_MR; i++)
+      for (int j = 0; j < MAT_NR; j++)
+        acc[i][j] += a[i] * b[j];
+    a += MAT_MR;
+    b += MAT_NR;
+  }
+  for (int i = 0; i < MAT_MR; i++)
+    for (int j = 0; j < MAT_NR; j++)
+      c[i * ldc + j] += alpha * acc[i][j];
+}
+
+#ifdef MATRIX_X86
+// 4x8 tile held in eight ymm accumulators.
+__attribute__((target("avx2,fma"))) static void
+matrix_kernel_avx2(int kc, const double *a, const double *b, double *c,
+                   int ldc, double alpha) {
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  for (int p = 0; p < kc; p++) {
+    __m256d b0 = _mm256_load_pd(b);
+    __m256d b1 = _mm256_load_pd(b + 4);
+    __m256d a0 = _mm256_broadcast_sd(a);
+    __m256d a1 = _mm256_broadcast_sd(a + 1);
+    c00 = _mm256_fmadd_pd(a0, b0, c00);
+    c01 = _mm256_fmadd_pd(a0, b1, c01);
+    c10 = _mm256_fmadd_pd(a1, b0, c10);
+    c11 = _mm256_fmadd_pd(a1, b1, c11);
+    __m256d a2 = _mm256_broadcast_sd(a + 2);
+    __m256d a3 = _mm256_broadcast_sd(a + 3);
+    c20 = _mm256_fmadd_pd(a2, b0, c20);
+    c21 = _mm256_fmadd_pd(a2, b1, c21);
+    c30 = _mm256_fmadd_pd(a3, b0, c30);
+    c31 = _mm256_fmadd_pd(a3, b1, c31);
+    a += MAT_MR;
+    b += MAT_NR;
+  }
+  __m256d al = _mm256_set1_pd(alpha);
+  __m256d acc[8] = {c00, c01, c10, c11, c20, c21, c30, c31};
+  for (int i = 0; i < MAT_MR; i++) {
+    double *row = c + i * ldc;
+    _mm256_storeu_pd(row,
+                     _mm256_fmadd_pd(al, acc[2 * i], _mm256_loadu_pd(row)));
+    _mm256_storeu_pd(row + 4, _mm256_fmadd_pd(al, acc[2 * i + 1],
+                                              _mm256_loadu_pd(row + 4)));
+  }
+}
+#endif
+
+static MatrixKernel matrix_kernel(void) {
+  static MatrixKernel k = NULL;
+  if (!k) {
+    k = matrix_kernel_scalar;
+#ifdef MATRIX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      k = matrix_kernel_avx2;
+#endif
+  }
+  return k;
+}
+
+// Packs an mc x kc block of A into MR-row panels, k-major, zero padded.
+static void matrix_pack_a(int mc, int kc, const double *A, int lda,
+                          double *buf) {
+  for (int i = 0; i < mc; i += MAT_MR) {
+    for (int p = 0; p < kc; p++)
+      for (int r = 0; r < MAT_MR; r++)
+        *buf++ = (i + r < mc) ? A[(size_t)(i + r) * lda + p] : 0.0;
+  }
+}
+
+// Packs a kc x nc block of B into NR-column panels, zero padded.
+static void matrix_pack_b(int kc, int nc, const double *B, int ldb,
+                          double *buf) {
+  for (int j = 0; j < nc; j += MAT_NR) {
+    int nr = nc - j < MAT_NR ? nc - j : MAT_NR;
+    for (int p = 0; p < kc; p++) {
+      const double *src = B + (size_t)p * ldb + j;
+      int c = 0;
+      for (; c < nr; c++)
+        *buf++ = src[c];
+      for (; c < MAT_NR; c++)
+        *buf++ = 0.0;
+    }
+  }
+}
+
+typedef struct {
+  int m, n, k;
+  double alpha;
+  const double *A, *B;
+  double *C;
+  int lda, ldb, ldc;
+} MatrixGemmArgs;
+
+static void matrix_gemm_rows(void *ctx, int begin, int end) {
+  MatrixGemmArgs *g = ctx;
+  MatrixKernel kernel = matrix_kernel();
+  double *bufA, *bufB;
+  if (posix_memalign((void **)&bufA, 64, MAT_MC * MAT_KC * sizeof(double)))
+    return;
+  if (posix_memalign((void **)&bufB, 64,
+                     (size_t)MAT_KC * (MAT_NC + MAT_NR) * sizeof(double))) {
+    free(bufA);
+    return;
+  }
+  double edge[MAT_MR * MAT_NR];
+
+  for (int jc = 0; jc < g->n; jc += MAT_NC) {
+    int nc = g->n - jc < MAT_NC ? g->n - jc : MAT_NC;
+    for (int pc = 0; pc < g->k; pc += MAT_KC) {
+      int kc = g->k - pc < MAT_KC ? g->k - pc : MAT_KC;
+      matrix_pack_b(kc, nc, g->B + (size_t)pc * g->ldb + jc, g->ldb, bufB);
+      for (int ic = begin; ic < end; ic += MAT_MC) {
+        int mc = end - ic < MAT_MC ? end - ic : MAT_MC;
+        matrix_pack_a(mc, kc, g->A + (size_t)ic * g->lda + pc, g->lda, bufA);
+        for (int jr = 0; jr < nc; jr += MAT_NR) {
+          int nr = nc - jr < MAT_NR ? nc - jr : MAT_NR;
+          for (int ir = 0; ir < mc; ir += MAT_MR) {
+            int mr = mc - ir < MAT_MR ? mc - ir : MAT_MR;
+            double *c = g->C + (size_t)(ic + ir) * g->ldc + jc + jr;
+            const double *pa = bufA + (size_t)ir * kc;
+            const double *pb = bufB + (size_t)jr * kc;
+            if (mr == MAT_MR && nr == MAT_NR) {
+              kernel(kc, pa, pb, c, g->ldc, g->alpha);
+            } else {
+              memset(edge, 0, sizeof(edge));
+              kernel(kc, pa, pb, edge, MAT_NR, g->alpha);
+              for (int i = 0; i < mr; i++)
+                for (int j = 0; j < nr; j++)
+                  c[(size_t)i * g->ldc + j] += edge[i * MAT_NR + j];
+            }
+          }
+        }
+      }
+    }
+  }
+  free(bufA);
+  free(bufB);
+}
+
+// C += alpha * A * B for an m x k A and k x n B, rows of C split across
+// threads.
+static void matrix_gemm(int m, int n, int k, double alpha, const double *A,
+                        int lda, const double *B, int ldb, double *C,
+                        int ldc) {
+  if (m <= 0 || n <= 0 || k <= 0)
+    return;
+  MatrixGemmArgs g = {m, n, k, alpha, A, B, C, lda, ldb, ldc};
+  matrix_kernel(); // pick the kernel before any worker thread asks for it
+  matrix_parallel_for(m, MAT_MR, 2.0 * m * n * k, matrix_gemm_rows, &g);
+}
+
+static int matrix_multiply(const Matrix *a, const Matrix *b, Matrix *out) {
+  if (a->cols != b->rows)
+    return 0;
+  Matrix t;
+  if (!matrix_create(&t, a->rows, b->cols))
+    return 0;
+  matrix_gemm(a->rows, b->cols, a->cols, 1.0, a->data, a->cols, b->data,
+              b->cols, t.data, t.cols);
+  matrix_free(out);
+  *out = t;
+  return 1;
+}
+
+static int matrix_add(const Matrix *a, const Matrix *b, double sign,
+                      Matrix *out) {
+  if (a->rows != b->rows || a->cols != b->cols)
+    return 0;
+  Matrix t;
+  if (!matrix_create(&t, a->rows, a->cols))
+    return 0;
+  for (size_t i = 0; i < (size_t)a->rows * a->cols; i++)
+    t.data[i] = a->data[i] + sign * b->data[i];
+  matrix_free(out);
+  *out = t;
+  return 1;
+}
+
+// Transposes in 32x32 tiles so both sides stay cache resident.
+static int matrix_transpose(const Matrix *a, Matrix *out) {
+  Matrix t;
+  if (!matrix_create(&t, a->cols, a->rows))
+    return 0;
+  for (int i0 = 0; i0 < a->rows; i0 += 32)
+    for (int j0 = 0; j0 < a->cols; j0 += 32)
+      for (int i = i0; i < i0 + 32 && i < a->rows; i++)
+        for (int j = j0; j < j0 + 32 && j < a->cols; j++)
+          t.data[(size_t)j * t.cols + i] = a->data[(size_t)i * a->cols + j];
+  matrix_free(out);
+  *out = t;
+  return 1;
+}
+
+// Right-looking blocked LU with partial pivoting, in place (unit L below the
+// diagonal, U on and above). piv[j] is the row swapped with j at step j.
+// Returns 0 for a singular matrix.
+static int matrix_lu(Matrix *a, int *piv, int *sign) {
+  int n = a->rows;
+  double *A = a->data;
+  int ok = 1;
+  *sign = 1;
+  for (int k = 0; k < n; k += MAT_NB) {
+    int kb = n - k < MAT_NB ? n - k : MAT_NB;
+    for (int j = k; j < k + kb; j++) {
+      int p = j;
+      double best = fabs(A[(size_t)j * n + j]);
+      for (int i = j + 1; i < n; i++) {
+        double v = fabs(A[(size_t)i * n + j]);
+        if (v > best) {
+          best = v;
+          p = i;
+        }
+      }
+      piv[j] = p;
+      if (best == 0) {
+        ok = 0;
+        continue;
+      }
+      if (p != j) {
+        double *rj = A + (size_t)j * n, *rp = A + (size_t)p * n;
+        for (int c = 0; c < n; c++) {
+          double t = rj[c];
+          rj[c] = rp[c];
+          rp[c] = t;
+        }
+        *sign = -*sign;
+      }
+      double inv = 1.0 / A[(size_t)j * n + j];
+      const double *rowJ = A + (size_t)j * n;
+      for (int i = j + 1; i < n; i++) {
+        double *rowI = A + (size_t)i * n;
+        double l = rowI[j] *= inv;
+        for (int c = j + 1; c < k + kb; c++)
+          rowI[c] -= l * rowJ[c];
+      }
+    }
+    // U12 = L11^-1 A12
+    for (int i = k + 1; i < k + kb; i++) {
+      double *rowI = A + (size_t)i * n;
+      for (int r = k; r < i; r++) {
+        double l = rowI[r];
+        const double *rowR = A + (size_t)r * n;
+        for (int c = k + kb; c < n; c++)
+          rowI[c] -= l * rowR[c];
+      }
+    }
+    // A22 -= L21 * U12
+    int rest = n - k - kb;
+    matrix_gemm(rest, rest, kb, -1.0, A + (size_t)(k + kb) * n + k, n,
+                A + (size_t)k * n + k + kb, n, A + (size_t)(k + kb) * n + k + kb,
+                n);
+  }
+  return ok;
+}
+
+static double matrix_det(const Matrix *a) {
+  if (a->rows != a->cols || a->rows == 0)
+    return NAN;
+  Matrix lu = {0, 0, NULL};
+  int *piv = malloc(a->rows * sizeof(int));
+  int sign;
+  double det = 0;
+  if (piv && matrix_copy(&lu, a) && matrix_lu(&lu, piv, &sign)) {
+    det = sign;
+    for (int i = 0; i < a->rows; i++)
+      det *= lu.data[(size_t)i * a->cols + i];
+  }
+  free(piv);
+  matrix_free(&lu);
+  return det;
+}
+
+// Solves LU X = P B in place on the n x nrhs matrix b, one MAT_NB block of
+// rows at a time with the off-diagonal part as a GEMM.
+static void matrix_lu_solve(const Matrix *lu, const int *piv, Matrix *b) {
+  int n = lu->rows, m = b->cols;
+  const double *L = lu->data;
+  double *B = b->data;
+  for (int j = 0; j < n; j++) {
+    if (piv[j] != j) {
+      double *r0 = B + (size_t)j * m, *r1 = B + (size_t)piv[j] * m;
+      for (int c = 0; c < m; c++) {
+        double t = r0[c];
+        r0[c] = r1[c];
+        r1[c] = t;
+      }
+    }
+  }
+  for (int ib = 0; ib < n; ib += MAT_NB) {
+    int ie = n - ib < MAT_NB ? n : ib + MAT_NB;
+    matrix_gemm(ie - ib, m, ib, -1.0, L + (size_t)ib * n, n, B, m,
+                B + (size_t)ib * m, m);
+    for (int i = ib; i < ie; i++)
+      for (int r = ib; r < i; r++) {
+        double l = L[(size_t)i * n + r];
+        for (int c = 0; c < m; c++)
+          B[(size_t)i * m + c] -= l * B[(size_t)r * m + c];
+      }
+  }
+  int lastStart = (n - 1) / MAT_NB * MAT_NB;
+  for (int ib = lastStart; ib >= 0; ib -= MAT_NB) {
+    int ie = n - ib < MAT_NB ? n : ib + MAT_NB;
+    matrix_gemm(ie - ib, m, n - ie, -1.0, L + (size_t)ib * n + ie, n,
+                B + (size_t)ie * m, m, B + (size_t)ib * m, m);
+    for (int i = ie - 1; i >= ib; i--) {
+      for (int r = i + 1; r < ie; r++) {
+        double u = L[(size_t)i * n + r];
+        for (int c = 0; c < m; c++)
+          B[(size_t)i * m + c] -= u * B[(size_t)r * m + c];
+      }
+      double inv = 1.0 / L[(size_t)i * n + i];
+      for (int c = 0; c < m; c++)
+        B[(size_t)i * m + c] *= inv;
+    }
+  }
+}
+
+// x = a^-1 b. Returns 0 for mismatched shapes or a singular a.
+static int matrix_solve(const Matrix *a, const Matrix *b, Matrix *x) {
+  if (a->rows != a->cols || b->rows != a->rows)
+    return 0;
+  Matrix lu = {0, 0, NULL}, t = {0, 0, NULL};
+  int *piv = malloc(a->rows * sizeof(int));
+  int sign, ok = 0;
+  if (piv && matrix_copy(&lu, a) && matrix_copy(&t, b) &&
+      matrix_lu(&lu, piv, &sign)) {
+    matrix_lu_solve(&lu, piv, &t);
+    matrix_free(x);
+    *x = t;
+    t.data = NULL;
+    ok = 1;
+  }
+  free(piv);
+  matrix_free(&lu);
+  matrix_free(&t);
+  return ok;
+}
+
+static int matrix_inverse(const Matrix *a, Matrix *out) {
+  Matrix id = {0, 0, NULL};
+  if (a->rows != a->cols || !matrix_create(&id, a->rows, a->cols))
+    return 0;
+  matrix_identity(&id);
+  int ok = matrix_solve(a, &id, out);
+  matrix_free(&id);
+  return ok;
+}
+
+// Blocked Householder QR: a = q r with q orthogonal (m x m) and r upper
+// (m x n). Each MAT_NB panel is factored column by column, its reflectors
+// are gathered into the compact WY form I - V T V^T and the trailing columns
+// and q are updated with GEMMs.
+static int matrix_qr(const Matrix *a, Matrix *q, Matrix *r) {
+  int m = a->rows, n = a->cols;
+  Matrix R = {0, 0, NULL}, Q = {0, 0, NULL};
+  int wide = n > m ? n : m;
+  double *V = malloc((size_t)m * MAT_NB * sizeof(double));
+  double *Vt = malloc((size_t)m * MAT_NB * sizeof(double));
+  double *W = malloc((size_t)wide * MAT_NB * sizeof(double));
+  double T[MAT_NB][MAT_NB], tau[MAT_NB];
+  int ok = V && Vt && W && matrix_copy(&R, a) && matrix_create(&Q, m, m);
+  int steps = m - 1 < n ? m - 1 : n;
+  if (ok)
+    matrix_identity(&Q);
+  for (int j = 0; ok && j < steps; j += MAT_NB) {
+    int nb = steps - j < MAT_NB ? steps - j : MAT_NB;
+    int len = m - j;
+    memset(V, 0, (size_t)len * nb * sizeof(double));
+    for (int t = 0; t < nb; t++) {
+      int col = j + t;
+      double norm = 0;
+      for (int i = t; i < len; i++) {
+        double x = R.data[(size_t)(j + i) * n + col];
+        V[(size_t)i * nb + t] = x;
+        norm += x * x;
+      }
+      norm = sqrt(norm);
+      tau[t] = 0;
+      if (norm == 0)
+        continue;
+      double alpha = V[(size_t)t * nb + t] > 0 ? -norm : norm;
+      V[(size_t)t * nb + t] -= alpha;
+      double vtv = 0;
+      for (int i = t; i < len; i++)
+        vtv += V[(size_t)i * nb + t] * V[(size_t)i * nb + t];
+      tau[t] = 2.0 / vtv;
+      for (int c = col + 1; c < j + nb; c++) {
+        double s = 0;
+        for (int i = t; i < len; i++)
+          s += V[(size_t)i * nb + t] * R.data[(size_t)(j + i) * n + c];
+        s *= tau[t];
+        for (int i = t; i < len; i++)
+          R.data[(size_t)(j + i) * n + c] -= s * V[(size_t)i * nb + t];
+      }
+      R.data[(size_t)col * n + col] = alpha;
+      for (int i = t + 1; i < len; i++)
+        R.data[(size_t)(j + i) * n + col] = 0;
+    }
+    // T[0:t, t] = -tau_t T[0:t, 0:t] V[:, 0:t]^T v_t
+    for (int t = 0; t < nb; t++) {
+      double z[MAT_NB];
+      for (int s = 0; s < t; s++) {
+        z[s] = 0;
+        for (int i = t; i < len; i++)
+          z[s] += V[(size_t)i * nb + s] * V[(size_t)i * nb + t];
+      }
+      for (int s = 0; s < t; s++) {
+        double acc = 0;
+        for (int u = s; u < t; u++)
+          acc += T[s][u] * z[u];
+        T[s][t] = -tau[t] * acc;
+      }
+      T[t][t] = tau[t];
+    }
+    for (int i = 0; i < len; i++)
+      for (int t = 0; t < nb; t++)
+        Vt[(size_t)t * len + i] = V[(size_t)i * nb + t];
+
+    // R2 -= V T^T (V^T R2)
+    int nc = n - j - nb;
+    if (nc > 0) {
+      double *R2 = R.data + (size_t)j * n + j + nb;
+      memset(W, 0, (size_t)nb * nc * sizeof(double));
+      matrix_gemm(nb, nc, len, 1.0, Vt, len, R2, n, W, nc);
+      for (int s = nb - 1; s >= 0; s--)
+        for (int c = 0; c < nc; c++) {
+          double acc = 0;
+          for (int u = 0; u <= s; u++)
+            acc += T[u][s] * W[(size_t)u * nc + c];
+          W[(size_t)s * nc + c] = acc;
+        }
+      matrix_gemm(len, nc, nb, -1.0, V, nb, W, nc, R2, n);
+    }
+    // Q2 -= (Q2 V) T V^T
+    double *Q2 = Q.data + j;
+    memset(W, 0, (size_t)m * nb * sizeof(double));
+    matrix_gemm(m, nb, len, 1.0, Q2, m, V, nb, W, nb);
+    for (int row = 0; row < m; row++) {
+      double *w = W + (size_t)row * nb;
+      for (int c = nb - 1; c >= 0; c--) {
+        double acc = 0;
+        for (int u = 0; u <= c; u++)
+          acc += w[u] * T[u][c];
+        w[c] = acc;
+      }
+    }
+    matrix_gemm(m, len, nb, -1.0, W, nb, Vt, len, Q2, m);
+  }
+  free(V);
+  free(Vt);
+  free(W);
+  if (!ok) {
+    matrix_free(&R);
+    matrix_free(&Q);
+    return 0;
+  }
+  matrix_free(q);
+  matrix_free(r);
+  *q = Q;
+  *r = R;
+  return 1;
+}
+
+#endif
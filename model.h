@@ -1,14 +1,40 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include <fcntl.h>
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MODEL_X86 1
+#endif
 
+// Shape of the network train.c builds, and of the headerless model.bin
+// files written before the versioned format.
 #define INPUT_NODES 784
 #define HIDDEN_NODES 128
 #define OUTPUT_NODES 10
 
+#define MODEL_MAGIC "CALCNET" // with its NUL, the first 8 bytes of a file
+#define MODEL_VERSION 1
+#define MODEL_ALIGN 64 // section alignment written by model_save
+#define MODEL_MAX_SECTIONS 16
+#define MODEL_MAX_INPUTS 4096
+#define MODEL_MAX_HIDDEN 4096
+#define MODEL_MAX_OUTPUTS 256
+#define MODEL_MAX_CHANNELS 32
+#define MODEL_CNN_MAX_SIDE 28
+#define MODEL_SPARSE_MAX(inputs) ((inputs) * 3 / 4) // lit inputs, sparse path
+#define MODEL_BATCH 8 // inputs per pass of the batched output layer
+#define QUANT_INPUT_MAX 127
+
 typedef struct {
   float w1[INPUT_NODES][HIDDEN_NODES];
   float b1[HIDDEN_NODES];
@@ -16,59 +42,800 @@ typedef struct {
   float b2[OUTPUT_NODES];
 } NeuralNetwork;
 
-static int model_load(const char *filename, NeuralNetwork *nn) {
-  FILE *f = fopen(filename, "rb");
+enum { MODEL_MLP = 1, MODEL_CNN = 2 };
+enum { MODEL_F32 = 1, MODEL_Q8 = 2 };
+enum { MODEL_W1, MODEL_S1, MODEL_B1, MODEL_W2, MODEL_B2, MODEL_MLP_SECTIONS };
+// A CNN's dense layers use the MLP sections, w1 taking the pooled features
+enum {
+  MODEL_K1 = MODEL_MLP_SECTIONS,
+  MODEL_KB1,
+  MODEL_K2,
+  MODEL_KB2,
+  MODEL_CNN_SECTIONS
+};
+
+// On-disk header, little-endian. Sections are located by offset so a
+// reader never assumes the layout, and aligned so they can be used in
+// place straight from the mapping. headerCrc covers the header up to
+// itself, payloadCrc every byte after the header.
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t kind;
+  uint32_t dtype;
+  uint32_t align;
+  uint32_t dims[8]; // inputs, hidden, outputs; CNN: + side, conv1, conv2
+  uint64_t offset[MODEL_MAX_SECTIONS];
+  uint64_t size[MODEL_MAX_SECTIONS];
+  uint32_t payloadCrc;
+  uint32_t headerCrc;
+} ModelHeader;
+
+// A network viewed in place in its read-only mapping. For MODEL_F32 w1 is
+// inputs x hidden, input-major. For MODEL_Q8 q1 holds int8 weights, four
+// inputs to a 32-bit lane per hidden unit ((inputs + 3) / 4 groups of
+// hidden x 4 bytes), and s1 the float scale of each unit's column. w2 is
+// hidden x outputs.
+//
+// A MODEL_CNN takes a side x side image through two 3x3 valid convolutions,
+// each with ReLU and 2x2 max pooling, into features values (rows x columns
+// x channels) that feed w1. k1 is 9 x conv1 and k2 9 * conv1 x conv2, tap
+// (row, column) major then input channel.
+typedef struct {
+  int kind, dtype;
+  int inputs, hidden, outputs;
+  int side, conv1, conv2, features;
+  const float *k1, *kb1, *k2, *kb2;
+  const float *w1;
+  const int8_t *q1;
+  const float *s1, *b1, *w2, *b2;
+  void *map;
+  size_t mapSize;
+} Model;
+
+static inline uint32_t model_crc32(uint32_t crc, const void *data, size_t n) {
+  static uint32_t table[256];
+  if (!table[1]) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  }
+  const unsigned char *p = data;
+  crc = ~crc;
+  while (n--)
+    crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static inline size_t model_quant_groups(int inputs) {
+  return ((size_t)inputs + 3) / 4;
+}
+
+// Side of a 3x3 valid convolution's output after 2x2 pooling.
+static inline int model_pool_side(int side) { return (side - 2) / 2; }
+
+static inline int model_cnn_features(int side, int conv2) {
+  int p = model_pool_side(model_pool_side(side));
+  return p * p * conv2;
+}
+
+// Byte size each section must have for the given kind, weight type and
+// dims; sections the kind does not use are 0.
+static inline void model_sizes(int kind, int dtype, const uint32_t *dims,
+                               uint64_t *size) {
+  uint64_t rows = dims[0], hidden = dims[1], outputs = dims[2];
+  memset(size, 0, MODEL_MAX_SECTIONS * sizeof(uint64_t));
+  if (kind == MODEL_CNN) {
+    size[MODEL_K1] = 9 * (uint64_t)dims[4] * sizeof(float);
+    size[MODEL_KB1] = (uint64_t)dims[4] * sizeof(float);
+    size[MODEL_K2] = 9 * (uint64_t)dims[4] * dims[5] * sizeof(float);
+    size[MODEL_KB2] = (uint64_t)dims[5] * sizeof(float);
+    rows = model_cnn_features(dims[3], dims[5]);
+  }
+  if (dtype == MODEL_Q8) {
+    size[MODEL_W1] = model_quant_groups(rows) * hidden * 4;
+    size[MODEL_S1] = hidden * sizeof(float);
+  } else {
+    size[MODEL_W1] = rows * hidden * sizeof(float);
+  }
+  size[MODEL_B1] = hidden * sizeof(float);
+  size[MODEL_W2] = hidden * outputs * sizeof(float);
+  size[MODEL_B2] = outputs * sizeof(float);
+}
+
+static inline void model_close(Model *m) {
+  if (m->map)
+    munmap(m->map, m->mapSize);
+  memset(m, 0, sizeof(*m));
+}
+
+// Checks the header against itself and the file and points m at the
+// sections; only the header page is read, so weights are faulted in as
+// inference first touches them and the page cache shares them between
+// processes. verify also checks the payload CRC, which reads every page.
+// A headerless model.bin of the compiled-in shape is accepted as-is.
+// Returns NULL on success or why the file was rejected.
+static inline const char *model_open(const char *path, Model *m,
+                                     int verify) {
+  memset(m, 0, sizeof(*m));
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return "cannot open file";
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return "cannot read file";
+  }
+  size_t fileSize = (size_t)st.st_size;
+  void *map = mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return "cannot map file";
+  m->map = map;
+  m->mapSize = fileSize;
+  const unsigned char *base = map;
+
+  ModelHeader h;
+  if (fileSize < sizeof(h) || memcmp(base, MODEL_MAGIC, 8) != 0) {
+    if (fileSize != sizeof(NeuralNetwork)) {
+      model_close(m);
+      return "not a model file";
+    }
+    memset(&h, 0, sizeof(h));
+    h.kind = MODEL_MLP;
+    h.dtype = MODEL_F32;
+    h.align = 4;
+    h.dims[0] = INPUT_NODES;
+    h.dims[1] = HIDDEN_NODES;
+    h.dims[2] = OUTPUT_NODES;
+    h.offset[MODEL_W1] = offsetof(NeuralNetwork, w1);
+    h.offset[MODEL_B1] = offsetof(NeuralNetwork, b1);
+    h.offset[MODEL_W2] = offsetof(NeuralNetwork, w2);
+    h.offset[MODEL_B2] = offsetof(NeuralNetwork, b2);
+    model_sizes(MODEL_MLP, MODEL_F32, h.dims, h.size);
+  } else {
+    memcpy(&h, base, sizeof(h));
+    const char *err = NULL;
+    if (model_crc32(0, &h, offsetof(ModelHeader, headerCrc)) != h.headerCrc)
+      err = "header checksum mismatch";
+    else if (h.version > MODEL_VERSION)
+      err = "model file is from a newer version";
+    else if (h.align < 4 || (h.align & (h.align - 1)))
+      err = "bad section alignment";
+    else if (h.kind != MODEL_MLP && h.kind != MODEL_CNN)
+      err = "unsupported network kind";
+    else if (h.dtype != MODEL_F32 &&
+             (h.dtype != MODEL_Q8 || h.kind != MODEL_MLP))
+      err = "unsupported weight type";
+    else if (verify && model_crc32(0, base + sizeof(h),
+                                   fileSize - sizeof(h)) != h.payloadCrc)
+      err = "payload checksum mismatch";
+    if (err) {
+      model_close(m);
+      return err;
+    }
+  }
+
+  if (h.dims[0] < 1 || h.dims[0] > MODEL_MAX_INPUTS || h.dims[1] < 8 ||
+      h.dims[1] > MODEL_MAX_HIDDEN || h.dims[1] % 8 || h.dims[2] < 1 ||
+      h.dims[2] > MODEL_MAX_OUTPUTS ||
+      (h.kind == MODEL_CNN &&
+       (h.dims[3] < 10 || h.dims[3] > MODEL_CNN_MAX_SIDE ||
+        h.dims[0] != h.dims[3] * h.dims[3] || h.dims[4] < 8 ||
+        h.dims[4] > MODEL_MAX_CHANNELS || h.dims[4] % 8 || h.dims[5] < 8 ||
+        h.dims[5] > MODEL_MAX_CHANNELS || h.dims[5] % 8))) {
+    model_close(m);
+    return "unsupported layer sizes";
+  }
+  uint64_t want[MODEL_MAX_SECTIONS];
+  model_sizes(h.kind, h.dtype, h.dims, want);
+  for (int s = 0; s < MODEL_MAX_SECTIONS; s++) {
+    if (h.size[s] != want[s] ||
+        (want[s] && (h.offset[s] % h.align || h.offset[s] > fileSize ||
+                     fileSize - h.offset[s] < want[s]))) {
+      model_close(m);
+      return "section missing or out of bounds";
+    }
+  }
+
+  m->kind = h.kind;
+  m->dtype = h.dtype;
+  m->inputs = h.dims[0];
+  m->hidden = h.dims[1];
+  m->outputs = h.dims[2];
+  m->features = m->inputs;
+  if (h.kind == MODEL_CNN) {
+    m->side = h.dims[3];
+    m->conv1 = h.dims[4];
+    m->conv2 = h.dims[5];
+    m->features = model_cnn_features(m->side, m->conv2);
+    m->k1 = (const float *)(base + h.offset[MODEL_K1]);
+    m->kb1 = (const float *)(base + h.offset[MODEL_KB1]);
+    m->k2 = (const float *)(base + h.offset[MODEL_K2]);
+    m->kb2 = (const float *)(base + h.offset[MODEL_KB2]);
+  }
+  if (h.dtype == MODEL_Q8) {
+    m->q1 = (const int8_t *)(base + h.offset[MODEL_W1]);
+    m->s1 = (const float *)(base + h.offset[MODEL_S1]);
+  } else {
+    m->w1 = (const float *)(base + h.offset[MODEL_W1]);
+  }
+  m->b1 = (const float *)(base + h.offset[MODEL_B1]);
+  m->w2 = (const float *)(base + h.offset[MODEL_W2]);
+  m->b2 = (const float *)(base + h.offset[MODEL_B2]);
+  return NULL;
+}
+
+// Writes the header and the sections of kind, each padded to MODEL_ALIGN.
+// dims and data are laid out as in the header: MODEL_MLP_SECTIONS entries
+// for an MLP, MODEL_CNN_SECTIONS for a CNN, and data[MODEL_S1] is only
+// read for MODEL_Q8. Returns 0 on failure.
+static inline int model_save(const char *path, int kind, int dtype,
+                             const uint32_t *dims, const void *const *data) {
+  static const unsigned char zero[MODEL_ALIGN];
+  ModelHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MODEL_MAGIC, 8);
+  h.version = MODEL_VERSION;
+  h.kind = kind;
+  h.dtype = dtype;
+  h.align = MODEL_ALIGN;
+  memcpy(h.dims, dims, (kind == MODEL_CNN ? 6 : 3) * sizeof(uint32_t));
+  model_sizes(kind, dtype, h.dims, h.size);
+
+  uint64_t at = sizeof(h);
+  uint32_t crc = 0;
+  for (int s = 0; s < MODEL_MAX_SECTIONS; s++) {
+    if (!h.size[s])
+      continue;
+    uint64_t pad = (MODEL_ALIGN - at % MODEL_ALIGN) % MODEL_ALIGN;
+    crc = model_crc32(crc, zero, pad);
+    h.offset[s] = at + pad;
+    crc = model_crc32(crc, data[s], h.size[s]);
+    at = h.offset[s] + h.size[s];
+  }
+  h.payloadCrc = crc;
+  h.headerCrc = model_crc32(0, &h, offsetof(ModelHeader, headerCrc));
+
+  FILE *f = fopen(path, "wb");
   if (!f)
     return 0;
+  int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  at = sizeof(h);
+  for (int s = 0; s < MODEL_MAX_SECTIONS && ok; s++) {
+    if (!h.size[s])
+      continue;
+    ok = fwrite(zero, 1, h.offset[s] - at, f) == h.offset[s] - at &&
+         fwrite(data[s], 1, h.size[s], f) == h.size[s];
+    at = h.offset[s] + h.size[s];
+  }
+  return fclose(f) == 0 && ok;
+}
+
+// Hidden-layer kernels produce the pre-activations b1 + input * w1. w1 is
+// input-major, so each input scales one contiguous row of hidden weights.
+// They add val[k] times row idx[k] (row k when idx is NULL, which is the
+// dense pass streaming w1 front to back) from base into pre, which may
+// alias base. Units are processed in blocks that fill the vector
+// registers; a remainder goes one register at a time.
+typedef void (*ModelRowKernel)(const Model *m, const int *idx,
+                               const float *val, int n, const float *base,
+                               float *pre);
+
+static inline void model_rows_scalar(const Model *m, const int *idx,
+                                     const float *val, int n, const float *base,
+                                     float *pre) {
+  int hidden = m->hidden;
+  float acc[MODEL_MAX_HIDDEN];
+  memcpy(acc, base, hidden * sizeof(float));
+  for (int k = 0; k < n; k++) {
+    float x = val[k];
+    const float *row = m->w1 + (size_t)(idx ? idx[k] : k) * hidden;
+    for (int i = 0; i < hidden; i++)
+      acc[i] += x * row[i];
+  }
+  memcpy(pre, acc, hidden * sizeof(float));
+}
+
+#ifdef MODEL_X86
+// Up to 128 hidden units held in sixteen ymm accumulators for the pass.
+__attribute__((target("avx2,fma"), always_inline)) static inline void
+model_rows_avx2_block(const float *w1, int ld, const int *idx,
+                      const float *val, int n, const float *base, float *pre,
+                      int nb) {
+  __m256 acc[16];
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    acc[k] = _mm256_loadu_ps(base + 8 * k);
+  for (int j = 0; j < n; j++) {
+    __m256 x = _mm256_set1_ps(val[j]);
+    const float *row = w1 + (size_t)(idx ? idx[j] : j) * ld;
+#pragma GCC unroll 16
+    for (int k = 0; k < nb; k++)
+      acc[k] = _mm256_fmadd_ps(x, _mm256_loadu_ps(row + 8 * k), acc[k]);
+  }
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    _mm256_storeu_ps(pre + 8 * k, acc[k]);
+}
+
+// Kept out of line so the row pointer stays a base register and the
+// sixteen column offsets fold into the loads.
+__attribute__((target("avx2,fma"), noinline)) static void
+model_rows_avx2_block16(const float *w1, int ld, const int *idx,
+                        const float *val, int n, const float *base,
+                        float *pre) {
+  model_rows_avx2_block(w1, ld, idx, val, n, base, pre, 16);
+}
+
+__attribute__((target("avx2,fma"))) static inline void
+model_rows_avx2(const Model *m, const int *idx, const float *val, int n,
+                const float *base, float *pre) {
+  int h = 0;
+  for (; h + 128 <= m->hidden; h += 128)
+    model_rows_avx2_block16(m->w1 + h, m->hidden, idx, val, n, base + h,
+                            pre + h);
+  for (; h < m->hidden; h += 8)
+    model_rows_avx2_block(m->w1 + h, m->hidden, idx, val, n, base + h,
+                          pre + h, 1);
+}
+
+// Sixteen xmm registers hold 64 units, so rows are streamed in 256-byte
+// column blocks.
+__attribute__((target("sse2"), always_inline)) static inline void
+model_rows_sse2_block(const float *w1, int ld, const int *idx,
+                      const float *val, int n, const float *base, float *pre,
+                      int nb) {
+  __m128 acc[16];
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    acc[k] = _mm_loadu_ps(base + 4 * k);
+  for (int j = 0; j < n; j++) {
+    __m128 x = _mm_set1_ps(val[j]);
+    const float *row = w1 + (size_t)(idx ? idx[j] : j) * ld;
+#pragma GCC unroll 16
+    for (int k = 0; k < nb; k++)
+      acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(x, _mm_loadu_ps(row + 4 * k)));
+  }
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    _mm_storeu_ps(pre + 4 * k, acc[k]);
+}
+
+__attribute__((target("sse2"))) static inline void
+model_rows_sse2(const Model *m, const int *idx, const float *val, int n,
+                const float *base, float *pre) {
+  int h = 0;
+  for (; h + 64 <= m->hidden; h += 64)
+    model_rows_sse2_block(m->w1 + h, m->hidden, idx, val, n, base + h,
+                          pre + h, 16);
+  for (; h < m->hidden; h += 4)
+    model_rows_sse2_block(m->w1 + h, m->hidden, idx, val, n, base + h,
+                          pre + h, 1);
+}
+#endif
+
+// 2 with AVX2 and FMA, 1 with SSE2, 0 otherwise.
+static inline int model_simd_level(void) {
+  static int level = -1;
+  if (level < 0) {
+    level = 0;
+#ifdef MODEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      level = 2;
+    else if (__builtin_cpu_supports("sse2"))
+      level = 1;
+#endif
+  }
+  return level;
+}
+
+static inline ModelRowKernel model_row_kernel(void) {
+#ifdef MODEL_X86
+  if (model_simd_level() == 2)
+    return model_rows_avx2;
+  if (model_simd_level() == 1)
+    return model_rows_sse2;
+#endif
+  return model_rows_scalar;
+}
+
+// Int8 kernels add the packed input groups val[k] (four 0..127 bytes) times
+// group grp[k] of q1 into int32 accumulators, one per hidden unit. Inputs
+// stay below 128 so the unsigned-by-signed pair sums of maddubs never
+// saturate.
+typedef void (*ModelQuantKernel)(const Model *m, const int *grp,
+                                 const uint32_t *val, int n, int32_t *acc);
+
+static inline void model_quant_scalar(const Model *m, const int *grp,
+                                      const uint32_t *val, int n,
+                                      int32_t *acc) {
+  int hidden = m->hidden;
+  for (int k = 0; k < n; k++) {
+    uint8_t x[4];
+    memcpy(x, &val[k], 4);
+    const int8_t *row = m->q1 + (size_t)grp[k] * hidden * 4;
+    for (int i = 0; i < hidden; i++, row += 4)
+      acc[i] += x[0] * row[0] + x[1] * row[1] + x[2] * row[2] + x[3] * row[3];
+  }
+}
+
+#ifdef MODEL_X86
+// maddubs forms the four byte products of a unit as two int16 pair sums,
+// madd against ones folds them into that unit's int32 lane.
+__attribute__((target("avx2"), always_inline)) static inline void
+model_quant_avx2_block(const int8_t *q1, size_t ld, const int *grp,
+                       const uint32_t *val, int n, int32_t *acc, int nb) {
+  __m256i sum[16];
+  __m256i ones = _mm256_set1_epi16(1);
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    sum[k] = _mm256_loadu_si256((const __m256i *)(acc + 8 * k));
+  for (int j = 0; j < n; j++) {
+    __m256i x = _mm256_set1_epi32((int)val[j]);
+    const int8_t *row = q1 + grp[j] * ld;
+#pragma GCC unroll 16
+    for (int k = 0; k < nb; k++) {
+      __m256i w = _mm256_loadu_si256((const __m256i *)(row + 32 * k));
+      sum[k] = _mm256_add_epi32(
+          sum[k], _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+    }
+  }
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    _mm256_storeu_si256((__m256i *)(acc + 8 * k), sum[k]);
+}
+
+__attribute__((target("avx2"))) static inline void
+model_quant_avx2(const Model *m, const int *grp, const uint32_t *val, int n,
+                 int32_t *acc) {
+  size_t ld = (size_t)m->hidden * 4;
+  int h = 0;
+  for (; h + 128 <= m->hidden; h += 128)
+    model_quant_avx2_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 16);
+  for (; h < m->hidden; h += 8)
+    model_quant_avx2_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 1);
+}
 
-  size_t read = 0;
-  read += fread(nn->w1, sizeof(float), INPUT_NODES * HIDDEN_NODES, f);
-  read += fread(nn->b1, sizeof(float), HIDDEN_NODES, f);
-  read += fread(nn->w2, sizeof(float), HIDDEN_NODES * OUTPUT_NODES, f);
-  read += fread(nn->b2, sizeof(float), OUTPUT_NODES, f);
+// dpbusd does the same four products and accumulation in one instruction;
+// client cores have it as AVX-VNNI, server cores through AVX-512 VNNI/VL.
+__attribute__((target("avxvnni"), always_inline)) static inline void
+model_quant_avxvnni_block(const int8_t *q1, size_t ld, const int *grp,
+                          const uint32_t *val, int n, int32_t *acc, int nb) {
+  __m256i sum[16];
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    sum[k] = _mm256_loadu_si256((const __m256i *)(acc + 8 * k));
+  for (int j = 0; j < n; j++) {
+    __m256i x = _mm256_set1_epi32((int)val[j]);
+    const int8_t *row = q1 + grp[j] * ld;
+#pragma GCC unroll 16
+    for (int k = 0; k < nb; k++)
+      sum[k] = _mm256_dpbusd_avx_epi32(
+          sum[k], x, _mm256_loadu_si256((const __m256i *)(row + 32 * k)));
+  }
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    _mm256_storeu_si256((__m256i *)(acc + 8 * k), sum[k]);
+}
+
+__attribute__((target("avxvnni"))) static inline void
+model_quant_avxvnni(const Model *m, const int *grp, const uint32_t *val,
+                    int n, int32_t *acc) {
+  size_t ld = (size_t)m->hidden * 4;
+  int h = 0;
+  for (; h + 128 <= m->hidden; h += 128)
+    model_quant_avxvnni_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 16);
+  for (; h < m->hidden; h += 8)
+    model_quant_avxvnni_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 1);
+}
 
-  fclose(f);
+__attribute__((target("avx512vnni,avx512vl"), always_inline)) static inline void
+model_quant_avx512vnni_block(const int8_t *q1, size_t ld, const int *grp,
+                             const uint32_t *val, int n, int32_t *acc,
+                             int nb) {
+  __m256i sum[16];
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    sum[k] = _mm256_loadu_si256((const __m256i *)(acc + 8 * k));
+  for (int j = 0; j < n; j++) {
+    __m256i x = _mm256_set1_epi32((int)val[j]);
+    const int8_t *row = q1 + grp[j] * ld;
+#pragma GCC unroll 16
+    for (int k = 0; k < nb; k++)
+      sum[k] = _mm256_dpbusd_epi32(
+          sum[k], x, _mm256_loadu_si256((const __m256i *)(row + 32 * k)));
+  }
+#pragma GCC unroll 16
+  for (int k = 0; k < nb; k++)
+    _mm256_storeu_si256((__m256i *)(acc + 8 * k), sum[k]);
+}
 
-  size_t expected = INPUT_NODES * HIDDEN_NODES + HIDDEN_NODES +
-                    HIDDEN_NODES * OUTPUT_NODES + OUTPUT_NODES;
+__attribute__((target("avx512vnni,avx512vl"))) static inline void
+model_quant_avx512vnni(const Model *m, const int *grp, const uint32_t *val,
+                       int n, int32_t *acc) {
+  size_t ld = (size_t)m->hidden * 4;
+  int h = 0;
+  for (; h + 128 <= m->hidden; h += 128)
+    model_quant_avx512vnni_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 16);
+  for (; h < m->hidden; h += 8)
+    model_quant_avx512vnni_block(m->q1 + 4 * h, ld, grp, val, n, acc + h, 1);
+}
+#endif
 
-  return (read == expected);
+static inline ModelQuantKernel model_quant_kernel(void) {
+  static ModelQuantKernel k = NULL;
+  if (!k) {
+    k = model_quant_scalar;
+#ifdef MODEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avxvnni"))
+      k = model_quant_avxvnni;
+    else if (__builtin_cpu_supports("avx512vnni") &&
+             __builtin_cpu_supports("avx512vl"))
+      k = model_quant_avx512vnni;
+    else if (__builtin_cpu_supports("avx2"))
+      k = model_quant_avx2;
+#endif
+  }
+  return k;
+}
+
+// Quantizes the input and runs only its non-empty groups of four, so the
+// sparse drawing grid is skipped here too.
+static inline void model_hidden_quant(const Model *m, const float *input,
+                                      float *pre) {
+  int grp[MODEL_MAX_INPUTS / 4];
+  uint32_t val[MODEL_MAX_INPUTS / 4];
+  int32_t acc[MODEL_MAX_HIDDEN];
+  int groups = (int)model_quant_groups(m->inputs);
+  int n = 0;
+
+  for (int g = 0; g < groups; g++) {
+    uint32_t x = 0;
+    for (int b = 0; b < 4 && 4 * g + b < m->inputs; b++) {
+      float v = input[4 * g + b];
+      v = v < 0 ? 0 : v > 1 ? 1 : v;
+      x |= (uint32_t)(v * QUANT_INPUT_MAX + 0.5f) << 8 * b;
+    }
+    grp[n] = g;
+    val[n] = x;
+    n += x != 0;
+  }
+  memset(acc, 0, m->hidden * sizeof(int32_t));
+  model_quant_kernel()(m, grp, val, n, acc);
+  for (int i = 0; i < m->hidden; i++)
+    pre[i] = m->b1[i] + acc[i] * (m->s1[i] / QUANT_INPUT_MAX);
 }
 
-static int model_predict(NeuralNetwork *nn, const float *input) {
-  float hidden[HIDDEN_NODES];
-  float output[OUTPUT_NODES];
+// GEMM kernels for the convolutions: c = max(a * b + bias, 0) for a m x k,
+// b k x n and c m x n, row-major, with n a multiple of 8 up to
+// MODEL_MAX_CHANNELS. Blocks of four rows by sixteen (or eight) columns of
+// c stay in registers while k is walked, so each row of b is loaded once
+// per four rows of a.
+typedef void (*ModelGemmKernel)(const float *a, const float *b,
+                                const float *bias, float *c, int m, int n,
+                                int k);
 
-  
-  for (int i = 0; i < HIDDEN_NODES; i++) {
-    float sum = nn->b1[i];
-    for (int j = 0; j < INPUT_NODES; j++) {
-      sum += input[j] * nn->w1[j][i];
+static inline void model_gemm_scalar(const float *a, const float *b,
+                                     const float *bias, float *c, int m, int n,
+                                     int k) {
+  for (int i = 0; i < m; i++) {
+    float acc[MODEL_MAX_CHANNELS];
+    memcpy(acc, bias, n * sizeof(float));
+    for (int p = 0; p < k; p++) {
+      float x = a[(size_t)i * k + p];
+      const float *row = b + (size_t)p * n;
+      for (int j = 0; j < n; j++)
+        acc[j] += x * row[j];
     }
-    
-    hidden[i] = sum > 0 ? sum : 0;
+    for (int j = 0; j < n; j++)
+      c[(size_t)i * n + j] = acc[j] > 0 ? acc[j] : 0;
   }
+}
 
-  
-  for (int i = 0; i < OUTPUT_NODES; i++) {
-    float sum = nn->b2[i];
-    for (int j = 0; j < HIDDEN_NODES; j++) {
-      sum += hidden[j] * nn->w2[j][i];
+#ifdef MODEL_X86
+__attribute__((target("avx2,fma"), always_inline)) static inline void
+model_gemm_avx2_block(const float *a, const float *b, const float *bias,
+                      float *c, int n, int k, int mr, int nb) {
+  __m256 acc[4][2], w[2];
+#pragma GCC unroll 4
+  for (int i = 0; i < mr; i++)
+#pragma GCC unroll 2
+    for (int j = 0; j < nb; j++)
+      acc[i][j] = _mm256_loadu_ps(bias + 8 * j);
+  for (int p = 0; p < k; p++) {
+#pragma GCC unroll 2
+    for (int j = 0; j < nb; j++)
+      w[j] = _mm256_loadu_ps(b + (size_t)p * n + 8 * j);
+#pragma GCC unroll 4
+    for (int i = 0; i < mr; i++) {
+      __m256 x = _mm256_set1_ps(a[(size_t)i * k + p]);
+#pragma GCC unroll 2
+      for (int j = 0; j < nb; j++)
+        acc[i][j] = _mm256_fmadd_ps(x, w[j], acc[i][j]);
     }
-    output[i] = sum; 
   }
+#pragma GCC unroll 4
+  for (int i = 0; i < mr; i++)
+#pragma GCC unroll 2
+    for (int j = 0; j < nb; j++)
+      _mm256_storeu_ps(c + (size_t)i * n + 8 * j,
+                       _mm256_max_ps(acc[i][j], _mm256_setzero_ps()));
+}
+
+__attribute__((target("avx2,fma"))) static inline void
+model_gemm_avx2(const float *a, const float *b, const float *bias, float *c,
+                int m, int n, int k) {
+  int j = 0;
+  for (; j + 16 <= n; j += 16) {
+    int i = 0;
+    for (; i + 4 <= m; i += 4)
+      model_gemm_avx2_block(a + (size_t)i * k, b + j, bias + j,
+                            c + (size_t)i * n + j, n, k, 4, 2);
+    for (; i < m; i++)
+      model_gemm_avx2_block(a + (size_t)i * k, b + j, bias + j,
+                            c + (size_t)i * n + j, n, k, 1, 2);
+  }
+  for (; j < n; j += 8) {
+    int i = 0;
+    for (; i + 4 <= m; i += 4)
+      model_gemm_avx2_block(a + (size_t)i * k, b + j, bias + j,
+                            c + (size_t)i * n + j, n, k, 4, 1);
+    for (; i < m; i++)
+      model_gemm_avx2_block(a + (size_t)i * k, b + j, bias + j,
+                            c + (size_t)i * n + j, n, k, 1, 1);
+  }
+}
+#endif
 
-  
-  int maxIdx = 0;
-  float maxVal = output[0];
-  for (int i = 1; i < OUTPUT_NODES; i++) {
-    if (output[i] > maxVal) {
-      maxVal = output[i];
-      maxIdx = i;
+static inline ModelGemmKernel model_gemm_kernel(void) {
+#ifdef MODEL_X86
+  if (model_simd_level() == 2)
+    return model_gemm_avx2;
+#endif
+  return model_gemm_scalar;
+}
+
+// 3x3 valid convolution of a side x side x cin image (channels innermost)
+// with k, bias and ReLU, then 2x2 max pooling into out. Each pair of conv
+// rows a pooled row needs is lowered to an im2col tile, whose rows are
+// three contiguous runs of the image, and multiplied in one GEMM call.
+static inline void model_conv_pool(ModelGemmKernel gemm, const float *in,
+                                   int side, int cin, const float *k,
+                                   const float *bias, int cout, float *out) {
+  float tile[2 * (MODEL_CNN_MAX_SIDE - 2) * 9 * MODEL_MAX_CHANNELS];
+  float conv[2 * (MODEL_CNN_MAX_SIDE - 2) * MODEL_MAX_CHANNELS];
+  int pw = model_pool_side(side), w = 2 * pw;
+  size_t run = 3 * cin * sizeof(float);
+
+  for (int py = 0; py < pw; py++) {
+    float *t = tile;
+    for (int r = 0; r < 2; r++)
+      for (int x = 0; x < w; x++)
+        for (int dy = 0; dy < 3; dy++, t += 3 * cin)
+          memcpy(t, in + ((size_t)(2 * py + r + dy) * side + x) * cin, run);
+    gemm(tile, k, bias, conv, 2 * w, cout, 9 * cin);
+
+    for (int px = 0; px < pw; px++) {
+      const float *q = conv + (size_t)2 * px * cout;
+      float *o = out + ((size_t)py * pw + px) * cout;
+      const float *q2 = q + (size_t)w * cout;
+      for (int c = 0; c < cout; c++)
+        o[c] = fmaxf(fmaxf(q[c], q[cout + c]), fmaxf(q2[c], q2[cout + c]));
     }
   }
+}
+
+// Pre-activations b1 + x * w1 of the n inputs x into pre (m->hidden
+// floats). Drawn digits leave most of the grid empty, and ReLU most of a
+// CNN's features, so only the rows of w1 for non-zero inputs are added;
+// past MODEL_SPARSE_MAX of them the index indirection stops paying and the
+// dense pass runs instead.
+static inline void model_hidden_rows(const Model *m, const float *x, int n,
+                                     float *pre) {
+  int idx[MODEL_MAX_INPUTS];
+  float val[MODEL_MAX_INPUTS];
+  int lit = 0;
+
+  // Branch-free compaction: every input is written, only lit ones advance.
+  for (int j = 0; j < n; j++) {
+    idx[lit] = j;
+    val[lit] = x[j];
+    lit += x[j] != 0;
+  }
+  if (lit <= MODEL_SPARSE_MAX(n))
+    model_row_kernel()(m, idx, val, lit, m->b1, pre);
+  else
+    model_row_kernel()(m, NULL, x, n, m->b1, pre);
+}
+
+// The convolutions, then the dense hidden layer over their features.
+static inline void model_hidden_cnn(const Model *m, const float *input,
+                                    float *pre) {
+  int p1 = model_pool_side(m->side);
+  float pool1[(MODEL_CNN_MAX_SIDE / 2) * (MODEL_CNN_MAX_SIDE / 2) *
+              MODEL_MAX_CHANNELS];
+  float features[MODEL_MAX_INPUTS];
+  ModelGemmKernel gemm = model_gemm_kernel();
+
+  model_conv_pool(gemm, input, m->side, 1, m->k1, m->kb1, m->conv1, pool1);
+  model_conv_pool(gemm, pool1, p1, m->conv1, m->k2, m->kb2, m->conv2,
+                  features);
+  model_hidden_rows(m, features, m->features, pre);
+}
+
+// Pre-activations of input into pre (m->hidden floats).
+static inline void model_hidden(const Model *m, const float *input,
+                                float *pre) {
+  if (m->kind == MODEL_CNN)
+    model_hidden_cnn(m, input, pre);
+  else if (m->dtype == MODEL_Q8)
+    model_hidden_quant(m, input, pre);
+  else
+    model_hidden_rows(m, input, m->inputs, pre);
+}
+
+// Moves pre from the pre-activations of old to those of cur by adding the
+// w1 rows of the inputs that differ, scaled by the difference. The int8
+// pass skips empty groups and is cheap enough to rerun whole, and a CNN is
+// not linear in its input so it always is. Returns the number of inputs
+// that changed.
+static inline int model_update(const Model *m, float *pre, const float *old,
+                               const float *cur) {
+  int idx[MODEL_MAX_INPUTS];
+  float val[MODEL_MAX_INPUTS];
+  int n = 0;
 
-  return maxIdx;
+  for (int j = 0; j < m->inputs; j++) {
+    idx[n] = j;
+    val[n] = cur[j] - old[j];
+    n += cur[j] != old[j];
+  }
+  if (m->kind == MODEL_CNN || m->dtype == MODEL_Q8 ||
+      n > MODEL_SPARSE_MAX(m->inputs))
+    model_hidden(m, cur, pre);
+  else if (n > 0)
+    model_row_kernel()(m, idx, val, n, pre, pre);
+  return n;
+}
+
+// ReLU, the output layer and argmax for count sets of hidden
+// pre-activations (m->hidden floats apart) into digits. Each w2 row is read
+// once per MODEL_BATCH inputs; the hidden layer stays per input, since drawn
+// digits light mostly different rows of w1 and a shared pass over their
+// union costs more than it saves.
+static inline void model_classify_batch(const Model *m, const float *pre,
+                                        int count, int *digits) {
+  float output[MODEL_BATCH][MODEL_MAX_OUTPUTS];
+  for (int at = 0; at < count; at += MODEL_BATCH) {
+    int nb = count - at < MODEL_BATCH ? count - at : MODEL_BATCH;
+    const float *p = pre + (size_t)at * m->hidden;
+    for (int b = 0; b < nb; b++)
+      memcpy(output[b], m->b2, m->outputs * sizeof(float));
+    for (int j = 0; j < m->hidden; j++) {
+      const float *row = m->w2 + (size_t)j * m->outputs;
+      for (int b = 0; b < nb; b++) {
+        float x = p[(size_t)b * m->hidden + j];
+        if (x <= 0)
+          continue;
+        for (int i = 0; i < m->outputs; i++)
+          output[b][i] += x * row[i];
+      }
+    }
+
+    for (int b = 0; b < nb; b++) {
+      int maxIdx = 0;
+      for (int i = 1; i < m->outputs; i++)
+        if (output[b][i] > output[b][maxIdx])
+          maxIdx = i;
+      digits[at + b] = maxIdx;
+    }
+  }
 }
 
 #endif
@@ -0,0 +1,527 @@
+#ifndef PRIME_H
+#define PRIME_H
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Odd-only bitsets: bit i of a segment starting at base is base + 2i + 1.
+#define PRIME_SEGMENT_WORDS 4096 // 32 KB, one L1d worth of bits
+#define PRIME_SEGMENT_SPAN ((uint64_t)PRIME_SEGMENT_WORDS * 128)
+#define PRIME_WHEEL_WORDS 15015 // 3*5*7*11*13, pre-sieved pattern period
+#define PRIME_TABLE_CAP (1ULL << 28)
+#define PRIME_MAX_THREADS 16
+#define PRIME_CACHE_SLOTS 256
+#define PRIME_PHI_K 6
+
+typedef struct {
+  uint64_t limit;   // table answers pi(n) for n <= limit
+  uint64_t *bits;   // odd-only primality bits for [0, limit]
+  uint32_t *rank;   // number of odd primes before each word
+  uint32_t *primes; // 1-based: primes[1] = 2
+  uint64_t numPrimes;
+  uint64_t *wheel;
+  uint16_t *phiTable[PRIME_PHI_K + 1];
+} PrimeTable;
+
+typedef struct {
+  uint64_t x;
+  uint64_t value;
+  int kind;
+} PrimeCacheEntry;
+
+static PrimeTable primeTable;
+static PrimeCacheEntry primeCache[PRIME_CACHE_SLOTS];
+
+static const uint32_t PRIME_PHI_PROD[PRIME_PHI_K + 1] = {1,  2,   6,   30,
+                                                         210, 2310, 30030};
+static const uint32_t PRIME_PHI_TOT[PRIME_PHI_K + 1] = {1,  1,   2,   8,
+                                                        48, 480, 5760};
+
+static uint64_t prime_isqrt(uint64_t x) {
+  uint64_t r = (uint64_t)sqrt((double)x);
+  while (r * r > x)
+    r--;
+  while ((r + 1) * (r + 1) <= x)
+    r++;
+  return r;
+}
+
+static uint64_t prime_iroot(uint64_t x, int k) {
+  uint64_t r = (uint64_t)pow((double)x, 1.0 / k);
+  for (;;) {
+    uint64_t p = 1;
+    for (int i = 0; i < k; i++)
+      p *= r;
+    if (p > x)
+      r--;
+    else
+      break;
+  }
+  for (;;) {
+    uint64_t p = 1, n = r + 1;
+    for (int i = 0; i < k; i++)
+      p *= n;
+    if (p <= x)
+      r++;
+    else
+      break;
+  }
+  return r;
+}
+
+static void prime_init_wheel(void) {
+  if (primeTable.wheel)
+    return;
+  primeTable.wheel = malloc(PRIME_WHEEL_WORDS * sizeof(uint64_t));
+  memset(primeTable.wheel, 0xff, PRIME_WHEEL_WORDS * sizeof(uint64_t));
+  static const int small[5] = {3, 5, 7, 11, 13};
+  for (int s = 0; s < 5; s++) {
+    uint64_t p = small[s];
+    // 2i + 1 == 0 (mod p)  <=>  i == (p - 1) / 2 (mod p)
+    for (uint64_t i = (p - 1) / 2; i < PRIME_WHEEL_WORDS * 64ULL; i += p)
+      primeTable.wheel[i >> 6] &= ~(1ULL << (i & 63));
+  }
+
+  for (int a = 1; a <= PRIME_PHI_K; a++) {
+    uint32_t prod = PRIME_PHI_PROD[a];
+    static const int first[PRIME_PHI_K] = {2, 3, 5, 7, 11, 13};
+    uint16_t *t = malloc(prod * sizeof(uint16_t));
+    uint16_t count = 0;
+    for (uint32_t r = 0; r < prod; r++) {
+      int coprime = r > 0;
+      for (int i = 0; i < a && coprime; i++)
+        if (r % first[i] == 0)
+          coprime = 0;
+      count += coprime;
+      t[r] = count;
+    }
+    primeTable.phiTable[a] = t;
+  }
+}
+
+// Sieves words of odd numbers starting at base (a multiple of 128) using
+// primes[] (odd, >= 17, ascending).
+static void prime_sieve_segment(uint64_t base, uint64_t *seg, size_t words,
+                                const uint32_t *primes, size_t nprimes) {
+  size_t w = (size_t)((base / 128) % PRIME_WHEEL_WORDS);
+  size_t done = 0;
+  while (done < words) {
+    size_t n = PRIME_WHEEL_WORDS - w;
+    if (n > words - done)
+      n = words - done;
+    memcpy(seg + done, primeTable.wheel + w, n * sizeof(uint64_t));
+    done += n;
+    w = 0;
+  }
+  if (base == 0) {
+    // 1 is not prime, the wheel primes themselves are
+    seg[0] &= ~1ULL;
+    seg[0] |= (1ULL << 1) | (1ULL << 2) | (1ULL << 3) | (1ULL << 5) |
+              (1ULL << 6);
+  }
+
+  uint64_t end = base + (uint64_t)words * 128;
+  for (size_t k = 0; k < nprimes; k++) {
+    uint64_t p = primes[k];
+    uint64_t m = p * p;
+    if (m >= end)
+      break;
+    if (m < base) {
+      m = (base + p - 1) / p * p;
+      if ((m & 1) == 0)
+        m += p;
+    }
+    for (uint64_t i = (m - base) >> 1; i < (uint64_t)words * 64; i += p)
+      seg[i >> 6] &= ~(1ULL << (i & 63));
+  }
+}
+
+static uint32_t *prime_small_sieve(uint32_t limit, size_t *count) {
+  unsigned char *composite = calloc(limit + 1, 1);
+  uint32_t *out = malloc((limit / 2 + 2) * sizeof(uint32_t));
+  size_t n = 0;
+  for (uint32_t i = 2; i <= limit; i++) {
+    if (composite[i])
+      continue;
+    out[n++] = i;
+    for (uint64_t j = (uint64_t)i * i; j <= limit; j += i)
+      composite[j] = 1;
+  }
+  free(composite);
+  *count = n;
+  return out;
+}
+
+static int prime_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > PRIME_MAX_THREADS)
+    n = PRIME_MAX_THREADS;
+  return (int)n;
+}
+
+typedef struct {
+  uint64_t *bits;
+  size_t firstWord, lastWord;
+  const uint32_t *sievePrimes;
+  size_t numSievePrimes;
+} PrimeTask;
+
+static void *prime_task_run(void *arg) {
+  PrimeTask *t = arg;
+  for (size_t w = t->firstWord; w < t->lastWord; w += PRIME_SEGMENT_WORDS) {
+    size_t n = t->lastWord - w;
+    if (n > PRIME_SEGMENT_WORDS)
+      n = PRIME_SEGMENT_WORDS;
+    prime_sieve_segment((uint64_t)w * 128, t->bits + w, n, t->sievePrimes,
+                        t->numSievePrimes);
+  }
+  return NULL;
+}
+
+// Rebuilds the table to cover [0, limit], splitting the segments across
+// threads. Each thread owns a disjoint word range of the bitset.
+static void prime_build_table(uint64_t limit) {
+  prime_init_wheel();
+  size_t words = (size_t)(limit / 128 + 1);
+  limit = (uint64_t)words * 128 - 1;
+
+  free(primeTable.bits);
+  free(primeTable.rank);
+  free(primeTable.primes);
+  primeTable.primes = NULL;
+  primeTable.numPrimes = 0;
+  primeTable.bits = malloc(words * sizeof(uint64_t));
+  primeTable.rank = malloc((words + 1) * sizeof(uint32_t));
+
+  size_t numSmall;
+  uint32_t *small = prime_small_sieve((uint32_t)prime_isqrt(limit), &numSmall);
+  size_t skip = 0;
+  while (skip < numSmall && small[skip] <= 13)
+    skip++;
+
+  int nthreads = prime_thread_count();
+  size_t segs = (words + PRIME_SEGMENT_WORDS - 1) / PRIME_SEGMENT_WORDS;
+  if ((size_t)nthreads > segs)
+    nthreads = (int)segs;
+  PrimeTask tasks[PRIME_MAX_THREADS];
+  pthread_t threads[PRIME_MAX_THREADS];
+  size_t perThread = (segs + nthreads - 1) / nthreads * PRIME_SEGMENT_WORDS;
+  for (int t = 0; t < nthreads; t++) {
+    tasks[t].bits = primeTable.bits;
+    tasks[t].firstWord = t * perThread;
+    tasks[t].lastWord = (t + 1) * perThread;
+    if (tasks[t].firstWord > words)
+      tasks[t].firstWord = words;
+    if (tasks[t].lastWord > words)
+      tasks[t].lastWord = words;
+    tasks[t].sievePrimes = small + skip;
+    tasks[t].numSievePrimes = numSmall - skip;
+    if (t > 0)
+      pthread_create(&threads[t], NULL, prime_task_run, &tasks[t]);
+  }
+  prime_task_run(&tasks[0]);
+  for (int t = 1; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+  free(small);
+
+  uint32_t running = 0;
+  for (size_t w = 0; w < words; w++) {
+    primeTable.rank[w] = running;
+    running += (uint32_t)__builtin_popcountll(primeTable.bits[w]);
+  }
+  primeTable.rank[words] = running;
+  primeTable.limit = limit;
+}
+
+static uint64_t prime_table_pi(uint64_t n) {
+  if (n < 2)
+    return 0;
+  uint64_t i = (n - 1) / 2;
+  uint64_t w = i >> 6;
+  uint64_t b = i & 63;
+  uint64_t mask = (b == 63) ? ~0ULL : ((1ULL << (b + 1)) - 1);
+  return 1 + primeTable.rank[w] +
+         (uint64_t)__builtin_popcountll(primeTable.bits[w] & mask);
+}
+
+// Makes primes[1..] cover every prime <= bound (bound <= table limit).
+static void prime_ensure_list(uint64_t bound) {
+  uint64_t have = primeTable.numPrimes;
+  if (have && primeTable.primes[have] >= bound)
+    return;
+  uint64_t n = prime_table_pi(bound) + 1; // one past bound for p_{a+1}
+  free(primeTable.primes);
+  primeTable.primes = malloc((n + 2) * sizeof(uint32_t));
+  primeTable.primes[0] = 0;
+  primeTable.primes[1] = 2;
+  uint64_t k = 2;
+  size_t words = (size_t)(primeTable.limit / 128 + 1);
+  for (size_t w = 0; w < words && k <= n; w++) {
+    uint64_t bits = primeTable.bits[w];
+    while (bits && k <= n) {
+      int b = __builtin_ctzll(bits);
+      bits &= bits - 1;
+      primeTable.primes[k++] = (uint32_t)(w * 128 + 2 * b + 1);
+    }
+  }
+  primeTable.numPrimes = k - 1;
+}
+
+static uint64_t prime_phi(uint64_t x, uint64_t a) {
+  if (a <= PRIME_PHI_K) {
+    uint32_t prod = PRIME_PHI_PROD[a];
+    return (x / prod) * PRIME_PHI_TOT[a] +
+           (a ? primeTable.phiTable[a][x % prod] : 0);
+  }
+  const uint32_t *p = primeTable.primes;
+  if (x < p[a + 1])
+    return x >= 1;
+  if (x <= primeTable.limit && x < (uint64_t)p[a + 1] * p[a + 1])
+    return prime_table_pi(x) - a + 1;
+  return prime_phi(x, a - 1) - prime_phi(x / p[a], a - 1);
+}
+
+static PrimeCacheEntry *prime_cache_slot(int kind, uint64_t x) {
+  uint64_t h = (x + (uint64_t)kind) * 0x9E3779B97F4A7C15ULL;
+  return &primeCache[(h >> 32) % PRIME_CACHE_SLOTS];
+}
+
+static int prime_cache_get(int kind, uint64_t x, uint64_t *out) {
+  PrimeCacheEntry *e = prime_cache_slot(kind, x);
+  if (e->kind == kind && e->x == x) {
+    *out = e->value;
+    return 1;
+  }
+  return 0;
+}
+
+static void prime_cache_put(int kind, uint64_t x, uint64_t value) {
+  PrimeCacheEntry *e = prime_cache_slot(kind, x);
+  e->kind = kind;
+  e->x = x;
+  e->value = value;
+}
+
+// Lehmer's formula; pi(w) for w beyond the table recurses.
+static uint64_t prime_lehmer(uint64_t x) {
+  if (x <= primeTable.limit)
+    return prime_table_pi(x);
+  uint64_t cached;
+  if (prime_cache_get(1, x, &cached))
+    return cached;
+
+  uint64_t a = prime_table_pi(prime_iroot(x, 4));
+  uint64_t b = prime_table_pi(prime_isqrt(x));
+  uint64_t c = prime_table_pi(prime_iroot(x, 3));
+  const uint32_t *p = primeTable.primes;
+
+  int64_t sum = (int64_t)prime_phi(x, a) + (int64_t)((b + a - 2) * (b - a + 1) / 2);
+  for (uint64_t i = a + 1; i <= b; i++) {
+    uint64_t w = x / p[i];
+    sum -= (int64_t)prime_lehmer(w);
+    if (i <= c) {
+      uint64_t bi = prime_table_pi(prime_isqrt(w));
+      for (uint64_t j = i; j <= bi; j++)
+        sum -= (int64_t)prime_table_pi(w / p[j]) - (int64_t)(j - 1);
+    }
+  }
+  prime_cache_put(1, x, (uint64_t)sum);
+  return (uint64_t)sum;
+}
+
+static void prime_prepare(uint64_t x) {
+  uint64_t want;
+  if (x <= (1ULL << 24))
+    want = x;
+  else {
+    double t = pow((double)x, 2.0 / 3.0);
+    want = t > (double)PRIME_TABLE_CAP ? PRIME_TABLE_CAP : (uint64_t)t;
+  }
+  uint64_t root = prime_isqrt(x) + 1;
+  if (want < root)
+    want = root;
+  if (want < 4096)
+    want = 4096;
+  if (want > primeTable.limit) {
+    if (primeTable.limit && want < 2 * primeTable.limit)
+      want = 2 * primeTable.limit;
+    if (want > PRIME_TABLE_CAP && root <= PRIME_TABLE_CAP)
+      want = PRIME_TABLE_CAP;
+    prime_build_table(want);
+  }
+  prime_ensure_list(root);
+}
+
+static uint64_t prime_count(uint64_t x) {
+  if (x < 2)
+    return 0;
+  prime_prepare(x);
+  return prime_lehmer(x);
+}
+
+// Odd-only window sieve of [lo, hi]; bit i is base + 2i + 1.
+static uint64_t *prime_window(uint64_t lo, uint64_t hi, uint64_t *base,
+                              size_t *words) {
+  uint64_t b = lo & ~127ULL;
+  size_t n = (size_t)((hi - b) / 128 + 1);
+  uint64_t *seg = malloc(n * sizeof(uint64_t));
+  prime_prepare(hi);
+  uint64_t skip = 1;
+  while (skip <= primeTable.numPrimes && primeTable.primes[skip] <= 13)
+    skip++;
+  prime_sieve_segment(b, seg, n, primeTable.primes + skip,
+                      primeTable.numPrimes - skip + 1);
+  for (uint64_t v = b + 1; v < lo; v += 2) {
+    uint64_t i = (v - b) >> 1;
+    seg[i >> 6] &= ~(1ULL << (i & 63));
+  }
+  for (uint64_t i = (hi - b + 1) >> 1; i < (uint64_t)n * 64; i++)
+    seg[i >> 6] &= ~(1ULL << (i & 63));
+  *base = b;
+  *words = n;
+  return seg;
+}
+
+static uint64_t prime_nth(uint64_t n) {
+  if (n == 0)
+    return 0;
+  if (n == 1)
+    return 2;
+  uint64_t cached;
+  if (prime_cache_get(2, n, &cached))
+    return cached;
+
+  double ln = log((double)n);
+  double est = n < 6 ? 13.0
+                     : n * (ln + log(ln) - 1.0 + (log(ln) - 2.0) / ln);
+  uint64_t x = (uint64_t)est;
+  uint64_t c = prime_count(x);
+  const uint64_t step = PRIME_SEGMENT_SPAN;
+  uint64_t result = 0;
+
+  while (!result) {
+    uint64_t lo, hi;
+    if (c >= n) {
+      hi = x;
+      lo = x > step ? x - step + 1 : 3;
+    } else {
+      lo = x + 1;
+      hi = x + step;
+    }
+    uint64_t b;
+    size_t words;
+    uint64_t *seg = prime_window(lo, hi, &b, &words);
+    uint64_t inWin = 0;
+    for (size_t w = 0; w < words; w++)
+      inWin += (uint64_t)__builtin_popcountll(seg[w]);
+    uint64_t before = (c >= n) ? c - inWin : c; // primes below lo
+    if (before < n && before + inWin >= n) {
+      uint64_t k = before;
+      for (size_t w = 0; w < words && !result; w++) {
+        uint64_t bits = seg[w];
+        while (bits) {
+          int bit = __builtin_ctzll(bits);
+          bits &= bits - 1;
+          if (++k == n) {
+            result = b + (uint64_t)w * 128 + 2 * bit + 1;
+            break;
+          }
+        }
+      }
+    } else if (c >= n) {
+      c = before;
+      x = lo - 1;
+    } else {
+      c += inWin;
+      x = hi;
+    }
+    free(seg);
+  }
+  prime_cache_put(2, n, result);
+  return result;
+}
+
+// Writes up to max primes from [lo, hi] into out; returns how many.
+static size_t prime_list(uint64_t lo, uint64_t hi, uint64_t *out, size_t max) {
+  size_t n = 0;
+  if (lo <= 2 && hi >= 2 && n < max)
+    out[n++] = 2;
+  if (lo < 3)
+    lo = 3;
+  while (lo <= hi && n < max) {
+    uint64_t end = hi - lo > PRIME_SEGMENT_SPAN ? lo + PRIME_SEGMENT_SPAN : hi;
+    uint64_t b;
+    size_t words;
+    uint64_t *seg = prime_window(lo, end, &b, &words);
+    for (size_t w = 0; w < words && n < max; w++) {
+      uint64_t bits = seg[w];
+      while (bits && n < max) {
+        int bit = __builtin_ctzll(bits);
+        bits &= bits - 1;
+        out[n++] = b + (uint64_t)w * 128 + 2 * bit + 1;
+      }
+    }
+    free(seg);
+    if (end == hi)
+      break;
+    lo = end + 1;
+  }
+  return n;
+}
+
+static uint64_t prime_mulmod(uint64_t a, uint64_t b, uint64_t m) {
+  return (uint64_t)((unsigned __int128)a * b % m);
+}
+
+static uint64_t prime_powmod(uint64_t a, uint64_t e, uint64_t m) {
+  uint64_t r = 1;
+  a %= m;
+  while (e) {
+    if (e & 1)
+      r = prime_mulmod(r, a, m);
+    a = prime_mulmod(a, a, m);
+    e >>= 1;
+  }
+  return r;
+}
+
+// Deterministic Miller-Rabin for all 64-bit n.
+static int prime_is_prime(uint64_t n) {
+  if (n < 2)
+    return 0;
+  static const uint64_t bases[12] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37};
+  for (int i = 0; i < 12; i++) {
+    if (n % bases[i] == 0)
+      return n == bases[i];
+  }
+  uint64_t d = n - 1;
+  int s = 0;
+  while ((d & 1) == 0) {
+    d >>= 1;
+    s++;
+  }
+  for (int i = 0; i < 12; i++) {
+    uint64_t x = prime_powmod(bases[i], d, n);
+    if (x == 1 || x == n - 1)
+      continue;
+    int composite = 1;
+    for (int r = 1; r < s; r++) {
+      x = prime_mulmod(x, x, n);
+      if (x == n - 1) {
+        composite = 0;
+        break;
+      }
+    }
+    if (composite)
+      return 0;
+  }
+  return 1;
+}
+
+#endif
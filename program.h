@@ -0,0 +1,389 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "rpn.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PROG_MAX_STEPS 4096
+#define PROG_REGS 10
+#define PROG_LABELS 10
+#define PROG_MAX_INSTRS 20000000 // per run, so a runaway stops within a second
+#define PROG_MAGIC 0x434C5031
+
+typedef enum {
+  PROG_LOADX,
+  PROG_ENT,
+  PROG_ADD,
+  PROG_SUB,
+  PROG_MUL,
+  PROG_DIV,
+  PROG_POW,
+  PROG_SWP,
+  PROG_DRP,
+  PROG_PICK,
+  PROG_ROLL,
+  PROG_DUPN,
+  PROG_DRPN,
+  PROG_SUM,
+  PROG_MEAN,
+  PROG_PROD,
+  PROG_SIN,
+  PROG_COS,
+  PROG_TAN,
+  PROG_LOG,
+  PROG_LN,
+  PROG_SQRT,
+  PROG_SQR,
+  PROG_STO,
+  PROG_RCL,
+  PROG_LBL,
+  PROG_GTO,
+  PROG_DSZ,
+  PROG_XEQ0,
+  PROG_XLTY,
+  PROG_XGTY,
+  PROG_RTN,
+  PROG_NUM_OPS
+} ProgOp;
+
+// One recorded keystroke. index is the register/label digit for the ops
+// that take one, value the literal for PROG_LOADX.
+typedef struct {
+  uint8_t op;
+  uint8_t index;
+  double value;
+} ProgStep;
+
+typedef struct {
+  ProgStep steps[PROG_MAX_STEPS];
+  int numSteps;
+} ProgProgram;
+
+// Compiled form: labels resolved to instruction offsets and literals moved
+// to a constant pool, so an instruction is four bytes.
+typedef struct {
+  uint8_t op;
+  uint8_t reg;
+  uint16_t arg;
+} ProgInstr;
+
+typedef struct {
+  ProgInstr code[PROG_MAX_STEPS + 2];
+  double consts[PROG_MAX_STEPS];
+  int len;
+} ProgCode;
+
+static const struct {
+  const char *key;
+  ProgOp op;
+} PROG_KEYS[] = {
+    {"ENT", PROG_ENT},   {"=", PROG_ENT},      {"+", PROG_ADD},
+    {"-", PROG_SUB},     {"*", PROG_MUL},      {"/", PROG_DIV},
+    {"^", PROG_POW},     {"x^y", PROG_POW},    {"SWP", PROG_SWP},
+    {"DRP", PROG_DRP},   {"PICK", PROG_PICK},  {"ROLL", PROG_ROLL},
+    {"DUPN", PROG_DUPN}, {"DRPN", PROG_DRPN},  {"ΣSTK", PROG_SUM},
+    {"MEAN", PROG_MEAN}, {"PROD", PROG_PROD},  {"sin", PROG_SIN},
+    {"cos", PROG_COS},   {"tan", PROG_TAN},    {"log", PROG_LOG},
+    {"ln", PROG_LN},     {"sqrt", PROG_SQRT},  {"sqr", PROG_SQR},
+    {"STO", PROG_STO},   {"RCL", PROG_RCL},    {"LBL", PROG_LBL},
+    {"GTO", PROG_GTO},   {"DSZ", PROG_DSZ},    {"x=0?", PROG_XEQ0},
+    {"x<y?", PROG_XLTY}, {"x>y?", PROG_XGTY},  {"RTN", PROG_RTN},
+};
+
+static int prog_op_for_key(const char *key) {
+  for (size_t i = 0; i < sizeof(PROG_KEYS) / sizeof(PROG_KEYS[0]); i++)
+    if (strcmp(PROG_KEYS[i].key, key) == 0)
+      return PROG_KEYS[i].op;
+  return -1;
+}
+
+static const char *prog_op_name(int op) {
+  if (op == PROG_LOADX)
+    return "#";
+  for (size_t i = 0; i < sizeof(PROG_KEYS) / sizeof(PROG_KEYS[0]); i++)
+    if ((int)PROG_KEYS[i].op == op)
+      return PROG_KEYS[i].key;
+  return "?";
+}
+
+static int prog_takes_index(int op) {
+  return op == PROG_STO || op == PROG_RCL || op == PROG_LBL ||
+         op == PROG_GTO || op == PROG_DSZ;
+}
+
+static int prog_append(ProgProgram *p, int op, int index, double value) {
+  if (p->numSteps >= PROG_MAX_STEPS)
+    return 0;
+  ProgStep *st = &p->steps[p->numSteps++];
+  st->op = (uint8_t)op;
+  st->index = (uint8_t)index;
+  st->value = value;
+  return 1;
+}
+
+// Returns 0 when a GTO names a label that was never defined.
+static int prog_compile(const ProgProgram *p, ProgCode *c) {
+  int labelAt[PROG_LABELS];
+  int n = 0, k = 0;
+  for (int i = 0; i < PROG_LABELS; i++)
+    labelAt[i] = -1;
+  for (int i = 0; i < p->numSteps; i++) {
+    if (p->steps[i].op == PROG_LBL)
+      labelAt[p->steps[i].index % PROG_LABELS] = n;
+    else
+      n++;
+  }
+
+  n = 0;
+  for (int i = 0; i < p->numSteps; i++) {
+    const ProgStep *st = &p->steps[i];
+    ProgInstr *in = &c->code[n];
+    in->op = st->op;
+    in->reg = st->index % PROG_REGS;
+    in->arg = 0;
+    switch (st->op) {
+    case PROG_LBL:
+      continue;
+    case PROG_LOADX:
+      c->consts[k] = st->value;
+      in->arg = (uint16_t)k++;
+      break;
+    case PROG_GTO:
+      if (labelAt[st->index % PROG_LABELS] < 0)
+        return 0;
+      in->arg = (uint16_t)labelAt[st->index % PROG_LABELS];
+      break;
+    case PROG_DSZ:
+    case PROG_XEQ0:
+    case PROG_XLTY:
+    case PROG_XGTY:
+      // Tests skip the next instruction when false
+      in->arg = (uint16_t)(n + 2);
+      break;
+    }
+    n++;
+  }
+  // Padding so a test in the last slot can still skip past the end
+  c->code[n].op = c->code[n + 1].op = PROG_RTN;
+  c->len = n;
+  return 1;
+}
+
+// Runs until RTN or the end. X is the display register; returns 0 if the
+// budget of PROG_MAX_INSTRS executed instructions ran out (a runaway loop).
+static int prog_run(const ProgCode *c, RpnStack *s, double *x, double *regs) {
+  static const void *dispatch[PROG_NUM_OPS] = {
+      [PROG_LOADX] = &&op_loadx, [PROG_ENT] = &&op_ent,
+      [PROG_ADD] = &&op_add,     [PROG_SUB] = &&op_sub,
+      [PROG_MUL] = &&op_mul,     [PROG_DIV] = &&op_div,
+      [PROG_POW] = &&op_pow,     [PROG_SWP] = &&op_swp,
+      [PROG_DRP] = &&op_drp,     [PROG_PICK] = &&op_pick,
+      [PROG_ROLL] = &&op_roll,   [PROG_DUPN] = &&op_dupn,
+      [PROG_DRPN] = &&op_drpn,   [PROG_SUM] = &&op_sum,
+      [PROG_MEAN] = &&op_mean,   [PROG_PROD] = &&op_prod,
+      [PROG_SIN] = &&op_sin,     [PROG_COS] = &&op_cos,
+      [PROG_TAN] = &&op_tan,     [PROG_LOG] = &&op_log,
+      [PROG_LN] = &&op_ln,       [PROG_SQRT] = &&op_sqrt,
+      [PROG_SQR] = &&op_sqr,     [PROG_STO] = &&op_sto,
+      [PROG_RCL] = &&op_rcl,     [PROG_LBL] = &&op_next,
+      [PROG_GTO] = &&op_gto,     [PROG_DSZ] = &&op_dsz,
+      [PROG_XEQ0] = &&op_xeq0,   [PROG_XLTY] = &&op_xlty,
+      [PROG_XGTY] = &&op_xgty,   [PROG_RTN] = &&op_rtn,
+  };
+  const ProgInstr *code = c->code;
+  const ProgInstr *ip = code;
+  double X = *x;
+  uint32_t budget = PROG_MAX_INSTRS;
+  int ok = 1;
+
+// Every dispatch spends one unit of the budget
+#define PROG_DISPATCH()                                                        \
+  do {                                                                         \
+    if (--budget == 0) {                                                       \
+      ok = 0;                                                                  \
+      goto op_rtn;                                                             \
+    }                                                                          \
+    goto *dispatch[ip->op];                                                    \
+  } while (0)
+#define PROG_NEXT()                                                            \
+  do {                                                                         \
+    ++ip;                                                                      \
+    PROG_DISPATCH();                                                           \
+  } while (0)
+#define PROG_JUMP(pc)                                                          \
+  do {                                                                         \
+    ip = code + (pc);                                                          \
+    PROG_DISPATCH();                                                           \
+  } while (0)
+// Binary ops pop y, replace X and push it back, like calc_inputOperator
+#define PROG_BINARY(expr)                                                      \
+  do {                                                                         \
+    if (s->depth) {                                                            \
+      double y = s->data[s->depth - 1];                                        \
+      X = (expr);                                                              \
+      rpn_touch(s, s->depth - 1);                                              \
+      s->data[s->depth - 1] = X;                                               \
+    } else {                                                                   \
+      double y = 0;                                                            \
+      X = (expr);                                                              \
+      rpn_push(s, X);                                                          \
+    }                                                                          \
+    PROG_NEXT();                                                               \
+  } while (0)
+
+  PROG_DISPATCH();
+
+op_loadx:
+  X = c->consts[ip->arg];
+  PROG_NEXT();
+op_ent:
+  rpn_push(s, X);
+  PROG_NEXT();
+op_add:
+  PROG_BINARY(y + X);
+op_sub:
+  PROG_BINARY(y - X);
+op_mul:
+  PROG_BINARY(y * X);
+op_div:
+  PROG_BINARY(X != 0 ? y / X : 0);
+op_pow:
+  PROG_BINARY(pow(y, X));
+op_swp:
+  rpn_swap(s);
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_drp:
+  rpn_pop(s);
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_pick:
+  rpn_pick(s, rpn_count(s, X));
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_roll:
+  rpn_roll(s, rpn_count(s, X));
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_dupn:
+  rpn_dupn(s, rpn_count(s, X));
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_drpn:
+  rpn_dropn(s, rpn_count(s, X));
+  X = rpn_peek(s, 1);
+  PROG_NEXT();
+op_sum:
+  X = rpn_sum(s);
+  PROG_NEXT();
+op_mean:
+  X = rpn_mean(s);
+  PROG_NEXT();
+op_prod:
+  X = rpn_product(s);
+  PROG_NEXT();
+op_sin:
+  X = sin(X);
+  PROG_NEXT();
+op_cos:
+  X = cos(X);
+  PROG_NEXT();
+op_tan:
+  X = tan(X);
+  PROG_NEXT();
+op_log:
+  X = log10(X);
+  PROG_NEXT();
+op_ln:
+  X = log(X);
+  PROG_NEXT();
+op_sqrt:
+  X = sqrt(X);
+  PROG_NEXT();
+op_sqr:
+  X = X * X;
+  PROG_NEXT();
+op_sto:
+  regs[ip->reg] = X;
+  PROG_NEXT();
+op_rcl:
+  X = regs[ip->reg];
+  PROG_NEXT();
+op_gto:
+  PROG_JUMP(ip->arg);
+op_dsz:
+  regs[ip->reg] -= 1;
+  if (regs[ip->reg] == 0)
+    PROG_JUMP(ip->arg);
+  PROG_NEXT();
+op_xeq0:
+  if (X == 0)
+    PROG_NEXT();
+  PROG_JUMP(ip->arg);
+op_xlty:
+  if (X < rpn_peek(s, 1))
+    PROG_NEXT();
+  PROG_JUMP(ip->arg);
+op_xgty:
+  if (X > rpn_peek(s, 1))
+    PROG_NEXT();
+  PROG_JUMP(ip->arg);
+op_next:
+  PROG_NEXT();
+op_rtn:
+  *x = X;
+  return ok;
+
+#undef PROG_DISPATCH
+#undef PROG_NEXT
+#undef PROG_JUMP
+#undef PROG_BINARY
+}
+
+static int prog_save(const char *filename, const ProgProgram *p,
+                     const double *regs) {
+  FILE *f = fopen(filename, "wb");
+  if (!f)
+    return 0;
+  uint32_t magic = PROG_MAGIC;
+  uint32_t n = (uint32_t)p->numSteps;
+  fwrite(&magic, sizeof(magic), 1, f);
+  fwrite(&n, sizeof(n), 1, f);
+  fwrite(p->steps, sizeof(ProgStep), n, f);
+  fwrite(regs, sizeof(double), PROG_REGS, f);
+  fclose(f);
+  return 1;
+}
+
+static int prog_load(const char *filename, ProgProgram *p, double *regs) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return 0;
+  uint32_t magic = 0, n = 0;
+  if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != PROG_MAGIC ||
+      fread(&n, sizeof(n), 1, f) != 1 || n > PROG_MAX_STEPS) {
+    fclose(f);
+    return 0;
+  }
+  // A file cut short is rejected whole rather than run half-read
+  double saved[PROG_REGS];
+  if (fread(p->steps, sizeof(ProgStep), n, f) != n ||
+      fread(saved, sizeof(double), PROG_REGS, f) != PROG_REGS) {
+    p->numSteps = 0;
+    fclose(f);
+    return 0;
+  }
+  memcpy(regs, saved, sizeof(saved));
+  p->numSteps = (int)n;
+  fclose(f);
+  for (int i = 0; i < p->numSteps; i++)
+    if (p->steps[i].op >= PROG_NUM_OPS)
+      p->numSteps = i;
+  return 1;
+}
+
+#endif
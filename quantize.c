@@ -0,0 +1,148 @@
+#include "model.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_IMG_PATH "dataset/t10k-images.idx3-ubyte"
+#define TEST_LBL_PATH "dataset/t10k-labels.idx1-ubyte"
+
+static uint32_t read_be32(FILE *f) {
+  unsigned char b[4] = {0};
+  if (fread(b, 1, 4, f) != 4)
+    return 0;
+  return (uint32_t)b[0] << 24 | b[1] << 16 | b[2] << 8 | b[3];
+}
+
+// Per-unit scale max |w| / 127 for q1 (groups x hidden x 4) and s1 from a
+// float model's w1.
+static void quantize_w1(const Model *m, int8_t *q1, float *s1) {
+  int hidden = m->hidden;
+  memset(q1, 0, model_quant_groups(m->inputs) * hidden * 4);
+  for (int i = 0; i < hidden; i++) {
+    float mx = 0;
+    for (int j = 0; j < m->inputs; j++)
+      mx = fmaxf(mx, fabsf(m->w1[(size_t)j * hidden + i]));
+    s1[i] = mx > 0 ? mx / 127 : 1;
+    for (int j = 0; j < m->inputs; j++) {
+      long q = lrintf(m->w1[(size_t)j * hidden + i] / s1[i]);
+      q1[((size_t)(j / 4) * hidden + i) * 4 + j % 4] =
+          (int8_t)(q > 127 ? 127 : q < -127 ? -127 : q);
+    }
+  }
+}
+
+// Classifies count inputs (m->inputs floats apart) into digits.
+static void predict_batch(const Model *m, const float *inputs, int count,
+                          int *digits) {
+  float pre[MODEL_BATCH * MODEL_MAX_HIDDEN];
+  for (int at = 0; at < count; at += MODEL_BATCH) {
+    int nb = count - at < MODEL_BATCH ? count - at : MODEL_BATCH;
+    for (int b = 0; b < nb; b++)
+      model_hidden(m, inputs + (size_t)(at + b) * m->inputs,
+                   pre + (size_t)b * m->hidden);
+    model_classify_batch(m, pre, nb, digits + at);
+  }
+}
+
+// Accuracy of both networks on the MNIST test set, when it is present.
+static void evaluate(const Model *fm, const Model *qm) {
+  FILE *fi = fopen(TEST_IMG_PATH, "rb");
+  FILE *fl = fopen(TEST_LBL_PATH, "rb");
+  if (!fi || !fl || fm->inputs != 784) {
+    printf("No test set in dataset/, skipping the accuracy check.\n");
+    if (fi)
+      fclose(fi);
+    if (fl)
+      fclose(fl);
+    return;
+  }
+
+  read_be32(fi);
+  uint32_t count = read_be32(fi);
+  read_be32(fi);
+  read_be32(fi);
+  read_be32(fl);
+  read_be32(fl);
+
+  int floatOk = 0, quantOk = 0, agree = 0, n = 0;
+  unsigned char img[784];
+  static float input[MODEL_BATCH * 784];
+  int label[MODEL_BATCH], pf[MODEL_BATCH], pq[MODEL_BATCH];
+  for (;;) {
+    int nb = 0;
+    while (nb < MODEL_BATCH && n + nb < (int)count &&
+           fread(img, 1, sizeof(img), fi) == sizeof(img) &&
+           (label[nb] = fgetc(fl)) != EOF) {
+      for (int i = 0; i < 784; i++)
+        input[nb * 784 + i] = img[i] / 255.0f;
+      nb++;
+    }
+    if (nb == 0)
+      break;
+    predict_batch(fm, input, nb, pf);
+    predict_batch(qm, input, nb, pq);
+    for (int b = 0; b < nb; b++) {
+      floatOk += pf[b] == label[b];
+      quantOk += pq[b] == label[b];
+      agree += pf[b] == pq[b];
+    }
+    n += nb;
+  }
+  fclose(fi);
+  fclose(fl);
+
+  if (n > 0)
+    printf("t10k: float %.2f%%, int8 %.2f%%, agreement %.2f%% over %d "
+           "images\n",
+           floatOk * 100.0 / n, quantOk * 100.0 / n, agree * 100.0 / n, n);
+}
+
+// Converts a float model (versioned or the old headerless model.bin) to
+// the per-channel int8 format, then reopens the result with its checksum
+// verified.
+int main(int argc, char **argv) {
+  const char *in = argc > 1 ? argv[1] : "model.bin";
+  const char *out = argc > 2 ? argv[2] : "model_q8.bin";
+
+  Model fm, qm;
+  const char *err = model_open(in, &fm, 1);
+  if (!err && (fm.kind != MODEL_MLP || fm.dtype != MODEL_F32)) {
+    model_close(&fm);
+    err = "not a float MLP";
+  }
+  if (err) {
+    printf("Error: %s: %s\n", in, err);
+    return 1;
+  }
+
+  size_t q1Size = model_quant_groups(fm.inputs) * fm.hidden * 4;
+  int8_t *q1 = malloc(q1Size);
+  float *s1 = malloc(fm.hidden * sizeof(float));
+  if (!q1 || !s1) {
+    printf("Error: out of memory\n");
+    return 1;
+  }
+  quantize_w1(&fm, q1, s1);
+  const uint32_t dims[] = {fm.inputs, fm.hidden, fm.outputs};
+  const void *sections[MODEL_MLP_SECTIONS] = {q1, s1, fm.b1, fm.w2, fm.b2};
+  if (!model_save(out, MODEL_MLP, MODEL_Q8, dims, sections)) {
+    printf("Error: could not write %s\n", out);
+    return 1;
+  }
+  free(q1);
+  free(s1);
+
+  err = model_open(out, &qm, 1);
+  if (err) {
+    printf("Error: %s: %s\n", out, err);
+    return 1;
+  }
+  printf("Wrote %s (%zu bytes, from %zu)\n", out, qm.mapSize, fm.mapSize);
+
+  evaluate(&fm, &qm);
+  model_close(&qm);
+  model_close(&fm);
+  return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef RPN_H
+#define RPN_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RPN_INITIAL_CAPACITY 64
+#define RPN_LANES 4
+
+// Level 1 (the top) lives at data[depth - 1], so push and pop never move the
+// rest of the stack. Everything below data[touched] is unchanged since the
+// undo journal last looked; every write lowers the mark.
+typedef struct {
+  double *data;
+  size_t depth;
+  size_t capacity;
+  size_t touched;
+} RpnStack;
+
+static void rpn_touch(RpnStack *s, size_t i) {
+  if (i < s->touched)
+    s->touched = i;
+}
+
+// Returns 0 when n levels cannot be allocated.
+static int rpn_reserve(RpnStack *s, size_t n) {
+  if (n <= s->capacity)
+    return 1;
+  if (n > SIZE_MAX / sizeof(double))
+    return 0;
+  size_t cap = s->capacity ? s->capacity : RPN_INITIAL_CAPACITY;
+  while (cap < n)
+    cap = cap > SIZE_MAX / sizeof(double) / 2 ? n : cap * 2;
+  double *d = realloc(s->data, cap * sizeof(double));
+  if (!d)
+    return 0;
+  s->data = d;
+  s->capacity = cap;
+  return 1;
+}
+
+static void rpn_push(RpnStack *s, double val) {
+  if (s->depth == s->capacity && !rpn_reserve(s, s->depth + 1))
+    return;
+  rpn_touch(s, s->depth);
+  s->data[s->depth++] = val;
+}
+
+// An empty stack reads as zeros, like the old fixed four-level stack.
+static double rpn_pop(RpnStack *s) {
+  if (s->depth == 0)
+    return 0;
+  rpn_touch(s, s->depth - 1);
+  return s->data[--s->depth];
+}
+
+static double rpn_peek(const RpnStack *s, size_t level) {
+  if (level < 1 || level > s->depth)
+    return 0;
+  return s->data[s->depth - level];
+}
+
+static void rpn_clear(RpnStack *s) {
+  s->depth = 0;
+  s->touched = 0;
+}
+
+static int rpn_swap(RpnStack *s) {
+  if (s->depth < 2)
+    return 0;
+  rpn_touch(s, s->depth - 2);
+  double tmp = s->data[s->depth - 1];
+  s->data[s->depth - 1] = s->data[s->depth - 2];
+  s->data[s->depth - 2] = tmp;
+  return 1;
+}
+
+// A level count taken from x for PICK, ROLL, DUPN and DRPN: |x| truncated,
+// or depth + 1, which they refuse, when x is NaN, infinite or deeper than
+// the stack.
+static size_t rpn_count(const RpnStack *s, double x) {
+  double n = fabs(x);
+  return n <= (double)s->depth ? (size_t)n : s->depth + 1;
+}
+
+// Copies level n to the top.
+static int rpn_pick(RpnStack *s, size_t n) {
+  if (n < 1 || n > s->depth)
+    return 0;
+  rpn_push(s, s->data[s->depth - n]);
+  return 1;
+}
+
+// Moves level n to the top, shifting levels 1..n-1 down by one.
+static int rpn_roll(RpnStack *s, size_t n) {
+  if (n < 1 || n > s->depth)
+    return 0;
+  double *lvl = s->data + s->depth - n;
+  double val = *lvl;
+  rpn_touch(s, s->depth - n);
+  memmove(lvl, lvl + 1, (n - 1) * sizeof(double));
+  s->data[s->depth - 1] = val;
+  return 1;
+}
+
+// Duplicates the top n levels as a block.
+static int rpn_dupn(RpnStack *s, size_t n) {
+  if (n > s->depth || !rpn_reserve(s, s->depth + n))
+    return 0;
+  rpn_touch(s, s->depth);
+  memcpy(s->data + s->depth, s->data + s->depth - n, n * sizeof(double));
+  s->depth += n;
+  return 1;
+}
+
+static int rpn_dropn(RpnStack *s, size_t n) {
+  if (n > s->depth)
+    return 0;
+  s->depth -= n;
+  rpn_touch(s, s->depth);
+  return 1;
+}
+
+// Reductions keep RPN_LANES independent accumulators so the loop maps onto
+// vector registers without needing -ffast-math.
+static double rpn_sum(const RpnStack *s) {
+  double acc[RPN_LANES] = {0};
+  size_t i = 0;
+  for (; i + RPN_LANES <= s->depth; i += RPN_LANES)
+    for (int l = 0; l < RPN_LANES; l++)
+      acc[l] += s->data[i + l];
+  for (; i < s->depth; i++)
+    acc[0] += s->data[i];
+  return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+static double rpn_product(const RpnStack *s) {
+  double acc[RPN_LANES] = {1, 1, 1, 1};
+  size_t i = 0;
+  for (; i + RPN_LANES <= s->depth; i += RPN_LANES)
+    for (int l = 0; l < RPN_LANES; l++)
+      acc[l] *= s->data[i + l];
+  for (; i < s->depth; i++)
+    acc[0] *= s->data[i];
+  return (acc[0] * acc[1]) * (acc[2] * acc[3]);
+}
+
+static double rpn_mean(const RpnStack *s) {
+  if (s->depth == 0)
+    return NAN;
+  return rpn_sum(s) / (double)s->depth;
+}
+
+#endif
@@ -0,0 +1,625 @@
+#ifndef SERIES_H
+#define SERIES_H
+
+#include "solve.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SERIES_LANES 256 // indices evaluated per block, one accumulator each
+#define SERIES_POWI_MAX 4 // x^n up to this is multiplied out, within 2 ulp
+#define SERIES_PER_THREAD 65536 // terms before another thread pays off
+#define SERIES_MAX_THREADS 16
+#define SERIES_MAX_INDEX 9007199254740992.0 // 2^53, largest exact index
+#define SERIES_MAX_TERMS 1e9 // runs on the UI thread, seconds on one core
+#define SERIES_ACCEL_START 64 // first partial sum of an infinite series
+#define SERIES_ACCEL_LEVELS 20 // doublings, so at most 2^26 terms
+#define SERIES_ACCEL_TOL 1e-10 // relative error a limit must be found to
+#define SERIES_TERM_TOL 1e-3 // last term, relative to the limit, for a sum
+
+typedef enum { SERIES_SUM, SERIES_PROD } SeriesKind;
+
+#define SERIES_POWI (SOLVE_FN + 1) // x^n for a small constant integer n
+
+typedef struct {
+  uint8_t op;
+  uint8_t fn;
+  int32_t n;
+  double num;
+} SeriesInstr;
+
+// The summand as batch code: solve.h's tape with constant integer powers
+// lowered to multiplies, and the stack depth it needs.
+typedef struct {
+  SeriesInstr code[SOLVE_MAX_CODE];
+  int len, depth;
+} SeriesTape;
+
+static void series_lower(SeriesTape *t, const SolveExpr *e) {
+  int sp = 0;
+  t->len = t->depth = 0;
+  for (int i = 0; i < e->len; i++) {
+    const SolveInstr *in = &e->code[i];
+    SeriesInstr *out = &t->code[t->len++];
+    out->op = in->op;
+    out->fn = in->fn;
+    out->n = 0;
+    out->num = in->num;
+    if (in->op == SOLVE_NUM && i + 1 < e->len &&
+        e->code[i + 1].op == SOLVE_POW && in->num == floor(in->num) &&
+        fabs(in->num) <= SERIES_POWI_MAX) {
+      out->op = SERIES_POWI;
+      out->n = (int32_t)in->num;
+      i++;
+      continue;
+    }
+    if (in->op == SOLVE_NUM || in->op == SOLVE_X)
+      sp++;
+    else if (in->op != SOLVE_NEG && in->op != SOLVE_FN)
+      sp--;
+    if (sp > t->depth)
+      t->depth = sp;
+  }
+}
+
+// A running sum s + c (Neumaier), or a running product (s + c) * 2^ex with
+// c the accumulated rounding error of the products.
+typedef struct {
+  double s, c;
+  int64_t ex;
+} SeriesAcc;
+
+static SeriesAcc series_acc_init(int kind) {
+  SeriesAcc a = {kind == SERIES_PROD ? 1.0 : 0.0, 0, 0};
+  return a;
+}
+
+static void series_acc_normalize(SeriesAcc *a) {
+  if (a->s == 0 || !isfinite(a->s))
+    return;
+  int e;
+  a->s = frexp(a->s, &e);
+  a->c = ldexp(a->c, -e);
+  a->ex += e;
+}
+
+static void series_acc_add(int kind, SeriesAcc *a, double x) {
+  if (kind == SERIES_SUM) {
+    double t = a->s + x;
+    a->c += fabs(a->s) >= fabs(x) ? (a->s - t) + x : (x - t) + a->s;
+    a->s = t;
+  } else {
+    double p = a->s * x;
+    a->c = a->c * x + fma(a->s, x, -p);
+    a->s = p;
+    series_acc_normalize(a);
+  }
+}
+
+static void series_acc_merge(int kind, SeriesAcc *a, const SeriesAcc *b) {
+  if (kind == SERIES_SUM) {
+    series_acc_add(kind, a, b->s);
+    series_acc_add(kind, a, b->c);
+  } else {
+    double p = a->s * b->s;
+    a->c = fma(a->s, b->s, -p) + a->s * b->c + a->c * b->s;
+    a->s = p;
+    a->ex += b->ex;
+    series_acc_normalize(a);
+  }
+}
+
+static double series_acc_value(int kind, const SeriesAcc *a) {
+  if (kind == SERIES_SUM)
+    return a->s + a->c;
+  double v = a->s + a->c;
+  int64_t ex = a->ex;
+  if (ex > 4096)
+    ex = 4096;
+  if (ex < -4096)
+    ex = -4096;
+  return ldexp(v, (int)ex);
+}
+
+// One tape instruction over n lanes; a is the top of the stack after it
+// runs, b the operand above it for binary ops.
+static void series_op(const SeriesInstr *in, double *a, const double *b,
+                      double k0, int n) {
+  switch (in->op) {
+  case SOLVE_NUM:
+    for (int i = 0; i < n; i++)
+      a[i] = in->num;
+    break;
+  case SOLVE_X:
+    for (int i = 0; i < n; i++)
+      a[i] = k0 + i;
+    break;
+  case SOLVE_NEG:
+    for (int i = 0; i < n; i++)
+      a[i] = -a[i];
+    break;
+  case SOLVE_ADD:
+    for (int i = 0; i < n; i++)
+      a[i] += b[i];
+    break;
+  case SOLVE_SUB:
+    for (int i = 0; i < n; i++)
+      a[i] -= b[i];
+    break;
+  case SOLVE_MUL:
+    for (int i = 0; i < n; i++)
+      a[i] *= b[i];
+    break;
+  case SOLVE_DIV:
+    for (int i = 0; i < n; i++)
+      a[i] /= b[i];
+    break;
+  case SOLVE_POW:
+    for (int i = 0; i < n; i++)
+      a[i] = pow(a[i], b[i]);
+    break;
+  case SOLVE_MOD:
+    for (int i = 0; i < n; i++)
+      a[i] = fmod(a[i], b[i]);
+    break;
+  case SOLVE_FN:
+    for (int i = 0; i < n; i++)
+      a[i] = solve_fn(in->fn, a[i], NULL);
+    break;
+  case SERIES_POWI: {
+    int m = abs(in->n);
+    for (int i = 0; i < n; i++) {
+      double r = m & 1 ? a[i] : 1, x = a[i];
+      for (int k = m >> 1; k; k >>= 1) {
+        x *= x;
+        if (k & 1)
+          r *= x;
+      }
+      a[i] = in->n < 0 ? 1 / r : r;
+    }
+    break;
+  }
+  }
+}
+
+static void series_accumulate(int kind, const double *v, int n, double *s,
+                              double *c) {
+  if (kind == SERIES_SUM) {
+    for (int i = 0; i < n; i++) {
+      double t = s[i] + v[i];
+      c[i] += fabs(s[i]) >= fabs(v[i]) ? (s[i] - t) + v[i] : (v[i] - t) + s[i];
+      s[i] = t;
+    }
+  } else {
+    for (int i = 0; i < n; i++) {
+      double p = s[i] * v[i];
+      c[i] = c[i] * v[i] + fma(s[i], v[i], -p);
+      s[i] = p;
+    }
+  }
+}
+
+#ifdef CPLX_X86
+// The arithmetic ops four lanes at a time; returns 0 for the ones left to
+// libm (pow, fmod and the transcendental functions).
+__attribute__((target("avx2,fma"))) static int
+series_op_avx2(const SeriesInstr *in, double *a, const double *b, double k0,
+               int n) {
+  __m256d sign = _mm256_set1_pd(-0.0);
+  int i = 0;
+  switch (in->op) {
+  case SOLVE_X: {
+    __m256d k = _mm256_add_pd(_mm256_set1_pd(k0), _mm256_set_pd(3, 2, 1, 0));
+    for (; i + 4 <= n; i += 4) {
+      _mm256_storeu_pd(a + i, k);
+      k = _mm256_add_pd(k, _mm256_set1_pd(4));
+    }
+    break;
+  }
+  case SOLVE_ADD:
+  case SOLVE_SUB:
+  case SOLVE_MUL:
+  case SOLVE_DIV:
+    for (; i + 4 <= n; i += 4) {
+      __m256d x = _mm256_loadu_pd(a + i), y = _mm256_loadu_pd(b + i);
+      x = in->op == SOLVE_ADD   ? _mm256_add_pd(x, y)
+          : in->op == SOLVE_SUB ? _mm256_sub_pd(x, y)
+          : in->op == SOLVE_MUL ? _mm256_mul_pd(x, y)
+                                : _mm256_div_pd(x, y);
+      _mm256_storeu_pd(a + i, x);
+    }
+    break;
+  case SOLVE_NEG:
+    for (; i + 4 <= n; i += 4)
+      _mm256_storeu_pd(a + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    break;
+  case SOLVE_FN:
+    if (in->fn > 4 || in->fn == 1)
+      return 0;
+    for (; i + 4 <= n; i += 4) {
+      __m256d x = _mm256_loadu_pd(a + i);
+      x = in->fn == 0   ? _mm256_andnot_pd(sign, x)
+          : in->fn == 2 ? _mm256_floor_pd(x)
+          : in->fn == 3 ? _mm256_ceil_pd(x)
+                        : _mm256_sqrt_pd(x);
+      _mm256_storeu_pd(a + i, x);
+    }
+    break;
+  case SERIES_POWI: {
+    int m = abs(in->n);
+    for (; i + 4 <= n; i += 4) {
+      __m256d x = _mm256_loadu_pd(a + i);
+      __m256d r = m & 1 ? x : _mm256_set1_pd(1);
+      for (int k = m >> 1; k; k >>= 1) {
+        x = _mm256_mul_pd(x, x);
+        if (k & 1)
+          r = _mm256_mul_pd(r, x);
+      }
+      if (in->n < 0)
+        r = _mm256_div_pd(_mm256_set1_pd(1), r);
+      _mm256_storeu_pd(a + i, r);
+    }
+    break;
+  }
+  default:
+    return 0;
+  }
+  if (i < n) {
+    SeriesInstr tail = *in;
+    series_op(&tail, a + i, b ? b + i : NULL, k0 + i, n - i);
+  }
+  return 1;
+}
+
+__attribute__((target("avx2,fma"))) static void
+series_accumulate_avx2(int kind, const double *v, int n, double *s,
+                       double *c) {
+  __m256d sign = _mm256_set1_pd(-0.0);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256d x = _mm256_loadu_pd(v + i), sv = _mm256_loadu_pd(s + i);
+    __m256d cv = _mm256_loadu_pd(c + i);
+    if (kind == SERIES_SUM) {
+      __m256d t = _mm256_add_pd(sv, x);
+      __m256d big = _mm256_cmp_pd(_mm256_andnot_pd(sign, sv),
+                                  _mm256_andnot_pd(sign, x), _CMP_GE_OQ);
+      __m256d fromS = _mm256_add_pd(_mm256_sub_pd(sv, t), x);
+      __m256d fromX = _mm256_add_pd(_mm256_sub_pd(x, t), sv);
+      cv = _mm256_add_pd(cv, _mm256_blendv_pd(fromX, fromS, big));
+      sv = t;
+    } else {
+      __m256d p = _mm256_mul_pd(sv, x);
+      cv = _mm256_fmadd_pd(cv, x, _mm256_fmsub_pd(sv, x, p));
+      sv = p;
+    }
+    _mm256_storeu_pd(s + i, sv);
+    _mm256_storeu_pd(c + i, cv);
+  }
+  if (i < n)
+    series_accumulate(kind, v + i, n - i, s + i, c + i);
+}
+#endif
+
+typedef struct {
+  const SeriesTape *t;
+  int kind;
+  double lo, hi; // indices lo .. hi - 1
+  SeriesAcc acc;
+} SeriesJob;
+
+// Evaluates the summand SERIES_LANES indices at a time and folds each lane
+// into its own compensated accumulator; the lanes are merged at the end.
+static void *series_job_run(void *arg) {
+  SeriesJob *j = arg;
+  const SeriesTape *t = j->t;
+  int depth = t->depth > 0 ? t->depth : 1;
+  double *buf = (double *)malloc((size_t)(depth + 2) * SERIES_LANES *
+                                 sizeof(double));
+  int64_t *ex = (int64_t *)calloc(SERIES_LANES, sizeof(int64_t));
+  j->acc = series_acc_init(j->kind);
+  if (!buf || !ex) {
+    free(buf);
+    free(ex);
+    j->acc.s = NAN;
+    return NULL;
+  }
+  double *s = buf + (size_t)depth * SERIES_LANES, *c = s + SERIES_LANES;
+  for (int i = 0; i < SERIES_LANES; i++) {
+    s[i] = j->kind == SERIES_PROD ? 1 : 0;
+    c[i] = 0;
+  }
+#ifdef CPLX_X86
+  int avx2 = cplx_has_avx2();
+#endif
+  for (double k = j->lo; k < j->hi; k += SERIES_LANES) {
+    int n = j->hi - k < SERIES_LANES ? (int)(j->hi - k) : SERIES_LANES;
+    int sp = 0;
+    for (int i = 0; i < t->len; i++) {
+      const SeriesInstr *in = &t->code[i];
+      int push = in->op == SOLVE_NUM || in->op == SOLVE_X;
+      int binary = in->op >= SOLVE_ADD && in->op <= SOLVE_MOD;
+      if (push)
+        sp++;
+      else if (binary)
+        sp--;
+      double *a = buf + (size_t)(sp - 1) * SERIES_LANES;
+      const double *b = binary ? a + SERIES_LANES : NULL;
+#ifdef CPLX_X86
+      if (avx2 && series_op_avx2(in, a, b, k, n))
+        continue;
+#endif
+      series_op(in, a, b, k, n);
+    }
+#ifdef CPLX_X86
+    if (avx2)
+      series_accumulate_avx2(j->kind, buf, n, s, c);
+    else
+#endif
+      series_accumulate(j->kind, buf, n, s, c);
+    if (j->kind == SERIES_PROD)
+      for (int i = 0; i < n; i++) {
+        SeriesAcc lane = {s[i], c[i], ex[i]};
+        series_acc_normalize(&lane);
+        s[i] = lane.s;
+        c[i] = lane.c;
+        ex[i] = lane.ex;
+      }
+  }
+  for (int i = 0; i < SERIES_LANES; i++) {
+    SeriesAcc lane = {s[i], c[i], ex[i]};
+    series_acc_merge(j->kind, &j->acc, &lane);
+  }
+  free(buf);
+  free(ex);
+  return NULL;
+}
+
+static int series_thread_count(double terms) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > SERIES_MAX_THREADS)
+    n = SERIES_MAX_THREADS;
+  if (terms / SERIES_PER_THREAD < n)
+    n = (long)(terms / SERIES_PER_THREAD) + 1;
+  return (int)n;
+}
+
+// Folds the terms at indices lo .. hi - 1 into acc. The range is cut into
+// one contiguous slice per core and the slices merged in order.
+static void series_reduce(const SeriesTape *t, int kind, double lo, double hi,
+                          SeriesAcc *acc) {
+  if (hi <= lo)
+    return;
+  int nthreads = series_thread_count(hi - lo);
+  SeriesJob jobs[SERIES_MAX_THREADS];
+  pthread_t tids[SERIES_MAX_THREADS];
+  double per = ceil((hi - lo) / nthreads / SERIES_LANES) * SERIES_LANES;
+  int started = 0;
+  for (int i = 0; i < nthreads; i++) {
+    jobs[i].t = t;
+    jobs[i].kind = kind;
+    jobs[i].lo = fmin(lo + i * per, hi);
+    jobs[i].hi = fmin(lo + (i + 1) * per, hi);
+  }
+  for (int i = 1; i < nthreads; i++, started++)
+    if (pthread_create(&tids[i], NULL, series_job_run, &jobs[i]) != 0)
+      break;
+  series_job_run(&jobs[0]);
+  for (int i = 1; i <= started; i++)
+    pthread_join(tids[i], NULL);
+  for (int i = started + 1; i < nthreads; i++)
+    series_job_run(&jobs[i]);
+  for (int i = 0; i < nthreads; i++)
+    series_acc_merge(kind, acc, &jobs[i].acc);
+}
+
+typedef struct {
+  double value;
+  double terms; // terms actually evaluated
+  double error; // estimated error of an accelerated limit, else 0
+  const char *method;
+  const char *err;
+} SeriesResult;
+
+// Limit of an infinite sum or product from its partial results at
+// N = SERIES_ACCEL_START * 2^j. Two extrapolations run side by side:
+// Richardson, which assumes an error expansion in powers of 1/N (p-series,
+// alternating series), and iterated Aitken delta-squared, which assumes
+// the error shrinks geometrically from one doubling to the next (so any
+// N^-p). Doubling stops when either agrees with its previous estimate to
+// rounding, and the one with the smaller last change wins. Both will also
+// settle on a value for some divergent series (1/sqrt(k) gives zeta(1/2)),
+// so the limit is only taken when it is within SERIES_ACCEL_TOL, the
+// partial results were not moving apart and the terms had gone to zero (or
+// the factors to one). Returns 0 otherwise.
+static int series_accelerate(const SeriesTape *t, int kind, double first,
+                             SeriesResult *r) {
+  double rich[SERIES_ACCEL_LEVELS + 1] = {0}, ait[SERIES_ACCEL_LEVELS + 1];
+  double part[SERIES_ACCEL_LEVELS + 1];
+  double bestRich = NAN, bestAit = NAN, lastAit = NAN;
+  double errRich = INFINITY, errAit = INFINITY;
+  SeriesAcc acc = series_acc_init(kind);
+  double n = 0;
+  int j;
+  for (j = 0; j <= SERIES_ACCEL_LEVELS; j++) {
+    double next = SERIES_ACCEL_START * ldexp(1, j);
+    series_reduce(t, kind, first + n, first + next, &acc);
+    n = next;
+    part[j] = series_acc_value(kind, &acc);
+    if (!isfinite(part[j]))
+      return 0;
+
+    // Richardson: rich[i] is the estimate eliminating 1/N .. 1/N^i.
+    double prev = rich[0], lastDiag = rich[j > 0 ? j - 1 : 0];
+    rich[0] = part[j];
+    for (int i = 1; i <= j; i++) {
+      double f = ldexp(1, i);
+      double cur = (f * rich[i - 1] - prev) / (f - 1);
+      prev = rich[i];
+      rich[i] = cur;
+    }
+    if (j > 0) {
+      double e = fmax(fabs(rich[j] - rich[j - 1]), fabs(rich[j] - lastDiag));
+      if (e < errRich) {
+        errRich = e;
+        bestRich = rich[j];
+      }
+    }
+
+    // Aitken, repeated on its own output every two levels.
+    memcpy(ait, part, (size_t)(j + 1) * sizeof(double));
+    int len = j + 1;
+    while (len >= 3) {
+      for (int i = 0; i + 2 < len; i++) {
+        double d1 = ait[i + 1] - ait[i], d2 = ait[i + 2] - ait[i + 1];
+        double den = d2 - d1;
+        ait[i] = den != 0 ? ait[i + 2] - d2 * d2 / den : ait[i + 2];
+      }
+      len -= 2;
+    }
+    if (j >= 3 && fabs(ait[len - 1] - lastAit) < errAit) {
+      errAit = fabs(ait[len - 1] - lastAit);
+      bestAit = ait[len - 1];
+    }
+    if (j >= 2)
+      lastAit = ait[len - 1];
+    double scale = 8 * DBL_EPSILON * fabs(part[j]);
+    if (errRich <= scale || errAit <= scale)
+      break;
+  }
+  j = j > SERIES_ACCEL_LEVELS ? SERIES_ACCEL_LEVELS : j;
+  r->terms = n;
+  if (errRich <= errAit && !isnan(bestRich)) {
+    r->value = bestRich;
+    r->error = errRich;
+    r->method = "Richardson";
+  } else if (!isnan(bestAit)) {
+    r->value = bestAit;
+    r->error = errAit;
+    r->method = "Aitken";
+  } else {
+    return 0;
+  }
+  if (!(r->error <= SERIES_ACCEL_TOL * fabs(r->value)))
+    return 0;
+  if (j >= 2 &&
+      fabs(part[j] - part[j - 1]) > fabs(part[j - 1] - part[j - 2]))
+    return 0;
+  SeriesAcc last = series_acc_init(kind);
+  series_reduce(t, kind, first + n, first + n + 1, &last);
+  double term = series_acc_value(kind, &last);
+  return kind == SERIES_PROD ? fabs(term - 1) <= SERIES_TERM_TOL
+                             : fabs(term) <= SERIES_TERM_TOL * fabs(r->value);
+}
+
+static const char *series_split(const char *p, const char *end) {
+  int depth = 0;
+  for (; p < end; p++) {
+    if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    else if (*p == ',' && depth == 0)
+      return p;
+  }
+  return NULL;
+}
+
+static int series_bound(const char *p, const char *end, double *out) {
+  SolveExpr e;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  while (end > p && isspace((unsigned char)end[-1]))
+    end--;
+  if (end - p == 3 && strncmp(p, "inf", 3) == 0) {
+    *out = INFINITY;
+    return 1;
+  }
+  e.len = 0;
+  if (!solve_compile_var(&e, p, end, ' ')) // no letter is the unknown here
+    return 0;
+  *out = solve_eval(&e, 0, NULL);
+  return *out == floor(*out);
+}
+
+// Whether text is sum(k=a, b, f) or prod(k=a, b, f), the whole line. The
+// index is any single letter and the only one f may use; b may be inf.
+static int series_is(const char *text) {
+  while (isspace((unsigned char)*text))
+    text++;
+  return strncmp(text, "sum(", 4) == 0 || strncmp(text, "prod(", 5) == 0;
+}
+
+// Evaluates a sum( or prod( line. Finite ranges are reduced exactly as
+// written; an infinite one is extrapolated from its partial results.
+static int series_eval(const char *text, SeriesResult *r) {
+  const char *p = text, *end = text + strlen(text);
+  memset(r, 0, sizeof(*r));
+  r->err = "syntax error";
+  while (isspace((unsigned char)*p))
+    p++;
+  while (end > p && isspace((unsigned char)end[-1]))
+    end--;
+  int kind = strncmp(p, "prod(", 5) == 0 ? SERIES_PROD : SERIES_SUM;
+  p += kind == SERIES_PROD ? 5 : 4;
+  if (end <= p || end[-1] != ')')
+    return 0;
+  end--;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  if (end - p < 2 || !isalpha((unsigned char)*p) || *p == 'e')
+    return 0;
+  char index = *p++;
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  if (p == end || *p++ != '=')
+    return 0;
+  const char *c1 = series_split(p, end);
+  const char *c2 = c1 ? series_split(c1 + 1, end) : NULL;
+  double lo, hi;
+  SolveExpr e;
+  uint64_t letters = 0;
+  e.len = 0;
+  if (!c2 || !solve_compile_var(&e, c2 + 1, end, index)) {
+    e.len = 0;
+    if (c2 && solve_compile_side(&e, c2 + 1, end, &letters))
+      r->err = "only the index may vary";
+    return 0;
+  }
+  if (!series_bound(p, c1, &lo) || !series_bound(c1 + 1, c2, &hi) ||
+      !isfinite(lo)) {
+    r->err = "bounds must be integers";
+    return 0;
+  }
+  SeriesTape t;
+  series_lower(&t, &e);
+  r->err = NULL;
+  if (isinf(hi)) {
+    if (!series_accelerate(&t, kind, lo, r)) {
+      r->err = "does not converge";
+      return 0;
+    }
+  } else {
+    if (fmax(fabs(lo), fabs(hi)) > SERIES_MAX_INDEX ||
+        hi - lo >= SERIES_MAX_TERMS) {
+      r->err = "range too long";
+      return 0;
+    }
+    SeriesAcc acc = series_acc_init(kind);
+    series_reduce(&t, kind, lo, hi + 1, &acc);
+    r->value = series_acc_value(kind, &acc);
+    r->terms = hi >= lo ? hi - lo + 1 : 0;
+    r->method = kind == SERIES_PROD ? "compensated product"
+                                    : "compensated sum";
+  }
+  if (isnan(r->value)) {
+    r->err = "undefined";
+    return 0;
+  }
+  return 1;
+}
+
+#endif
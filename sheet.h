@@ -0,0 +1,839 @@
+#ifndef SHEET_H
+#define SHEET_H
+
+#include "atod.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SHEET_TEXT_MAX 128
+#define SHEET_NAME_MAX 32
+#define SHEET_MAX_CELLS 65536
+#define SHEET_MAGIC 0x434C5331
+#define SHEET_PARALLEL_MIN 512 // cells in one wave before threads pay off
+#define SHEET_MAX_THREADS 16
+
+// Compile-time errors live in the cell; the rest are decided at recalc.
+typedef enum {
+  SHEET_OK,
+  SHEET_BLANK,
+  SHEET_ERR_SYNTAX,
+  SHEET_ERR_UNDEFINED,
+  SHEET_ERR_DUPLICATE,
+  SHEET_ERR_CYCLE,
+  SHEET_ERR_REF
+} SheetStatus;
+
+typedef enum {
+  SHEET_NUM,
+  SHEET_LOAD,
+  SHEET_NEG,
+  SHEET_ADD,
+  SHEET_SUB,
+  SHEET_MUL,
+  SHEET_DIV,
+  SHEET_POW,
+  SHEET_FN1,
+  SHEET_FN2
+} SheetOp;
+
+typedef struct {
+  uint8_t op;
+  uint8_t fn;
+  int32_t sym;
+  double num;
+} SheetInstr;
+
+// One line of the sheet. Ids are stable while lines move; refs are the
+// distinct symbols the expression reads.
+typedef struct {
+  char text[SHEET_TEXT_MAX];
+  SheetInstr *code;
+  int codeLen;
+  int *refs;
+  int numRefs;
+  int sym; // symbol this line defines, or -1
+  double value;
+  uint8_t err;
+  uint8_t status;
+  uint8_t live;
+} SheetCell;
+
+// A name. def is the cell that owns it (the first to claim it); readers are
+// the cells whose expressions mention it, i.e. the reverse edges of the DAG.
+typedef struct {
+  char name[SHEET_NAME_MAX];
+  int def;
+  int *readers;
+  int numReaders, capReaders;
+} SheetSym;
+
+typedef struct {
+  SheetCell *cells;
+  int numCells, capCells;
+  int *freeIds;
+  int numFree;
+  int *order; // display order of cell ids
+  int numLines;
+  SheetSym *syms;
+  int numSyms, capSyms;
+  int *symIndex; // open addressing, name hash -> symbol
+  uint32_t symIndexSize;
+  int *seeds;
+  int numSeeds, capSeeds;
+  // Recalc scratch, capCells entries each
+  uint8_t *dirty;
+  int *indeg, *list, *queue;
+  int lastRecalc; // cells recomputed by the last edit
+} Sheet;
+
+static const struct {
+  const char *name;
+  double (*f)(double);
+} SHEET_FN1S[] = {
+    {"sin", sin},   {"cos", cos},     {"tan", tan},   {"asin", asin},
+    {"acos", acos}, {"atan", atan},   {"sinh", sinh}, {"cosh", cosh},
+    {"tanh", tanh}, {"sqrt", sqrt},   {"ln", log},    {"log", log10},
+    {"exp", exp},   {"abs", fabs},    {"floor", floor}, {"ceil", ceil},
+};
+
+static const struct {
+  const char *name;
+  double (*f)(double, double);
+} SHEET_FN2S[] = {
+    {"min", fmin}, {"max", fmax}, {"mod", fmod}, {"atan2", atan2},
+    {"hypot", hypot},
+};
+
+#define SHEET_NUM_FN1 (int)(sizeof(SHEET_FN1S) / sizeof(SHEET_FN1S[0]))
+#define SHEET_NUM_FN2 (int)(sizeof(SHEET_FN2S) / sizeof(SHEET_FN2S[0]))
+
+static const char *sheet_status_text(int status) {
+  static const char *text[] = {"",          "",          "syntax error",
+                               "undefined", "duplicate", "cycle",
+                               "bad ref"};
+  return text[status];
+}
+
+static int sheet_grow(void **p, int *cap, int need, size_t elem) {
+  if (need <= *cap)
+    return 1;
+  int n = *cap ? *cap : 16;
+  while (n < need)
+    n *= 2;
+  void *q = realloc(*p, (size_t)n * elem);
+  if (!q)
+    return 0;
+  *p = q;
+  *cap = n;
+  return 1;
+}
+
+static uint64_t sheet_hash(const char *s, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+static int sheet_reindex(Sheet *s, uint32_t size) {
+  int *idx = malloc(size * sizeof(int));
+  if (!idx)
+    return 0;
+  for (uint32_t i = 0; i < size; i++)
+    idx[i] = -1;
+  for (int k = 0; k < s->numSyms; k++) {
+    const char *n = s->syms[k].name;
+    uint32_t i = (uint32_t)sheet_hash(n, strlen(n)) & (size - 1);
+    while (idx[i] >= 0)
+      i = (i + 1) & (size - 1);
+    idx[i] = k;
+  }
+  free(s->symIndex);
+  s->symIndex = idx;
+  s->symIndexSize = size;
+  return 1;
+}
+
+// Finds or creates the symbol for name[0..len). Returns -1 only when out of
+// memory.
+static int sheet_intern(Sheet *s, const char *name, size_t len) {
+  if ((uint32_t)(s->numSyms + 1) * 2 > s->symIndexSize &&
+      !sheet_reindex(s, s->symIndexSize ? s->symIndexSize * 2 : 64))
+    return -1;
+  uint32_t mask = s->symIndexSize - 1;
+  uint32_t i = (uint32_t)sheet_hash(name, len) & mask;
+  for (; s->symIndex[i] >= 0; i = (i + 1) & mask) {
+    const char *n = s->syms[s->symIndex[i]].name;
+    if (strncmp(n, name, len) == 0 && n[len] == '\0')
+      return s->symIndex[i];
+  }
+  if (!sheet_grow((void **)&s->syms, &s->capSyms, s->numSyms + 1,
+                  sizeof(SheetSym)))
+    return -1;
+  SheetSym *y = &s->syms[s->numSyms];
+  memset(y, 0, sizeof(*y));
+  memcpy(y->name, name, len);
+  y->def = -1;
+  s->symIndex[i] = s->numSyms;
+  return s->numSyms++;
+}
+
+static int sheet_ident_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int sheet_ident_char(char c) {
+  return sheet_ident_start(c) || (unsigned)(c - '0') < 10;
+}
+
+// Recursive descent straight to stack code. Names become symbol ids, so a
+// line compiles once and evaluates without touching its text.
+typedef struct {
+  Sheet *s;
+  const char *p, *end;
+  SheetInstr code[SHEET_TEXT_MAX];
+  int len;
+  int refs[SHEET_TEXT_MAX];
+  int numRefs;
+  int ok;
+} SheetParser;
+
+static void sheet_skip(SheetParser *ps) {
+  while (ps->p < ps->end && (*ps->p == ' ' || *ps->p == '\t'))
+    ps->p++;
+}
+
+static void sheet_emit(SheetParser *ps, int op, int fn, int sym, double num) {
+  if (ps->len == SHEET_TEXT_MAX) {
+    ps->ok = 0;
+    return;
+  }
+  SheetInstr *in = &ps->code[ps->len++];
+  in->op = (uint8_t)op;
+  in->fn = (uint8_t)fn;
+  in->sym = sym;
+  in->num = num;
+}
+
+static int sheet_accept(SheetParser *ps, char c) {
+  sheet_skip(ps);
+  if (ps->p < ps->end && *ps->p == c) {
+    ps->p++;
+    return 1;
+  }
+  return 0;
+}
+
+static void sheet_parse_expr(SheetParser *ps);
+static void sheet_parse_unary(SheetParser *ps);
+
+static void sheet_parse_primary(SheetParser *ps) {
+  sheet_skip(ps);
+  if (ps->p == ps->end) {
+    ps->ok = 0;
+    return;
+  }
+  if (sheet_accept(ps, '(')) {
+    sheet_parse_expr(ps);
+    if (!sheet_accept(ps, ')'))
+      ps->ok = 0;
+    return;
+  }
+  if (sheet_ident_start(*ps->p)) {
+    const char *name = ps->p;
+    while (ps->p < ps->end && sheet_ident_char(*ps->p))
+      ps->p++;
+    size_t len = (size_t)(ps->p - name);
+    if (len >= SHEET_NAME_MAX) {
+      ps->ok = 0;
+      return;
+    }
+    if (sheet_accept(ps, '(')) {
+      for (int f = 0; f < SHEET_NUM_FN1; f++)
+        if (strncmp(SHEET_FN1S[f].name, name, len) == 0 &&
+            SHEET_FN1S[f].name[len] == '\0') {
+          sheet_parse_expr(ps);
+          sheet_emit(ps, SHEET_FN1, f, -1, 0);
+          if (!sheet_accept(ps, ')'))
+            ps->ok = 0;
+          return;
+        }
+      for (int f = 0; f < SHEET_NUM_FN2; f++)
+        if (strncmp(SHEET_FN2S[f].name, name, len) == 0 &&
+            SHEET_FN2S[f].name[len] == '\0') {
+          sheet_parse_expr(ps);
+          if (!sheet_accept(ps, ','))
+            ps->ok = 0;
+          sheet_parse_expr(ps);
+          sheet_emit(ps, SHEET_FN2, f, -1, 0);
+          if (!sheet_accept(ps, ')'))
+            ps->ok = 0;
+          return;
+        }
+      ps->ok = 0;
+      return;
+    }
+    if (len == 2 && strncmp(name, "pi", 2) == 0) {
+      sheet_emit(ps, SHEET_NUM, 0, -1, M_PI);
+      return;
+    }
+    if (len == 1 && *name == 'e') {
+      sheet_emit(ps, SHEET_NUM, 0, -1, M_E);
+      return;
+    }
+    int sym = sheet_intern(ps->s, name, len);
+    if (sym < 0) {
+      ps->ok = 0;
+      return;
+    }
+    int k = 0;
+    while (k < ps->numRefs && ps->refs[k] != sym)
+      k++;
+    if (k == ps->numRefs)
+      ps->refs[ps->numRefs++] = sym;
+    sheet_emit(ps, SHEET_LOAD, 0, sym, 0);
+    return;
+  }
+  double v;
+  const char *next = atod_parse(ps->p, ps->end, &v);
+  if (!next) {
+    ps->ok = 0;
+    return;
+  }
+  ps->p = next;
+  sheet_emit(ps, SHEET_NUM, 0, -1, v);
+}
+
+// ^ binds tighter than unary minus and associates to the right.
+static void sheet_parse_power(SheetParser *ps) {
+  sheet_parse_primary(ps);
+  if (sheet_accept(ps, '^')) {
+    sheet_parse_unary(ps);
+    sheet_emit(ps, SHEET_POW, 0, -1, 0);
+  }
+}
+
+static void sheet_parse_unary(SheetParser *ps) {
+  if (sheet_accept(ps, '-')) {
+    sheet_parse_unary(ps);
+    sheet_emit(ps, SHEET_NEG, 0, -1, 0);
+  } else if (sheet_accept(ps, '+')) {
+    sheet_parse_unary(ps);
+  } else {
+    sheet_parse_power(ps);
+  }
+}
+
+static void sheet_parse_term(SheetParser *ps) {
+  sheet_parse_unary(ps);
+  while (ps->ok) {
+    if (sheet_accept(ps, '*')) {
+      sheet_parse_unary(ps);
+      sheet_emit(ps, SHEET_MUL, 0, -1, 0);
+    } else if (sheet_accept(ps, '/')) {
+      sheet_parse_unary(ps);
+      sheet_emit(ps, SHEET_DIV, 0, -1, 0);
+    } else {
+      break;
+    }
+  }
+}
+
+static void sheet_parse_expr(SheetParser *ps) {
+  if (!ps->ok)
+    return;
+  sheet_parse_term(ps);
+  while (ps->ok) {
+    if (sheet_accept(ps, '+')) {
+      sheet_parse_term(ps);
+      sheet_emit(ps, SHEET_ADD, 0, -1, 0);
+    } else if (sheet_accept(ps, '-')) {
+      sheet_parse_term(ps);
+      sheet_emit(ps, SHEET_SUB, 0, -1, 0);
+    } else {
+      break;
+    }
+  }
+}
+
+static int sheet_reserved(const char *name, size_t len) {
+  if ((len == 2 && strncmp(name, "pi", 2) == 0) || (len == 1 && *name == 'e'))
+    return 1;
+  for (int f = 0; f < SHEET_NUM_FN1; f++)
+    if (strncmp(SHEET_FN1S[f].name, name, len) == 0 &&
+        SHEET_FN1S[f].name[len] == '\0')
+      return 1;
+  for (int f = 0; f < SHEET_NUM_FN2; f++)
+    if (strncmp(SHEET_FN2S[f].name, name, len) == 0 &&
+        SHEET_FN2S[f].name[len] == '\0')
+      return 1;
+  return 0;
+}
+
+// Compiles "name = expr" or a bare "expr" into the cell. The name is taken
+// even when the expression is bad, so readers see a broken ref rather than
+// an undefined one.
+static void sheet_compile(Sheet *s, SheetCell *c) {
+  SheetParser ps;
+  ps.s = s;
+  ps.p = c->text;
+  ps.end = c->text + strlen(c->text);
+  ps.len = ps.numRefs = 0;
+  ps.ok = 1;
+
+  free(c->code);
+  free(c->refs);
+  c->code = NULL;
+  c->refs = NULL;
+  c->codeLen = c->numRefs = 0;
+  c->sym = -1;
+  c->err = SHEET_OK;
+
+  sheet_skip(&ps);
+  if (ps.p == ps.end) {
+    c->err = SHEET_BLANK;
+    return;
+  }
+  const char *q = ps.p;
+  while (q < ps.end && sheet_ident_char(*q))
+    q++;
+  const char *eq = q;
+  while (eq < ps.end && (*eq == ' ' || *eq == '\t'))
+    eq++;
+  if (sheet_ident_start(*ps.p) && eq < ps.end && *eq == '=') {
+    size_t len = (size_t)(q - ps.p);
+    if (len >= SHEET_NAME_MAX || sheet_reserved(ps.p, len)) {
+      c->err = SHEET_ERR_SYNTAX;
+      return;
+    }
+    c->sym = sheet_intern(s, ps.p, len);
+    ps.p = eq + 1;
+  }
+
+  sheet_parse_expr(&ps);
+  sheet_skip(&ps);
+  if (!ps.ok || ps.p != ps.end || ps.len == 0) {
+    c->err = SHEET_ERR_SYNTAX;
+    return;
+  }
+  c->code = malloc((size_t)ps.len * sizeof(SheetInstr));
+  c->refs = malloc((size_t)(ps.numRefs ? ps.numRefs : 1) * sizeof(int));
+  if (!c->code || !c->refs) {
+    c->err = SHEET_ERR_SYNTAX;
+    return;
+  }
+  memcpy(c->code, ps.code, (size_t)ps.len * sizeof(SheetInstr));
+  memcpy(c->refs, ps.refs, (size_t)ps.numRefs * sizeof(int));
+  c->codeLen = ps.len;
+  c->numRefs = ps.numRefs;
+}
+
+static double sheet_run(const Sheet *s, const SheetCell *c) {
+  double stack[SHEET_TEXT_MAX];
+  int sp = 0;
+  for (int i = 0; i < c->codeLen; i++) {
+    const SheetInstr *in = &c->code[i];
+    switch (in->op) {
+    case SHEET_NUM:
+      stack[sp++] = in->num;
+      break;
+    case SHEET_LOAD:
+      stack[sp++] = s->cells[s->syms[in->sym].def].value;
+      break;
+    case SHEET_NEG:
+      stack[sp - 1] = -stack[sp - 1];
+      break;
+    case SHEET_ADD:
+      sp--;
+      stack[sp - 1] += stack[sp];
+      break;
+    case SHEET_SUB:
+      sp--;
+      stack[sp - 1] -= stack[sp];
+      break;
+    case SHEET_MUL:
+      sp--;
+      stack[sp - 1] *= stack[sp];
+      break;
+    case SHEET_DIV:
+      sp--;
+      stack[sp - 1] /= stack[sp];
+      break;
+    case SHEET_POW:
+      sp--;
+      stack[sp - 1] = pow(stack[sp - 1], stack[sp]);
+      break;
+    case SHEET_FN1:
+      stack[sp - 1] = SHEET_FN1S[in->fn].f(stack[sp - 1]);
+      break;
+    case SHEET_FN2:
+      sp--;
+      stack[sp - 1] = SHEET_FN2S[in->fn].f(stack[sp - 1], stack[sp]);
+      break;
+    }
+  }
+  return stack[0];
+}
+
+// Reads only cells finished in an earlier wave, writes only its own.
+static void sheet_eval_cell(Sheet *s, int id) {
+  SheetCell *c = &s->cells[id];
+  int status = c->err;
+  if (status == SHEET_OK && c->sym >= 0 && s->syms[c->sym].def != id)
+    status = SHEET_ERR_DUPLICATE;
+  for (int k = 0; k < c->numRefs && status == SHEET_OK; k++) {
+    int def = s->syms[c->refs[k]].def;
+    if (def < 0)
+      status = SHEET_ERR_UNDEFINED;
+    else if (s->cells[def].status != SHEET_OK)
+      status = SHEET_ERR_REF;
+  }
+  c->status = (uint8_t)status;
+  c->value = status == SHEET_OK ? sheet_run(s, c) : NAN;
+}
+
+typedef struct {
+  Sheet *s;
+  const int *ids;
+  int n;
+} SheetJob;
+
+static void *sheet_job_run(void *arg) {
+  SheetJob *j = arg;
+  for (int i = 0; i < j->n; i++)
+    sheet_eval_cell(j->s, j->ids[i]);
+  return NULL;
+}
+
+static int sheet_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > SHEET_MAX_THREADS)
+    n = SHEET_MAX_THREADS;
+  return (int)n;
+}
+
+// Cells in one wave never read each other, so a wide wave is split across
+// cores. Narrow waves (long chains) stay on this thread.
+static void sheet_eval_wave(Sheet *s, const int *ids, int n) {
+  int nthreads = n < SHEET_PARALLEL_MIN ? 1 : sheet_thread_count();
+  SheetJob jobs[SHEET_MAX_THREADS];
+  pthread_t tids[SHEET_MAX_THREADS];
+  int per = (n + nthreads - 1) / nthreads, started = 0;
+  for (int t = 0; t < nthreads; t++) {
+    int lo = t * per, hi = lo + per < n ? lo + per : n;
+    jobs[t].s = s;
+    jobs[t].ids = ids + lo;
+    jobs[t].n = hi > lo ? hi - lo : 0;
+  }
+  for (int t = 1; t < nthreads; t++, started++)
+    if (pthread_create(&tids[t], NULL, sheet_job_run, &jobs[t]) != 0)
+      break;
+  sheet_job_run(&jobs[0]);
+  for (int t = 1; t <= started; t++)
+    pthread_join(tids[t], NULL);
+  for (int t = started + 1; t < nthreads; t++)
+    sheet_job_run(&jobs[t]);
+}
+
+static void sheet_seed(Sheet *s, int id) {
+  if (id >= 0 && sheet_grow((void **)&s->seeds, &s->capSeeds, s->numSeeds + 1,
+                            sizeof(int)))
+    s->seeds[s->numSeeds++] = id;
+}
+
+static void sheet_seed_readers(Sheet *s, int sym) {
+  for (int k = 0; k < s->syms[sym].numReaders; k++)
+    sheet_seed(s, s->syms[sym].readers[k]);
+}
+
+// Recomputes the seeds and everything downstream of them. The dirty set is
+// walked along reader edges, then evaluated in topological waves (Kahn);
+// whatever never reaches in-degree zero sits on or behind a cycle.
+static void sheet_recalc(Sheet *s) {
+  int numDirty = 0, top = 0;
+  for (int i = 0; i < s->numSeeds; i++) {
+    int id = s->seeds[i];
+    if (s->cells[id].live && !s->dirty[id]) {
+      s->dirty[id] = 1;
+      s->queue[top++] = id;
+    }
+  }
+  s->numSeeds = 0;
+  while (top) {
+    int id = s->queue[--top];
+    const SheetCell *c = &s->cells[id];
+    s->list[numDirty++] = id;
+    if (c->sym < 0 || s->syms[c->sym].def != id)
+      continue;
+    const SheetSym *y = &s->syms[c->sym];
+    for (int k = 0; k < y->numReaders; k++) {
+      int r = y->readers[k];
+      if (!s->dirty[r]) {
+        s->dirty[r] = 1;
+        s->queue[top++] = r;
+      }
+    }
+  }
+
+  int tail = 0;
+  for (int i = 0; i < numDirty; i++) {
+    int id = s->list[i], n = 0;
+    const SheetCell *c = &s->cells[id];
+    for (int k = 0; k < c->numRefs; k++) {
+      int def = s->syms[c->refs[k]].def;
+      n += def >= 0 && s->dirty[def];
+    }
+    s->indeg[id] = n;
+    if (n == 0)
+      s->queue[tail++] = id;
+  }
+  int head = 0;
+  while (head < tail) {
+    int waveEnd = tail;
+    sheet_eval_wave(s, s->queue + head, waveEnd - head);
+    for (; head < waveEnd; head++) {
+      int id = s->queue[head];
+      const SheetCell *c = &s->cells[id];
+      if (c->sym < 0 || s->syms[c->sym].def != id)
+        continue;
+      const SheetSym *y = &s->syms[c->sym];
+      for (int k = 0; k < y->numReaders; k++) {
+        int r = y->readers[k];
+        if (s->dirty[r] && --s->indeg[r] == 0)
+          s->queue[tail++] = r;
+      }
+    }
+  }
+
+  for (int i = 0; i < numDirty; i++) {
+    int id = s->list[i];
+    if (s->indeg[id] > 0) {
+      s->cells[id].status = SHEET_ERR_CYCLE;
+      s->cells[id].value = NAN;
+    }
+    s->dirty[id] = 0;
+  }
+  s->lastRecalc = numDirty;
+}
+
+static void sheet_link(Sheet *s, int id, int add) {
+  const SheetCell *c = &s->cells[id];
+  for (int k = 0; k < c->numRefs; k++) {
+    SheetSym *y = &s->syms[c->refs[k]];
+    if (add) {
+      if (sheet_grow((void **)&y->readers, &y->capReaders, y->numReaders + 1,
+                     sizeof(int)))
+        y->readers[y->numReaders++] = id;
+      continue;
+    }
+    for (int j = 0; j < y->numReaders; j++)
+      if (y->readers[j] == id) {
+        y->readers[j] = y->readers[--y->numReaders];
+        break;
+      }
+  }
+}
+
+// The next line, in display order, that claims sym once `except` lets go.
+static int sheet_find_def(const Sheet *s, int sym, int except) {
+  for (int i = 0; i < s->numLines; i++) {
+    int id = s->order[i];
+    if (id != except && s->cells[id].sym == sym)
+      return id;
+  }
+  return -1;
+}
+
+// Replaces a cell's text and queues what must be recomputed: the cell, the
+// readers of a name it gave up or took, and any line that inherits a name.
+static void sheet_assign(Sheet *s, int id, const char *text) {
+  SheetCell *c = &s->cells[id];
+  int oldSym = c->sym;
+  sheet_link(s, id, 0);
+  snprintf(c->text, sizeof(c->text), "%s", text);
+  sheet_compile(s, c);
+  sheet_link(s, id, 1);
+  sheet_seed(s, id);
+  if (oldSym == c->sym)
+    return;
+  if (oldSym >= 0 && s->syms[oldSym].def == id) {
+    s->syms[oldSym].def = sheet_find_def(s, oldSym, id);
+    sheet_seed(s, s->syms[oldSym].def);
+    sheet_seed_readers(s, oldSym);
+  }
+  if (c->sym >= 0 && s->syms[c->sym].def < 0) {
+    s->syms[c->sym].def = id;
+    sheet_seed_readers(s, c->sym);
+  }
+}
+
+static int sheet_reserve(Sheet *s, int need) {
+  int cap = s->capCells;
+  if (!sheet_grow((void **)&s->cells, &cap, need, sizeof(SheetCell)))
+    return 0;
+  if (cap == s->capCells)
+    return 1;
+  int *order = realloc(s->order, (size_t)cap * sizeof(int));
+  int *freeIds = order ? realloc(s->freeIds, (size_t)cap * sizeof(int)) : NULL;
+  if (order)
+    s->order = order;
+  if (freeIds)
+    s->freeIds = freeIds;
+  uint8_t *dirty = calloc((size_t)cap, 1);
+  int *indeg = malloc((size_t)cap * sizeof(int));
+  int *list = malloc((size_t)cap * sizeof(int));
+  int *queue = malloc((size_t)cap * sizeof(int));
+  if (!order || !freeIds || !dirty || !indeg || !list || !queue) {
+    free(dirty);
+    free(indeg);
+    free(list);
+    free(queue);
+    return 0;
+  }
+  free(s->dirty);
+  free(s->indeg);
+  free(s->list);
+  free(s->queue);
+  s->dirty = dirty;
+  s->indeg = indeg;
+  s->list = list;
+  s->queue = queue;
+  s->capCells = cap;
+  return 1;
+}
+
+static void sheet_init(Sheet *s) { memset(s, 0, sizeof(*s)); }
+
+static void sheet_free(Sheet *s) {
+  for (int i = 0; i < s->numCells; i++) {
+    free(s->cells[i].code);
+    free(s->cells[i].refs);
+  }
+  for (int i = 0; i < s->numSyms; i++)
+    free(s->syms[i].readers);
+  free(s->cells);
+  free(s->freeIds);
+  free(s->order);
+  free(s->syms);
+  free(s->symIndex);
+  free(s->seeds);
+  free(s->dirty);
+  free(s->indeg);
+  free(s->list);
+  free(s->queue);
+  sheet_init(s);
+}
+
+// Adds a line at display position pos without recalculating. Returns the
+// cell id, or -1 when the sheet is full.
+static int sheet_add(Sheet *s, int pos, const char *text) {
+  if (s->numLines >= SHEET_MAX_CELLS)
+    return -1;
+  int id;
+  if (s->numFree) {
+    id = s->freeIds[--s->numFree];
+  } else {
+    if (!sheet_reserve(s, s->numCells + 1))
+      return -1;
+    id = s->numCells++;
+  }
+  SheetCell *c = &s->cells[id];
+  memset(c, 0, sizeof(*c));
+  c->sym = -1;
+  c->live = 1;
+  memmove(s->order + pos + 1, s->order + pos,
+          (size_t)(s->numLines - pos) * sizeof(int));
+  s->order[pos] = id;
+  s->numLines++;
+  sheet_assign(s, id, text);
+  return id;
+}
+
+static int sheet_insert(Sheet *s, int pos, const char *text) {
+  int id = sheet_add(s, pos, text);
+  sheet_recalc(s);
+  return id;
+}
+
+static void sheet_set(Sheet *s, int pos, const char *text) {
+  int id = s->order[pos];
+  if (strcmp(s->cells[id].text, text) == 0)
+    return;
+  sheet_assign(s, id, text);
+  sheet_recalc(s);
+}
+
+static void sheet_remove(Sheet *s, int pos) {
+  int id = s->order[pos];
+  sheet_assign(s, id, "");
+  SheetCell *c = &s->cells[id];
+  c->live = 0;
+  free(c->code);
+  free(c->refs);
+  c->code = NULL;
+  c->refs = NULL;
+  memmove(s->order + pos, s->order + pos + 1,
+          (size_t)(s->numLines - pos - 1) * sizeof(int));
+  s->numLines--;
+  s->freeIds[s->numFree++] = id;
+  sheet_recalc(s);
+}
+
+static const SheetCell *sheet_line(const Sheet *s, int pos) {
+  return &s->cells[s->order[pos]];
+}
+
+// Magic, line count, then each line as a length byte and its text.
+static int sheet_save(const char *filename, const Sheet *s) {
+  FILE *f = fopen(filename, "wb");
+  if (!f)
+    return 0;
+  uint32_t magic = SHEET_MAGIC, n = (uint32_t)s->numLines;
+  fwrite(&magic, sizeof(magic), 1, f);
+  fwrite(&n, sizeof(n), 1, f);
+  for (int i = 0; i < s->numLines; i++) {
+    const char *text = sheet_line(s, i)->text;
+    uint8_t len = (uint8_t)strlen(text);
+    fwrite(&len, 1, 1, f);
+    fwrite(text, 1, len, f);
+  }
+  return fclose(f) == 0;
+}
+
+// Replaces the sheet with the file's lines and recalculates once.
+static int sheet_load(const char *filename, Sheet *s) {
+  FILE *f = fopen(filename, "rb");
+  if (!f)
+    return 0;
+  uint32_t magic = 0, n = 0;
+  if (fread(&magic, sizeof(magic), 1, f) != 1 || magic != SHEET_MAGIC ||
+      fread(&n, sizeof(n), 1, f) != 1 || n > SHEET_MAX_CELLS) {
+    fclose(f);
+    return 0;
+  }
+  sheet_free(s);
+  char text[SHEET_TEXT_MAX];
+  for (uint32_t i = 0; i < n; i++) {
+    uint8_t len;
+    if (fread(&len, 1, 1, f) != 1 || len >= SHEET_TEXT_MAX ||
+        fread(text, 1, len, f) != len)
+      break;
+    text[len] = '\0';
+    if (sheet_add(s, s->numLines, text) < 0)
+      break;
+  }
+  fclose(f);
+  sheet_recalc(s);
+  return 1;
+}
+
+#endif
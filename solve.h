@@ -0,0 +1,937 @@
+#ifndef SOLVE_H
+#define SOLVE_H
+
+#include "atod.h"
+#include "cplx.h"
+#include <ctype.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOLVE_MAX_CODE 256
+#define SOLVE_MAX_DEGREE 4096
+#define SOLVE_MAX_ITER 500
+#define SOLVE_MAX_ROOTS 64 // real roots kept for a general equation
+#define SOLVE_SPAN 100.0   // general equations are scanned finely on ±SPAN
+#define SOLVE_SCAN 8192
+#define SOLVE_FAR 1e9 // and, if that finds nothing, out to ±FAR
+#define SOLVE_FAR_SCAN 512
+
+typedef enum {
+  SOLVE_NUM,
+  SOLVE_X,
+  SOLVE_NEG,
+  SOLVE_ADD,
+  SOLVE_SUB,
+  SOLVE_MUL,
+  SOLVE_DIV,
+  SOLVE_POW,
+  SOLVE_MOD,
+  SOLVE_FN
+} SolveOp;
+
+typedef struct {
+  uint8_t op;
+  uint8_t fn;
+  double num;
+} SolveInstr;
+
+typedef struct {
+  SolveInstr code[SOLVE_MAX_CODE];
+  int len;
+} SolveExpr;
+
+// The graph grammar's functions, tried in the same order as
+// parse_graph_factor so prefixes resolve the same way. They take a single
+// factor, with or without parentheses: "sin x", "sqrt(2x)".
+static const char *const SOLVE_FNS[] = {
+    "abs",  "sign", "floor", "ceil", "sqrt", "sinh", "cosh", "tanh",
+    "sin",  "cos",  "tan",   "asin", "acos", "atan", "log",  "ln"};
+
+#define SOLVE_NUM_FNS (int)(sizeof(SOLVE_FNS) / sizeof(SOLVE_FNS[0]))
+
+// Value of a function at a, and its derivative there in *d unless d is
+// NULL (batch evaluation skips the extra libm calls).
+static double solve_fn(int fn, double a, double *d) {
+  double v, unused;
+  int want = d != NULL;
+  if (!want)
+    d = &unused;
+  switch (fn) {
+  case 0:
+    *d = (a > 0) - (a < 0);
+    return fabs(a);
+  case 1:
+    *d = 0;
+    return (a > 0) - (a < 0);
+  case 2:
+    *d = 0;
+    return floor(a);
+  case 3:
+    *d = 0;
+    return ceil(a);
+  case 4:
+    v = sqrt(a);
+    *d = 0.5 / v;
+    return v;
+  case 5:
+    *d = want ? cosh(a) : 0;
+    return sinh(a);
+  case 6:
+    *d = want ? sinh(a) : 0;
+    return cosh(a);
+  case 7:
+    v = tanh(a);
+    *d = 1 - v * v;
+    return v;
+  case 8:
+    *d = want ? cos(a) : 0;
+    return sin(a);
+  case 9:
+    *d = want ? -sin(a) : 0;
+    return cos(a);
+  case 10:
+    v = tan(a);
+    *d = 1 + v * v;
+    return v;
+  case 11:
+    *d = 1 / sqrt(1 - a * a);
+    return asin(a);
+  case 12:
+    *d = -1 / sqrt(1 - a * a);
+    return acos(a);
+  case 13:
+    *d = 1 / (1 + a * a);
+    return atan(a);
+  case 14:
+    *d = 1 / (a * M_LN10);
+    return log10(a);
+  default:
+    *d = 1 / a;
+    return log(a);
+  }
+}
+
+// Recursive descent over the graph grammar to stack code, so the solver
+// evaluates f and f' thousands of times without rereading the text. A
+// single letter other than e is the unknown, juxtaposition multiplies, and
+// ^ binds tighter than unary minus and to the right.
+typedef struct {
+  const char *p, *end;
+  SolveExpr *e;
+  int ok;
+  uint64_t letters; // bit c & 63 for each letter c read as the unknown
+} SolveParser;
+
+static void solve_skip(SolveParser *ps) {
+  while (ps->p < ps->end && isspace((unsigned char)*ps->p))
+    ps->p++;
+}
+
+static void solve_emit(SolveParser *ps, int op, int fn, double num) {
+  if (ps->e->len == SOLVE_MAX_CODE) {
+    ps->ok = 0;
+    return;
+  }
+  SolveInstr *in = &ps->e->code[ps->e->len++];
+  in->op = (uint8_t)op;
+  in->fn = (uint8_t)fn;
+  in->num = num;
+}
+
+static int solve_accept(SolveParser *ps, char c) {
+  solve_skip(ps);
+  if (ps->p < ps->end && *ps->p == c) {
+    ps->p++;
+    return 1;
+  }
+  return 0;
+}
+
+static int solve_starts(SolveParser *ps, const char *word) {
+  size_t n = strlen(word);
+  if ((size_t)(ps->end - ps->p) < n || strncmp(ps->p, word, n) != 0)
+    return 0;
+  ps->p += n;
+  return 1;
+}
+
+static void solve_parse_expr(SolveParser *ps);
+static void solve_parse_unary(SolveParser *ps);
+
+static void solve_parse_primary(SolveParser *ps) {
+  solve_skip(ps);
+  if (ps->p == ps->end) {
+    ps->ok = 0;
+    return;
+  }
+  if (solve_accept(ps, '(')) {
+    solve_parse_expr(ps);
+    if (!solve_accept(ps, ')'))
+      ps->ok = 0;
+    return;
+  }
+  char c = *ps->p;
+  if (isalpha((unsigned char)c)) {
+    int single = ps->p + 1 == ps->end || !isalpha((unsigned char)ps->p[1]);
+    if (single) {
+      if (c != 'e')
+        ps->letters |= 1ull << (c & 63);
+      ps->p++;
+      solve_emit(ps, c == 'e' ? SOLVE_NUM : SOLVE_X, 0, M_E);
+      return;
+    }
+    if (solve_starts(ps, "pi")) {
+      solve_emit(ps, SOLVE_NUM, 0, M_PI);
+      return;
+    }
+    if (solve_starts(ps, "mod")) {
+      if (!solve_accept(ps, '(')) {
+        ps->ok = 0;
+        return;
+      }
+      solve_parse_expr(ps);
+      if (!solve_accept(ps, ','))
+        ps->ok = 0;
+      solve_parse_expr(ps);
+      if (!solve_accept(ps, ')'))
+        ps->ok = 0;
+      solve_emit(ps, SOLVE_MOD, 0, 0);
+      return;
+    }
+    for (int f = 0; f < SOLVE_NUM_FNS; f++)
+      if (solve_starts(ps, SOLVE_FNS[f])) {
+        solve_parse_primary(ps);
+        solve_emit(ps, SOLVE_FN, f, 0);
+        return;
+      }
+    ps->ok = 0;
+    return;
+  }
+  double v;
+  const char *next = atod_parse(ps->p, ps->end, &v);
+  if (!next) {
+    ps->ok = 0;
+    return;
+  }
+  ps->p = next;
+  solve_emit(ps, SOLVE_NUM, 0, v);
+}
+
+static void solve_parse_power(SolveParser *ps) {
+  solve_parse_primary(ps);
+  if (solve_accept(ps, '^')) {
+    solve_parse_unary(ps);
+    solve_emit(ps, SOLVE_POW, 0, 0);
+  }
+}
+
+static void solve_parse_unary(SolveParser *ps) {
+  if (solve_accept(ps, '-')) {
+    solve_parse_unary(ps);
+    solve_emit(ps, SOLVE_NEG, 0, 0);
+  } else if (solve_accept(ps, '+')) {
+    solve_parse_unary(ps);
+  } else {
+    solve_parse_power(ps);
+  }
+}
+
+static void solve_parse_term(SolveParser *ps) {
+  solve_parse_unary(ps);
+  while (ps->ok) {
+    if (solve_accept(ps, '*')) {
+      solve_parse_unary(ps);
+      solve_emit(ps, SOLVE_MUL, 0, 0);
+    } else if (solve_accept(ps, '/')) {
+      solve_parse_unary(ps);
+      solve_emit(ps, SOLVE_DIV, 0, 0);
+    } else if (ps->p < ps->end &&
+               (*ps->p == '(' || *ps->p == '.' ||
+                isalnum((unsigned char)*ps->p))) {
+      solve_parse_power(ps);
+      solve_emit(ps, SOLVE_MUL, 0, 0);
+    } else {
+      break;
+    }
+  }
+}
+
+static void solve_parse_expr(SolveParser *ps) {
+  if (!ps->ok)
+    return;
+  solve_parse_term(ps);
+  while (ps->ok) {
+    if (solve_accept(ps, '+')) {
+      solve_parse_term(ps);
+      solve_emit(ps, SOLVE_ADD, 0, 0);
+    } else if (solve_accept(ps, '-')) {
+      solve_parse_term(ps);
+      solve_emit(ps, SOLVE_SUB, 0, 0);
+    } else {
+      break;
+    }
+  }
+}
+
+// Compiles one side of an equation, adding the letters it uses to *letters.
+static int solve_compile_side(SolveExpr *e, const char *p, const char *end,
+                              uint64_t *letters) {
+  SolveParser ps = {p, end, e, 1, 0};
+  solve_parse_expr(&ps);
+  solve_skip(&ps);
+  *letters |= ps.letters;
+  return ps.ok && ps.p == ps.end;
+}
+
+// As solve_compile_side, but only the letter var may appear (none for a
+// var that is not a letter).
+static int solve_compile_var(SolveExpr *e, const char *p, const char *end,
+                             char var) {
+  uint64_t letters = 0;
+  if (!solve_compile_side(e, p, end, &letters))
+    return 0;
+  return isalpha((unsigned char)var) ? !(letters & ~(1ull << (var & 63)))
+                                     : letters == 0;
+}
+
+// Compiles "lhs = rhs" as lhs - rhs, or a bare expression as itself = 0.
+// Returns 0 for a syntax error and -1 when more than one letter appears.
+static int solve_compile(SolveExpr *e, const char *text) {
+  const char *end = text + strlen(text);
+  const char *eq = strchr(text, '=');
+  uint64_t letters = 0;
+  e->len = 0;
+  if (!eq) {
+    if (!solve_compile_side(e, text, end, &letters))
+      return 0;
+  } else {
+    if (strchr(eq + 1, '=') || !solve_compile_side(e, text, eq, &letters) ||
+        !solve_compile_side(e, eq + 1, end, &letters))
+      return 0;
+    if (e->len == SOLVE_MAX_CODE)
+      return 0;
+    e->code[e->len++] = (SolveInstr){SOLVE_SUB, 0, 0};
+  }
+  return letters & (letters - 1) ? -1 : 1;
+}
+
+// f(x), with f'(x) carried alongside as a dual number into *deriv.
+static double solve_eval(const SolveExpr *e, double x, double *deriv) {
+  double v[SOLVE_MAX_CODE], d[SOLVE_MAX_CODE];
+  int sp = 0;
+  for (int i = 0; i < e->len; i++) {
+    const SolveInstr *in = &e->code[i];
+    double a = 0, da = 0, b = 0, db = 0, fd;
+    if (in->op >= SOLVE_ADD && in->op <= SOLVE_MOD) {
+      sp--;
+      a = v[sp - 1], da = d[sp - 1], b = v[sp], db = d[sp];
+    }
+    switch (in->op) {
+    case SOLVE_NUM:
+      v[sp] = in->num;
+      d[sp++] = 0;
+      break;
+    case SOLVE_X:
+      v[sp] = x;
+      d[sp++] = 1;
+      break;
+    case SOLVE_NEG:
+      v[sp - 1] = -v[sp - 1];
+      d[sp - 1] = -d[sp - 1];
+      break;
+    case SOLVE_ADD:
+      v[sp - 1] = a + b;
+      d[sp - 1] = da + db;
+      break;
+    case SOLVE_SUB:
+      v[sp - 1] = a - b;
+      d[sp - 1] = da - db;
+      break;
+    case SOLVE_MUL:
+      v[sp - 1] = a * b;
+      d[sp - 1] = da * b + a * db;
+      break;
+    case SOLVE_DIV:
+      v[sp - 1] = a / b;
+      d[sp - 1] = (da * b - a * db) / (b * b);
+      break;
+    case SOLVE_POW:
+      v[sp - 1] = pow(a, b);
+      fd = 0;
+      if (da != 0)
+        fd += b * pow(a, b - 1) * da;
+      if (db != 0)
+        fd += v[sp - 1] * log(a) * db;
+      d[sp - 1] = fd;
+      break;
+    case SOLVE_MOD:
+      v[sp - 1] = fmod(a, b);
+      d[sp - 1] = da - trunc(a / b) * db;
+      break;
+    case SOLVE_FN:
+      v[sp - 1] = solve_fn(in->fn, v[sp - 1], &fd);
+      d[sp - 1] *= fd;
+      break;
+    }
+  }
+  if (deriv)
+    *deriv = d[0];
+  return v[0];
+}
+
+// A polynomial in ascending powers while the tape is being expanded.
+typedef struct {
+  double *c;
+  int deg;
+} SolvePoly;
+
+static int solve_poly_alloc(SolvePoly *p, int deg) {
+  p->c = (double *)calloc((size_t)deg + 1, sizeof(double));
+  p->deg = deg;
+  return p->c != NULL;
+}
+
+static void solve_poly_trim(SolvePoly *p) {
+  while (p->deg > 0 && p->c[p->deg] == 0)
+    p->deg--;
+}
+
+static int solve_poly_mul(SolvePoly *r, const SolvePoly *a,
+                          const SolvePoly *b) {
+  if (a->deg + b->deg > SOLVE_MAX_DEGREE ||
+      !solve_poly_alloc(r, a->deg + b->deg))
+    return 0;
+  for (int i = 0; i <= a->deg; i++) {
+    if (a->c[i] == 0)
+      continue;
+    for (int j = 0; j <= b->deg; j++)
+      r->c[i + j] += a->c[i] * b->c[j];
+  }
+  return 1;
+}
+
+// Expands the tape into coefficients when it is a polynomial in x: sums,
+// products, division by constants and non-negative integer powers, with
+// everything else folded when its arguments are constant. Returns the
+// degree with *out malloc'd (ascending), or -1.
+static int solve_expand(const SolveExpr *e, double **out) {
+  SolvePoly st[SOLVE_MAX_CODE];
+  int sp = 0, ok = 1;
+  for (int i = 0; i < e->len && ok; i++) {
+    const SolveInstr *in = &e->code[i];
+    SolvePoly r = {NULL, 0};
+    if (in->op == SOLVE_NUM || in->op == SOLVE_X) {
+      if (!(ok = solve_poly_alloc(&r, in->op == SOLVE_X)))
+        break;
+      r.c[r.deg] = in->op == SOLVE_X ? 1 : in->num;
+      st[sp++] = r;
+      continue;
+    }
+    if (in->op == SOLVE_NEG || in->op == SOLVE_FN) {
+      SolvePoly *a = &st[sp - 1];
+      double fd;
+      if (in->op == SOLVE_NEG)
+        for (int k = 0; k <= a->deg; k++)
+          a->c[k] = -a->c[k];
+      else if (a->deg == 0)
+        a->c[0] = solve_fn(in->fn, a->c[0], &fd);
+      else
+        ok = 0;
+      continue;
+    }
+    SolvePoly *a = &st[sp - 2], *b = &st[sp - 1];
+    switch (in->op) {
+    case SOLVE_ADD:
+    case SOLVE_SUB: {
+      SolvePoly *hi = a->deg >= b->deg ? a : b;
+      if (!(ok = solve_poly_alloc(&r, hi->deg)))
+        break;
+      for (int k = 0; k <= a->deg; k++)
+        r.c[k] = a->c[k];
+      for (int k = 0; k <= b->deg; k++)
+        r.c[k] += in->op == SOLVE_ADD ? b->c[k] : -b->c[k];
+      break;
+    }
+    case SOLVE_MUL:
+      ok = solve_poly_mul(&r, a, b);
+      break;
+    case SOLVE_DIV:
+      if (!(ok = b->deg == 0 && b->c[0] != 0 && solve_poly_alloc(&r, a->deg)))
+        break;
+      for (int k = 0; k <= a->deg; k++)
+        r.c[k] = a->c[k] / b->c[0];
+      break;
+    case SOLVE_POW: {
+      double n = b->c[0];
+      if (b->deg != 0) {
+        ok = 0;
+      } else if (a->deg == 0) {
+        if ((ok = solve_poly_alloc(&r, 0)))
+          r.c[0] = pow(a->c[0], n);
+      } else if (n < 0 || n != floor(n) || n * a->deg > SOLVE_MAX_DEGREE) {
+        ok = 0;
+      } else {
+        // Square and multiply, so x^1000 is ten products.
+        SolvePoly base = {NULL, 0}, t;
+        unsigned k = (unsigned)n;
+        ok = solve_poly_alloc(&r, 0) && solve_poly_alloc(&base, a->deg);
+        if (ok) {
+          r.c[0] = 1;
+          memcpy(base.c, a->c, ((size_t)a->deg + 1) * sizeof(double));
+        }
+        while (ok && k) {
+          if (k & 1) {
+            ok = solve_poly_mul(&t, &r, &base);
+            free(r.c);
+            r = t;
+          }
+          k >>= 1;
+          if (ok && k) {
+            ok = solve_poly_mul(&t, &base, &base);
+            free(base.c);
+            base = t;
+          }
+        }
+        free(base.c);
+      }
+      break;
+    }
+    case SOLVE_MOD:
+      if ((ok = a->deg == 0 && b->deg == 0 && solve_poly_alloc(&r, 0)))
+        r.c[0] = fmod(a->c[0], b->c[0]);
+      break;
+    }
+    free(a->c);
+    free(b->c);
+    sp -= 2;
+    if (!ok) {
+      free(r.c);
+      break;
+    }
+    solve_poly_trim(&r);
+    st[sp++] = r;
+  }
+  for (int k = 0; ok && k <= st[0].deg; k++)
+    ok = isfinite(st[0].c[k]);
+  if (!ok || sp != 1) {
+    while (sp > 0)
+      free(st[--sp].c);
+    return -1;
+  }
+  *out = st[0].c;
+  return st[0].deg;
+}
+
+// Initial guesses from the upper convex hull of (i, log|c_i|): each edge
+// from i to j puts j - i points on the circle whose radius balances those
+// two terms, which lands near the root moduli even when they span many
+// orders of magnitude.
+static void solve_aberth_start(const double *c, int n, double *zr,
+                               double *zi) {
+  int *hull = (int *)malloc(((size_t)n + 1) * sizeof(int));
+  int h = 0;
+  if (!hull)
+    return;
+  for (int i = 0; i <= n; i++) {
+    if (c[i] == 0)
+      continue;
+    while (h >= 2) {
+      int a = hull[h - 2], b = hull[h - 1];
+      double la = log(fabs(c[a])), lb = log(fabs(c[b]));
+      double li = log(fabs(c[i]));
+      if ((lb - la) * (i - a) > (li - la) * (b - a))
+        break;
+      h--;
+    }
+    hull[h++] = i;
+  }
+  int k = 0;
+  for (int e = 0; e + 1 < h; e++) {
+    int i = hull[e], j = hull[e + 1];
+    double r = exp((log(fabs(c[i])) - log(fabs(c[j]))) / (j - i));
+    for (int m = 0; m < j - i; m++, k++) {
+      double t = 2 * M_PI * m / (j - i) + 2 * M_PI * i / n + 0.4;
+      zr[k] = r * cos(t);
+      zi[k] = r * sin(t);
+    }
+  }
+  free(hull);
+}
+
+// All n complex roots of c[0] + ... + c[n] x^n (c[0], c[n] nonzero) by
+// Aberth-Ehrlich. Each sweep evaluates p and p' at every unfinished root
+// in one batched Horner pass; points outside the unit circle go through
+// the reversed polynomial at 1/z so degree-1000 evaluations stay in range.
+// A root stops moving once |p(z)| is within rounding of the running error
+// bound n*eps*sum|c_i||z|^i.
+static void solve_aberth(const double *c, int n, double *zr, double *zi) {
+  size_t m = (size_t)n + 1;
+  double *buf = (double *)calloc(m * 5 + (size_t)n * 8, sizeof(double));
+  int *idx = (int *)malloc((size_t)n * sizeof(int));
+  uint8_t *done = (uint8_t *)calloc((size_t)n * 2, 1), *conv = done + n;
+  if (!buf || !idx || !done) {
+    free(buf);
+    free(idx);
+    free(done);
+    return;
+  }
+  // Highest power first, the order cplx_horner_split wants.
+  double *p = buf, *dp = p + m, *q = dp + m, *dq = q + m, *zero = dq + m;
+  double *xr = zero + m, *xi = xr + n, *fr = xi + n, *fi = fr + n;
+  double *gr = fi + n, *gi = gr + n, *nr = gi + n, *ni = nr + n;
+  for (int k = 0; k <= n; k++) {
+    p[k] = c[n - k];
+    q[k] = c[k];
+  }
+  for (int k = 0; k < n; k++) {
+    dp[k] = (n - k) * c[n - k];
+    dq[k] = (n - k) * c[k];
+  }
+  solve_aberth_start(c, n, zr, zi);
+
+  int active = n;
+  for (int iter = 0; iter < SOLVE_MAX_ITER && active; iter++) {
+    // Unit disc first, then the rest as w = 1/z.
+    int in = 0, out = n;
+    for (int k = 0; k < n; k++) {
+      if (done[k])
+        continue;
+      double r2 = zr[k] * zr[k] + zi[k] * zi[k];
+      int s = r2 <= 1 ? in++ : --out;
+      idx[s] = k;
+      xr[s] = r2 <= 1 ? zr[k] : zr[k] / r2;
+      xi[s] = r2 <= 1 ? zi[k] : -zi[k] / r2;
+    }
+    int outer = n - out;
+    cplx_horner_split(n, p, zero, in, xr, xi, fr, fi);
+    cplx_horner_split(n - 1, dp, zero, in, xr, xi, gr, gi);
+    cplx_horner_split(n, q, zero, outer, xr + out, xi + out, fr + out,
+                      fi + out);
+    cplx_horner_split(n - 1, dq, zero, outer, xr + out, xi + out, gr + out,
+                      gi + out);
+
+    // Newton corrections p/p'; for 1/z that is q / (w (n q - w q')).
+    for (int s = 0; s < n; s++) {
+      if (s == in)
+        s = out;
+      if (s >= n)
+        break;
+      Cplx f = cplx(fr[s], fi[s]), g = cplx(gr[s], gi[s]);
+      Cplx x = cplx(xr[s], xi[s]);
+      double t = cplx_abs(x), bound = 0;
+      for (int k = n; k >= 0; k--)
+        bound = bound * t + fabs(s < in ? c[k] : c[n - k]);
+      Cplx d = s < in ? g
+                      : cplx_mul(x, cplx_sub(cplx_scale(f, n),
+                                             cplx_mul(x, g)));
+      Cplx nw = cplx_div(f, d);
+      if (!isfinite(nw.re) || !isfinite(nw.im))
+        nw = cplx(0, 0);
+      nr[s] = nw.re;
+      ni[s] = nw.im;
+      conv[s] = cplx_abs(f) <= 4.0 * n * DBL_EPSILON * bound;
+    }
+
+    // z_k -= N / (1 - N sum 1/(z_k - z_j)), using the newest z_j.
+    for (int s = 0; s < n; s++) {
+      if (s == in)
+        s = out;
+      if (s >= n)
+        break;
+      int k = idx[s];
+      Cplx z = cplx(zr[k], zi[k]);
+      Cplx sum = cplx_add(cplx_inv_sum_split((size_t)k, zr, zi, z),
+                          cplx_inv_sum_split((size_t)(n - k - 1), zr + k + 1,
+                                             zi + k + 1, z));
+      Cplx nw = cplx(nr[s], ni[s]);
+      Cplx w = cplx_div(nw, cplx_sub(cplx(1, 0), cplx_mul(nw, sum)));
+      if (!isfinite(w.re) || !isfinite(w.im))
+        w = nw;
+      zr[k] -= w.re;
+      zi[k] -= w.im;
+      // A root inside the error bound takes this last step and stops.
+      if (conv[s] || cplx_abs(w) <= DBL_EPSILON * hypot(zr[k], zi[k])) {
+        done[k] = 1;
+        active--;
+      }
+    }
+  }
+  free(buf);
+  free(idx);
+  free(done);
+}
+
+// Whether |p(x)| is within the rounding error of evaluating p at x.
+static int solve_real_root_ok(const double *c, int n, double x) {
+  double v = 0, bound = 0;
+  if (fabs(x) <= 1) {
+    for (int k = n; k >= 0; k--) {
+      v = v * x + c[k];
+      bound = bound * fabs(x) + fabs(c[k]);
+    }
+  } else {
+    for (int k = 0; k <= n; k++) {
+      v = v / x + c[k];
+      bound = bound / fabs(x) + fabs(c[k]);
+    }
+  }
+  return fabs(v) <= 4.0 * n * DBL_EPSILON * bound;
+}
+
+// Real roots first, ascending, then the complex ones by real part.
+static int solve_root_cmp(const void *pa, const void *pb) {
+  const Cplx *a = (const Cplx *)pa, *b = (const Cplx *)pb;
+  int ca = a->im != 0, cb = b->im != 0;
+  if (ca != cb)
+    return ca - cb;
+  if (a->re != b->re)
+    return a->re < b->re ? -1 : 1;
+  return (a->im > b->im) - (a->im < b->im);
+}
+
+// The deg roots of c[0] + ... + c[deg] x^deg (c[deg] nonzero) into roots.
+static int solve_poly_roots(const double *c, int deg, Cplx *roots) {
+  int z = 0;
+  while (z < deg && c[z] == 0)
+    roots[z++] = cplx(0, 0);
+  const double *a = c + z;
+  int n = deg - z;
+  Cplx *r = roots + z;
+  if (n == 1) {
+    r[0] = cplx(-a[0] / a[1], 0);
+  } else if (n == 2) {
+    double disc = a[1] * a[1] - 4 * a[2] * a[0];
+    if (disc >= 0) {
+      double t = -0.5 * (a[1] + copysign(sqrt(disc), a[1]));
+      r[0] = cplx(t / a[2], 0);
+      r[1] = cplx(a[0] / t, 0);
+    } else {
+      double re = -a[1] / (2 * a[2]), im = fabs(sqrt(-disc) / (2 * a[2]));
+      r[0] = cplx(re, im);
+      r[1] = cplx(re, -im);
+    }
+  } else if (n > 2) {
+    double *zr = (double *)malloc((size_t)n * 2 * sizeof(double));
+    if (!zr)
+      return 0;
+    double *zi = zr + n;
+    solve_aberth(a, n, zr, zi);
+    // Real coefficients, so a root within rounding of the axis whose real
+    // part is itself a root to working precision is taken as real.
+    for (int k = 0; k < n; k++)
+      if (fabs(zi[k]) <= 1e-8 * fmax(1, fabs(zr[k])) &&
+          solve_real_root_ok(a, n, zr[k]))
+        zi[k] = 0;
+    cplx_join((size_t)n, zr, zi, r);
+    free(zr);
+  }
+  qsort(roots, (size_t)deg, sizeof(Cplx), solve_root_cmp);
+  return deg;
+}
+
+// Safeguarded Newton inside a sign change [a, b]: a Newton step that
+// leaves the bracket or fails to halve it becomes a bisection.
+static double solve_bracket(const SolveExpr *e, double a, double fa,
+                            double b) {
+  double x = 0.5 * (a + b), prevStep = b - a;
+  for (int it = 0; it < 200; it++) {
+    double d, f = solve_eval(e, x, &d);
+    if (f == 0)
+      break;
+    if ((f < 0) == (fa < 0)) {
+      a = x;
+      fa = f;
+    } else {
+      b = x;
+    }
+    double next = x - f / d;
+    if (!(next > a && next < b) || fabs(next - x) > 0.5 * prevStep)
+      next = 0.5 * (a + b);
+    prevStep = fabs(next - x);
+    if (next == x || b - a <= 2 * DBL_EPSILON * fabs(x))
+      break;
+    x = next;
+  }
+  return x;
+}
+
+// Newton from a local minimum of |f| that does not cross zero, for roots
+// of even multiplicity; kept only if it really reaches f = 0.
+static int solve_touch(const SolveExpr *e, double lo, double x, double hi,
+                       double *root) {
+  for (int it = 0; it < 100; it++) {
+    double d, f = solve_eval(e, x, &d);
+    if (f == 0 || d == 0)
+      break;
+    double next = x - f / d;
+    if (!(next >= lo && next <= hi) || next == x)
+      break;
+    x = next;
+  }
+  double f = solve_eval(e, x, NULL);
+  *root = x;
+  return fabs(f) <= 1e-12 * fmax(1, fabs(x));
+}
+
+static int solve_add_real(double *out, int n, double x) {
+  for (int k = 0; k < n; k++)
+    if (fabs(out[k] - x) <= 1e-9 * fmax(1, fabs(x)))
+      return n;
+  if (n < SOLVE_MAX_ROOTS)
+    out[n++] = x;
+  return n;
+}
+
+static int solve_dbl_cmp(const void *pa, const void *pb) {
+  double a = *(const double *)pa, b = *(const double *)pb;
+  return (a > b) - (a < b);
+}
+
+// Bisects from a sample where f is nonzero towards one where it is 0 for
+// the edge of the set where f evaluates to 0.
+static double solve_zero_edge(const SolveExpr *e, double off, double on) {
+  for (int it = 0; it < 200; it++) {
+    double mid = 0.5 * (off + on);
+    if (mid == off || mid == on)
+      break;
+    if (solve_eval(e, mid, NULL) == 0)
+      on = mid;
+    else
+      off = mid;
+  }
+  return on;
+}
+
+// Brackets and refines the roots on one sampled grid, xs ascending.
+static int solve_scan(const SolveExpr *e, const double *xs, const double *fs,
+                      int total, double *out, int n) {
+  for (int k = 0; k < total; k++) {
+    if (fs[k] == 0) {
+      // A run of zero samples is one root, at the middle of the zero set,
+      // which is wide where f underflows around a multiple root. A run
+      // reaching the end of the grid is underflow with no root to place.
+      int j = k;
+      while (j + 1 < total && fs[j + 1] == 0)
+        j++;
+      if (k > 0 && j + 1 < total)
+        n = solve_add_real(out, n,
+                           0.5 * (solve_zero_edge(e, xs[k - 1], xs[k]) +
+                                  solve_zero_edge(e, xs[j + 1], xs[j])));
+      else if (j == k)
+        n = solve_add_real(out, n, xs[k]);
+      k = j;
+      continue;
+    }
+    if (k + 1 < total && isfinite(fs[k]) && isfinite(fs[k + 1]) &&
+        fs[k + 1] != 0 && (fs[k] < 0) != (fs[k + 1] < 0)) {
+      double x = solve_bracket(e, xs[k], fs[k], xs[k + 1]);
+      double f = fabs(solve_eval(e, x, NULL));
+      if (f <= fmin(fabs(fs[k]), fabs(fs[k + 1])))
+        n = solve_add_real(out, n, x);
+    } else if (k > 0 && k + 1 < total && isfinite(fs[k]) &&
+               fabs(fs[k]) < fabs(fs[k - 1]) &&
+               fabs(fs[k]) <= fabs(fs[k + 1]) &&
+               (fs[k - 1] < 0) == (fs[k] < 0) &&
+               (fs[k + 1] < 0) == (fs[k] < 0)) {
+      double x;
+      if (solve_touch(e, xs[k - 1], xs[k], xs[k + 1], &x))
+        n = solve_add_real(out, n, x);
+    }
+  }
+  return n;
+}
+
+// Real roots of a general f by scanning for sign changes on ±SOLVE_SPAN,
+// then refining each bracket. Only when that finds nothing is the scan
+// carried out to ±SOLVE_FAR on a geometric grid. Sign changes across a
+// pole (|f| growing instead of vanishing) are dropped.
+static int solve_general(const SolveExpr *e, double *out) {
+  int total = SOLVE_SCAN + 1;
+  double *xs = (double *)malloc((size_t)total * 2 * sizeof(double));
+  if (!xs)
+    return 0;
+  double *fs = xs + total;
+  for (int k = 0; k < total; k++) {
+    xs[k] = -SOLVE_SPAN + 2 * SOLVE_SPAN * k / SOLVE_SCAN;
+    fs[k] = solve_eval(e, xs[k], NULL);
+  }
+  int n = solve_scan(e, xs, fs, total, out, 0);
+  double ratio = pow(SOLVE_FAR / SOLVE_SPAN, 1.0 / SOLVE_FAR_SCAN);
+  for (int side = -1; n == 0 && side <= 1; side += 2) {
+    for (int k = 0; k <= SOLVE_FAR_SCAN; k++) {
+      int at = side < 0 ? SOLVE_FAR_SCAN - k : k;
+      xs[at] = side * SOLVE_SPAN * pow(ratio, k);
+      fs[at] = solve_eval(e, xs[at], NULL);
+    }
+    n = solve_scan(e, xs, fs, SOLVE_FAR_SCAN + 1, out, n);
+  }
+  free(xs);
+  qsort(out, (size_t)n, sizeof(double), solve_dbl_cmp);
+  return n;
+}
+
+typedef struct {
+  Cplx *roots;
+  int count, cap;
+  int degree; // of the polynomial, or -1 for a general equation
+  const char *err;
+} SolveResult;
+
+static void solve_free(SolveResult *r) {
+  free(r->roots);
+  memset(r, 0, sizeof(*r));
+}
+
+static int solve_reserve(SolveResult *r, int need) {
+  if (need <= r->cap)
+    return 1;
+  Cplx *p = (Cplx *)realloc(r->roots, (size_t)need * sizeof(Cplx));
+  if (!p)
+    return 0;
+  r->roots = p;
+  r->cap = need;
+  return 1;
+}
+
+// Solves the equation in text for its unknown. Polynomials get all their
+// complex roots; anything else gets the real roots the scan can bracket.
+// Returns 0 with r->err set when there is nothing to show.
+static int solve_equation(const char *text, SolveResult *r) {
+  SolveExpr e;
+  double *c;
+  r->count = 0;
+  r->degree = -1;
+  r->err = NULL;
+  int compiled = solve_compile(&e, text);
+  if (compiled <= 0) {
+    r->err = compiled ? "more than one unknown" : "syntax error";
+    return 0;
+  }
+  int deg = solve_expand(&e, &c);
+  if (deg == 0) {
+    r->err = c[0] == 0 ? "true for every x" : "no solution";
+    free(c);
+    return 0;
+  }
+  if (deg > 0) {
+    r->degree = deg;
+    r->count = solve_reserve(r, deg) ? solve_poly_roots(c, deg, r->roots) : 0;
+    free(c);
+  } else {
+    double real[SOLVE_MAX_ROOTS];
+    int n = solve_general(&e, real);
+    if (solve_reserve(r, n > 0 ? n : 1))
+      for (r->count = 0; r->count < n; r->count++)
+        r->roots[r->count] = cplx(real[r->count], 0);
+  }
+  if (r->count == 0) {
+    r->err = "no real root found";
+    return 0;
+  }
+  return 1;
+}
+
+#endif
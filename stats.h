@@ -0,0 +1,487 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "atod.h"
+
+#define STATS_BLOCK 4096
+#define STATS_LANES 4
+#define STATS_TD_COMPRESSION 200
+#define STATS_TD_CENTROIDS (STATS_TD_COMPRESSION + 16)
+#define STATS_MAX_THREADS 16
+#define STATS_PARALLEL_BYTES (1 << 24)
+
+// Merging t-digest (Dunning): incoming values are buffered, radix sorted and
+// folded into at most ~compression centroids sized by the k1 scale, so the
+// tails stay sharp. Digests merge, which lets file chunks be summarised in
+// parallel.
+typedef struct {
+  double mean[STATS_TD_CENTROIDS];
+  double weight[STATS_TD_CENTROIDS];
+  int count;
+  double total;
+  double buf[STATS_BLOCK];
+  int buffered;
+} StatsDigest;
+
+// Moments are merged block by block (Chan/Pebay), so no value is ever kept.
+typedef struct {
+  uint64_t n;
+  double mean, m2, m3, m4;
+  double sum, sumComp; // Neumaier-compensated running sum
+  double min, max;
+  // Paired samples for regression
+  uint64_t np;
+  double mx, my, sxx, syy, sxy;
+  StatsDigest digest;
+} StatsAcc;
+
+static uint64_t stats_sort_key(double x) {
+  uint64_t k;
+  memcpy(&k, &x, sizeof(k));
+  return (k >> 63) ? ~k : k ^ (1ULL << 63);
+}
+
+static double stats_key_value(uint64_t k) {
+  k = (k >> 63) ? k ^ (1ULL << 63) : ~k;
+  double x;
+  memcpy(&x, &k, sizeof(x));
+  return x;
+}
+
+// LSD radix sort on the order-preserving bit pattern. The low bytes are left
+// unsorted: values closer than 2^-29 relative may stay swapped, far below the
+// digest's own resolution. Byte positions where every key agrees are skipped.
+static void stats_radix_sort(double *x, int n) {
+  uint64_t a[STATS_BLOCK], b[STATS_BLOCK];
+  uint64_t *src = a, *dst = b;
+  for (int i = 0; i < n; i++)
+    a[i] = stats_sort_key(x[i]);
+  for (int shift = 24; shift < 64; shift += 8) {
+    int cnt[256] = {0};
+    for (int i = 0; i < n; i++)
+      cnt[(src[i] >> shift) & 0xFF]++;
+    if (cnt[(src[0] >> shift) & 0xFF] == n)
+      continue;
+    int pos = 0;
+    for (int d = 0; d < 256; d++) {
+      int c = cnt[d];
+      cnt[d] = pos;
+      pos += c;
+    }
+    for (int i = 0; i < n; i++)
+      dst[cnt[(src[i] >> shift) & 0xFF]++] = src[i];
+    uint64_t *t = src;
+    src = dst;
+    dst = t;
+  }
+  for (int i = 0; i < n; i++)
+    x[i] = stats_key_value(src[i]);
+}
+
+static double stats_td_k(double q) {
+  return STATS_TD_COMPRESSION / (2 * M_PI) * asin(2 * q - 1);
+}
+
+static double stats_td_q(double k) {
+  if (k >= STATS_TD_COMPRESSION / 4.0)
+    return 1.0;
+  return (1 + sin(k * 2 * M_PI / STATS_TD_COMPRESSION)) / 2;
+}
+
+// Folds a sorted run of weighted points into the centroids.
+static void stats_td_merge(StatsDigest *d, const double *xm, const double *xw,
+                           int xn) {
+  double total = d->total;
+  for (int j = 0; j < xn; j++)
+    total += xw[j];
+  if (total == 0)
+    return;
+
+  // Centroids are built as weighted sums and divided once at the end
+  double om[STATS_TD_CENTROIDS], ow[STATS_TD_CENTROIDS];
+  int on = 0, i = 0, j = 0;
+  double sofar = 0, limit = 0;
+  while (i < d->count || j < xn) {
+    double m, w;
+    if (j >= xn || (i < d->count && d->mean[i] <= xm[j])) {
+      m = d->mean[i];
+      w = d->weight[i++];
+    } else {
+      m = xm[j];
+      w = xw[j++];
+    }
+    if (on > 0 && (sofar + ow[on - 1] + w <= limit ||
+                   on == STATS_TD_CENTROIDS)) {
+      ow[on - 1] += w;
+      om[on - 1] += w * m;
+    } else {
+      if (on > 0)
+        sofar += ow[on - 1];
+      limit = total * stats_td_q(stats_td_k(sofar / total) + 1);
+      om[on] = w * m;
+      ow[on++] = w;
+    }
+  }
+  for (int k = 0; k < on; k++)
+    d->mean[k] = om[k] / ow[k];
+  memcpy(d->weight, ow, on * sizeof(double));
+  d->count = on;
+  d->total = total;
+}
+
+static void stats_td_flush(StatsDigest *d) {
+  if (d->buffered == 0)
+    return;
+  double ones[STATS_BLOCK];
+  for (int i = 0; i < d->buffered; i++)
+    ones[i] = 1.0;
+  stats_radix_sort(d->buf, d->buffered);
+  stats_td_merge(d, d->buf, ones, d->buffered);
+  d->buffered = 0;
+}
+
+static void stats_td_add(StatsDigest *d, const double *x, size_t n) {
+  while (n > 0) {
+    size_t take = STATS_BLOCK - d->buffered;
+    if (take > n)
+      take = n;
+    memcpy(d->buf + d->buffered, x, take * sizeof(double));
+    d->buffered += (int)take;
+    x += take;
+    n -= take;
+    if (d->buffered == STATS_BLOCK)
+      stats_td_flush(d);
+  }
+}
+
+// Interpolates between centroid midpoints, pinned to min and max at the ends.
+static double stats_td_quantile(StatsDigest *d, double q, double lo,
+                                double hi) {
+  stats_td_flush(d);
+  if (d->count == 0)
+    return NAN;
+  if (d->count == 1)
+    return d->mean[0];
+  double target = q * d->total;
+  double cum = 0;
+  if (target < d->weight[0] / 2) {
+    double frac = target / (d->weight[0] / 2);
+    return lo + frac * (d->mean[0] - lo);
+  }
+  for (int i = 0; i + 1 < d->count; i++) {
+    double left = cum + d->weight[i] / 2;
+    double right = cum + d->weight[i] + d->weight[i + 1] / 2;
+    if (target <= right) {
+      double frac = (target - left) / (right - left);
+      return d->mean[i] + frac * (d->mean[i + 1] - d->mean[i]);
+    }
+    cum += d->weight[i];
+  }
+  int last = d->count - 1;
+  double left = d->total - d->weight[last] / 2;
+  double frac = (target - left) / (d->weight[last] / 2);
+  return d->mean[last] + frac * (hi - d->mean[last]);
+}
+
+static void stats_init(StatsAcc *s) {
+  memset(s, 0, sizeof(*s));
+  s->min = INFINITY;
+  s->max = -INFINITY;
+}
+
+// Chan/Pebay combination of the running moments with those of nb more
+// values about their own mean.
+static void stats_merge_moments(StatsAcc *s, double nb, double bmean,
+                                double bm2, double bm3, double bm4) {
+  double na = (double)s->n, n = na + nb;
+  double d = bmean - s->mean, d2 = d * d;
+  double m2 = s->m2 + bm2 + d2 * na * nb / n;
+  double m3 = s->m3 + bm3 + d2 * d * na * nb * (na - nb) / (n * n) +
+              3 * d * (na * bm2 - nb * s->m2) / n;
+  double m4 = s->m4 + bm4 +
+              d2 * d2 * na * nb * (na * na - na * nb + nb * nb) / (n * n * n) +
+              6 * d2 * (na * na * bm2 + nb * nb * s->m2) / (n * n) +
+              4 * d * (na * bm3 - nb * s->m3) / n;
+  s->mean += d * nb / n;
+  s->m2 = m2;
+  s->m3 = m3;
+  s->m4 = m4;
+  s->n += (uint64_t)nb;
+}
+
+static void stats_add_sum(StatsAcc *s, double x) {
+  double t = s->sum + x;
+  if (fabs(s->sum) >= fabs(x))
+    s->sumComp += (s->sum - t) + x;
+  else
+    s->sumComp += (x - t) + s->sum;
+  s->sum = t;
+}
+
+// Folds a block in: its own moments are taken two-pass around the block mean
+// with independent lanes, then combined with the running ones.
+static void stats_add_block(StatsAcc *s, const double *x, size_t nb) {
+  if (nb == 0)
+    return;
+  double sl[STATS_LANES] = {0};
+  double lo = x[0], hi = x[0];
+  size_t i = 0;
+  for (; i + STATS_LANES <= nb; i += STATS_LANES)
+    for (int l = 0; l < STATS_LANES; l++)
+      sl[l] += x[i + l];
+  for (; i < nb; i++)
+    sl[0] += x[i];
+  double bsum = (sl[0] + sl[1]) + (sl[2] + sl[3]);
+  double bmean = bsum / nb;
+
+  double a2[STATS_LANES] = {0}, a3[STATS_LANES] = {0}, a4[STATS_LANES] = {0};
+  for (i = 0; i + STATS_LANES <= nb; i += STATS_LANES) {
+    for (int l = 0; l < STATS_LANES; l++) {
+      double d = x[i + l] - bmean, d2 = d * d;
+      a2[l] += d2;
+      a3[l] += d2 * d;
+      a4[l] += d2 * d2;
+    }
+  }
+  for (; i < nb; i++) {
+    double d = x[i] - bmean, d2 = d * d;
+    a2[0] += d2;
+    a3[0] += d2 * d;
+    a4[0] += d2 * d2;
+  }
+  for (i = 0; i < nb; i++) {
+    lo = x[i] < lo ? x[i] : lo;
+    hi = x[i] > hi ? x[i] : hi;
+  }
+  stats_merge_moments(s, (double)nb, bmean, (a2[0] + a2[1]) + (a2[2] + a2[3]),
+                      (a3[0] + a3[1]) + (a3[2] + a3[3]),
+                      (a4[0] + a4[1]) + (a4[2] + a4[3]));
+  stats_add_sum(s, bsum);
+  if (lo < s->min)
+    s->min = lo;
+  if (hi > s->max)
+    s->max = hi;
+  stats_td_add(&s->digest, x, nb);
+}
+
+static void stats_add(StatsAcc *s, double x) { stats_add_block(s, &x, 1); }
+
+// Welford co-moment update for the regression sums.
+static void stats_add_pair(StatsAcc *s, double x, double y) {
+  s->np++;
+  double dx = x - s->mx;
+  double dy = y - s->my;
+  s->mx += dx / s->np;
+  s->my += dy / s->np;
+  s->sxx += dx * (x - s->mx);
+  s->syy += dy * (y - s->my);
+  s->sxy += dx * (y - s->my);
+}
+
+static void stats_merge(StatsAcc *s, StatsAcc *o) {
+  if (o->n > 0)
+    stats_merge_moments(s, (double)o->n, o->mean, o->m2, o->m3, o->m4);
+  stats_add_sum(s, o->sum);
+  stats_add_sum(s, o->sumComp);
+  if (o->min < s->min)
+    s->min = o->min;
+  if (o->max > s->max)
+    s->max = o->max;
+  if (o->np > 0) {
+    double na = (double)s->np, nb = (double)o->np, n = na + nb;
+    double dx = o->mx - s->mx, dy = o->my - s->my;
+    s->sxx += o->sxx + dx * dx * na * nb / n;
+    s->syy += o->syy + dy * dy * na * nb / n;
+    s->sxy += o->sxy + dx * dy * na * nb / n;
+    s->mx += dx * nb / n;
+    s->my += dy * nb / n;
+    s->np += o->np;
+  }
+  stats_td_flush(&s->digest);
+  stats_td_flush(&o->digest);
+  stats_td_merge(&s->digest, o->digest.mean, o->digest.weight,
+                 o->digest.count);
+}
+
+static double stats_sum(const StatsAcc *s) { return s->sum + s->sumComp; }
+
+static double stats_variance(const StatsAcc *s) {
+  return s->n > 1 ? s->m2 / (s->n - 1) : NAN;
+}
+
+static double stats_stddev(const StatsAcc *s) {
+  return sqrt(stats_variance(s));
+}
+
+static double stats_skewness(const StatsAcc *s) {
+  return s->n > 2 && s->m2 > 0 ? sqrt((double)s->n) * s->m3 / pow(s->m2, 1.5)
+                               : NAN;
+}
+
+// Excess kurtosis
+static double stats_kurtosis(const StatsAcc *s) {
+  return s->n > 3 && s->m2 > 0 ? s->n * s->m4 / (s->m2 * s->m2) - 3.0 : NAN;
+}
+
+static double stats_quantile(StatsAcc *s, double q) {
+  return stats_td_quantile(&s->digest, q, s->min, s->max);
+}
+
+static double stats_slope(const StatsAcc *s) {
+  return s->np > 1 && s->sxx > 0 ? s->sxy / s->sxx : NAN;
+}
+
+static double stats_intercept(const StatsAcc *s) {
+  return s->my - stats_slope(s) * s->mx;
+}
+
+static double stats_correlation(const StatsAcc *s) {
+  return s->np > 1 && s->sxx > 0 && s->syy > 0
+             ? s->sxy / sqrt(s->sxx * s->syy)
+             : NAN;
+}
+
+static int stats_number_start(char c) {
+  return (unsigned)(c - '0') < 10 || c == '-' || c == '+' || c == '.';
+}
+
+typedef struct {
+  const char *begin, *end;
+  int paired;
+  long long count;
+  StatsAcc acc;
+} StatsChunk;
+
+static void *stats_chunk_run(void *arg) {
+  StatsChunk *c = arg;
+  const char *p = c->begin, *end = c->end;
+  double buf[STATS_BLOCK];
+  size_t nb = 0;
+  int col = 0;
+  double lastX = 0;
+  while (p < end) {
+    while (p < end && !stats_number_start(*p)) {
+      if (*p == '\n')
+        col = 0;
+      p++;
+    }
+    if (p == end)
+      break;
+    double v;
+    const char *next = atod_parse(p, end, &v);
+    if (!next) {
+      p++;
+      continue;
+    }
+    p = next;
+    c->count++;
+    if (c->paired && col++ > 0) {
+      if (col == 2)
+        stats_add_pair(&c->acc, lastX, v);
+      continue;
+    }
+    lastX = v;
+    buf[nb++] = v;
+    if (nb == STATS_BLOCK) {
+      stats_add_block(&c->acc, buf, nb);
+      nb = 0;
+    }
+  }
+  stats_add_block(&c->acc, buf, nb);
+  return NULL;
+}
+
+static int stats_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  if (n > STATS_MAX_THREADS)
+    n = STATS_MAX_THREADS;
+  return (int)n;
+}
+
+// Streams every number in a mapped file into the accumulator. When the first
+// line holds exactly two numbers the file is read as x y columns: x feeds
+// the summary and each pair feeds the regression. Large files are cut at
+// line breaks and summarised on all cores. Returns the number of values
+// read, or -1 if the file cannot be mapped.
+static long long stats_load_file(const char *path, StatsAcc *s) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)st.st_size;
+  const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return -1;
+  madvise((void *)data, size, MADV_SEQUENTIAL);
+  const char *end = data + size;
+
+  int perLine = 0;
+  for (const char *q = data; q < end && *q != '\n';) {
+    double v;
+    const char *next =
+        stats_number_start(*q) ? atod_parse(q, end, &v) : NULL;
+    if (next) {
+      perLine++;
+      q = next;
+    } else {
+      q++;
+    }
+  }
+
+  int nthreads = size < STATS_PARALLEL_BYTES ? 1 : stats_thread_count();
+  StatsChunk *chunks = malloc(nthreads * sizeof(StatsChunk));
+  if (!chunks) {
+    munmap((void *)data, size);
+    return -1;
+  }
+  pthread_t threads[STATS_MAX_THREADS];
+  const char *begin = data;
+  for (int t = 0; t < nthreads; t++) {
+    const char *cut = t == nthreads - 1 ? end : data + size / nthreads * (t + 1);
+    while (cut < end && cut[-1] != '\n')
+      cut++;
+    if (cut < begin)
+      cut = begin;
+    chunks[t].begin = begin;
+    chunks[t].end = cut;
+    chunks[t].paired = perLine == 2;
+    chunks[t].count = 0;
+    stats_init(&chunks[t].acc);
+    begin = cut;
+    if (t > 0)
+      pthread_create(&threads[t], NULL, stats_chunk_run, &chunks[t]);
+  }
+  stats_chunk_run(&chunks[0]);
+  long long count = chunks[0].count;
+  stats_merge(s, &chunks[0].acc);
+  for (int t = 1; t < nthreads; t++) {
+    pthread_join(threads[t], NULL);
+    count += chunks[t].count;
+    stats_merge(s, &chunks[t].acc);
+  }
+  free(chunks);
+  munmap((void *)data, size);
+  return count;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef STROKE_H
+#define STROKE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STROKE_X86 1
+#endif
+
+#define STROKE_MAX_POINTS 1024
+#define STROKE_MAX 64
+#define STROKE_MIN_STEP 0.25f // pad cells between recorded points
+#define STROKE_BOX 20         // side of the raster, MNIST's digit box
+#define STROKE_STRIDE 24      // raster row stride, a whole number of ymm
+
+typedef struct {
+  float x, y; // pad cells
+  uint32_t t; // SDL ticks
+} StrokePoint;
+
+// Pen strokes as polylines: stroke i runs from point start[i] up to the
+// start of the next.
+typedef struct {
+  int count, strokes;
+  int start[STROKE_MAX];
+  StrokePoint pts[STROKE_MAX_POINTS];
+} StrokeSet;
+
+static void stroke_clear(StrokeSet *s) { s->count = s->strokes = 0; }
+
+static int stroke_end(const StrokeSet *s, int i) {
+  return i + 1 < s->strokes ? s->start[i + 1] : s->count;
+}
+
+// Starts a stroke at (x, y). Returns 0 when the set is full.
+static int stroke_begin(StrokeSet *s, float x, float y, uint32_t t) {
+  if (s->strokes == STROKE_MAX || s->count == STROKE_MAX_POINTS)
+    return 0;
+  s->start[s->strokes++] = s->count;
+  s->pts[s->count++] = (StrokePoint){x, y, t};
+  return 1;
+}
+
+// Extends the current stroke. Points within STROKE_MIN_STEP of the last
+// add nothing to the raster and are dropped; returns 1 when the point was
+// kept.
+static int stroke_add(StrokeSet *s, float x, float y, uint32_t t) {
+  if (s->strokes == 0)
+    return stroke_begin(s, x, y, t);
+  if (s->count == STROKE_MAX_POINTS)
+    return 0;
+  const StrokePoint *p = &s->pts[s->count - 1];
+  float dx = x - p->x, dy = y - p->y;
+  if (dx * dx + dy * dy < STROKE_MIN_STEP * STROKE_MIN_STEP)
+    return 0;
+  s->pts[s->count++] = (StrokePoint){x, y, t};
+  return 1;
+}
+
+// Segment kernels sweep a pen of radius r from a to b over the pixels of
+// rows y0..y1 and columns x0..x1 of the raster. A pixel's coverage is
+// clamp(r + 0.5 - d, 0, 1) for d the distance from its centre to the
+// segment, exact across a straight edge and close at the round caps.
+// Coverage is max-combined, so joints and crossings are no darker than the
+// pen. The SIMD kernels widen the columns to whole registers, which only
+// recomputes pixels exactly.
+typedef void (*StrokeSegKernel)(float *img, int y0, int y1, int x0, int x1,
+                                float ax, float ay, float bx, float by,
+                                float r);
+
+static void stroke_seg_scalar(float *img, int y0, int y1, int x0, int x1,
+                              float ax, float ay, float bx, float by,
+                              float r) {
+  float dx = bx - ax, dy = by - ay, len2 = dx * dx + dy * dy;
+  float inv = len2 > 0 ? 1 / len2 : 0;
+  for (int y = y0; y <= y1; y++) {
+    float *row = img + y * STROKE_STRIDE;
+    float py = y + 0.5f - ay;
+    for (int x = x0; x <= x1; x++) {
+      float px = x + 0.5f - ax;
+      float t = (px * dx + py * dy) * inv;
+      t = t < 0 ? 0 : t > 1 ? 1 : t;
+      float ex = px - t * dx, ey = py - t * dy;
+      float c = r + 0.5f - sqrtf(ex * ex + ey * ey);
+      c = c < 0 ? 0 : c > 1 ? 1 : c;
+      row[x] = row[x] > c ? row[x] : c;
+    }
+  }
+}
+
+#ifdef STROKE_X86
+__attribute__((target("avx"))) static void
+stroke_seg_avx(float *img, int y0, int y1, int x0, int x1, float ax,
+               float ay, float bx, float by, float r) {
+  float dx = bx - ax, dy = by - ay, len2 = dx * dx + dy * dy;
+  __m256 vdx = _mm256_set1_ps(dx), vdy = _mm256_set1_ps(dy);
+  __m256 inv = _mm256_set1_ps(len2 > 0 ? 1 / len2 : 0);
+  __m256 edge = _mm256_set1_ps(r + 0.5f);
+  __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+  __m256 px[STROKE_STRIDE / 8];
+  for (int k = x0 / 8; k <= x1 / 8; k++)
+    px[k] = _mm256_sub_ps(
+        _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f),
+        _mm256_set1_ps(ax - 8 * k));
+  for (int y = y0; y <= y1; y++) {
+    float *row = img + y * STROKE_STRIDE;
+    __m256 py = _mm256_set1_ps(y + 0.5f - ay);
+    __m256 pyd = _mm256_mul_ps(py, vdy);
+    for (int k = x0 / 8; k <= x1 / 8; k++) {
+      __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(px[k], vdx), pyd),
+                               inv);
+      t = _mm256_min_ps(_mm256_max_ps(t, zero), one);
+      __m256 ex = _mm256_sub_ps(px[k], _mm256_mul_ps(t, vdx));
+      __m256 ey = _mm256_sub_ps(py, _mm256_mul_ps(t, vdy));
+      __m256 d = _mm256_sqrt_ps(
+          _mm256_add_ps(_mm256_mul_ps(ex, ex), _mm256_mul_ps(ey, ey)));
+      __m256 c = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(edge, d), zero),
+                               one);
+      _mm256_storeu_ps(row + 8 * k,
+                       _mm256_max_ps(_mm256_loadu_ps(row + 8 * k), c));
+    }
+  }
+}
+#endif
+
+static StrokeSegKernel stroke_seg_kernel(void) {
+  static StrokeSegKernel kernel = NULL;
+  if (!kernel) {
+    kernel = stroke_seg_scalar;
+#ifdef STROKE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx"))
+      kernel = stroke_seg_avx;
+#endif
+  }
+  return kernel;
+}
+
+// Rasterizes the strokes whose sel entry is id (all of them when sel is
+// NULL) into img, STROKE_BOX rows of STROKE_STRIDE floats, placing pad
+// point p at (p - origin) * scale. Points closer than half a pixel to the
+// last one drawn are passed over, and each segment only touches the
+// pixels its pen can reach.
+static void stroke_render(const StrokeSet *s, const unsigned char *sel, int id,
+                          float ox, float oy, float scale, float radius,
+                          float *img) {
+  StrokeSegKernel seg = stroke_seg_kernel();
+  memset(img, 0, STROKE_BOX * STROKE_STRIDE * sizeof(float));
+  for (int i = 0; i < s->strokes; i++) {
+    if (sel && sel[i] != id)
+      continue;
+    int end = stroke_end(s, i);
+    float ax = (s->pts[s->start[i]].x - ox) * scale;
+    float ay = (s->pts[s->start[i]].y - oy) * scale;
+    // A lone point is a segment of length zero, a dot
+    for (int k = s->start[i] + (end - s->start[i] > 1); k < end; k++) {
+      float bx = (s->pts[k].x - ox) * scale, by = (s->pts[k].y - oy) * scale;
+      float d2 = (bx - ax) * (bx - ax) + (by - ay) * (by - ay);
+      if (k + 1 < end && d2 < 0.25f)
+        continue;
+      int x0 = (int)floorf((ax < bx ? ax : bx) - radius - 0.5f);
+      int x1 = (int)ceilf((ax > bx ? ax : bx) + radius + 0.5f);
+      int y0 = (int)floorf((ay < by ? ay : by) - radius - 0.5f);
+      int y1 = (int)ceilf((ay > by ? ay : by) + radius + 0.5f);
+      x0 = x0 < 0 ? 0 : x0;
+      x1 = x1 > STROKE_BOX - 1 ? STROKE_BOX - 1 : x1;
+      y0 = y0 < 0 ? 0 : y0;
+      y1 = y1 > STROKE_BOX - 1 ? STROKE_BOX - 1 : y1;
+      if (x0 <= x1 && y0 <= y1)
+        seg(img, y0, y1, x0, x1, ax, ay, bx, by, radius);
+      ax = bx;
+      ay = by;
+    }
+  }
+}
+
+#endif
@@ -14,6 +14,20 @@
 #define BATCH_SIZE 32
 #define NUM_TRAIN 60000
 
+// The CNN: two 3x3 conv + ReLU + 2x2 max-pool stages, then a dense head.
+// Activations are rows x columns x channels, as model.h reads them.
+#define CNN_SIDE 28
+#define CNN_CONV1 8
+#define CNN_CONV2 16
+#define CNN_OUT1 (CNN_SIDE - 2)
+#define CNN_POOL1 (CNN_OUT1 / 2)
+#define CNN_OUT2 (CNN_POOL1 - 2)
+#define CNN_POOL2 (CNN_OUT2 / 2)
+#define CNN_FEATURES (CNN_POOL2 * CNN_POOL2 * CNN_CONV2)
+#define CNN_HIDDEN 64
+#define CNN_LEARNING_RATE 0.05f
+#define CNN_EPOCHS 5
+
 uint32_t flip_bytes(uint32_t val) {
   return ((val >> 24) & 0x000000FF) | ((val >> 8) & 0x0000FF00) |
          ((val << 8) & 0x00FF0000) | ((val << 24) & 0xFF000000);
@@ -245,27 +259,299 @@ void train(NeuralNetwork *nn) {
   free(targets);
 }
 
-void save_model(NeuralNetwork *nn) {
-  FILE *f = fopen("model.bin", "wb");
-  if (!f) {
+typedef struct {
+  float k1[9][CNN_CONV1];
+  float kb1[CNN_CONV1];
+  float k2[9 * CNN_CONV1][CNN_CONV2];
+  float kb2[CNN_CONV2];
+  float w1[CNN_FEATURES][CNN_HIDDEN];
+  float b1[CNN_HIDDEN];
+  float w2[CNN_HIDDEN][OUTPUT_NODES];
+  float b2[OUTPUT_NODES];
+} ConvNet;
+
+// Activations of one forward pass, kept for backprop. arg1/arg2 hold the
+// index of the conv output each pooled value came from.
+typedef struct {
+  float conv1[CNN_OUT1][CNN_OUT1][CNN_CONV1];
+  float pool1[CNN_POOL1][CNN_POOL1][CNN_CONV1];
+  int arg1[CNN_POOL1][CNN_POOL1][CNN_CONV1];
+  float conv2[CNN_OUT2][CNN_OUT2][CNN_CONV2];
+  float pool2[CNN_FEATURES];
+  int arg2[CNN_FEATURES];
+  float hidden[CNN_HIDDEN];
+  float output[OUTPUT_NODES];
+} ConvCache;
+
+void init_cnn(ConvNet *cn) {
+  memset(cn, 0, sizeof(*cn));
+  for (int i = 0; i < 9; i++)
+    for (int j = 0; j < CNN_CONV1; j++)
+      cn->k1[i][j] = rand_weight() * sqrtf(2.0f / 9);
+  for (int i = 0; i < 9 * CNN_CONV1; i++)
+    for (int j = 0; j < CNN_CONV2; j++)
+      cn->k2[i][j] = rand_weight() * sqrtf(2.0f / (9 * CNN_CONV1));
+  for (int i = 0; i < CNN_FEATURES; i++)
+    for (int j = 0; j < CNN_HIDDEN; j++)
+      cn->w1[i][j] = rand_weight() * sqrtf(2.0f / CNN_FEATURES);
+  for (int i = 0; i < CNN_HIDDEN; i++)
+    for (int j = 0; j < OUTPUT_NODES; j++)
+      cn->w2[i][j] = rand_weight() * sqrtf(2.0f / CNN_HIDDEN);
+}
+
+void cnn_forward(const ConvNet *cn, const float *input, ConvCache *c) {
+  for (int y = 0; y < CNN_OUT1; y++) {
+    for (int x = 0; x < CNN_OUT1; x++) {
+      for (int o = 0; o < CNN_CONV1; o++) {
+        float sum = cn->kb1[o];
+        for (int t = 0; t < 9; t++)
+          sum += input[(y + t / 3) * CNN_SIDE + x + t % 3] * cn->k1[t][o];
+        c->conv1[y][x][o] = sum > 0 ? sum : 0;
+      }
+    }
+  }
+  for (int y = 0; y < CNN_POOL1; y++) {
+    for (int x = 0; x < CNN_POOL1; x++) {
+      for (int o = 0; o < CNN_CONV1; o++) {
+        int best = -1;
+        for (int t = 0; t < 4; t++) {
+          int i = ((2 * y + t / 2) * CNN_OUT1 + 2 * x + t % 2) * CNN_CONV1 + o;
+          if (best < 0 || (&c->conv1[0][0][0])[i] > (&c->conv1[0][0][0])[best])
+            best = i;
+        }
+        c->arg1[y][x][o] = best;
+        c->pool1[y][x][o] = (&c->conv1[0][0][0])[best];
+      }
+    }
+  }
+
+  for (int y = 0; y < CNN_OUT2; y++) {
+    for (int x = 0; x < CNN_OUT2; x++) {
+      for (int o = 0; o < CNN_CONV2; o++) {
+        float sum = cn->kb2[o];
+        for (int t = 0; t < 9; t++)
+          for (int i = 0; i < CNN_CONV1; i++)
+            sum += c->pool1[y + t / 3][x + t % 3][i] *
+                   cn->k2[t * CNN_CONV1 + i][o];
+        c->conv2[y][x][o] = sum > 0 ? sum : 0;
+      }
+    }
+  }
+  for (int y = 0; y < CNN_POOL2; y++) {
+    for (int x = 0; x < CNN_POOL2; x++) {
+      for (int o = 0; o < CNN_CONV2; o++) {
+        int f = (y * CNN_POOL2 + x) * CNN_CONV2 + o, best = -1;
+        for (int t = 0; t < 4; t++) {
+          int i = ((2 * y + t / 2) * CNN_OUT2 + 2 * x + t % 2) * CNN_CONV2 + o;
+          if (best < 0 || (&c->conv2[0][0][0])[i] > (&c->conv2[0][0][0])[best])
+            best = i;
+        }
+        c->arg2[f] = best;
+        c->pool2[f] = (&c->conv2[0][0][0])[best];
+      }
+    }
+  }
+
+  for (int h = 0; h < CNN_HIDDEN; h++) {
+    float sum = cn->b1[h];
+    for (int i = 0; i < CNN_FEATURES; i++)
+      sum += c->pool2[i] * cn->w1[i][h];
+    c->hidden[h] = sum > 0 ? sum : 0;
+  }
+  float max_logit = -1e9;
+  for (int o = 0; o < OUTPUT_NODES; o++) {
+    float sum = cn->b2[o];
+    for (int h = 0; h < CNN_HIDDEN; h++)
+      sum += c->hidden[h] * cn->w2[h][o];
+    c->output[o] = sum;
+    if (sum > max_logit)
+      max_logit = sum;
+  }
+  float sum_exp = 0;
+  for (int o = 0; o < OUTPUT_NODES; o++) {
+    c->output[o] = expf(c->output[o] - max_logit);
+    sum_exp += c->output[o];
+  }
+  for (int o = 0; o < OUTPUT_NODES; o++)
+    c->output[o] /= sum_exp;
+}
+
+// Adds the cross-entropy gradient of one sample to g. Pooling passes the
+// gradient to the winning conv output only, and ReLU stops it at zeros, so
+// most conv positions are skipped.
+void cnn_backward(const ConvNet *cn, const float *input, const ConvCache *c,
+                  int target, ConvNet *g) {
+  float grad_output[OUTPUT_NODES], grad_hidden[CNN_HIDDEN];
+  float grad_pool2[CNN_FEATURES];
+  static float grad_conv2[CNN_OUT2 * CNN_OUT2 * CNN_CONV2];
+  static float grad_pool1[CNN_POOL1][CNN_POOL1][CNN_CONV1];
+  static float grad_conv1[CNN_OUT1 * CNN_OUT1 * CNN_CONV1];
+
+  for (int o = 0; o < OUTPUT_NODES; o++) {
+    grad_output[o] = c->output[o] - (o == target ? 1.0f : 0.0f);
+    g->b2[o] += grad_output[o];
+    for (int h = 0; h < CNN_HIDDEN; h++)
+      g->w2[h][o] += grad_output[o] * c->hidden[h];
+  }
+  for (int h = 0; h < CNN_HIDDEN; h++) {
+    float sum = 0;
+    for (int o = 0; o < OUTPUT_NODES; o++)
+      sum += grad_output[o] * cn->w2[h][o];
+    grad_hidden[h] = c->hidden[h] > 0 ? sum : 0;
+    g->b1[h] += grad_hidden[h];
+  }
+  for (int i = 0; i < CNN_FEATURES; i++) {
+    float sum = 0;
+    for (int h = 0; h < CNN_HIDDEN; h++) {
+      g->w1[i][h] += grad_hidden[h] * c->pool2[i];
+      sum += grad_hidden[h] * cn->w1[i][h];
+    }
+    grad_pool2[i] = c->pool2[i] > 0 ? sum : 0;
+  }
+
+  memset(grad_conv2, 0, sizeof(grad_conv2));
+  for (int i = 0; i < CNN_FEATURES; i++)
+    grad_conv2[c->arg2[i]] += grad_pool2[i];
+  memset(grad_pool1, 0, sizeof(grad_pool1));
+  for (int y = 0; y < CNN_OUT2; y++) {
+    for (int x = 0; x < CNN_OUT2; x++) {
+      for (int o = 0; o < CNN_CONV2; o++) {
+        float d = grad_conv2[(y * CNN_OUT2 + x) * CNN_CONV2 + o];
+        if (d == 0)
+          continue;
+        g->kb2[o] += d;
+        for (int t = 0; t < 9; t++) {
+          for (int i = 0; i < CNN_CONV1; i++) {
+            g->k2[t * CNN_CONV1 + i][o] +=
+                d * c->pool1[y + t / 3][x + t % 3][i];
+            grad_pool1[y + t / 3][x + t % 3][i] +=
+                d * cn->k2[t * CNN_CONV1 + i][o];
+          }
+        }
+      }
+    }
+  }
+
+  memset(grad_conv1, 0, sizeof(grad_conv1));
+  for (int y = 0; y < CNN_POOL1; y++)
+    for (int x = 0; x < CNN_POOL1; x++)
+      for (int o = 0; o < CNN_CONV1; o++)
+        if (c->pool1[y][x][o] > 0)
+          grad_conv1[c->arg1[y][x][o]] += grad_pool1[y][x][o];
+  for (int y = 0; y < CNN_OUT1; y++) {
+    for (int x = 0; x < CNN_OUT1; x++) {
+      for (int o = 0; o < CNN_CONV1; o++) {
+        float d = grad_conv1[(y * CNN_OUT1 + x) * CNN_CONV1 + o];
+        if (d == 0)
+          continue;
+        g->kb1[o] += d;
+        for (int t = 0; t < 9; t++)
+          g->k1[t][o] += d * input[(y + t / 3) * CNN_SIDE + x + t % 3];
+      }
+    }
+  }
+}
+
+void train_cnn(ConvNet *cn) {
+  int *indices = malloc(NUM_TRAIN * sizeof(int));
+  for (int i = 0; i < NUM_TRAIN; i++)
+    indices[i] = i;
+
+  static ConvNet grad;
+  static ConvCache cache;
+  float *params = (float *)cn, *grads = (float *)&grad;
+  int num_params = sizeof(ConvNet) / sizeof(float);
+
+  for (int epoch = 0; epoch < CNN_EPOCHS; epoch++) {
+
+    for (int i = NUM_TRAIN - 1; i > 0; i--) {
+      int j = rand() % (i + 1);
+      int temp = indices[i];
+      indices[i] = indices[j];
+      indices[j] = temp;
+    }
+
+    double total_loss = 0;
+    int correct_total = 0;
+    int batches = NUM_TRAIN / BATCH_SIZE;
+
+    for (int b = 0; b < batches; b++) {
+      memset(&grad, 0, sizeof(grad));
+
+      for (int i = 0; i < BATCH_SIZE; i++) {
+        int idx = indices[b * BATCH_SIZE + i];
+
+        float input[INPUT_NODES];
+        augment_image(&train_images[idx * 784], input);
+        int target = train_labels[idx];
+
+        cnn_forward(cn, input, &cache);
+        if (cache.output[target] > 1e-9)
+          total_loss += -logf(cache.output[target]);
+        int pred = 0;
+        for (int o = 1; o < OUTPUT_NODES; o++)
+          if (cache.output[o] > cache.output[pred])
+            pred = o;
+        correct_total += pred == target;
+
+        cnn_backward(cn, input, &cache, target, &grad);
+      }
+
+      float lr_batch = CNN_LEARNING_RATE / BATCH_SIZE;
+      for (int p = 0; p < num_params; p++)
+        params[p] -= lr_batch * grads[p];
+    }
+
+    printf("Epoch %d: Loss = %.4f, Accuracy = %.2f%%\n", epoch + 1,
+           total_loss / NUM_TRAIN, (float)correct_total * 100 / NUM_TRAIN);
+  }
+
+  free(indices);
+}
+
+void save_cnn(ConvNet *cn) {
+  const uint32_t dims[] = {INPUT_NODES, CNN_HIDDEN, OUTPUT_NODES,
+                           CNN_SIDE,    CNN_CONV1,  CNN_CONV2};
+  const void *sections[MODEL_CNN_SECTIONS] = {
+      cn->w1, NULL, cn->b1, cn->w2, cn->b2, cn->k1, cn->kb1, cn->k2, cn->kb2};
+  if (!model_save("model_cnn.bin", MODEL_CNN, MODEL_F32, dims, sections)) {
     printf("Error saving model.\n");
     return;
   }
+  printf("Model saved to model_cnn.bin\n");
+}
 
-  fwrite(nn->w1, sizeof(float), INPUT_NODES * HIDDEN_NODES, f);
-  fwrite(nn->b1, sizeof(float), HIDDEN_NODES, f);
-  fwrite(nn->w2, sizeof(float), HIDDEN_NODES * OUTPUT_NODES, f);
-  fwrite(nn->b2, sizeof(float), OUTPUT_NODES, f);
-
-  fclose(f);
+void save_model(NeuralNetwork *nn) {
+  const uint32_t dims[] = {INPUT_NODES, HIDDEN_NODES, OUTPUT_NODES};
+  const void *sections[MODEL_MLP_SECTIONS] = {nn->w1, NULL, nn->b1, nn->w2,
+                                              nn->b2};
+  if (!model_save("model.bin", MODEL_MLP, MODEL_F32, dims, sections)) {
+    printf("Error saving model.\n");
+    return;
+  }
   printf("Model saved to model.bin\n");
 }
 
-int main() {
+// ./train trains the MLP into model.bin, ./train cnn the CNN into
+// model_cnn.bin.
+int main(int argc, char **argv) {
   srand(time(NULL));
 
   load_mnist();
 
+  if (argc > 1 && strcmp(argv[1], "cnn") == 0) {
+    static ConvNet cn;
+    init_cnn(&cn);
+    printf("Starting CNN training (Mini-batch Size: %d, %d-%d channels, "
+           "Hidden Nodes: %d)...\n",
+           BATCH_SIZE, CNN_CONV1, CNN_CONV2, CNN_HIDDEN);
+    train_cnn(&cn);
+    save_cnn(&cn);
+    free(train_images);
+    free(train_labels);
+    return 0;
+  }
+
   NeuralNetwork nn;
   init_network(&nn);
 
@@ -0,0 +1,245 @@
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "rpn.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDO_MAX_REGIONS 24
+#define UNDO_MAX_BYTES (512 * 1024) // oldest steps are dropped past this
+#define UNDO_GAP 16 // unchanged bytes cheaper to copy than a new record
+#define UNDO_RECORD_HEADER 13
+
+// A block of state the journal watches. A fixed region is compared whole
+// against its shadow (the state as of the last commit); the RPN stack only
+// changes at and above its touched mark, so only that tail is compared.
+typedef struct {
+  unsigned char *data;
+  size_t size;
+  RpnStack *stack;
+  unsigned char *shadow;
+  size_t shadowSize, shadowCap;
+} UndoRegion;
+
+// Each step is a run of records {region, offset, old bytes, new bytes}, so
+// it can be applied in either direction without a full snapshot. For the
+// stack a record always runs to the end, which is how its depth changes.
+typedef struct {
+  UndoRegion regions[UNDO_MAX_REGIONS];
+  int numRegions;
+  unsigned char *log;
+  size_t logLen, logCap;
+  size_t *steps; // start of each step in log
+  int numSteps;
+  size_t capSteps;
+  int cursor; // steps before it can be undone, from it on redone
+} UndoJournal;
+
+static int undo_reserve(void **p, size_t *cap, size_t need, size_t elem) {
+  if (need <= *cap)
+    return 1;
+  size_t n = *cap ? *cap : 64;
+  while (n < need)
+    n *= 2;
+  void *q = realloc(*p, n * elem);
+  if (!q)
+    return 0;
+  *p = q;
+  *cap = n;
+  return 1;
+}
+
+static UndoRegion *undo_add_region(UndoJournal *j) {
+  if (j->numRegions == UNDO_MAX_REGIONS)
+    return NULL;
+  UndoRegion *r = &j->regions[j->numRegions++];
+  memset(r, 0, sizeof(*r));
+  return r;
+}
+
+// Watches size bytes at data from now on.
+static void undo_watch(UndoJournal *j, void *data, size_t size) {
+  UndoRegion *r = undo_add_region(j);
+  if (!r || !undo_reserve((void **)&r->shadow, &r->shadowCap, size, 1))
+    return;
+  r->data = data;
+  r->size = size;
+  memcpy(r->shadow, data, size);
+  r->shadowSize = size;
+}
+
+static void undo_watch_stack(UndoJournal *j, RpnStack *s) {
+  UndoRegion *r = undo_add_region(j);
+  size_t bytes = s->depth * sizeof(double);
+  if (!r || !undo_reserve((void **)&r->shadow, &r->shadowCap, bytes, 1))
+    return;
+  r->stack = s;
+  if (bytes)
+    memcpy(r->shadow, s->data, bytes);
+  r->shadowSize = bytes;
+  s->touched = s->depth;
+}
+
+static void undo_put(UndoJournal *j, int region, size_t offset,
+                     const void *old, size_t oldLen, const void *cur,
+                     size_t curLen) {
+  size_t need = j->logLen + UNDO_RECORD_HEADER + oldLen + curLen;
+  if (!undo_reserve((void **)&j->log, &j->logCap, need, 1))
+    return;
+  unsigned char *p = j->log + j->logLen;
+  uint32_t h[3] = {(uint32_t)offset, (uint32_t)oldLen, (uint32_t)curLen};
+  *p = (uint8_t)region;
+  memcpy(p + 1, h, sizeof(h));
+  memcpy(p + UNDO_RECORD_HEADER, old, oldLen);
+  memcpy(p + UNDO_RECORD_HEADER + oldLen, cur, curLen);
+  j->logLen = need;
+}
+
+// Appends the changed runs of a fixed region, joining runs closer than
+// UNDO_GAP, and brings the shadow up to date.
+static void undo_diff_fixed(UndoJournal *j, int idx) {
+  UndoRegion *r = &j->regions[idx];
+  size_t i = 0;
+  while (i < r->size) {
+    if (r->data[i] == r->shadow[i]) {
+      i++;
+      continue;
+    }
+    size_t start = i, end = i + 1;
+    for (i = end; i < r->size && i - end < UNDO_GAP; i++)
+      if (r->data[i] != r->shadow[i])
+        end = i + 1;
+    undo_put(j, idx, start, r->shadow + start, end - start, r->data + start,
+             end - start);
+    memcpy(r->shadow + start, r->data + start, end - start);
+    i = end;
+  }
+}
+
+// Below the touched mark the stack still matches the shadow; above it the
+// common prefix is skipped, so a push or pop records one element.
+static void undo_diff_stack(UndoJournal *j, int idx) {
+  UndoRegion *r = &j->regions[idx];
+  RpnStack *s = r->stack;
+  size_t cur = s->depth * sizeof(double);
+  size_t from = s->touched * sizeof(double);
+  if (from > r->shadowSize)
+    from = r->shadowSize;
+  if (from > cur)
+    from = cur;
+  while (from < cur && from < r->shadowSize &&
+         memcmp(s->data + from / sizeof(double),
+                r->shadow + from, sizeof(double)) == 0)
+    from += sizeof(double);
+  if (from < cur || from < r->shadowSize) {
+    undo_put(j, idx, from, r->shadow + from, r->shadowSize - from,
+             (unsigned char *)s->data + from, cur - from);
+    if (undo_reserve((void **)&r->shadow, &r->shadowCap, cur, 1)) {
+      memcpy(r->shadow + from, (unsigned char *)s->data + from, cur - from);
+      r->shadowSize = cur;
+    }
+  }
+  s->touched = s->depth;
+}
+
+// Drops the oldest steps, a quarter of the budget at a time, so trimming
+// stays amortised.
+static void undo_trim(UndoJournal *j) {
+  if (j->logLen <= UNDO_MAX_BYTES)
+    return;
+  int drop = 0;
+  while (drop < j->cursor - 1 &&
+         j->logLen - j->steps[drop + 1] > UNDO_MAX_BYTES * 3 / 4)
+    drop++;
+  if (drop == 0)
+    return;
+  size_t cut = j->steps[drop];
+  memmove(j->log, j->log + cut, j->logLen - cut);
+  j->logLen -= cut;
+  for (int i = drop; i < j->numSteps; i++)
+    j->steps[i - drop] = j->steps[i] - cut;
+  j->numSteps -= drop;
+  j->cursor -= drop;
+}
+
+// Records whatever changed since the last commit as one step, discarding
+// the redo tail. Returns 0 when nothing changed.
+static int undo_commit(UndoJournal *j) {
+  size_t mark = j->cursor < j->numSteps ? j->steps[j->cursor] : j->logLen;
+  size_t before = j->logLen;
+  j->logLen = mark;
+  for (int i = 0; i < j->numRegions; i++) {
+    if (j->regions[i].stack)
+      undo_diff_stack(j, i);
+    else if (j->regions[i].data)
+      undo_diff_fixed(j, i);
+  }
+  if (j->logLen == mark) {
+    j->logLen = before;
+    return 0;
+  }
+  if (!undo_reserve((void **)&j->steps, &j->capSteps, (size_t)j->cursor + 1,
+                    sizeof(size_t))) {
+    j->logLen = mark;
+    return 0;
+  }
+  j->steps[j->cursor++] = mark;
+  j->numSteps = j->cursor;
+  undo_trim(j);
+  return 1;
+}
+
+static void undo_apply(UndoJournal *j, int step, int forward) {
+  size_t p = j->steps[step];
+  size_t end = step + 1 < j->numSteps ? j->steps[step + 1] : j->logLen;
+  while (p < end) {
+    const unsigned char *rec = j->log + p;
+    uint32_t h[3];
+    memcpy(h, rec + 1, sizeof(h));
+    UndoRegion *r = &j->regions[rec[0]];
+    const unsigned char *bytes = rec + UNDO_RECORD_HEADER;
+    size_t len = forward ? h[2] : h[1];
+    if (forward)
+      bytes += h[1]; // past the old bytes
+    if (r->stack) {
+      RpnStack *s = r->stack;
+      size_t depth = (h[0] + len) / sizeof(double);
+      if (rpn_reserve(s, depth) &&
+          undo_reserve((void **)&r->shadow, &r->shadowCap, h[0] + len, 1)) {
+        memcpy((unsigned char *)s->data + h[0], bytes, len);
+        memcpy(r->shadow + h[0], bytes, len);
+        s->depth = depth;
+        s->touched = depth;
+        r->shadowSize = h[0] + len;
+      }
+    } else {
+      memcpy(r->data + h[0], bytes, len);
+      memcpy(r->shadow + h[0], bytes, len);
+    }
+    p += UNDO_RECORD_HEADER + h[1] + h[2];
+  }
+}
+
+// Pending changes are committed first, so undo always steps back from what
+// is on screen.
+static int undo_undo(UndoJournal *j) {
+  undo_commit(j);
+  if (j->cursor == 0)
+    return 0;
+  undo_apply(j, --j->cursor, 0);
+  return 1;
+}
+
+static int undo_redo(UndoJournal *j) {
+  if (j->cursor == j->numSteps)
+    return 0;
+  undo_apply(j, j->cursor++, 1);
+  return 1;
+}
+
+static size_t undo_bytes(const UndoJournal *j) {
+  return j->logLen + (size_t)j->numSteps * sizeof(size_t);
+}
+
+#endif
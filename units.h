@@ -0,0 +1,171 @@
+#ifndef UNITS_H
+#define UNITS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define UNIT_DIMS 8
+#define UNIT_CACHE_SLOTS 64
+#define UNIT_SI 1
+#define UNIT_BIN 2
+
+// A registry entry maps a value onto the coherent SI unit as
+// value * scale + offset. Dimensions are L, M, T, I, K, N, J and information.
+typedef struct {
+  uint64_t hash;
+  double scale;
+  double offset;
+  int8_t dim[UNIT_DIMS];
+  const char *name;
+} UnitDef;
+
+typedef struct {
+  double scale;
+  double offset;
+} UnitConv;
+
+// FNV-1a, shared with gen_units so the table and the lookup agree. Zero marks
+// an empty slot, so no name may hash to it.
+static uint64_t unit_hash(const char *s, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h ? h : 1;
+}
+
+static uint64_t unit_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+static uint32_t unit_bucket(uint64_t h, uint32_t buckets) {
+  return (uint32_t)(h >> 32) % buckets;
+}
+
+static uint32_t unit_slot(uint64_t h, uint32_t disp, uint32_t size) {
+  return (uint32_t)(unit_mix(h ^ (disp * 0x9e3779b97f4a7c15ULL)) & (size - 1));
+}
+
+#ifndef UNITS_GENERATOR
+
+// Built from units.def by gen_units (see the Makefile).
+#include "units_table.h"
+
+// One hash, one displacement and one slot probe; the stored 64-bit hash
+// rejects names that are not in the registry.
+static const UnitDef *unit_find(const char *s, size_t len) {
+  uint64_t h = unit_hash(s, len);
+  uint32_t d = UNIT_DISP[unit_bucket(h, UNIT_BUCKETS)];
+  const UnitDef *u = &UNIT_TABLE[unit_slot(h, d, UNIT_TABLE_SIZE)];
+  return u->hash == h ? u : NULL;
+}
+
+// Parses a product of registry units with integer powers, e.g. kg*m/s^2.
+// An affine offset only survives for a lone unit; inside a compound it is
+// a difference (degC/s is a rate, not an absolute temperature).
+static int unit_parse(const char *s, size_t len, double *scale,
+                      double *offset, int8_t dim[UNIT_DIMS]) {
+  int d[UNIT_DIMS] = {0};
+  double sc = 1, off = 0;
+  int sign = 1, terms = 0, lastPow = 0;
+  size_t i = 0;
+
+  if (len == 0)
+    return 0;
+  while (i < len) {
+    size_t start = i;
+    while (i < len && s[i] != '*' && s[i] != '/' && s[i] != '^')
+      i++;
+    const UnitDef *u = unit_find(s + start, i - start);
+    if (!u)
+      return 0;
+    int p = 1;
+    if (i < len && s[i] == '^') {
+      int neg = 0, digits = 0;
+      p = 0;
+      if (++i < len && s[i] == '-') {
+        neg = 1;
+        i++;
+      }
+      for (; i < len && s[i] >= '0' && s[i] <= '9'; i++, digits++)
+        p = p * 10 + (s[i] - '0');
+      if (!digits || p > 32)
+        return 0;
+      if (neg)
+        p = -p;
+    }
+    lastPow = sign * p;
+    sc *= pow(u->scale, lastPow);
+    for (int k = 0; k < UNIT_DIMS; k++)
+      d[k] += lastPow * u->dim[k];
+    off = u->offset;
+    terms++;
+    if (i < len) {
+      if (s[i] != '*' && s[i] != '/')
+        return 0;
+      sign = s[i] == '/' ? -1 : 1;
+      if (++i == len)
+        return 0;
+    }
+  }
+  for (int k = 0; k < UNIT_DIMS; k++) {
+    if (d[k] < INT8_MIN || d[k] > INT8_MAX)
+      return 0;
+    dim[k] = (int8_t)d[k];
+  }
+  *scale = sc;
+  *offset = terms == 1 && lastPow == 1 ? off : 0;
+  return 1;
+}
+
+typedef struct {
+  uint64_t key;
+  UnitConv conv;
+} UnitCacheEntry;
+
+static UnitCacheEntry unit_cache[UNIT_CACHE_SLOTS];
+
+// Composes from -> to into a single scale/offset pair, cached by the pair of
+// unit strings. Returns 1 on success, 0 for an unknown unit and -1 when the
+// dimensions differ.
+static int unit_conversion(const char *from, const char *to, UnitConv *out) {
+  size_t fl = strlen(from), tl = strlen(to);
+  uint64_t key = unit_mix(unit_hash(from, fl) ^ unit_mix(unit_hash(to, tl)));
+  key = key ? key : 1;
+  UnitCacheEntry *e = &unit_cache[key % UNIT_CACHE_SLOTS];
+  if (e->key == key) {
+    *out = e->conv;
+    return 1;
+  }
+
+  double fs, fo, ts, to_;
+  int8_t fd[UNIT_DIMS], td[UNIT_DIMS];
+  if (!unit_parse(from, fl, &fs, &fo, fd) || !unit_parse(to, tl, &ts, &to_, td))
+    return 0;
+  if (memcmp(fd, td, sizeof(fd)) != 0)
+    return -1;
+  out->scale = fs / ts;
+  out->offset = (fo - to_) / ts;
+  e->key = key;
+  e->conv = *out;
+  return 1;
+}
+
+static double unit_apply(UnitConv c, double x) { return x * c.scale + c.offset; }
+
+// A single multiply-add over the column, which the compiler vectorizes.
+static void unit_convert_batch(UnitConv c, double *x, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    x[i] = x[i] * c.scale + c.offset;
+}
+
+#endif
+
+#endif